@@ -0,0 +1,93 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "types.hpp"
+
+/* Lock-free single producer/single consumer ring buffer, size must be a power of two */
+template <typename T, u64 size>
+struct RingBuffer {
+    static_assert((size & (size - 1)) == 0);
+
+    /* Appends up to count elements, returns the number of elements written (producer only) */
+    u64 tryPush(const T *data, u64 count) {
+        u64 written = 0;
+
+        while (count) {
+            const auto head = writeIdx.load(std::memory_order_relaxed);
+            const auto tail = readIdx.load(std::memory_order_acquire);
+
+            const auto space = size - (head - tail);
+
+            if (!space) break;
+
+            const auto len = std::min({count, space, size - (head & (size - 1))});
+
+            std::memcpy(&buf[head & (size - 1)], data, len * sizeof(T));
+
+            writeIdx.store(head + len, std::memory_order_release);
+
+            data    += len;
+            count   -= len;
+            written += len;
+        }
+
+        return written;
+    }
+
+    /* Appends count elements, waits for the consumer if the buffer is full (producer only) */
+    void push(const T *data, u64 count) {
+        while (count) {
+            const auto len = tryPush(data, count);
+
+            if (!len) std::this_thread::yield();
+
+            data  += len;
+            count -= len;
+        }
+    }
+
+    /* Returns the number of contiguous readable elements at data (consumer only) */
+    u64 peek(const T *&data) {
+        const auto tail = readIdx.load(std::memory_order_relaxed);
+        const auto head = writeIdx.load(std::memory_order_acquire);
+
+        data = &buf[tail & (size - 1)];
+
+        return std::min(head - tail, size - (tail & (size - 1)));
+    }
+
+    /* Releases count elements returned by peek() (consumer only) */
+    void pop(u64 count) {
+        readIdx.store(readIdx.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    /* Returns the number of elements that can be appended without waiting (producer only) */
+    u64 getSpace() {
+        return size - (writeIdx.load(std::memory_order_relaxed) - readIdx.load(std::memory_order_acquire));
+    }
+
+    /* Returns the number of readable elements (consumer only) */
+    u64 getCount() {
+        return writeIdx.load(std::memory_order_acquire) - readIdx.load(std::memory_order_relaxed);
+    }
+
+    bool isEmpty() {
+        return readIdx.load(std::memory_order_acquire) == writeIdx.load(std::memory_order_acquire);
+    }
+
+private:
+    T buf[size];
+
+    /* Indices aren't wrapped, each one is only written by one side */
+    alignas(64) std::atomic<u64> writeIdx = 0;
+    alignas(64) std::atomic<u64> readIdx  = 0;
+};
@@ -16,6 +16,7 @@
 #include "../ee/timer/timer.hpp"
 #include "../ee/gif/gif.hpp"
 #include "../ee/pgif/pgif.hpp"
+#include "../ee/vu/vu_thread.hpp"
 #include "../gs/gs.hpp"
 #include "../iop/cdrom/cdrom.hpp"
 #include "../iop/cdvd/cdvd.hpp"
@@ -259,6 +260,8 @@ u64 read64(u32 addr) {
 
     if (inRange(addr, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) {
         std::memcpy(&data, &ram[addr], sizeof(u64));
+    } else if (inRange(addr, static_cast<u32>(MemoryBase::IPU), static_cast<u32>(MemorySize::IPU))) {
+        return ee::ipu::read64(addr);
     } else if (inRange(addr, static_cast<u32>(MemoryBase::GS), static_cast<u32>(MemorySize::GS))) {
         return gs::readPriv(addr);
     } else {
@@ -281,6 +284,8 @@ u128 read128(u32 addr) {
         std::memcpy(&data, &ram[addr], sizeof(u128));
     } else {
         switch (addr) {
+            case 0x10007000:
+                return ee::ipu::readFIFO();
             default:
                 std::printf("[Bus:EE    ] Unhandled 128-bit read @ 0x%08X\n", addr);
 
@@ -442,6 +447,18 @@ u128 readDMAC128(u32 addr) {
     return data;
 }
 
+/* Returns a pointer to qwc quadwords of EE RAM or scratchpad RAM (DMAC), nullptr if the span isn't contiguous */
+u8 *getDMACSpan(u32 addr, u32 qwc) {
+    assert(!(addr & 15));
+
+    if (addr & (1 << 31)) return ee::cpu::getSPRAMSpan(addr, qwc);
+
+    if (!inRange(addr, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) return nullptr;
+    if (!inRange(addr + 16 * qwc - 1, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) return nullptr;
+
+    return &ram[addr];
+}
+
 /* Writes a byte to the EE bus */
 void write8(u32 addr, u8 data) {
     if (inRange(addr, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) {
@@ -547,7 +564,9 @@ void write64(u32 addr, u64 data) {
     if (inRange(addr, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) {
         memcpy(&ram[addr], &data, sizeof(u64));
     } else if (inRange(addr, static_cast<u32>(MemoryBase::VU1Code), static_cast<u32>(MemorySize::VU1))) {
-        /* TODO: implement VU code1 writes */
+        ee::vu::thread::sync();
+
+        ee::cpu::getVU(1)->writeMicro64(addr, data);
     } else if (inRange(addr, static_cast<u32>(MemoryBase::GS), static_cast<u32>(MemorySize::GS))) {
         gs::writePriv(addr, data);
     } else {
@@ -565,25 +584,30 @@ void write128(u32 addr, const u128 &data) {
     if (inRange(addr, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) {
         memcpy(&ram[addr], &data, sizeof(u128));
     } else if (inRange(addr, static_cast<u32>(MemoryBase::VU0Code), static_cast<u32>(MemorySize::VU0))) {
-        /* TODO: implement VU mem1 writes */
+        ee::cpu::getVU(0)->writeMicro64(addr + 0, data._u64[0]);
+        ee::cpu::getVU(0)->writeMicro64(addr + 8, data._u64[1]);
+    } else if (inRange(addr, static_cast<u32>(MemoryBase::VU1Code), static_cast<u32>(MemorySize::VU1))) {
+        ee::vu::thread::sync();
+
+        ee::cpu::getVU(1)->writeMicro64(addr + 0, data._u64[0]);
+        ee::cpu::getVU(1)->writeMicro64(addr + 8, data._u64[1]);
     } else if (inRange(addr, static_cast<u32>(MemoryBase::VU0Data), static_cast<u32>(MemorySize::VU0))) {
-        /* TODO: implement VU mem1 writes */
+        ee::cpu::getVU(0)->writeData128(addr & 0xFFF, data);
     } else if (inRange(addr, static_cast<u32>(MemoryBase::VU1Data), static_cast<u32>(MemorySize::VU1))) {
-        /* TODO: implement VU mem1 writes */
+        ee::vu::thread::sync();
+
+        ee::cpu::getVU(1)->writeData128(addr, data);
     } else {
         switch (addr) {
             case 0x10004000:
-                std::printf("[Bus:EE    ] 128-bit write @ VIF0_FIFO = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
-                break;
+                return vif[0]->writeFIFO(data);
             case 0x10005000:
-                std::printf("[Bus:EE    ] 128-bit write @ VIF1_FIFO = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
-                break;
+                return vif[1]->writeFIFO(data);
             case 0x10006000:
                 std::printf("[Bus:EE    ] 128-bit write @ GIF_FIFO = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
                 break;
             case 0x10007010:
-                std::printf("[Bus:EE    ] 128-bit write @ IPU_IN_FIFO = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
-                break;
+                return ee::ipu::writeFIFO(data);
             default:
                 std::printf("[Bus:EE    ] Unhandled 128-bit write @ 0x%08X = 0x%016llX%016llX\n", addr, data._u64[1], data._u64[0]);
 
@@ -758,6 +782,8 @@ void writeDMAC32(u32 addr, u32 data) {
 void writeDMAC128(u32 addr, const u128 &data) {
     assert(!(addr & 15));
 
+    if (addr & (1 << 31)) return ee::cpu::writeSPRAM128(addr, data);
+
     if (inRange(addr, static_cast<u32>(MemoryBase::RAM), static_cast<u32>(MemorySize::RAM))) {
         memcpy(&ram[addr], &data, sizeof(u128));
     } else {
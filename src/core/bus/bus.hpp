@@ -30,6 +30,8 @@ u32 readIOP32(u32 addr);
 u32  readDMAC32(u32 addr);
 u128 readDMAC128(u32 addr);
 
+u8 *getDMACSpan(u32 addr, u32 qwc);
+
 void write8(u32 addr, u8 data);
 void write16(u32 addr, u16 data);
 void write32(u32 addr, u32 data);
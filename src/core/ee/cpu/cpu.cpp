@@ -429,6 +429,15 @@ u128 readSPRAM128(u32 addr) {
     return data;
 }
 
+/* Returns a pointer to qwc quadwords of scratchpad RAM, nullptr if the span wraps around */
+u8 *getSPRAMSpan(u32 addr, u32 qwc) {
+    addr &= 0x3FF0;
+
+    if ((addr + 16 * qwc) > sizeof(spram)) return nullptr;
+
+    return &spram[addr];
+}
+
 /* Reads a quadword from memory */
 u128 read128(u32 addr) {
     assert(!(addr & 15));
@@ -710,6 +719,7 @@ void iBCF(int copN, u32 instr) {
     bool cpcond;
     switch (copN) {
         case 1: cpcond = fpu::getCPCOND(); break;
+        case 2: cpcond = vus[0].isBusy(); break; // VU0 busy
         default:
             std::printf("[EE Core   ] BCF: Unhandled coprocessor %d\n", copN);
 
@@ -731,6 +741,7 @@ void iBCFL(int copN, u32 instr) {
     bool cpcond;
     switch (copN) {
         case 1: cpcond = fpu::getCPCOND(); break;
+        case 2: cpcond = vus[0].isBusy(); break; // VU0 busy
         default:
             std::printf("[EE Core   ] BCFL: Unhandled coprocessor %d\n", copN);
 
@@ -752,6 +763,7 @@ void iBCTL(int copN, u32 instr) {
     bool cpcond;
     switch (copN) {
         case 1: cpcond = fpu::getCPCOND(); break;
+        case 2: cpcond = vus[0].isBusy(); break; // VU0 busy
         default:
             std::printf("[EE Core   ] BCTL: Unhandled coprocessor %d\n", copN);
 
@@ -773,6 +785,7 @@ void iBCT(int copN, u32 instr) {
     bool cpcond;
     switch (copN) {
         case 1: cpcond = fpu::getCPCOND(); break;
+        case 2: cpcond = vus[0].isBusy(); break; // VU0 busy
         default:
             std::printf("[EE Core   ] BCT: Unhandled coprocessor %d\n", copN);
 
@@ -1516,10 +1529,7 @@ void iLQC2(u32 instr) {
 
     const auto data = read128(addr);
 
-    vus[0].setVF(rt, 0, data._u32[0]);
-    vus[0].setVF(rt, 1, data._u32[1]);
-    vus[0].setVF(rt, 2, data._u32[2]);
-    vus[0].setVF(rt, 3, data._u32[3]);
+    vus[0].setVF128(rt, 0xF, data);
 }
 
 /* Load Upper Immediate */
@@ -2287,12 +2297,7 @@ void iQMFC(int copN, u32 instr) {
 
     switch (copN) {
         case 2:
-            {
-                data._u32[0] = vus[0].getVF(rd, 0);
-                data._u32[1] = vus[0].getVF(rd, 1);
-                data._u32[2] = vus[0].getVF(rd, 2);
-                data._u32[3] = vus[0].getVF(rd, 3);
-            }
+            data = vus[0].getVF128(rd);
             break;
         default:
             std::printf("[EE Core   ] QMFC: Unhandled coprocessor %d\n", copN);
@@ -2318,10 +2323,7 @@ void iQMTC(int copN, u32 instr) {
 
     switch (copN) {
         case 2:
-            vus[0].setVF(rd, 0, regs[rt]._u32[0]);
-            vus[0].setVF(rd, 1, regs[rt]._u32[1]);
-            vus[0].setVF(rd, 2, regs[rt]._u32[2]);
-            vus[0].setVF(rd, 3, regs[rt]._u32[3]);
+            vus[0].setVF128(rd, 0xF, regs[rt]);
             break;
         default:
             std::printf("[EE Core   ] QMTC: Unhandled coprocessor %d\n", copN);
@@ -2556,12 +2558,7 @@ void iSQC2(u32 instr) {
 
     const auto addr = regs[rs]._u32[0] + imm;
 
-    u128 data;
-
-    data._u32[0] = vus[0].getVF(rt, 0);
-    data._u32[1] = vus[0].getVF(rt, 1);
-    data._u32[2] = vus[0].getVF(rt, 2);
-    data._u32[3] = vus[0].getVF(rt, 3);
+    const auto data = vus[0].getVF128(rt);
 
     if (doDisasm) {
         std::printf("[EE Core   ] SQC2 %d, 0x%X(%s); [0x%08X] = 0x%016llX%016llX\n", rt, imm, regNames[rs], addr, data._u64[1], data._u64[0]);
@@ -2957,6 +2954,22 @@ void decodeInstr(u32 instr) {
                     case COPOpcode::CF : iCFC(2, instr); break;
                     case COPOpcode::QMT: iQMTC(2, instr); break;
                     case COPOpcode::CT : iCTC(2, instr); break;
+                    case COPOpcode::BC :
+                        {
+                            const auto rt = getRt(instr);
+
+                            switch (rt) {
+                                case COPBranch::BCF : iBCF(2, instr); break;
+                                case COPBranch::BCT : iBCT(2, instr); break;
+                                case COPBranch::BCFL: iBCFL(2, instr); break;
+                                case COPBranch::BCTL: iBCTL(2, instr); break;
+                                default:
+                                    std::printf("[EE Core   ] Unhandled COP2 branch instruction 0x%02X (0x%08X) @ 0x%08X\n", rt, instr, cpc);
+
+                                    exit(0);
+                            }
+                        }
+                        break;
                     default:
                         std::printf("[EE Core   ] Unhandled COP2 instruction 0x%02X (0x%08X) @ 0x%08X\n", rs, instr, cpc);
 
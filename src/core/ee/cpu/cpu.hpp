@@ -16,6 +16,9 @@ void init();
 void step(i64 c);
 
 u128 readSPRAM128(u32 addr);
+void writeSPRAM128(u32 addr, const u128 &data);
+
+u8 *getSPRAMSpan(u32 addr, u32 qwc);
 
 void doInterrupt();
 
@@ -12,6 +12,9 @@
 
 #include "../cpu/cop0.hpp"
 #include "../gif/gif.hpp"
+#include "../ipu/ipu.hpp"
+#include "../vu/vu_thread.hpp"
+#include "../../gs/gs.hpp"
 #include "../../scheduler.hpp"
 #include "../../sif.hpp"
 #include "../../bus/bus.hpp"
@@ -20,6 +23,7 @@
 namespace ps2::ee::dmac {
 
 using IOPChannel = iop::dmac::Channel;
+using VectorInterface = vif::VectorInterface;
 
 const char *chnNames[10] = {
     "VIF0", "VIF1", "PATH3", "IPU_FROM", "IPU_TO", "SIF0", "SIF1", "SIF2", "SPR_FROM", "SPR_TO"
@@ -41,6 +45,13 @@ enum class DTag {
     CNT, CNTS, END = 7,
 };
 
+/* --- DMAC constants --- */
+
+constexpr u16 SLICE_SIZE = 8; // In quadwords
+
+/* D_CTRL.RCYC, in bus cycles */
+constexpr i64 releaseCycles[8] = {8, 16, 32, 64, 128, 256, 256, 256};
+
 /* --- DMAC registers --- */
 
 /* DMA channel registers (0x1000xx00) */
@@ -65,6 +76,13 @@ enum class ControlReg {
     STADR = 0x1000E060, // Stall tag address
 };
 
+/* D_CTRL.MFD */
+enum MFD {
+    NoMFIFO,
+    MFIFOVIF1 = 2,
+    MFIFOGIF,
+};
+
 /* D_CTRL */
 struct CTRL {
     bool dmae; // DMA enable
@@ -82,6 +100,12 @@ struct PCR {
     bool pce; // Priority control enable
 };
 
+/* D_SQWC */
+struct SQWC {
+    u8 sqwc; // Skip quadword count
+    u8 tqwc; // Transfer quadword count
+};
+
 /* D_STAT */
 struct STAT {
     u16  cis;  // Channel interrupt status
@@ -122,13 +146,28 @@ CTRL ctrl; // D_CTRL
 PCR  pcr;  // D_PCR
 STAT stat; // D_STAT
 
+SQWC sqwc; // D_SQWC
+
+u32 rbsr, rbor; // MFIFO ring buffer size (mask)/offset
+
+u32 stadr; // D_STADR
+
 u32 enable = 0x1201; // D_ENABLE
 
+int busOwner = -1; // Channel that holds the bus, -1 if the bus is free
+
+VectorInterface *vif[2];
+
 /* DMAC scheduler event IDs */
-u32 idTransferEnd, idRestart, idSIF0Start, idSIF1Start;
+u32 idTransferEnd, idRestart, idWait, idSIF0Start, idSIF1Start;
 
 void checkInterrupt();
-void checkRunning(Channel);
+void checkRunning();
+
+/* Frees the bus if chnID holds it */
+void releaseBus(int chnID) {
+    if (busOwner == chnID) busOwner = -1;
+}
 
 void transferEndEvent(int chnID) {
     auto &chn  = channels[chnID];
@@ -146,10 +185,24 @@ void transferEndEvent(int chnID) {
     stat.cis |= 1 << chnID;
 
     checkInterrupt();
+
+    releaseBus(chnID);
+
+    checkRunning();
 }
 
+/* Ends a slice, the channel competes for the bus again */
 void restartEvent(int chnID) {
-    checkRunning(static_cast<Channel>(chnID));
+    releaseBus(chnID);
+
+    checkRunning();
+}
+
+/* Sets DRQ again after waitDRQ() */
+void waitEvent(int chnID) {
+    channels[chnID].drq = true;
+
+    checkRunning();
 }
 
 void sif0StartEvent() {
@@ -180,8 +233,135 @@ Channel getChannel(u32 addr) {
     }
 }
 
-/* Reads and decodes a source chain tag */
-void readSourceTag(Channel chnID) {
+/* Returns true if a channel wants the bus */
+bool isRequesting(int chnID) {
+    const auto &chn = channels[chnID];
+
+    return chn.drq && (!pcr.pce || (pcr.cde & (1 << chnID))) && chn.chcr.str;
+}
+
+/* Returns the number of quadwords a channel may transfer before the bus is rearbitrated */
+u16 getSliceSize(Channel chn) {
+    for (int i = 0; i < 10; i++) {
+        if ((i != static_cast<int>(chn)) && isRequesting(i)) return SLICE_SIZE;
+    }
+
+    /* No other channel competes, coalesce all slices */
+    return UINT16_MAX;
+}
+
+/* Holds the bus for qwc transferred quadwords, then ends the transfer or rearbitrates */
+void endSlice(Channel chn, u16 qwc, bool isDone) {
+    auto cycles = 4 * (i64)qwc;
+
+    /* The CPU gets the bus for RCYC cycles after every slice */
+    if (ctrl.rele) cycles += ((qwc + SLICE_SIZE - 1) / SLICE_SIZE) * 2 * releaseCycles[ctrl.rcyc];
+
+    scheduler::addEvent(isDone ? idTransferEnd : idRestart, static_cast<int>(chn), cycles);
+}
+
+/* Clears DRQ and frees the bus, DRQ is set again after cycles (waits for a busy peripheral) */
+void waitDRQ(Channel chn, i64 cycles) {
+    const auto chnID = static_cast<int>(chn);
+
+    channels[chnID].drq = false;
+
+    releaseBus(chnID);
+
+    scheduler::addEvent(idWait, chnID, cycles);
+}
+
+/* --- Stall control --- */
+
+/*
+ * The stall source channel (D_CTRL.STS) writes its MADR to D_STADR,
+ * the drain channel (D_CTRL.STD) doesn't read past it in REFS tags.
+ * Only VIF1 and PATH3 drains stall, SIF1's DRQ belongs to the IOP.
+ */
+
+constexpr int stallSources[4] = {-1, static_cast<int>(Channel::SIF0), static_cast<int>(Channel::SPRFROM), static_cast<int>(Channel::IPUFROM)};
+constexpr int stallDrains[4]  = {-1, static_cast<int>(Channel::VIF1), static_cast<int>(Channel::PATH3), static_cast<int>(Channel::SIF1)};
+
+/* Updates D_STADR after the stall source channel wrote to RAM, wakes a stalled drain */
+void updateStall(Channel chn) {
+    if (static_cast<int>(chn) != stallSources[ctrl.sts]) return;
+
+    stadr = channels[static_cast<int>(chn)].madr;
+
+    if ((ctrl.std == 1) || (ctrl.std == 2)) channels[stallDrains[ctrl.std]].drq = true;
+}
+
+/* Returns the number of quadwords a drain may read at MADR, 0 if it has to stall */
+u16 getStallSize(Channel chn, u16 qwc) {
+    const auto &chnRef = channels[static_cast<int>(chn)];
+
+    if ((static_cast<int>(chn) != stallDrains[ctrl.std]) || (((chnRef.chcr.tag >> 12) & 7) != static_cast<int>(STag::REFS))) return qwc;
+
+    if (chnRef.madr >= stadr) return 0;
+
+    return std::min<u32>(qwc, (stadr - chnRef.madr) / 16);
+}
+
+/* Stalls the drain until the stall source writes more data */
+void stallDrain(Channel chn) {
+    stat.sis = true;
+
+    checkInterrupt();
+
+    channels[static_cast<int>(chn)].drq = false;
+
+    releaseBus(static_cast<int>(chn));
+}
+
+/* --- MFIFO --- */
+
+/*
+ * With D_CTRL.MFD set, SPR_FROM writes to a ring buffer in RAM (RBOR, RBSR + 16 bytes)
+ * and VIF1 or PATH3 drains it in Chain mode. SPR_FROM's MADR is the write pointer,
+ * the drain stalls (and sets MEIS) when it catches up to it.
+ */
+
+/* Returns the channel that drains the MFIFO */
+Channel getMFIFODrain() {
+    return (ctrl.mfd == MFD::MFIFOVIF1) ? Channel::VIF1 : Channel::PATH3;
+}
+
+bool isMFIFODrain(Channel chn) {
+    return (ctrl.mfd >= MFD::MFIFOVIF1) && (chn == getMFIFODrain());
+}
+
+/* Wraps an address into the ring buffer */
+u32 getMFIFOAddr(u32 addr) {
+    return (addr & rbsr) | rbor;
+}
+
+bool isInMFIFO(u32 addr) {
+    return (addr >= rbor) && (addr < (rbor + rbsr + 16));
+}
+
+/* Returns the number of quadwords the drain can read at addr without passing SPR_FROM or the end of the ring buffer */
+u16 getMFIFOSize(u32 addr) {
+    const auto avail = ((channels[static_cast<int>(Channel::SPRFROM)].madr - addr) & rbsr) / 16;
+    const auto left  = (rbor + rbsr + 16 - addr) / 16;
+
+    return std::min(avail, left);
+}
+
+/* Stalls the drain until SPR_FROM writes more data */
+void stallMFIFO(Channel chn) {
+    //std::printf("[DMAC:EE   ] MFIFO empty\n");
+
+    stat.meis = true;
+
+    checkInterrupt();
+
+    channels[static_cast<int>(chn)].drq = false;
+
+    releaseBus(static_cast<int>(chn));
+}
+
+/* Reads and decodes a source chain tag, returns the DMAtag */
+u128 readSourceTag(Channel chnID) {
     auto &chn  = channels[static_cast<int>(chnID)];
     auto &chcr = chn.chcr;
 
@@ -195,11 +375,13 @@ void readSourceTag(Channel chnID) {
     std::printf("[DMAC:EE   ] New DMAtag = 0x%016llX%016llX, QWC = %u\n", dmaTag._u64[1], dmaTag._u64[0], chn.qwc);
 
     /* Get tag ID */
-    const auto tag = (STag)((dmaTag._u16[1] >> 12) & 3);
+    const auto tag = (STag)((dmaTag._u16[1] >> 12) & 7);
+
+    const auto addr = dmaTag._u32[1] & ~15; // Bit 31 selects scratchpad RAM
 
     switch (tag) {
         case STag::REFE:
-            chn.madr  = dmaTag._u32[1] & ~15;
+            chn.madr  = addr;
             chn.tadr += 16;
 
             chn.isTagEnd = true;
@@ -216,25 +398,77 @@ void readSourceTag(Channel chnID) {
             break;
         case STag::NEXT:
             chn.madr = chn.tadr + 16;
-            chn.tadr = dmaTag._u32[1] & ~15;
+            chn.tadr = addr;
 
             chn.isTagEnd = (dmaTag._u32[0] & (1 << 31)) && chcr.tie;
 
             std::printf("[DMAC:EE   ] NEXT; MADR = 0x%08X, TADR = 0x%08X, isTagEnd = %d\n", chn.madr, chn.tadr, chn.isTagEnd);
             break;
         case STag::REF:
-            chn.madr  = dmaTag._u32[1] & ~15;
+        case STag::REFS: // Stall control is done by the channel
+            chn.madr  = addr;
             chn.tadr += 16;
 
             chn.isTagEnd = (dmaTag._u32[0] & (1 << 31)) && chcr.tie;
 
-            std::printf("[DMAC:EE   ] REF; MADR = 0x%08X, TADR = 0x%08X, isTagEnd = %d\n", chn.madr, chn.tadr, chn.isTagEnd);
+            std::printf("[DMAC:EE   ] REF%s; MADR = 0x%08X, TADR = 0x%08X, isTagEnd = %d\n", (tag == STag::REFS) ? "S" : "", chn.madr, chn.tadr, chn.isTagEnd);
+            break;
+        case STag::CALL:
+            chn.madr = chn.tadr + 16;
+
+            /* Push the address of the tag after the data onto the address stack */
+            switch (chcr.asp) {
+                case 0: chn.asr0 = chn.madr + 16 * chn.qwc; break;
+                case 1: chn.asr1 = chn.madr + 16 * chn.qwc; break;
+                default:
+                    std::printf("[DMAC:EE   ] CALL with full address stack\n");
+
+                    exit(0);
+            }
+
+            chcr.asp++;
+
+            chn.tadr = addr;
+
+            chn.isTagEnd = (dmaTag._u32[0] & (1 << 31)) && chcr.tie;
+
+            std::printf("[DMAC:EE   ] CALL; MADR = 0x%08X, TADR = 0x%08X, ASP = %u, isTagEnd = %d\n", chn.madr, chn.tadr, chcr.asp, chn.isTagEnd);
+            break;
+        case STag::RET:
+            chn.madr = chn.tadr + 16;
+
+            /* Pop the return address, RET with an empty stack ends the transfer */
+            if (chcr.asp) {
+                chn.tadr = (--chcr.asp) ? chn.asr1 : chn.asr0;
+
+                chn.isTagEnd = (dmaTag._u32[0] & (1 << 31)) && chcr.tie;
+            } else {
+                chn.isTagEnd = true;
+            }
+
+            std::printf("[DMAC:EE   ] RET; MADR = 0x%08X, TADR = 0x%08X, ASP = %u, isTagEnd = %d\n", chn.madr, chn.tadr, chcr.asp, chn.isTagEnd);
+            break;
+        case STag::END:
+            chn.madr = chn.tadr + 16;
+
+            chn.isTagEnd = true;
+
+            std::printf("[DMAC:EE   ] END; MADR = 0x%08X, TADR = 0x%08X\n", chn.madr, chn.tadr);
             break;
         default:
             std::printf("[DMAC:EE   ] Unhandled Source Chain tag %d\n", tag);
 
             exit(0);
     }
+
+    /* MFIFO tags and the data following them wrap around the ring buffer */
+    if (isMFIFODrain(chnID)) {
+        chn.tadr = getMFIFOAddr(chn.tadr);
+
+        if ((tag != STag::REFE) && (tag != STag::REF) && (tag != STag::REFS)) chn.madr = getMFIFOAddr(chn.madr);
+    }
+
+    return dmaTag;
 }
 
 /* Decodes a destination chain tag */
@@ -249,15 +483,21 @@ void decodeDestinationTag(Channel chnID, u64 dmaTag) {
     std::printf("[DMAC:EE   ] New DMAtag = 0x%016llX, QWC = %u\n", dmaTag, chn.qwc);
 
     /* Get tag ID */
-    const auto tag = (DTag)((dmaTag >> 28) & 3);
+    const auto tag = (DTag)((dmaTag >> 28) & 7);
 
-    switch (tag) {
-        case DTag::CNTS:
-            chn.madr = (dmaTag >> 32) & ~15;
+    chn.madr = (dmaTag >> 32) & ~15;
 
+    switch (tag) {
+        case DTag::CNT:
+        case DTag::CNTS: // Stall control is done by the channel
             chn.isTagEnd = (dmaTag & (1u << 31)) && chcr.tie;
 
-            std::printf("[DMAC:EE   ] CNTS; MADR = 0x%08X, isTagEnd = %d\n", chn.madr, chn.isTagEnd);
+            std::printf("[DMAC:EE   ] CNT%s; MADR = 0x%08X, isTagEnd = %d\n", (tag == DTag::CNTS) ? "S" : "", chn.madr, chn.isTagEnd);
+            break;
+        case DTag::END:
+            chn.isTagEnd = true;
+
+            std::printf("[DMAC:EE   ] END; MADR = 0x%08X\n", chn.madr);
             break;
         default:
             std::printf("[DMAC:EE   ] Unhandled Destination Chain tag %d\n", tag);
@@ -275,37 +515,55 @@ void doPATH3() {
 
     //std::printf("[DMAC:EE   ] PATH3 transfer\n");
 
+    /* Wait for VIF1 to unmask PATH3 */
+    if (gif::isPATH3Masked()) return waitDRQ(chnID, 64);
+
     /* PATH3 is always from RAM */
 
     if (!chn.qwc) {
         assert(chcr.mod == Mode::Chain); // Should only happen in Chain mode
 
-        std::printf("[DMAC:EE   ] Unhandled PATH3 chain transfer\n");
+        if (isMFIFODrain(chnID) && !getMFIFOSize(chn.tadr)) return stallMFIFO(chnID);
 
-        exit(0);
+        /* Read and decode DMAtag */
+        readSourceTag(chnID);
+
+        if (!chn.qwc) {
+            if (!chn.isTagEnd) return scheduler::addEvent(idRestart, static_cast<int>(chnID), 1);
+
+            return scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 1);
+        }
     }
 
-    /* Transfer all data (Normal)/one slice (Chain) */
+    /* Transfer one slice, or all data (Normal)/one tag (Chain) if the bus is free */
 
-    auto qwc  = chn.qwc;
+    auto qwc  = std::min(chn.qwc, getSliceSize(chnID));
     auto madr = chn.madr;
 
-    assert(qwc);
+    const auto isMFIFOData = isMFIFODrain(chnID) && isInMFIFO(madr);
 
-    for (u32 i = 0; i < qwc; i++) {
-        gif::writePATH3(bus::readDMAC128(madr + 16 * i));
+    if (isMFIFOData && !(qwc = std::min(qwc, getMFIFOSize(madr)))) return stallMFIFO(chnID);
+
+    if (!(qwc = getStallSize(chnID, qwc))) return stallDrain(chnID);
+
+    if (const auto src = bus::getDMACSpan(madr, qwc)) {
+        gif::writePATH3((const u128 *)src, qwc);
+    } else {
+        for (u32 i = 0; i < qwc; i++) {
+            gif::writePATH3(bus::readDMAC128(madr + 16 * i));
+        }
     }
 
     /* Update channel registers */
     chn.qwc  -= qwc;
     chn.madr += 16 * qwc;
 
+    if (isMFIFOData) chn.madr = getMFIFOAddr(chn.madr);
+
     ///* Clear DRQ */
     //chn.drq = false;
 
-    if (!chn.qwc && ((chcr.mod != Mode::Chain) || chn.isTagEnd)) {
-        scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 4 * qwc);
-    }
+    endSlice(chnID, qwc, !chn.qwc && ((chcr.mod != Mode::Chain) || chn.isTagEnd));
 }
 
 /* Performs SIF0 DMA */
@@ -345,15 +603,15 @@ void doSIF0() {
     chn.qwc  -= qwc;
     chn.madr += 16 * qwc;
 
+    updateStall(chnID);
+
     /* Clear DRQ */
     chn.drq = false;
 
     scheduler::addEvent(idSIF0Start, 0, 4 * qwc);
 
-    if (!chn.qwc && chn.isTagEnd) {
-        /* NOTE: no need to reschedule because the SIF0 Start event happens at the same time */
-        scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 4 * qwc);
-    }
+    /* SIF0 runs again when the IOP sets DRQ */
+    endSlice(chnID, qwc, !chn.qwc && chn.isTagEnd);
 }
 
 /* Performs SIF1 DMA */
@@ -401,30 +659,68 @@ void doSIF1() {
 
     scheduler::addEvent(idSIF1Start, 0, 4 * qwc);
 
-    if (!chn.qwc && chn.isTagEnd) {
-        /* NOTE: no need to reschedule because the SIF1 Start event happens at the same time */
-        scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 4 * qwc);
-    }
+    /* SIF1 runs again when the IOP sets DRQ */
+    endSlice(chnID, qwc, !chn.qwc && chn.isTagEnd);
 }
 
-/* Performs VIF1 DMA */
-void doVIF1() {
+/* Performs a VIF1 GS download (Local->Host transmission) */
+void doVIF1Download() {
     const auto chnID = Channel::VIF1;
 
     auto &chn  = channels[static_cast<int>(chnID)];
     auto &chcr = chn.chcr;
 
-    //std::printf("[DMAC:EE   ] VIF1 transfer\n");
+    assert(chcr.mod == Mode::Normal); // GS downloads are always in Normal mode
+
+    const auto qwc  = chn.qwc;
+    const auto madr = chn.madr;
+
+    std::printf("[DMAC:EE   ] VIF1 GS download, MADR = 0x%08X, QWC = %u\n", madr, qwc);
 
-    assert(chcr.mod == Mode::Chain); // Always in Chain mode?
-    assert(chcr.dir); // No GS downloads for now
+    /* Queued PATH1/PATH2 packets have to reach the GS first */
+    vu::thread::sync();
+
+    /* Stream readback data straight into RAM */
+    if (const auto dst = bus::getDMACSpan(madr, qwc)) {
+        gs::readHWREG((u64 *)dst, 2 * qwc);
+    } else {
+        for (u32 i = 0; i < qwc; i++) {
+            u128 data;
+
+            gs::readHWREG(data._u64, 2);
+
+            bus::writeDMAC128(madr + 16 * i, data);
+        }
+    }
+
+    /* Update channel registers */
+    chn.madr += 16 * qwc;
+
+    chn.qwc = 0;
+
+    endSlice(chnID, qwc, true);
+}
+
+/* Performs VIF0/VIF1 DMA */
+void doVIF(Channel chnID) {
+    auto &chn  = channels[static_cast<int>(chnID)];
+    auto &chcr = chn.chcr;
+
+    auto vifUnit = vif[static_cast<int>(chnID)];
+
+    //std::printf("[DMAC:EE   ] %s transfer\n", chnNames[static_cast<int>(chnID)]);
+
+    if (!chn.qwc) {
+        assert(chcr.mod == Mode::Chain); // Should only happen in Chain mode
+
+        if (isMFIFODrain(chnID) && !getMFIFOSize(chn.tadr)) return stallMFIFO(chnID);
 
-    if (!chn.qwc) { // Same as `if (!chn.hasTag)` because VIF1 only runs in Chain mode
         /* Read and decode DMAtag */
-        readSourceTag(chnID);
+        const auto dmaTag = readSourceTag(chnID);
+
+        /* Send the upper half of the tag to the VIF (usually VIFcodes) */
+        if (chcr.tte) vifUnit->transfer(&dmaTag._u32[2], 2);
 
-        //assert(!chcr.tte); // No tag transfers?
-        
         if (!chn.qwc) {
             if (!chn.isTagEnd) return scheduler::addEvent(idRestart, static_cast<int>(chnID), 1);
 
@@ -432,85 +728,337 @@ void doVIF1() {
         }
     }
 
-    /* Transfer all quadwords */
-
-    assert(chn.qwc);
+    /* Transfer one slice, or all quadwords (Normal)/one tag (Chain) if the bus is free */
 
+    auto qwc  = std::min(chn.qwc, getSliceSize(chnID));
     auto madr = chn.madr;
 
-    for (u32 i = 0; i < chn.qwc; i++) {
-        const auto data = bus::readDMAC128(madr + 16 * i);
+    const auto isMFIFOData = isMFIFODrain(chnID) && isInMFIFO(madr);
+
+    if (isMFIFOData && !(qwc = std::min(qwc, getMFIFOSize(madr)))) return stallMFIFO(chnID);
+
+    if (!(qwc = getStallSize(chnID, qwc))) return stallDrain(chnID);
 
-        std::printf("[DMAC:EE   ] VIF1 write = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
+    if (const auto src = bus::getDMACSpan(madr, qwc)) {
+        vifUnit->transfer((const u32 *)src, 4 * qwc);
+    } else {
+        for (u32 i = 0; i < qwc; i++) {
+            vifUnit->writeFIFO(bus::readDMAC128(madr + 16 * i));
+        }
     }
 
     /* Update channel registers */
-    chn.madr += 16 * chn.qwc;
+    chn.qwc  -= qwc;
+    chn.madr += 16 * qwc;
 
-    chn.qwc = 0;
+    if (isMFIFOData) chn.madr = getMFIFOAddr(chn.madr);
 
     /* Clear DRQ */
     //chn.drq = false;
 
-    scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 4 * chn.qwc);
+    endSlice(chnID, qwc, !chn.qwc && ((chcr.mod != Mode::Chain) || chn.isTagEnd));
+}
 
-    chn.qwc = 0;
+/* Performs VIF1 DMA */
+void doVIF1() {
+    if (!channels[static_cast<int>(Channel::VIF1)].chcr.dir) return doVIF1Download();
+
+    doVIF(Channel::VIF1);
 }
 
-void startDMA(Channel chn) {
-    switch (chn) {
-        case Channel::VIF1 : doVIF1(); break;
-        case Channel::PATH3: doPATH3(); break;
-        case Channel::SIF0 : doSIF0(); break;
-        case Channel::SIF1 : doSIF1(); break;
-        default:
-            std::printf("[DMAC:EE   ] Unhandled channel %d DMA transfer\n", chn);
+/* Performs IPU_FROM DMA */
+void doIPUFROM() {
+    const auto chnID = Channel::IPUFROM;
 
-            exit(0);
+    auto &chn  = channels[static_cast<int>(chnID)];
+    auto &chcr = chn.chcr;
+
+    /* IPU_FROM is always to RAM, in Normal mode */
+    assert(chcr.mod == Mode::Normal);
+
+    /* Transfer whatever the IPU has decoded so far, up to one slice if other channels compete */
+
+    const auto size = std::min(chn.qwc, getSliceSize(chnID));
+    const auto madr = chn.madr;
+
+    u16 qwc;
+
+    if (const auto dst = bus::getDMACSpan(madr, size)) {
+        qwc = ipu::readFIFO((u128 *)dst, size);
+    } else {
+        for (qwc = 0; qwc < size; qwc++) {
+            u128 data;
+
+            if (!ipu::readFIFO(&data, 1)) break;
+
+            bus::writeDMAC128(madr + 16 * qwc, data);
+        }
     }
+
+    /* Wait for the IPU to fill the OUT FIFO */
+    if (!qwc) return waitDRQ(chnID, 256);
+
+    /* Update channel registers */
+    chn.qwc  -= qwc;
+    chn.madr += 16 * qwc;
+
+    updateStall(chnID);
+
+    endSlice(chnID, qwc, !chn.qwc);
 }
 
-void checkInterrupt() {
-    std::printf("[DMAC:EE   ] STAT.CIM = 0x%03X, STAT.CIS = 0x%03X\n", stat.cim, stat.cis);
+/* Performs IPU_TO DMA */
+void doIPUTO() {
+    const auto chnID = Channel::IPUTO;
+
+    auto &chn  = channels[static_cast<int>(chnID)];
+    auto &chcr = chn.chcr;
+
+    if (!chn.qwc) {
+        assert(chcr.mod == Mode::Chain); // Should only happen in Chain mode
+
+        /* Read and decode DMAtag */
+        readSourceTag(chnID);
+
+        if (!chn.qwc) {
+            if (!chn.isTagEnd) return scheduler::addEvent(idRestart, static_cast<int>(chnID), 1);
+
+            return scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 1);
+        }
+    }
+
+    /* Prefetch the current transfer/tag ahead of the IN FIFO, D4_MADR and D4_QWC don't move yet */
+    const auto prefetched = std::min<u32>(ipu::getPrefetchQWC(), chn.qwc);
+    const auto length     = std::min<u32>(chn.qwc - prefetched, ipu::getPrefetchSpace());
+
+    if (length) {
+        const auto addr = chn.madr + 16 * prefetched;
 
-    ee::cpu::cop0::setInterruptPendingDMAC(stat.cim & stat.cis);
+        if (const auto src = bus::getDMACSpan(addr, length)) {
+            ipu::prefetchFIFO((const u128 *)src, length);
+        } else {
+            for (u32 i = 0; i < length; i++) {
+                const auto data = bus::readDMAC128(addr + 16 * i);
+
+                ipu::prefetchFIFO(&data, 1);
+            }
+        }
+    }
+
+    /* Transfer as much prefetched data as the IN FIFO can take, up to one slice if other channels compete */
+    const auto qwc = std::min<u32>({ipu::getPrefetchQWC(), ipu::getInputSpace(), chn.qwc, getSliceSize(chnID)});
+
+    /* Wait for room in the IN FIFO */
+    if (!qwc) return waitDRQ(chnID, 256);
+
+    ipu::acceptPrefetch(qwc);
+
+    /* Update channel registers */
+    chn.qwc  -= qwc;
+    chn.madr += 16 * qwc;
+
+    endSlice(chnID, qwc, !chn.qwc && ((chcr.mod != Mode::Chain) || chn.isTagEnd));
 }
 
-void checkRunning(Channel chn) {
-    const auto chnID = static_cast<int>(chn);
+/* Copies qwc quadwords between scratchpad RAM and RAM, wraps around scratchpad RAM and the MFIFO, skips SQWC quadwords in Interleave mode */
+void copySPR(Channel chnID, u16 qwc) {
+    auto &chn  = channels[static_cast<int>(chnID)];
+    auto &chcr = chn.chcr;
 
-    //std::printf("[DMAC:EE   ] Channel %d check\n", chnID);
+    const auto isToSPR = chnID == Channel::SPRTO;
+    const auto isMFIFO = !isToSPR && (ctrl.mfd >= MFD::MFIFOVIF1);
 
-    if ((enable & (1 << 16)) || !ctrl.dmae) {
-        //std::printf("[DMAC:EE   ] D_ENABLE = 0x%08X, D_CTRL.DMAE = %d\n", enable, ctrl.dmae);
-        return;
+    const auto isInterleave = (chcr.mod == Mode::Interleave) && sqwc.tqwc;
+
+    u32 blockLeft = sqwc.tqwc;
+
+    while (qwc) {
+        u16 len = std::min<u32>(qwc, (0x4000 - (chn.sadr & 0x3FF0)) / 16);
+
+        if (isMFIFO) len = std::min<u32>(len, (rbor + rbsr + 16 - chn.madr) / 16);
+        if (isInterleave) len = std::min<u32>(len, blockLeft);
+
+        const auto spr = bus::getDMACSpan(chn.sadr | (1 << 31), len);
+        const auto ram = bus::getDMACSpan(chn.madr, len);
+
+        if (spr && ram) {
+            if (isToSPR) {
+                std::memcpy(spr, ram, 16 * len);
+            } else {
+                std::memcpy(ram, spr, 16 * len);
+            }
+        } else {
+            for (u32 i = 0; i < len; i++) {
+                const auto sadr = ((chn.sadr + 16 * i) & 0x3FF0) | (1 << 31);
+
+                if (isToSPR) {
+                    bus::writeDMAC128(sadr, bus::readDMAC128(chn.madr + 16 * i));
+                } else {
+                    bus::writeDMAC128(chn.madr + 16 * i, bus::readDMAC128(sadr));
+                }
+            }
+        }
+
+        /* Update channel registers */
+        chn.qwc  -= len;
+        chn.madr += 16 * len;
+        chn.sadr  = (chn.sadr + 16 * len) & 0x3FF0;
+
+        qwc -= len;
+
+        if (isMFIFO) chn.madr = getMFIFOAddr(chn.madr);
+
+        /* Skip SQWC quadwords in RAM after every TQWC quadwords */
+        if (isInterleave && !(blockLeft -= len)) {
+            chn.madr += 16 * sqwc.sqwc;
+
+            blockLeft = sqwc.tqwc;
+        }
+    }
+}
+
+/* Performs SPR_FROM DMA */
+void doSPRFROM() {
+    const auto chnID = Channel::SPRFROM;
+
+    auto &chn  = channels[static_cast<int>(chnID)];
+    auto &chcr = chn.chcr;
+
+    const auto isMFIFO = ctrl.mfd >= MFD::MFIFOVIF1;
+
+    if (!chn.qwc) {
+        assert(chcr.mod == Mode::Chain); // Should only happen in Chain mode
+
+        /* Read and decode DMAtag, destination chain tags are in scratchpad RAM */
+        const auto madr = chn.madr;
+
+        decodeDestinationTag(chnID, bus::readDMAC128(chn.sadr | (1 << 31))._u64[0]);
+
+        chn.sadr = (chn.sadr + 16) & 0x3FF0;
+
+        /* MADR stays the MFIFO write pointer */
+        if (isMFIFO) chn.madr = madr;
+
+        if (!chn.qwc) {
+            if (!chn.isTagEnd) return scheduler::addEvent(idRestart, static_cast<int>(chnID), 1);
+
+            return scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 1);
+        }
+    }
+
+    if (isMFIFO) chn.madr = getMFIFOAddr(chn.madr);
+
+    /* SPR_FROM is a burst channel, transfer all quadwords (Normal/Interleave)/one tag (Chain) */
+
+    const auto qwc = chn.qwc;
+
+    copySPR(chnID, qwc);
+
+    updateStall(chnID);
+
+    /* Wake up a stalled drain channel */
+    if (isMFIFO) channels[static_cast<int>(getMFIFODrain())].drq = true;
+
+    endSlice(chnID, qwc, (chcr.mod != Mode::Chain) || chn.isTagEnd);
+}
+
+/* Performs SPR_TO DMA */
+void doSPRTO() {
+    const auto chnID = Channel::SPRTO;
+
+    auto &chn  = channels[static_cast<int>(chnID)];
+    auto &chcr = chn.chcr;
+
+    if (!chn.qwc) {
+        assert(chcr.mod == Mode::Chain); // Should only happen in Chain mode
+
+        /* Read and decode DMAtag */
+        const auto dmaTag = readSourceTag(chnID);
+
+        /* Send the tag to scratchpad RAM */
+        if (chcr.tte) {
+            bus::writeDMAC128(chn.sadr | (1 << 31), dmaTag);
+
+            chn.sadr = (chn.sadr + 16) & 0x3FF0;
+        }
+
+        if (!chn.qwc) {
+            if (!chn.isTagEnd) return scheduler::addEvent(idRestart, static_cast<int>(chnID), 1);
+
+            return scheduler::addEvent(idTransferEnd, static_cast<int>(chnID), 1);
+        }
     }
 
-    //std::printf("[DMAC:EE   ] D%d.DRQ = %d, PCR.PCE = %d, PCR.CDE%d = %d, D%d_CHCR.STR = %d\n", chnID, channels[chnID].drq, pcr.pce, chnID, pcr.cde & (1 << chnID), chnID, channels[chnID].chcr.str);
+    /* SPR_TO is a burst channel, transfer all quadwords (Normal/Interleave)/one tag (Chain) */
+
+    const auto qwc = chn.qwc;
+
+    copySPR(chnID, qwc);
 
-    if (channels[chnID].drq && (!pcr.pce || (pcr.cde & (1 << chnID))) && channels[chnID].chcr.str) startDMA(chn);
+    endSlice(chnID, qwc, (chcr.mod != Mode::Chain) || chn.isTagEnd);
 }
 
-void checkRunningAll() {
+void startDMA(Channel chn) {
+    switch (chn) {
+        case Channel::VIF0   : doVIF(Channel::VIF0); break;
+        case Channel::VIF1   : doVIF1(); break;
+        case Channel::PATH3  : doPATH3(); break;
+        case Channel::IPUFROM: doIPUFROM(); break;
+        case Channel::IPUTO  : doIPUTO(); break;
+        case Channel::SIF0   : doSIF0(); break;
+        case Channel::SIF1   : doSIF1(); break;
+        case Channel::SPRFROM: doSPRFROM(); break;
+        case Channel::SPRTO  : doSPRTO(); break;
+        default:
+            std::printf("[DMAC:EE   ] Unhandled channel %d DMA transfer\n", chn);
+
+            exit(0);
+    }
+}
+
+void checkInterrupt() {
+    std::printf("[DMAC:EE   ] STAT.CIM = 0x%03X, STAT.CIS = 0x%03X\n", stat.cim, stat.cis);
+
+    ee::cpu::cop0::setInterruptPendingDMAC((stat.cim & stat.cis) || (stat.sis && stat.sim) || (stat.meis && stat.meim));
+}
+
+/*
+ * Gives the bus to the highest priority requesting channel.
+ * D_PCR priority control (PCE/CDE) only decides which channels may request the bus, see isRequesting().
+ * Among those, priority is simplified to a fixed order: the lowest channel number wins every arbitration,
+ * so a busy low channel can keep higher ones waiting until its transfer ends. D_PCR.CPC isn't emulated.
+ */
+void checkRunning() {
     if ((enable & (1 << 16)) || !ctrl.dmae) {
         //std::printf("[DMAC:EE   ] D_ENABLE = 0x%08X, D_CTRL.DMAE = %d\n", enable, ctrl.dmae);
         return;
     }
 
-    for (int i = 0; i < 10; i++) {
+    /* Channels that wait for DRQ free the bus right away, keep looking */
+    for (int i = 0; (i < 10) && (busOwner < 0); i++) {
         //std::printf("[DMAC:EE   ] D%d.DRQ = %d, PCR.PCE = %d, PCR.CDE%d = %d, D%d_CHCR.STR = %d\n", i, channels[i].drq, pcr.pce, i, pcr.cde & (1 << i), i, channels[i].chcr.str);
 
-        if (channels[i].drq && (!pcr.pce || (pcr.cde & (1 << i))) && channels[i].chcr.str) startDMA((Channel)i);
+        if (isRequesting(i)) {
+            busOwner = i;
+
+            startDMA((Channel)i);
+        }
     }
 }
 
-void init() {
+void init(VectorInterface *vif0, VectorInterface *vif1) {
     std::memset(&channels, 0, 10 * sizeof(DMAChannel));
 
+    vif[0] = vif0;
+    vif[1] = vif1;
+
+    busOwner = -1;
+
     /* Set initial DRQs */
     channels[static_cast<int>(Channel::VIF0   )].drq = true;
     channels[static_cast<int>(Channel::VIF1   )].drq = true;
     channels[static_cast<int>(Channel::PATH3  )].drq = true;
+    channels[static_cast<int>(Channel::IPUFROM)].drq = true; // IPU_FROM polls the OUT FIFO
     channels[static_cast<int>(Channel::IPUTO  )].drq = true;
     channels[static_cast<int>(Channel::SIF1   )].drq = true;
     channels[static_cast<int>(Channel::SIF2   )].drq = true;
@@ -521,6 +1069,7 @@ void init() {
 
     idTransferEnd = scheduler::registerEvent([](int chnID) { transferEndEvent(chnID); });
     idRestart   = scheduler::registerEvent([](int chnID) { restartEvent(chnID); });
+    idWait      = scheduler::registerEvent([](int chnID) { waitEvent(chnID); });
     idSIF0Start = scheduler::registerEvent([](int) { sif0StartEvent(); });
     idSIF1Start = scheduler::registerEvent([](int) { sif1StartEvent(); });
 }
@@ -558,6 +1107,15 @@ u32 read(u32 addr) {
             case static_cast<u32>(ChannelReg::TADR):
                 std::printf("[DMAC:EE   ] 32-bit read @ D%u_TADR\n", chnID);
                 return chn.tadr;
+            case static_cast<u32>(ChannelReg::ASR0):
+                std::printf("[DMAC:EE   ] 32-bit read @ D%u_ASR0\n", chnID);
+                return chn.asr0;
+            case static_cast<u32>(ChannelReg::ASR1):
+                std::printf("[DMAC:EE   ] 32-bit read @ D%u_ASR1\n", chnID);
+                return chn.asr1;
+            case static_cast<u32>(ChannelReg::SADR):
+                std::printf("[DMAC:EE   ] 32-bit read @ D%u_SADR\n", chnID);
+                return chn.sadr;
             default:
                 std::printf("[DMAC:EE   ] Unhandled 32-bit channel read @ 0x%08X\n", addr);
 
@@ -595,16 +1153,16 @@ u32 read(u32 addr) {
                 break;
             case static_cast<u32>(ControlReg::SQWC):
                 std::printf("[DMAC:EE   ] 32-bit read @ D_SQWC\n");
-                return 0;
+                return sqwc.sqwc | ((u32)sqwc.tqwc << 16);
             case static_cast<u32>(ControlReg::RBSR):
                 std::printf("[DMAC:EE   ] 32-bit read @ D_RBSR\n");
-                return 0;
+                return rbsr;
             case static_cast<u32>(ControlReg::RBOR):
                 std::printf("[DMAC:EE   ] 32-bit read @ D_RBOR\n");
-                return 0;
+                return rbor;
             case static_cast<u32>(ControlReg::STADR):
                 std::printf("[DMAC:EE   ] 32-bit read @ D_STADR\n");
-                return 0;
+                return stadr;
             default:
                 std::printf("[DMAC:EE   ] Unhandled 32-bit control read @ 0x%08X\n", addr);
 
@@ -640,7 +1198,7 @@ void write(u32 addr, u32 data) {
                     chcr.str = data & (1 << 8);
                 }
 
-                checkRunning(static_cast<Channel>(chnID));
+                checkRunning();
                 break;
             case static_cast<u32>(ChannelReg::MADR):
                 std::printf("[DMAC:EE   ] 32-bit write @ D%u_MADR = 0x%08X\n", chnID, data);
@@ -689,18 +1247,24 @@ void write(u32 addr, u32 data) {
                 ctrl.std  = (data >> 6) & 3;
                 ctrl.rcyc = (data >> 8) & 7;
 
-                checkRunningAll();
+                /* Drains stalled on an empty MFIFO request the bus again */
+                if (ctrl.mfd < MFD::MFIFOVIF1) {
+                    channels[static_cast<int>(Channel::VIF1 )].drq = true;
+                    channels[static_cast<int>(Channel::PATH3)].drq = true;
+                }
+
+                checkRunning();
                 break;
             case static_cast<u32>(ControlReg::STAT):
                 std::printf("[DMAC:EE   ] 32-bit write @ D_STAT = 0x%08X\n", data);
 
                 stat.cis &= (~data & 0x3FF);
-                stat.sis  = data & (1 << 13);
-                stat.meis = data & (1 << 14);
-                stat.beis = data & (1 << 15);
+                stat.sis  = stat.sis  && !(data & (1 << 13));
+                stat.meis = stat.meis && !(data & (1 << 14));
+                stat.beis = stat.beis && !(data & (1 << 15));
                 stat.cim ^= ((data >> 16) & 0x3FF);
-                stat.sim  = data & (1 << 29);
-                stat.meim = data & (1 << 30);
+                stat.sim  = stat.sim  != (bool)(data & (1 << 29));
+                stat.meim = stat.meim != (bool)(data & (1 << 30));
 
                 checkInterrupt();
                 break;
@@ -711,16 +1275,28 @@ void write(u32 addr, u32 data) {
                 pcr.cde = (data >> 16) & 0x3FF;
                 pcr.pce = data & (1 << 31);
 
-                checkRunningAll();
+                checkRunning();
                 break;
             case static_cast<u32>(ControlReg::SQWC):
                 std::printf("[DMAC:EE   ] 32-bit write @ D_SQWC = 0x%08X\n", data);
+
+                sqwc.sqwc = data;
+                sqwc.tqwc = data >> 16;
                 break;
             case static_cast<u32>(ControlReg::RBSR):
                 std::printf("[DMAC:EE   ] 32-bit write @ D_RBSR = 0x%08X\n", data);
+
+                rbsr = data & 0x7FFFFFF0;
                 break;
             case static_cast<u32>(ControlReg::RBOR):
                 std::printf("[DMAC:EE   ] 32-bit write @ D_RBOR = 0x%08X\n", data);
+
+                rbor = data & 0x7FFFFFF0;
+                break;
+            case static_cast<u32>(ControlReg::STADR):
+                std::printf("[DMAC:EE   ] 32-bit write @ D_STADR = 0x%08X\n", data);
+
+                stadr = data & 0x7FFFFFF0;
                 break;
             default:
                 std::printf("[DMAC:EE   ] Unhandled 32-bit control write @ 0x%08X = 0x%08X\n", addr, data);
@@ -741,14 +1317,14 @@ void writeEnable(u32 data) {
 
     enable = data;
 
-    checkRunningAll();
+    checkRunning();
 }
 
 /* Sets DRQ, runs channel if enabled */
 void setDRQ(Channel chn, bool drq) {
     channels[static_cast<int>(chn)].drq = drq;
 
-    checkRunning(chn);
+    checkRunning();
 }
 
 }
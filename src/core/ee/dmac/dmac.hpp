@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "../vif/vif.hpp"
 #include "../../../common/types.hpp"
 
 namespace ps2::ee::dmac {
@@ -23,7 +24,7 @@ enum class Channel {
     SPRTO,   // To scratchpad
 };
 
-void init();
+void init(ps2::ee::vif::VectorInterface *vif0, ps2::ee::vif::VectorInterface *vif1);
 
 u32 read(u32 addr);
 u32 readEnable();
@@ -5,10 +5,12 @@
 
 #include "gif.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 
 #include "../../gs/gs.hpp"
+#include "../../../common/ring_buffer.hpp"
 
 namespace ps2::ee::gif {
 
@@ -21,6 +23,9 @@ enum Format {
     IMAGE,
 };
 
+/* GS register descriptors */
+constexpr u8 PRIM = 0x00, A_D = 0x0E;
+
 /* --- GIF registers --- */
 
 enum GIFReg {
@@ -44,12 +49,57 @@ struct GIFtag {
     Format fmt;
 
     bool hasTag;
+
+    /* Register descriptors and PACKED handlers, decoded once per tag */
+
+    u8 regList[16];
+
+    gs::PACKEDFn packedFns[16];
+
+    bool isAD; // All registers are A+D
+};
+
+/* Saved GIF state of a PATH */
+struct GIFPath {
+    GIFtag gifTag;
+
+    u16 nloop, nregs;
 };
 
+/* State of the active PATH, the others are kept in paths[] */
 GIFtag gifTag;
 
 u16 nloop = 0, nregs = 0;
 
+GIFPath paths[3];
+
+int activePath = 3;
+
+bool isPATH3Mask = false; // MSKPATH3 (VIF1)
+
+/*
+ * With VU1 on its own thread, PATH1/PATH2 packets and MSKPATH3 are queued
+ * and sent to the GS by the EE thread (flushQueue()).
+ * Each entry is a header quadword (path, size in quadwords, argument) followed by the packet.
+ */
+
+constexpr u64 PATH_QUEUE_SIZE = 1 << 16; // In quadwords
+
+/* Queue entry types */
+enum QueueCmd {
+    SetPATH3Mask,
+    PATH1,
+    PATH2,
+};
+
+RingBuffer<u128, PATH_QUEUE_SIZE> pathQueue;
+
+bool isQueued = false;
+
+/* Consumer state, packets can be split across flushQueue() calls */
+int queuePath = 0;
+u32 queueLeft = 0;
+
 /* Decodes GIFtags */
 void decodeTag(const u128 &data) {
     std::printf("[GIF       ] New GIFtag = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
@@ -63,8 +113,6 @@ void decodeTag(const u128 &data) {
     gifTag.nregs = (data._u64[0] >> 60);
     gifTag.regs  = data._u64[1];
 
-    assert(gifTag.nloop);
-
     /* NREGS = 0 means 16 */
     if (!gifTag.nregs) gifTag.nregs = 16;
 
@@ -75,63 +123,138 @@ void decodeTag(const u128 &data) {
             gifTag.fmt = Format::IMAGE;
     }
 
-    gifTag.hasTag = true;
+    gifTag.isAD = true;
+
+    for (int i = 0; i < gifTag.nregs; i++) {
+        const auto reg = (gifTag.regs >> (4 * i)) & 0xF;
+
+        gifTag.regList[i]   = reg;
+        gifTag.packedFns[i] = gs::getPACKEDFn(reg);
+
+        gifTag.isAD &= reg == A_D;
+    }
+
+    /* A tag with NLOOP = 0 has no data */
+    gifTag.hasTag = gifTag.nloop != 0;
+
+    nloop = gifTag.nloop;
+    nregs = 0;
 
     gs::initQ();
+
+    /* PRE is only valid in PACKED mode */
+    if (gifTag.prim && (gifTag.fmt == Format::PACKED)) gs::write(PRIM, gifTag.pdata);
+}
+
+/* Ends the current loop iteration after the last register */
+inline void stepReg(const char *fmtName) {
+    if (++nregs != gifTag.nregs) return;
+
+    nregs = 0;
+
+    if (!--nloop) {
+        std::printf("[GIF       ] %s transfer end\n", fmtName);
+
+        gifTag.hasTag = false;
+    }
 }
 
-/* Handles IMAGE transfers */
-void doIMAGE(const u128 &data) {
+/* Handles IMAGE data, returns the number of quadwords used */
+u32 doIMAGE(const u128 *data, u32 qwc) {
     if (nloop == gifTag.nloop) std::printf("[GIF       ] IMAGE transfer; NLOOP = %u\n", gifTag.nloop);
 
-    /* Write two dwords to HWREG */
-    gs::writeHWREG(data._u64[0]);
-    gs::writeHWREG(data._u64[1]);
+    const auto len = std::min((u32)nloop, qwc);
+
+    /* Write all dwords to HWREG without copying */
+    gs::writeHWREG(data->_u64, 2 * len);
 
-    nloop--;
+    nloop -= len;
 
     if (!nloop) {
         std::printf("[GIF       ] IMAGE transfer end\n");
 
         gifTag.hasTag = false;
     }
+
+    return len;
 }
 
-/* Handles PACKED transfers */
-void doPACKED(const u128 &data) {
+/* Handles PACKED data, returns the number of quadwords used */
+u32 doPACKED(const u128 *data, u32 qwc) {
     if (!nregs && (nloop == gifTag.nloop)) std::printf("[GIF       ] PACKED transfer; NREGS = %u, NLOOP = %u\n", gifTag.nregs, gifTag.nloop);
 
-    const auto reg = (gifTag.regs >> (4 * nregs)) & 0xF;
+    u32 i = 0;
 
-    gs::writePACKED(reg, data);
+    /* Finish a loop iteration that was split across blocks */
+    while (nregs && (i < qwc)) {
+        gifTag.packedFns[nregs](data[i++]);
 
-    nregs++;
+        stepReg("PACKED");
+    }
 
-    if (nregs == gifTag.nregs) {
-        nloop--;
+    if (!gifTag.hasTag) return i;
 
-        if (!nloop) {
-            std::printf("[GIF       ] PACKED transfer end\n");
+    /* Whole loop iterations */
+    const auto loops = std::min((u32)nloop, (qwc - i) / gifTag.nregs);
 
-            gifTag.hasTag = false;
+    if (gifTag.isAD) {
+        for (u32 j = 0; j < (loops * gifTag.nregs); j++, i++) {
+            gs::write(data[i]._u8[8], data[i]._u64[0]);
         }
+    } else if (gifTag.nregs == 1) {
+        const auto fn = gifTag.packedFns[0];
+
+        for (u32 j = 0; j < loops; j++) fn(data[i++]);
+    } else {
+        for (u32 j = 0; j < loops; j++) {
+            for (u32 reg = 0; reg < gifTag.nregs; reg++) gifTag.packedFns[reg](data[i++]);
+        }
+    }
+
+    nloop -= loops;
+
+    if (!nloop) {
+        std::printf("[GIF       ] PACKED transfer end\n");
+
+        gifTag.hasTag = false;
 
-        nregs = 0;
+        return i;
     }
+
+    /* Start of a loop iteration that continues in the next block */
+    while (i < qwc) {
+        gifTag.packedFns[nregs](data[i++]);
+
+        stepReg("PACKED");
+    }
+
+    return i;
 }
 
-/* Handles REGLIST transfers */
-void doREGLIST(u64 data) {
+/* Handles REGLIST data, returns the number of quadwords used */
+u32 doREGLIST(const u128 *data, u32 qwc) {
     if (!nregs && (nloop == gifTag.nloop)) std::printf("[GIF       ] REGLIST transfer; NREGS = %u, NLOOP = %u\n", gifTag.nregs, gifTag.nloop);
 
-    const auto reg = (gifTag.regs >> (4 * nregs)) & 0xF;
+    /* REGLIST data is a list of dwords */
+    const auto dwords = data->_u64;
+    const auto count  = 2 * qwc;
+
+    u32 i = 0;
+
+    while (nregs && (i < count)) {
+        gs::write(gifTag.regList[nregs], dwords[i++]);
+
+        stepReg("REGLIST");
+    }
 
-    gs::write(reg, data);
+    if (gifTag.hasTag) {
+        const auto loops = std::min((u32)nloop, (count - i) / gifTag.nregs);
 
-    nregs++;
+        for (u32 j = 0; j < loops; j++) {
+            for (u32 reg = 0; reg < gifTag.nregs; reg++) gs::write(gifTag.regList[reg], dwords[i++]);
+        }
 
-    if (nregs == gifTag.nregs) {
-        nloop--;
+        nloop -= loops;
 
         if (!nloop) {
             std::printf("[GIF       ] REGLIST transfer end\n");
@@ -139,35 +262,31 @@ void doREGLIST(u64 data) {
             gifTag.hasTag = false;
         }
 
-        nregs = 0;
+        while (gifTag.hasTag && (i < count)) {
+            gs::write(gifTag.regList[nregs], dwords[i++]);
+
+            stepReg("REGLIST");
+        }
     }
+
+    /* Discard the second dword of the last quadword if the register count is odd */
+    return (i + 1) / 2;
 }
 
-/* Handles GIF packets */
-void doCmd(const u128 &data) {
+/* Handles GIF packets, returns the number of quadwords used */
+u32 doCmd(const u128 *data, u32 qwc) {
     if (!gifTag.hasTag) {
         /* Set up GIFtag */
 
-        decodeTag(data);
+        decodeTag(*data);
 
-        assert(gifTag.nloop);
-        assert(!gifTag.prim);
-
-        nloop = gifTag.nloop;
-        nregs = 0;
-
-        return;
+        return 1;
     }
 
     switch (gifTag.fmt) {
-        case Format::PACKED : doPACKED(data); break;
-        case Format::REGLIST: 
-            doREGLIST(data._u64[0]); 
-            
-            /* Discard second dword if the previous transfer reset NREGS */
-            if (nregs) doREGLIST(data._u64[1]);
-            break;
-        case Format::IMAGE  : doIMAGE(data); break;
+        case Format::PACKED : return doPACKED(data, qwc);
+        case Format::REGLIST: return doREGLIST(data, qwc);
+        case Format::IMAGE  : return doIMAGE(data, qwc);
         default:
             std::printf("[GIF       ] Unhandled %s format\n", fmtNames[gifTag.fmt]);
 
@@ -207,12 +326,174 @@ void write(u32 addr, u32 data) {
     }
 }
 
+/* Switches the active PATH, packets of different PATHs don't share state */
+void setActivePath(int path) {
+    if (path == activePath) return;
+
+    auto &oldPath = paths[activePath - 1];
+
+    oldPath.gifTag = gifTag;
+    oldPath.nloop  = nloop;
+    oldPath.nregs  = nregs;
+
+    const auto &newPath = paths[path - 1];
+
+    gifTag = newPath.gifTag;
+    nloop  = newPath.nloop;
+    nregs  = newPath.nregs;
+
+    activePath = path;
+}
+
+/* Parses a block of GIF data on a PATH */
+void writePath(int path, const u128 *data, u32 qwc) {
+    setActivePath(path);
+
+    while (qwc) {
+        const auto len = doCmd(data, qwc);
+
+        data += len;
+        qwc  -= len;
+    }
+}
+
+/* Queues an entry header for the EE thread, the entry's data has to be pushed right after it */
+void queueHeader(QueueCmd cmd, u32 qwc, u32 arg) {
+    u128 header;
+
+    header._u32[0] = cmd;
+    header._u32[1] = qwc;
+    header._u32[2] = arg;
+    header._u32[3] = 0;
+
+    pathQueue.push(&header, 1);
+}
+
+/* Returns the size of a GIF packet in quadwords (including GIFtags), addr and mask are in quadwords */
+u32 getPacketSize(const u128 *mem, u32 addr, u32 mask) {
+    u32 size = 0;
+
+    while (size <= mask) {
+        const auto &tag = mem[(addr + size) & mask];
+
+        const u32 nloop = tag._u16[0] & 0x7FFF;
+        const u32 nregs = (tag._u64[0] >> 60) ? (tag._u64[0] >> 60) : 16;
+
+        switch ((tag._u64[0] >> 58) & 3) {
+            case Format::PACKED : size += 1 + nloop * nregs; break;
+            case Format::REGLIST: size += 1 + (nloop * nregs + 1) / 2; break;
+            default             : size += 1 + nloop; break;
+        }
+
+        if (tag._u16[0] & (1 << 15)) break;
+    }
+
+    /* A packet can't be larger than VU memory */
+    return std::min(size, mask + 1);
+}
+
+/* Sends a GIF packet from VU1 data memory (XGKICK), addr and mask are in quadwords */
+void writePATH1(const u128 *mem, u32 addr, u32 mask) {
+    const auto size = getPacketSize(mem, addr, mask);
+
+    /* The packet can wrap around */
+    const auto len = std::min(size, mask + 1 - (addr & mask));
+
+    if (isQueued) {
+        queueHeader(QueueCmd::PATH1, size, 0);
+
+        pathQueue.push(&mem[addr & mask], len);
+        pathQueue.push(mem, size - len);
+
+        return;
+    }
+
+    writePath(1, &mem[addr & mask], len);
+    writePath(1, mem, size - len);
+}
+
+/* Parses a block of PATH2 (VIF1 DIRECT) data */
+void writePATH2(const u128 *data, u32 qwc) {
+    if (isQueued) {
+        queueHeader(QueueCmd::PATH2, qwc, 0);
+
+        return pathQueue.push(data, qwc);
+    }
+
+    writePath(2, data, qwc);
+}
+
 void writePATH3(const u128 &data) {
     /* TODO: PATH arbitration? */
 
     //std::printf("[GIF:PATH3 ] Write = 0x%016llX%016llX\n", data._u64[1], data._u64[0]);
 
-    doCmd(data);
+    writePATH3(&data, 1);
+}
+
+/* Parses a block of PATH3 data in place, whole register loops are handled at once */
+void writePATH3(const u128 *data, u32 qwc) {
+    /* Let queued PATH1/PATH2 packets go first */
+    if (isQueued) flushQueue();
+
+    writePath(3, data, qwc);
+}
+
+/* Sets the PATH3 mask (VIF1 MSKPATH3) */
+void setPATH3Mask(bool isMasked) {
+    if (isQueued) return queueHeader(QueueCmd::SetPATH3Mask, 0, isMasked);
+
+    isPATH3Mask = isMasked;
+}
+
+/* Returns true if PATH3 transfers are stalled, the mask only applies between packets */
+bool isPATH3Masked() {
+    if (!isPATH3Mask) return false;
+
+    return (activePath == 3) ? !gifTag.hasTag : !paths[2].gifTag.hasTag;
+}
+
+/* Makes PATH1/PATH2 go through the packet queue (VU1 thread) */
+void setQueued(bool isQueued) {
+    gif::isQueued = isQueued;
+}
+
+/* Sends queued PATH1/PATH2 packets to the GS (EE thread) */
+void flushQueue() {
+    const u128 *data;
+
+    while (const auto count = pathQueue.peek(data)) {
+        if (!queueLeft) {
+            /* Next entry */
+            const auto header = *data;
+
+            pathQueue.pop(1);
+
+            switch (header._u32[0]) {
+                case QueueCmd::SetPATH3Mask:
+                    isPATH3Mask = header._u32[2];
+                    break;
+                default:
+                    queuePath = (header._u32[0] == QueueCmd::PATH1) ? 1 : 2;
+                    queueLeft = header._u32[1];
+                    break;
+            }
+
+            if (!queueLeft) queuePath = 0;
+
+            continue;
+        }
+
+        const auto len = (u32)std::min((u64)queueLeft, count);
+
+        writePath(queuePath, data, len);
+
+        pathQueue.pop(len);
+
+        queueLeft -= len;
+
+        if (!queueLeft) queuePath = 0;
+    }
 }
 
 }
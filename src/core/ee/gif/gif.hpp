@@ -13,6 +13,16 @@ u32 read(u32 addr);
 
 void write(u32 addr, u32 data);
 
+void writePATH1(const u128 *mem, u32 addr, u32 mask);
+void writePATH2(const u128 *data, u32 qwc);
 void writePATH3(const u128 &data);
+void writePATH3(const u128 *data, u32 qwc);
+
+void setPATH3Mask(bool isMasked);
+
+bool isPATH3Masked();
+
+void setQueued(bool isQueued);
+void flushQueue();
 
 }
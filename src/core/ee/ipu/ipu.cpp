@@ -5,54 +5,1967 @@
 
 #include "ipu.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <numbers>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "../../intc.hpp"
+#include "../../../common/ring_buffer.hpp"
 
 namespace ps2::ee::ipu {
 
-/* IPU commands */
-enum Command {
-    BCLR  = 0x0,
-    SETIQ = 0x5,
-    SETTH = 0x9,
-};
+using Interrupt = intc::Interrupt;
+
+/*
+ * The IPU decodes MPEG bit streams from the IN FIFO.
+ *
+ * Commands decode optimistically: reads past the end of the IN FIFO return zeroes
+ * and set isUnderflow, in which case the decoder state is restored
+ * and the command is resumed when more data has been written.
+ * Results are committed one macroblock at a time.
+ *
+ * Like on hardware, the IN FIFO holds 8 quadwords, IPU_TO waits for room (getInputSpace()).
+ * Since commands only consume data once a whole macroblock is decoded, a command that ran out of data
+ * may receive 8 quadwords more than what the decoder has seen so far.
+ *
+ * The 8 quadword limit only applies to what the guest sees (IFC, BP, D4_MADR/D4_QWC).
+ * With the IPU thread enabled, IPU_TO reads up to RUN_AHEAD_SIZE quadwords of the current transfer
+ * ahead of the IN FIFO (prefetchFIFO()), so that the decoder doesn't have to wait for the EE.
+ * Prefetched data is moved to the IN FIFO as room frees up (acceptPrefetch()).
+ * BCLR and IPU resets drop prefetched data, IPU_TO reads it again from D4_MADR.
+ *
+ * IPU register writes and IN FIFO data go through inQueue, decoded data comes back through outQueue.
+ * With the IPU thread enabled, the decoder runs ahead of the EE; the EE only waits for it (sync())
+ * when it reads IPU_CMD/IPU_CTRL/IPU_BP/IPU_TOP, finds the OUT FIFO empty or fills inQueue.
+ * Otherwise, the EE thread processes queued writes right away.
+ * A full OUT FIFO stalls the decoder between macroblocks until the EE reads from it.
+ */
+
+/* IPU commands */
+enum Command {
+    BCLR  = 0x0,
+    IDEC  = 0x1,
+    BDEC  = 0x2,
+    VDEC  = 0x3,
+    FDEC  = 0x4,
+    SETIQ = 0x5,
+    SETVQ = 0x6,
+    CSC   = 0x7,
+    PACK  = 0x8,
+    SETTH = 0x9,
+};
+
+/* --- IPU registers --- */
+
+enum class IPUReg {
+    CMD  = 0x10002000,
+    CTRL = 0x10002010,
+    BP   = 0x10002020,
+    TOP  = 0x10002030,
+};
+
+/* IPU_CTRL */
+struct CTRL {
+    u8   cbp; // Coded block pattern
+    bool ecd; // Error code detected
+    bool scd; // Start code detected
+    u8   idp; // Intra DC precision
+    bool as;  // Alternate scan
+    bool ivf; // Intra VLC format
+    bool qst; // Q scale type
+    bool mp1; // MPEG-1 bit stream
+    u8   pct; // Picture type
+};
+
+/* Macroblock type flags */
+enum MBType {
+    MB_INTRA   = 1 << 0,
+    MB_PATTERN = 1 << 1,
+    MB_BWD     = 1 << 2,
+    MB_FWD     = 1 << 3,
+    MB_QUANT   = 1 << 4,
+};
+
+/* Special VLC values */
+constexpr i32 MBA_ESCAPE = -1, MBA_STUFFING = -2;
+
+constexpr u8 DCT_EOB = 64, DCT_ESCAPE = 65;
+
+/* --- VLC tables (ISO/IEC 13818-2 Annex B) --- */
+
+/* VLC code, spaces are ignored */
+struct VLC {
+    const char *code;
+    i32 value;
+};
+
+/* DCT coefficient VLC, codes don't include the sign bit */
+struct DCTVLC {
+    const char *code;
+    u8 run, level;
+};
+
+/* B.1, macroblock_address_increment */
+const VLC mbaTable[] = {
+    {"1", 1}, {"011", 2}, {"010", 3}, {"0011", 4}, {"0010", 5}, {"0001 1", 6}, {"0001 0", 7},
+    {"0000 111", 8}, {"0000 110", 9}, {"0000 1011", 10}, {"0000 1010", 11}, {"0000 1001", 12},
+    {"0000 1000", 13}, {"0000 0111", 14}, {"0000 0110", 15}, {"0000 0101 11", 16}, {"0000 0101 10", 17},
+    {"0000 0101 01", 18}, {"0000 0101 00", 19}, {"0000 0100 11", 20}, {"0000 0100 10", 21},
+    {"0000 0100 011", 22}, {"0000 0100 010", 23}, {"0000 0100 001", 24}, {"0000 0100 000", 25},
+    {"0000 0011 111", 26}, {"0000 0011 110", 27}, {"0000 0011 101", 28}, {"0000 0011 100", 29},
+    {"0000 0011 011", 30}, {"0000 0011 010", 31}, {"0000 0011 001", 32}, {"0000 0011 000", 33},
+    {"0000 0001 000", MBA_ESCAPE}, {"0000 0001 111", MBA_STUFFING},
+};
+
+/* B.2-B.4 and D-pictures, macroblock_type */
+const VLC mbTypeTableI[] = {
+    {"1", MB_INTRA}, {"01", MB_QUANT | MB_INTRA},
+};
+
+const VLC mbTypeTableP[] = {
+    {"1", MB_FWD | MB_PATTERN}, {"01", MB_PATTERN}, {"001", MB_FWD}, {"0001 1", MB_INTRA},
+    {"0001 0", MB_QUANT | MB_FWD | MB_PATTERN}, {"0000 1", MB_QUANT | MB_PATTERN}, {"0000 01", MB_QUANT | MB_INTRA},
+};
+
+const VLC mbTypeTableB[] = {
+    {"10", MB_FWD | MB_BWD}, {"11", MB_FWD | MB_BWD | MB_PATTERN}, {"010", MB_BWD}, {"011", MB_BWD | MB_PATTERN},
+    {"0010", MB_FWD}, {"0011", MB_FWD | MB_PATTERN}, {"0001 1", MB_INTRA}, {"0001 0", MB_QUANT | MB_FWD | MB_BWD | MB_PATTERN},
+    {"0000 11", MB_QUANT | MB_FWD | MB_PATTERN}, {"0000 10", MB_QUANT | MB_BWD | MB_PATTERN}, {"0000 01", MB_QUANT | MB_INTRA},
+};
+
+const VLC mbTypeTableD[] = {
+    {"1", MB_INTRA},
+};
+
+/* B.9, coded_block_pattern */
+const VLC cbpTable[] = {
+    {"111", 60}, {"1101", 4}, {"1100", 8}, {"1011", 16}, {"1010", 32}, {"1001 1", 12}, {"1001 0", 48},
+    {"1000 1", 20}, {"1000 0", 40}, {"0111 1", 28}, {"0111 0", 44}, {"0110 1", 52}, {"0110 0", 56},
+    {"0101 1", 1}, {"0101 0", 61}, {"0100 1", 2}, {"0100 0", 62}, {"0011 11", 24}, {"0011 10", 36},
+    {"0011 01", 3}, {"0011 00", 63}, {"0010 111", 5}, {"0010 110", 9}, {"0010 101", 17}, {"0010 100", 33},
+    {"0010 011", 6}, {"0010 010", 10}, {"0010 001", 18}, {"0010 000", 34}, {"0001 1111", 7}, {"0001 1110", 11},
+    {"0001 1101", 19}, {"0001 1100", 35}, {"0001 1011", 13}, {"0001 1010", 49}, {"0001 1001", 21}, {"0001 1000", 41},
+    {"0001 0111", 14}, {"0001 0110", 50}, {"0001 0101", 22}, {"0001 0100", 42}, {"0001 0011", 15}, {"0001 0010", 51},
+    {"0001 0001", 23}, {"0001 0000", 43}, {"0000 1111", 25}, {"0000 1110", 37}, {"0000 1101", 26}, {"0000 1100", 38},
+    {"0000 1011", 29}, {"0000 1010", 45}, {"0000 1001", 53}, {"0000 1000", 57}, {"0000 0111", 30}, {"0000 0110", 46},
+    {"0000 0101", 54}, {"0000 0100", 58}, {"0000 0011 1", 31}, {"0000 0011 0", 47}, {"0000 0010 1", 55},
+    {"0000 0010 0", 59}, {"0000 0001 1", 27}, {"0000 0001 0", 39}, {"0000 0000 1", 0},
+};
+
+/* B.10, motion_code (without the sign bit) */
+const VLC motionCodeTable[] = {
+    {"1", 0}, {"01", 1}, {"001", 2}, {"0001", 3}, {"0000 11", 4}, {"0000 101", 5}, {"0000 100", 6},
+    {"0000 011", 7}, {"0000 0101 1", 8}, {"0000 0101 0", 9}, {"0000 0100 1", 10}, {"0000 0100 01", 11},
+    {"0000 0100 00", 12}, {"0000 0011 11", 13}, {"0000 0011 10", 14}, {"0000 0011 01", 15}, {"0000 0011 00", 16},
+};
+
+/* B.11, dmvector */
+const VLC dmvTable[] = {
+    {"0", 0}, {"10", 1}, {"11", -1},
+};
+
+/* B.12/B.13, dct_dc_size_luminance/chrominance */
+const VLC dcSizeTableLuma[] = {
+    {"100", 0}, {"00", 1}, {"01", 2}, {"101", 3}, {"110", 4}, {"1110", 5}, {"1111 0", 6},
+    {"1111 10", 7}, {"1111 110", 8}, {"1111 1110", 9}, {"1111 1111 0", 10}, {"1111 1111 1", 11},
+};
+
+const VLC dcSizeTableChroma[] = {
+    {"00", 0}, {"01", 1}, {"10", 2}, {"110", 3}, {"1110", 4}, {"1111 0", 5}, {"1111 10", 6},
+    {"1111 110", 7}, {"1111 1110", 8}, {"1111 1111 0", 9}, {"1111 1111 10", 10}, {"1111 1111 11", 11},
+};
+
+/* B.14, DCT coefficients table zero */
+const DCTVLC dctTableZero[] = {
+    {"11", 0, 1}, {"0100", 0, 2}, {"0010 1", 0, 3},
+    {"0000 110", 0, 4}, {"0010 0110", 0, 5}, {"0010 0001", 0, 6},
+    {"0000 0010 10", 0, 7}, {"0000 0001 1101", 0, 8}, {"0000 0001 1000", 0, 9},
+    {"0000 0001 0011", 0, 10}, {"0000 0001 0000", 0, 11}, {"0000 0000 1101 0", 0, 12},
+    {"0000 0000 1100 1", 0, 13}, {"0000 0000 1100 0", 0, 14}, {"0000 0000 1011 1", 0, 15},
+    {"0000 0000 0111 11", 0, 16}, {"0000 0000 0111 10", 0, 17}, {"0000 0000 0111 01", 0, 18},
+    {"0000 0000 0111 00", 0, 19}, {"0000 0000 0110 11", 0, 20}, {"0000 0000 0110 10", 0, 21},
+    {"0000 0000 0110 01", 0, 22}, {"0000 0000 0110 00", 0, 23}, {"0000 0000 0101 11", 0, 24},
+    {"0000 0000 0101 10", 0, 25}, {"0000 0000 0101 01", 0, 26}, {"0000 0000 0101 00", 0, 27},
+    {"0000 0000 0100 11", 0, 28}, {"0000 0000 0100 10", 0, 29}, {"0000 0000 0100 01", 0, 30},
+    {"0000 0000 0100 00", 0, 31}, {"0000 0000 0011 000", 0, 32}, {"0000 0000 0010 111", 0, 33},
+    {"0000 0000 0010 110", 0, 34}, {"0000 0000 0010 101", 0, 35}, {"0000 0000 0010 100", 0, 36},
+    {"0000 0000 0010 011", 0, 37}, {"0000 0000 0010 010", 0, 38}, {"0000 0000 0010 001", 0, 39},
+    {"0000 0000 0010 000", 0, 40}, {"011", 1, 1}, {"0001 10", 1, 2},
+    {"0010 0101", 1, 3}, {"0000 0011 00", 1, 4}, {"0000 0001 1011", 1, 5},
+    {"0000 0000 1011 0", 1, 6}, {"0000 0000 1010 1", 1, 7}, {"0000 0000 0011 111", 1, 8},
+    {"0000 0000 0011 110", 1, 9}, {"0000 0000 0011 101", 1, 10}, {"0000 0000 0011 100", 1, 11},
+    {"0000 0000 0011 011", 1, 12}, {"0000 0000 0011 010", 1, 13}, {"0000 0000 0011 001", 1, 14},
+    {"0000 0000 0001 0011", 1, 15}, {"0000 0000 0001 0010", 1, 16}, {"0000 0000 0001 0001", 1, 17},
+    {"0000 0000 0001 0000", 1, 18}, {"0101", 2, 1}, {"0000 100", 2, 2},
+    {"0000 0010 11", 2, 3}, {"0000 0001 0100", 2, 4}, {"0000 0000 1010 0", 2, 5},
+    {"0011 1", 3, 1}, {"0010 0100", 3, 2}, {"0000 0001 1100", 3, 3},
+    {"0000 0000 1001 1", 3, 4}, {"0011 0", 4, 1}, {"0000 0011 11", 4, 2},
+    {"0000 0001 0010", 4, 3}, {"0001 11", 5, 1}, {"0000 0010 01", 5, 2},
+    {"0000 0000 1001 0", 5, 3}, {"0001 01", 6, 1}, {"0000 0001 1110", 6, 2},
+    {"0000 0000 0001 0100", 6, 3}, {"0001 00", 7, 1}, {"0000 0001 0101", 7, 2},
+    {"0000 111", 8, 1}, {"0000 0001 0001", 8, 2}, {"0000 101", 9, 1},
+    {"0000 0000 1000 1", 9, 2}, {"0010 0111", 10, 1}, {"0000 0000 1000 0", 10, 2},
+    {"0010 0011", 11, 1}, {"0000 0000 0001 1010", 11, 2}, {"0010 0010", 12, 1},
+    {"0000 0000 0001 1001", 12, 2}, {"0010 0000", 13, 1}, {"0000 0000 0001 1000", 13, 2},
+    {"0000 0011 10", 14, 1}, {"0000 0000 0001 0111", 14, 2}, {"0000 0011 01", 15, 1},
+    {"0000 0000 0001 0110", 15, 2}, {"0000 0010 00", 16, 1}, {"0000 0000 0001 0101", 16, 2},
+    {"0000 0001 1111", 17, 1}, {"0000 0001 1010", 18, 1}, {"0000 0001 1001", 19, 1},
+    {"0000 0001 0111", 20, 1}, {"0000 0001 0110", 21, 1}, {"0000 0000 1111 1", 22, 1},
+    {"0000 0000 1111 0", 23, 1}, {"0000 0000 1110 1", 24, 1}, {"0000 0000 1110 0", 25, 1},
+    {"0000 0000 1101 1", 26, 1}, {"0000 0000 0001 1111", 27, 1}, {"0000 0000 0001 1110", 28, 1},
+    {"0000 0000 0001 1101", 29, 1}, {"0000 0000 0001 1100", 30, 1}, {"0000 0000 0001 1011", 31, 1},
+    {"10", DCT_EOB, 0}, {"0000 01", DCT_ESCAPE, 0},
+};
+
+/* B.15, DCT coefficients table one */
+const DCTVLC dctTableOne[] = {
+    {"10", 0, 1}, {"110", 0, 2}, {"0111", 0, 3},
+    {"1110 0", 0, 4}, {"1110 1", 0, 5}, {"0001 01", 0, 6},
+    {"0001 00", 0, 7}, {"1111 011", 0, 8}, {"1111 100", 0, 9},
+    {"0010 0011", 0, 10}, {"0010 0010", 0, 11}, {"1111 1010", 0, 12},
+    {"1111 1011", 0, 13}, {"1111 1110", 0, 14}, {"1111 1111", 0, 15},
+    {"0000 0000 0111 11", 0, 16}, {"0000 0000 0111 10", 0, 17}, {"0000 0000 0111 01", 0, 18},
+    {"0000 0000 0111 00", 0, 19}, {"0000 0000 0110 11", 0, 20}, {"0000 0000 0110 10", 0, 21},
+    {"0000 0000 0110 01", 0, 22}, {"0000 0000 0110 00", 0, 23}, {"0000 0000 0101 11", 0, 24},
+    {"0000 0000 0101 10", 0, 25}, {"0000 0000 0101 01", 0, 26}, {"0000 0000 0101 00", 0, 27},
+    {"0000 0000 0100 11", 0, 28}, {"0000 0000 0100 10", 0, 29}, {"0000 0000 0100 01", 0, 30},
+    {"0000 0000 0100 00", 0, 31}, {"0000 0000 0011 000", 0, 32}, {"0000 0000 0010 111", 0, 33},
+    {"0000 0000 0010 110", 0, 34}, {"0000 0000 0010 101", 0, 35}, {"0000 0000 0010 100", 0, 36},
+    {"0000 0000 0010 011", 0, 37}, {"0000 0000 0010 010", 0, 38}, {"0000 0000 0010 001", 0, 39},
+    {"0000 0000 0010 000", 0, 40}, {"010", 1, 1}, {"0011 0", 1, 2},
+    {"1111 001", 1, 3}, {"0010 0111", 1, 4}, {"0010 0000", 1, 5},
+    {"0000 0000 1011 0", 1, 6}, {"0000 0000 1010 1", 1, 7}, {"0000 0000 0011 111", 1, 8},
+    {"0000 0000 0011 110", 1, 9}, {"0000 0000 0011 101", 1, 10}, {"0000 0000 0011 100", 1, 11},
+    {"0000 0000 0011 011", 1, 12}, {"0000 0000 0011 010", 1, 13}, {"0000 0000 0011 001", 1, 14},
+    {"0000 0000 0001 0011", 1, 15}, {"0000 0000 0001 0010", 1, 16}, {"0000 0000 0001 0001", 1, 17},
+    {"0000 0000 0001 0000", 1, 18}, {"0010 1", 2, 1}, {"0000 111", 2, 2},
+    {"1111 1100", 2, 3}, {"0000 0011 00", 2, 4}, {"0000 0000 1010 0", 2, 5},
+    {"0011 1", 3, 1}, {"0010 0110", 3, 2}, {"0000 0001 1100", 3, 3},
+    {"0000 0000 1001 1", 3, 4}, {"0001 10", 4, 1}, {"1111 1101", 4, 2},
+    {"0000 0001 0010", 4, 3}, {"0001 11", 5, 1}, {"0000 0010 0", 5, 2},
+    {"0000 0000 1001 0", 5, 3}, {"0000 110", 6, 1}, {"0000 0001 1110", 6, 2},
+    {"0000 0000 0001 0100", 6, 3}, {"0000 100", 7, 1}, {"0000 0001 0101", 7, 2},
+    {"0000 101", 8, 1}, {"0000 0001 0001", 8, 2}, {"1111 000", 9, 1},
+    {"0000 0000 1000 1", 9, 2}, {"1111 010", 10, 1}, {"0000 0000 1000 0", 10, 2},
+    {"0010 0001", 11, 1}, {"0000 0000 0001 1010", 11, 2}, {"0010 0101", 12, 1},
+    {"0000 0000 0001 1001", 12, 2}, {"0010 0100", 13, 1}, {"0000 0000 0001 1000", 13, 2},
+    {"0000 0010 1", 14, 1}, {"0000 0000 0001 0111", 14, 2}, {"0000 0011 1", 15, 1},
+    {"0000 0000 0001 0110", 15, 2}, {"0000 0011 01", 16, 1}, {"0000 0000 0001 0101", 16, 2},
+    {"0000 0001 1111", 17, 1}, {"0000 0001 1010", 18, 1}, {"0000 0001 1001", 19, 1},
+    {"0000 0001 0111", 20, 1}, {"0000 0001 0110", 21, 1}, {"0000 0000 1111 1", 22, 1},
+    {"0000 0000 1111 0", 23, 1}, {"0000 0000 1110 1", 24, 1}, {"0000 0000 1110 0", 25, 1},
+    {"0000 0000 1101 1", 26, 1}, {"0000 0000 0001 1111", 27, 1}, {"0000 0000 0001 1110", 28, 1},
+    {"0000 0000 0001 1101", 29, 1}, {"0000 0000 0001 1100", 30, 1}, {"0000 0000 0001 1011", 31, 1},
+    {"0110", DCT_EOB, 0}, {"0000 01", DCT_ESCAPE, 0},
+};
+
+/* Scan orders (scan position -> coefficient index) */
+const u8 zigzagScan[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+const u8 alternateScan[64] = {
+     0,  8, 16, 24,  1,  9,  2, 10, 17, 25, 32, 40, 48, 56, 57, 49,
+    41, 33, 26, 18,  3, 11,  4, 12, 19, 27, 34, 42, 50, 58, 35, 43,
+    51, 59, 20, 28,  5, 13,  6, 14, 21, 29, 36, 44, 52, 60, 37, 45,
+    53, 61, 22, 30,  7, 15, 23, 31, 38, 46, 54, 62, 39, 47, 55, 63,
+};
+
+/* Default intra quantiser matrix */
+const u8 defaultIntraMatrix[64] = {
+     8, 16, 19, 22, 26, 27, 29, 34,
+    16, 16, 22, 24, 27, 29, 34, 37,
+    19, 22, 26, 27, 29, 34, 34, 38,
+    22, 22, 26, 27, 29, 34, 37, 40,
+    22, 26, 27, 29, 32, 35, 40, 48,
+    26, 27, 29, 32, 35, 40, 48, 58,
+    26, 27, 29, 34, 38, 46, 56, 69,
+    27, 29, 35, 38, 46, 56, 69, 83,
+};
+
+/* Non-linear quantiser_scale */
+const u8 nonLinearQScale[32] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8, 10, 12, 14, 16, 18, 20, 22,
+    24, 28, 32, 36, 40, 44, 48, 52, 56, 64, 72, 80, 88, 96, 104, 112,
+};
+
+/* RGB16 dither matrix, rows are repeated to the width of a macroblock */
+alignas(32) const i16 ditherMatrix[4][16] = {
+    {-4,  0, -3,  1, -4,  0, -3,  1, -4,  0, -3,  1, -4,  0, -3,  1},
+    { 2, -2,  3, -1,  2, -2,  3, -1,  2, -2,  3, -1,  2, -2,  3, -1},
+    {-3,  1, -4,  0, -3,  1, -4,  0, -3,  1, -4,  0, -3,  1, -4,  0},
+    { 3, -1,  2, -2,  3, -1,  2, -2,  3, -1,  2, -2,  3, -1,  2, -2},
+};
+
+/* VLC lookup table entry */
+struct VLCEntry {
+    i16 value;
+    u8  length; // 0 = invalid code
+};
+
+/* DCT coefficient lookup table entry */
+struct DCTEntry {
+    u8 run; // DCT_EOB/DCT_ESCAPE for special codes
+    u8 level;
+    u8 length;
+};
+
+/* Single-level VLC lookup table, indexed with the next bits of the bit stream */
+template <int bits>
+struct VLCTable {
+    VLCEntry entries[1 << bits];
+};
+
+/* Restartable decoder state */
+struct Decoder {
+    u64 bitPos; // Bit position in the IN FIFO
+
+    i32 dcPred[3]; // DC predictors (Y, Cb, Cr)
+
+    u32 qsc; // quantiser_scale_code
+
+    u32 mbCount; // Macroblocks decoded by the current command
+};
+
+/* Decoded macroblock, RAW16 layout */
+struct Macroblock {
+    alignas(32) i16 y[16 * 16];
+    alignas(32) i16 cb[8 * 8];
+    alignas(32) i16 cr[8 * 8];
+};
+
+static_assert(sizeof(Macroblock) == (48 * sizeof(u128)));
+
+/* RAW8 macroblock (CSC input) */
+struct MacroblockRAW8 {
+    alignas(16) u8 y[16 * 16];
+    u8 cb[8 * 8];
+    u8 cr[8 * 8];
+};
+
+static_assert(sizeof(MacroblockRAW8) == (24 * sizeof(u128)));
+
+VLCTable<11> mbaLookup;
+VLCTable<6>  mbTypeLookup[4];
+VLCTable<9>  cbpLookup;
+VLCTable<10> motionCodeLookup;
+VLCTable<2>  dmvLookup;
+VLCTable<9>  dcSizeLookupLuma;
+VLCTable<10> dcSizeLookupChroma;
+
+/* DCT coefficient lookup tables, codes with six leading zeroes are in dctLongLookup */
+DCTEntry dctLookup[2][1 << 10], dctLongLookup[2][1 << 10];
+
+alignas(32) f32 idctMatrix[8][8];
+
+/* --- IPU state --- */
+
+CTRL ctrl;
+
+Decoder dec;
+
+u32 cmd, cmdData; // Current command, IPU_CMD data
+
+bool isBusy = false;
+
+bool isUnderflow, isError; // Set by the bit stream reader and VLC decoders
+
+std::vector<u8> inFIFO; // Bit stream data taken from inQueue
+
+/* Quantiser matrices */
+alignas(32) u16 intraMatrix[64], nonIntraMatrix[64];
+
+u16 vqclut[16];
+
+u16 th0, th1; // Alpha thresholds
+
+/* --- IPU queues --- */
+
+constexpr u64 IN_FIFO_SIZE   = 8; // In quadwords
+constexpr u64 RUN_AHEAD_SIZE = 1 << 12;
+
+constexpr u64 IN_QUEUE_SIZE  = 1 << 16; // In quadwords
+constexpr u64 OUT_QUEUE_SIZE = 1 << 14;
+
+constexpr u32 MAX_WRITE_SIZE = IN_QUEUE_SIZE / 2; // Largest IN FIFO write queued in one entry
+
+constexpr int SPIN_COUNT = 1024; // Empty polls before the IPU thread starts sleeping
+
+/* inQueue entry headers, IN FIFO data follows WriteFIFO headers */
+enum QueueCmd {
+    WriteCMD,
+    WriteCTRL,
+    WriteFIFO,
+    Resume, // Retries a command stalled by a full OUT FIFO
+};
+
+RingBuffer<u128, IN_QUEUE_SIZE > inQueue;  // EE -> IPU
+RingBuffer<u128, OUT_QUEUE_SIZE> outQueue; // IPU -> EE (OUT FIFO)
+
+u32 queueLeft = 0; // Quadwords left in the current WriteFIFO entry
+
+u64 inputCount = 0; // Quadwords moved to the IN FIFO (IPU thread)
+u64 writeCount = 0; // Quadwords written to the IN FIFO, including prefetched ones (EE thread)
+u64 prefetchQWC = 0; // Prefetched quadwords that the guest doesn't see in the IN FIFO yet (EE thread)
+
+std::atomic<u64> inputLimit = IN_FIFO_SIZE; // writeCount the IN FIFO has room for
+
+std::atomic<bool> isOutputStalled = false, isIRQPending = false;
+
+std::atomic<bool> isActive = false, isStopped = true;
+
+/* Returns the bits of a VLC code */
+u32 parseCode(const char *code, int &length) {
+    u32 bits = 0;
+
+    length = 0;
+
+    for (; *code; code++) {
+        if (*code == ' ') continue;
+
+        bits = (bits << 1) | (*code == '1');
+
+        length++;
+    }
+
+    return bits;
+}
+
+template <int bits, int size>
+void buildTable(VLCTable<bits> &table, const VLC (&vlcs)[size]) {
+    std::memset(table.entries, 0, sizeof(table.entries));
+
+    for (const auto &vlc : vlcs) {
+        int length;
+
+        const auto code = parseCode(vlc.code, length);
+
+        assert(length <= bits);
+
+        const auto shift = bits - length;
+
+        for (u32 i = 0; i < (1u << shift); i++) {
+            table.entries[(code << shift) | i] = VLCEntry{(i16)vlc.value, (u8)length};
+        }
+    }
+}
+
+/* Fills a 10-bit DCT lookup table with all codes that start with "skip" zeroes */
+template <int size>
+void buildDCTTable(DCTEntry *table, const DCTVLC (&vlcs)[size], int skip) {
+    std::memset(table, 0, (1 << 10) * sizeof(DCTEntry));
+
+    for (const auto &vlc : vlcs) {
+        int length;
+
+        const auto code = parseCode(vlc.code, length);
+
+        if ((length <= skip) || (skip && (code >> (length - skip)))) continue;
+
+        const auto rest = length - skip;
+
+        if (rest > 10) continue;
+
+        const auto shift = 10 - rest;
+
+        for (u32 i = 0; i < (1u << shift); i++) {
+            table[((code & ((1 << rest) - 1)) << shift) | i] = DCTEntry{vlc.run, vlc.level, (u8)length};
+        }
+    }
+}
+
+/* Clears the IN FIFO and the decoder state, the OUT FIFO is cleared by the EE thread */
+void reset() {
+    isBusy = false;
+
+    isOutputStalled = false;
+
+    inFIFO.clear();
+
+    dec = Decoder{};
+
+    ctrl.cbp = 0;
+    ctrl.ecd = ctrl.scd = false;
+}
+
+void init() {
+    buildTable(mbaLookup, mbaTable);
+    buildTable(mbTypeLookup[0], mbTypeTableI);
+    buildTable(mbTypeLookup[1], mbTypeTableP);
+    buildTable(mbTypeLookup[2], mbTypeTableB);
+    buildTable(mbTypeLookup[3], mbTypeTableD);
+    buildTable(cbpLookup, cbpTable);
+    buildTable(motionCodeLookup, motionCodeTable);
+    buildTable(dmvLookup, dmvTable);
+    buildTable(dcSizeLookupLuma, dcSizeTableLuma);
+    buildTable(dcSizeLookupChroma, dcSizeTableChroma);
+
+    buildDCTTable(dctLookup[0], dctTableZero, 0);
+    buildDCTTable(dctLookup[1], dctTableOne, 0);
+    buildDCTTable(dctLongLookup[0], dctTableZero, 6);
+    buildDCTTable(dctLongLookup[1], dctTableOne, 6);
+
+    /* T[u][x] = C(u) / 2 * cos((2x + 1) * u * pi / 16) */
+    for (int u = 0; u < 8; u++) {
+        for (int x = 0; x < 8; x++) {
+            const auto c = (u == 0) ? std::sqrt(0.5) : 1.0;
+
+            idctMatrix[u][x] = (f32)(0.5 * c * std::cos((2 * x + 1) * u * std::numbers::pi / 16.0));
+        }
+    }
+
+    for (int i = 0; i < 64; i++) {
+        intraMatrix[i] = defaultIntraMatrix[i];
+        nonIntraMatrix[i] = 16;
+    }
+
+    ctrl = CTRL{};
+
+    th0 = th1 = 0;
+
+    reset();
+}
+
+/* --- Bit stream reader --- */
+
+bool hasBits(u32 count) {
+    return (dec.bitPos + count) <= (8 * inFIFO.size());
+}
+
+/* Returns the next 32 bits, zero-padded past the end of the IN FIFO */
+u32 peekBits32() {
+    const auto idx = dec.bitPos >> 3;
+
+    u64 data;
+
+    if ((idx + 8) <= inFIFO.size()) {
+        std::memcpy(&data, &inFIFO[idx], sizeof(u64));
+
+        data = __builtin_bswap64(data);
+    } else {
+        data = 0;
+
+        for (u64 i = idx; i < (idx + 8); i++) {
+            data = (data << 8) | ((i < inFIFO.size()) ? inFIFO[i] : 0);
+        }
+    }
+
+    return (data << (dec.bitPos & 7)) >> 32;
+}
+
+u32 peekBits(int count) {
+    assert((count > 0) && (count <= 32));
+
+    return peekBits32() >> (32 - count);
+}
+
+void skipBits(int count) {
+    dec.bitPos += count;
+
+    if (!hasBits(0)) isUnderflow = true;
+}
+
+u32 getBits(int count) {
+    const auto data = peekBits(count);
+
+    skipBits(count);
+
+    return data;
+}
+
+/* Invalid codes read from the zero padding only mean that more data is needed */
+void vlcError() {
+    if (hasBits(32)) {
+        isError = true;
+    } else {
+        isUnderflow = true;
+    }
+}
+
+template <int bits>
+i32 decodeVLC(const VLCTable<bits> &table) {
+    const auto &entry = table.entries[peekBits(bits)];
+
+    if (!entry.length) {
+        vlcError();
+
+        return 0;
+    }
+
+    skipBits(entry.length);
+
+    return entry.value;
+}
+
+/* Removes fully consumed quadwords from the IN FIFO, only compacts it once they make up half of it */
+void commit() {
+    const auto qwc = std::min<u64>(dec.bitPos >> 7, inFIFO.size() >> 4);
+
+    if (!qwc || ((32 * qwc) < inFIFO.size())) return;
+
+    inFIFO.erase(inFIFO.begin(), inFIFO.begin() + 16 * qwc);
+
+    dec.bitPos -= 128 * qwc;
+}
+
+/* Reads raw data from the bit stream, returns false if the IN FIFO doesn't hold enough data */
+bool readBytes(void *data, u32 size) {
+    if (!hasBits(8 * size)) return false;
+
+    auto dst = (u8 *)data;
+
+    if (dec.bitPos & 7) {
+        for (u32 i = 0; i < size; i++) dst[i] = getBits(8);
+    } else {
+        std::memcpy(dst, &inFIFO[dec.bitPos >> 3], size);
+
+        dec.bitPos += 8 * size;
+    }
+
+    commit();
+
+    return true;
+}
+
+/* Returns the number of unread quadwords in the IN FIFO */
+u32 getInputQWC() {
+    const auto qwc = inFIFO.size() >> 4;
+    const auto pos = dec.bitPos >> 7;
+
+    return (pos < qwc) ? qwc - pos : 0;
+}
+
+/* Publishes how much data the EE may write to the IN FIFO (IPU thread) */
+void updateInputLimit() {
+    auto limit = inputCount - getInputQWC() + IN_FIFO_SIZE;
+
+    /* Commands that aren't stalled by the OUT FIFO need more data to finish the current macroblock */
+    if (isBusy && !isOutputStalled) limit = std::max(limit, inputCount + IN_FIFO_SIZE);
+
+    inputLimit.store(limit, std::memory_order_release);
+}
+
+/* Returns true if the OUT FIFO can take qwc quadwords, stalls the current command otherwise */
+bool hasOutputSpace(u32 qwc) {
+    if (outQueue.getSpace() >= qwc) return true;
+
+    isOutputStalled = true;
+
+    return false;
+}
+
+/* Sends decoded data to the OUT FIFO, commands check for space with hasOutputSpace() first */
+void pushOut(const void *data, int qwc) {
+    outQueue.push((const u128 *)data, qwc);
+}
+
+/* --- VLC decoders --- */
+
+/* Decodes macroblock_address_increment, including escapes and stuffing */
+i32 decodeMBA() {
+    i32 inc = 0;
+
+    while (true) {
+        const auto value = decodeVLC(mbaLookup);
+
+        if (isError || isUnderflow) return 0;
+
+        if (value == MBA_ESCAPE) {
+            inc += 33;
+        } else if (value != MBA_STUFFING) {
+            return inc + value;
+        }
+    }
+}
+
+i32 decodeMBType() {
+    if ((ctrl.pct < 1) || (ctrl.pct > 4)) {
+        std::printf("[IPU       ] Invalid picture type %u\n", ctrl.pct);
+
+        isError = true;
+
+        return 0;
+    }
+
+    return decodeVLC(mbTypeLookup[ctrl.pct - 1]);
+}
+
+i32 decodeMotionCode() {
+    const auto code = decodeVLC(motionCodeLookup);
+
+    if (!code) return 0;
+
+    return getBits(1) ? -code : code;
+}
+
+/* Decodes an intra DC coefficient (7.2.1) */
+i32 decodeDC(int comp) {
+    const auto size = comp ? decodeVLC(dcSizeLookupChroma) : decodeVLC(dcSizeLookupLuma);
+
+    if (size) {
+        i32 diff = getBits(size);
+
+        if (diff < (1 << (size - 1))) diff -= (1 << size) - 1;
+
+        dec.dcPred[comp] += diff;
+    }
+
+    return dec.dcPred[comp] << (3 - ctrl.idp);
+}
+
+/* Decodes the levels of a block (7.2.2) into natural order, returns true if any AC level was read */
+bool decodeCoefficients(i16 *levels, bool isIntra) {
+    const auto scan = ctrl.as ? alternateScan : zigzagScan;
+
+    const auto tbl = (isIntra && ctrl.ivf && !ctrl.mp1) ? 1 : 0;
+
+    int i = isIntra ? 1 : 0;
+
+    bool hasAC = false;
+
+    /* The first coefficient of a non-intra block uses a shorter code for level 1 */
+    if (!isIntra && peekBits(1)) {
+        skipBits(1);
+
+        levels[0] = getBits(1) ? -1 : 1;
+
+        i = 1;
+    }
+
+    while (true) {
+        const auto bits = peekBits(16);
+
+        const auto &entry = (bits >= (1 << 10)) ? dctLookup[tbl][bits >> 6] : dctLongLookup[tbl][bits & 0x3FF];
+
+        if (!entry.length) {
+            vlcError();
+
+            break;
+        }
+
+        skipBits(entry.length);
+
+        if (entry.run == DCT_EOB) break;
+
+        i32 run, level;
+
+        if (entry.run == DCT_ESCAPE) {
+            run = getBits(6);
+
+            if (ctrl.mp1) {
+                level = (i8)getBits(8);
+
+                if (level == -128) {
+                    level = (i32)getBits(8) - 256;
+                } else if (!level) {
+                    level = getBits(8);
+                }
+            } else {
+                level = ((i32)(getBits(12) << 20)) >> 20;
+            }
+        } else {
+            run = entry.run;
+
+            level = getBits(1) ? -entry.level : entry.level;
+        }
+
+        i += run;
+
+        if (i > 63) {
+            vlcError();
+
+            break;
+        }
+
+        const auto idx = scan[i++];
+
+        levels[idx] = level;
+
+        hasAC |= idx != 0;
+    }
+
+    return hasAC;
+}
+
+/* --- Inverse quantisation and IDCT --- */
+
+u32 getQuantiserScale() {
+    return ctrl.qst ? nonLinearQScale[dec.qsc] : 2 * dec.qsc;
+}
+
+/*
+ * Inverse quantisation (7.4.2), MPEG-1 streams are handled by the same formula.
+ * Returns the XOR of all coefficients for mismatch control
+ */
+u16 dequantize(i16 *block, const u16 *w, u32 qs, bool isIntra) {
+    const auto isMPEG1 = ctrl.mp1;
+
+#if defined(__AVX2__)
+    const auto qsVec = _mm256_set1_epi16(qs);
+    const auto k     = _mm256_set1_epi16(!isIntra);
+    const auto one   = _mm256_set1_epi16(1);
+    const auto zero  = _mm256_setzero_si256();
+
+    auto parity = zero;
+
+    for (int i = 0; i < 64; i += 16) {
+        const auto level = _mm256_load_si256((__m256i *)&block[i]);
+        const auto sign  = _mm256_srai_epi16(level, 15);
+
+        /* (2 * |QF| + k) * W * qs, products are 32-bit */
+        const auto num = _mm256_add_epi16(_mm256_slli_epi16(_mm256_abs_epi16(level), 1), _mm256_andnot_si256(_mm256_cmpeq_epi16(level, zero), k));
+        const auto wq  = _mm256_mullo_epi16(_mm256_load_si256((__m256i *)&w[i]), qsVec);
+
+        const auto lo = _mm256_mullo_epi16(num, wq);
+        const auto hi = _mm256_mulhi_epu16(num, wq);
+
+        auto val = _mm256_packs_epi32(_mm256_srli_epi32(_mm256_unpacklo_epi16(lo, hi), 5), _mm256_srli_epi32(_mm256_unpackhi_epi16(lo, hi), 5));
+
+        /* MPEG-1 oddification */
+        if (isMPEG1) val = _mm256_andnot_si256(_mm256_cmpeq_epi16(val, zero), _mm256_or_si256(_mm256_sub_epi16(val, one), one));
+
+        /* Saturate to [-2048, 2047] */
+        val = _mm256_min_epi16(val, _mm256_sub_epi16(_mm256_set1_epi16(2047), sign));
+        val = _mm256_sub_epi16(_mm256_xor_si256(val, sign), sign);
+
+        _mm256_store_si256((__m256i *)&block[i], val);
+
+        parity = _mm256_xor_si256(parity, val);
+    }
+
+    auto p = _mm_xor_si128(_mm256_castsi256_si128(parity), _mm256_extracti128_si256(parity, 1));
+#elif defined(__SSE2__)
+    const auto qsVec = _mm_set1_epi16(qs);
+    const auto k     = _mm_set1_epi16(!isIntra);
+    const auto one   = _mm_set1_epi16(1);
+    const auto zero  = _mm_setzero_si128();
+
+    auto p = zero;
+
+    for (int i = 0; i < 64; i += 8) {
+        const auto level = _mm_load_si128((__m128i *)&block[i]);
+        const auto sign  = _mm_srai_epi16(level, 15);
+
+        const auto num = _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_xor_si128(level, sign), sign), 1), _mm_andnot_si128(_mm_cmpeq_epi16(level, zero), k));
+        const auto wq  = _mm_mullo_epi16(_mm_load_si128((__m128i *)&w[i]), qsVec);
+
+        const auto lo = _mm_mullo_epi16(num, wq);
+        const auto hi = _mm_mulhi_epu16(num, wq);
+
+        auto val = _mm_packs_epi32(_mm_srli_epi32(_mm_unpacklo_epi16(lo, hi), 5), _mm_srli_epi32(_mm_unpackhi_epi16(lo, hi), 5));
+
+        if (isMPEG1) val = _mm_andnot_si128(_mm_cmpeq_epi16(val, zero), _mm_or_si128(_mm_sub_epi16(val, one), one));
+
+        val = _mm_min_epi16(val, _mm_sub_epi16(_mm_set1_epi16(2047), sign));
+        val = _mm_sub_epi16(_mm_xor_si128(val, sign), sign);
+
+        _mm_store_si128((__m128i *)&block[i], val);
+
+        p = _mm_xor_si128(p, val);
+    }
+#endif
+
+#ifdef __SSE2__
+    p = _mm_xor_si128(p, _mm_srli_si128(p, 8));
+    p = _mm_xor_si128(p, _mm_srli_si128(p, 4));
+    p = _mm_xor_si128(p, _mm_srli_si128(p, 2));
+
+    return _mm_cvtsi128_si32(p);
+#else
+    u16 parity = 0;
+
+    for (int i = 0; i < 64; i++) {
+        const i32 level = block[i];
+
+        if (!level) continue;
+
+        i32 val = ((2 * std::abs(level) + !isIntra) * w[i] * qs) >> 5;
+
+        if (isMPEG1 && val) val = (val - 1) | 1;
+
+        val = (level < 0) ? -std::min(val, 2048) : std::min(val, 2047);
+
+        block[i] = val;
+
+        parity ^= val;
+    }
+
+    return parity;
+#endif
+}
+
+/* Separable 8x8 IDCT, the result is clamped to [min, max] and written to dst */
+void idct(const i16 *block, i16 *dst, int stride, i16 min, i16 max, bool isDCOnly) {
+    if (isDCOnly) {
+        /* Same operations as the full transform with a single non-zero coefficient */
+        const auto val = (i16)std::clamp<long>(std::lrintf(idctMatrix[0][0] * ((f32)block[0] * idctMatrix[0][0])), min, max);
+
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) dst[y * stride + x] = val;
+        }
+
+        return;
+    }
+
+    alignas(32) f32 coeffs[64];
+
+#if defined(__AVX2__)
+    __m256 t[8], tmp[8];
+
+    for (int i = 0; i < 8; i++) {
+        t[i] = _mm256_load_ps(idctMatrix[i]);
+
+        _mm256_store_ps(&coeffs[8 * i], _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *)&block[8 * i]))));
+    }
+
+    /* Rows */
+    for (int r = 0; r < 8; r++) {
+        auto acc = _mm256_mul_ps(_mm256_set1_ps(coeffs[8 * r]), t[0]);
+
+        for (int u = 1; u < 8; u++) acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(coeffs[8 * r + u]), t[u]));
+
+        tmp[r] = acc;
+    }
+
+    /* Columns */
+    const auto vMin = _mm_set1_epi16(min), vMax = _mm_set1_epi16(max);
+
+    for (int y = 0; y < 8; y++) {
+        auto acc = _mm256_mul_ps(_mm256_set1_ps(idctMatrix[0][y]), tmp[0]);
+
+        for (int v = 1; v < 8; v++) acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(idctMatrix[v][y]), tmp[v]));
+
+        const auto res = _mm256_cvtps_epi32(acc);
+
+        const auto row = _mm_packs_epi32(_mm256_castsi256_si128(res), _mm256_extracti128_si256(res, 1));
+
+        _mm_storeu_si128((__m128i *)&dst[y * stride], _mm_max_epi16(_mm_min_epi16(row, vMax), vMin));
+    }
+#elif defined(__SSE2__)
+    __m128 tLo[8], tHi[8], tmpLo[8], tmpHi[8];
+
+    for (int i = 0; i < 8; i++) {
+        tLo[i] = _mm_load_ps(&idctMatrix[i][0]);
+        tHi[i] = _mm_load_ps(&idctMatrix[i][4]);
+
+        const auto row  = _mm_loadu_si128((__m128i *)&block[8 * i]);
+        const auto sign = _mm_srai_epi16(row, 15);
+
+        _mm_store_ps(&coeffs[8 * i + 0], _mm_cvtepi32_ps(_mm_unpacklo_epi16(row, sign)));
+        _mm_store_ps(&coeffs[8 * i + 4], _mm_cvtepi32_ps(_mm_unpackhi_epi16(row, sign)));
+    }
+
+    for (int r = 0; r < 8; r++) {
+        auto c = _mm_set1_ps(coeffs[8 * r]);
+
+        auto accLo = _mm_mul_ps(c, tLo[0]);
+        auto accHi = _mm_mul_ps(c, tHi[0]);
+
+        for (int u = 1; u < 8; u++) {
+            c = _mm_set1_ps(coeffs[8 * r + u]);
+
+            accLo = _mm_add_ps(accLo, _mm_mul_ps(c, tLo[u]));
+            accHi = _mm_add_ps(accHi, _mm_mul_ps(c, tHi[u]));
+        }
+
+        tmpLo[r] = accLo;
+        tmpHi[r] = accHi;
+    }
+
+    const auto vMin = _mm_set1_epi16(min), vMax = _mm_set1_epi16(max);
+
+    for (int y = 0; y < 8; y++) {
+        auto c = _mm_set1_ps(idctMatrix[0][y]);
+
+        auto accLo = _mm_mul_ps(c, tmpLo[0]);
+        auto accHi = _mm_mul_ps(c, tmpHi[0]);
+
+        for (int v = 1; v < 8; v++) {
+            c = _mm_set1_ps(idctMatrix[v][y]);
+
+            accLo = _mm_add_ps(accLo, _mm_mul_ps(c, tmpLo[v]));
+            accHi = _mm_add_ps(accHi, _mm_mul_ps(c, tmpHi[v]));
+        }
+
+        const auto row = _mm_packs_epi32(_mm_cvtps_epi32(accLo), _mm_cvtps_epi32(accHi));
+
+        _mm_storeu_si128((__m128i *)&dst[y * stride], _mm_max_epi16(_mm_min_epi16(row, vMax), vMin));
+    }
+#else
+    f32 tmp[64];
+
+    for (int i = 0; i < 64; i++) coeffs[i] = block[i];
+
+    for (int r = 0; r < 8; r++) {
+        for (int x = 0; x < 8; x++) {
+            auto acc = coeffs[8 * r] * idctMatrix[0][x];
+
+            for (int u = 1; u < 8; u++) acc += coeffs[8 * r + u] * idctMatrix[u][x];
+
+            tmp[8 * r + x] = acc;
+        }
+    }
+
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            auto acc = idctMatrix[0][y] * tmp[x];
+
+            for (int v = 1; v < 8; v++) acc += idctMatrix[v][y] * tmp[8 * v + x];
+
+            dst[y * stride + x] = std::clamp<long>(std::lrintf(acc), min, max);
+        }
+    }
+#endif
+}
+
+/* Decodes the blocks of a macroblock, CBP bit 5 is Y0 */
+void decodeBlocks(Macroblock &mb, u32 cbp, bool isIntra, bool isFieldDCT) {
+    const auto w  = isIntra ? intraMatrix : nonIntraMatrix;
+    const auto qs = getQuantiserScale();
+
+    const i16 min = isIntra ? 0 : -256;
+
+    for (int i = 0; i < 6; i++) {
+        i16 *dst;
+
+        int stride = 8;
+
+        if (i < 4) {
+            /* Field DCT interleaves the lines of the top and bottom luma blocks */
+            if (isFieldDCT) {
+                dst = &mb.y[16 * (i >> 1) + 8 * (i & 1)];
+
+                stride = 32;
+            } else {
+                dst = &mb.y[128 * (i >> 1) + 8 * (i & 1)];
+
+                stride = 16;
+            }
+        } else {
+            dst = (i == 4) ? mb.cb : mb.cr;
+        }
+
+        if (!(cbp & (0x20 >> i))) {
+            for (int y = 0; y < 8; y++) std::memset(&dst[y * stride], 0, 8 * sizeof(i16));
+
+            continue;
+        }
+
+        alignas(32) i16 block[64] = {};
+
+        i32 dc = 0;
+
+        if (isIntra) dc = decodeDC((i < 4) ? 0 : i - 3);
+
+        const auto hasAC = decodeCoefficients(block, isIntra);
+
+        if (isError || isUnderflow) return;
+
+        auto parity = dequantize(block, w, qs, isIntra);
+
+        if (isIntra) {
+            block[0] = dc;
+
+            parity ^= dc;
+        }
+
+        /* Mismatch control (MPEG-2) */
+        if (!ctrl.mp1 && !(parity & 1)) block[63] ^= 1;
+
+        idct(block, dst, stride, min, 255, !hasAC && !block[63]);
+    }
+}
+
+void resetDC() {
+    for (auto &pred : dec.dcPred) pred = 128 << ctrl.idp;
+}
+
+/* --- Color space conversion --- */
+
+/*
+ * YCbCr -> RGB uses 7-bit fractions of the BT.601 coefficients:
+ * R = (149 * (Y - 16) + 204 * Cr + 64) >> 7
+ * G = (149 * (Y - 16) -  50 * Cb - 104 * Cr + 64) >> 7
+ * B = (149 * (Y - 16) + 258 * Cb + 64) >> 7
+ * with Cb/Cr centered on 0, all kernels convert one macroblock per call.
+ */
+
+/* Converts a decoded macroblock to RAW8 */
+void toRAW8(const Macroblock &mb, MacroblockRAW8 &raw) {
+    const auto src = (const i16 *)&mb;
+    const auto dst = (u8 *)&raw;
+
+#ifdef __SSE2__
+    for (int i = 0; i < 384; i += 16) {
+        const auto lo = _mm_load_si128((__m128i *)&src[i + 0]);
+        const auto hi = _mm_load_si128((__m128i *)&src[i + 8]);
+
+        _mm_store_si128((__m128i *)&dst[i], _mm_packus_epi16(lo, hi));
+    }
+#else
+    for (int i = 0; i < 384; i++) dst[i] = std::clamp<i16>(src[i], 0, 255);
+#endif
+}
+
+/* Converts a RAW8 macroblock to RGB32, applies the alpha thresholds */
+void convertRGB32(const MacroblockRAW8 &mb, u32 *out, bool isSigned) {
+#if defined(__AVX2__)
+    const auto coeffR = _mm256_set1_epi32((204 << 16) | 149);
+    const auto coeffG = _mm256_set1_epi32((  1 << 16) | 149);
+    const auto coeffB = _mm256_set1_epi32((258 << 16) | 149);
+
+    const auto round  = _mm256_set1_epi32(64);
+    const auto vTH0   = _mm256_set1_epi16(th0);
+    const auto vTH1   = _mm256_set1_epi16(th1);
+    const auto v16    = _mm256_set1_epi16(16);
+    const auto v128   = _mm256_set1_epi16(128);
+    const auto v255   = _mm256_set1_epi16(255);
+    const auto alpha  = _mm256_set1_epi16(0x40);
+    const auto sign   = _mm256_set1_epi16(isSigned ? 0x80 : 0);
+    const auto zero   = _mm256_setzero_si256();
+
+    for (int y = 0; y < 16; y++) {
+        const auto luma = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_load_si128((__m128i *)&mb.y[16 * y])), v16);
+
+        /* Chroma samples cover two pixels */
+        const auto cbRow = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i *)&mb.cb[8 * (y >> 1)]));
+        const auto crRow = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i *)&mb.cr[8 * (y >> 1)]));
+
+        const auto cb = _mm256_sub_epi16(_mm256_set_m128i(_mm_unpackhi_epi16(cbRow, cbRow), _mm_unpacklo_epi16(cbRow, cbRow)), v128);
+        const auto cr = _mm256_sub_epi16(_mm256_set_m128i(_mm_unpackhi_epi16(crRow, crRow), _mm_unpacklo_epi16(crRow, crRow)), v128);
+
+        const auto cg = _mm256_add_epi16(_mm256_mullo_epi16(cb, _mm256_set1_epi16(-50)), _mm256_mullo_epi16(cr, _mm256_set1_epi16(-104)));
+
+        /* 149 * luma + coefficient * chroma, products are 32-bit */
+        const auto madd = [&](__m256i c, __m256i coeff) {
+            const auto lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(luma, c), coeff), round), 7);
+            const auto hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(luma, c), coeff), round), 7);
+
+            return _mm256_max_epi16(_mm256_min_epi16(_mm256_packs_epi32(lo, hi), v255), zero);
+        };
+
+        auto r = madd(cr, coeffR);
+        auto g = madd(cg, coeffG);
+        auto b = madd(cb, coeffB);
+
+        const auto isTransparent = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi16(vTH0, r), _mm256_cmpgt_epi16(vTH0, g)), _mm256_cmpgt_epi16(vTH0, b));
+        const auto isSemi = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi16(vTH1, r), _mm256_cmpgt_epi16(vTH1, g)), _mm256_cmpgt_epi16(vTH1, b));
+
+        auto a = _mm256_andnot_si256(isTransparent, _mm256_sub_epi16(v128, _mm256_and_si256(isSemi, alpha)));
+
+        r = _mm256_xor_si256(_mm256_andnot_si256(isTransparent, r), sign);
+        g = _mm256_xor_si256(_mm256_andnot_si256(isTransparent, g), sign);
+        b = _mm256_xor_si256(_mm256_andnot_si256(isTransparent, b), sign);
+
+        const auto rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        const auto ba = _mm256_or_si256(b, _mm256_slli_epi16(a, 8));
+
+        /* Unpacking works on 128-bit lanes */
+        const auto lo = _mm256_unpacklo_epi16(rg, ba);
+        const auto hi = _mm256_unpackhi_epi16(rg, ba);
+
+        _mm256_store_si256((__m256i *)&out[16 * y + 0], _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_store_si256((__m256i *)&out[16 * y + 8], _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+#elif defined(__SSE2__)
+    const auto coeffR = _mm_set1_epi32((204 << 16) | 149);
+    const auto coeffG = _mm_set1_epi32((  1 << 16) | 149);
+    const auto coeffB = _mm_set1_epi32((258 << 16) | 149);
+
+    const auto round  = _mm_set1_epi32(64);
+    const auto vTH0   = _mm_set1_epi16(th0);
+    const auto vTH1   = _mm_set1_epi16(th1);
+    const auto v16    = _mm_set1_epi16(16);
+    const auto v128   = _mm_set1_epi16(128);
+    const auto v255   = _mm_set1_epi16(255);
+    const auto alpha  = _mm_set1_epi16(0x40);
+    const auto sign   = _mm_set1_epi16(isSigned ? 0x80 : 0);
+    const auto zero   = _mm_setzero_si128();
+
+    for (int y = 0; y < 16; y++) {
+        const auto yRow  = _mm_load_si128((__m128i *)&mb.y[16 * y]);
+        const auto cbRow = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)&mb.cb[8 * (y >> 1)]), zero), v128);
+        const auto crRow = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)&mb.cr[8 * (y >> 1)]), zero), v128);
+
+        /* Two groups of 8 pixels */
+        for (int i = 0; i < 2; i++) {
+            const auto luma = _mm_sub_epi16(i ? _mm_unpackhi_epi8(yRow, zero) : _mm_unpacklo_epi8(yRow, zero), v16);
+
+            const auto cb = i ? _mm_unpackhi_epi16(cbRow, cbRow) : _mm_unpacklo_epi16(cbRow, cbRow);
+            const auto cr = i ? _mm_unpackhi_epi16(crRow, crRow) : _mm_unpacklo_epi16(crRow, crRow);
+
+            const auto cg = _mm_add_epi16(_mm_mullo_epi16(cb, _mm_set1_epi16(-50)), _mm_mullo_epi16(cr, _mm_set1_epi16(-104)));
+
+            const auto madd = [&](__m128i c, __m128i coeff) {
+                const auto lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(luma, c), coeff), round), 7);
+                const auto hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(luma, c), coeff), round), 7);
+
+                return _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(lo, hi), v255), zero);
+            };
+
+            auto r = madd(cr, coeffR);
+            auto g = madd(cg, coeffG);
+            auto b = madd(cb, coeffB);
+
+            const auto isTransparent = _mm_and_si128(_mm_and_si128(_mm_cmplt_epi16(r, vTH0), _mm_cmplt_epi16(g, vTH0)), _mm_cmplt_epi16(b, vTH0));
+            const auto isSemi = _mm_and_si128(_mm_and_si128(_mm_cmplt_epi16(r, vTH1), _mm_cmplt_epi16(g, vTH1)), _mm_cmplt_epi16(b, vTH1));
+
+            auto a = _mm_andnot_si128(isTransparent, _mm_sub_epi16(v128, _mm_and_si128(isSemi, alpha)));
+
+            r = _mm_xor_si128(_mm_andnot_si128(isTransparent, r), sign);
+            g = _mm_xor_si128(_mm_andnot_si128(isTransparent, g), sign);
+            b = _mm_xor_si128(_mm_andnot_si128(isTransparent, b), sign);
+
+            const auto rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+            const auto ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+
+            _mm_store_si128((__m128i *)&out[16 * y + 8 * i + 0], _mm_unpacklo_epi16(rg, ba));
+            _mm_store_si128((__m128i *)&out[16 * y + 8 * i + 4], _mm_unpackhi_epi16(rg, ba));
+        }
+    }
+#else
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 16; x++) {
+            const i32 luma = 149 * (mb.y[16 * y + x] - 16);
+
+            const i32 cb = mb.cb[8 * (y >> 1) + (x >> 1)] - 128;
+            const i32 cr = mb.cr[8 * (y >> 1) + (x >> 1)] - 128;
+
+            i32 r = std::clamp((luma + 204 * cr + 64) >> 7, 0, 255);
+            i32 g = std::clamp((luma - 50 * cb - 104 * cr + 64) >> 7, 0, 255);
+            i32 b = std::clamp((luma + 258 * cb + 64) >> 7, 0, 255);
+            i32 a = 0x80;
+
+            if ((r < th0) && (g < th0) && (b < th0)) {
+                r = g = b = a = 0;
+            } else if ((r < th1) && (g < th1) && (b < th1)) {
+                a = 0x40;
+            }
+
+            if (isSigned) {
+                r ^= 0x80;
+                g ^= 0x80;
+                b ^= 0x80;
+            }
+
+            out[16 * y + x] = r | (g << 8) | (b << 16) | (a << 24);
+        }
+    }
+#endif
+}
+
+/* Converts an RGB32 macroblock to RGB16, A is set for semi-transparent pixels */
+void convertRGB16(const u32 *in, u16 *out, bool isDithered) {
+#if defined(__AVX2__)
+    const auto mask = _mm256_set1_epi32(0xFF);
+    const auto v255 = _mm256_set1_epi16(255);
+    const auto zero = _mm256_setzero_si256();
+
+    for (int y = 0; y < 16; y++) {
+        const auto p0 = _mm256_load_si256((__m256i *)&in[16 * y + 0]);
+        const auto p1 = _mm256_load_si256((__m256i *)&in[16 * y + 8]);
+
+        /* Packing works on 128-bit lanes */
+        const auto unpack = [&](int shift) {
+            const auto c0 = _mm256_and_si256(_mm256_srli_epi32(p0, shift), mask);
+            const auto c1 = _mm256_and_si256(_mm256_srli_epi32(p1, shift), mask);
+
+            return _mm256_permute4x64_epi64(_mm256_packs_epi32(c0, c1), 0xD8);
+        };
+
+        auto r = unpack(0);
+        auto g = unpack(8);
+        auto b = unpack(16);
+
+        const auto a = _mm256_cmpeq_epi16(unpack(24), _mm256_set1_epi16(0x40));
+
+        if (isDithered) {
+            const auto d = _mm256_load_si256((__m256i *)ditherMatrix[y & 3]);
+
+            r = _mm256_max_epi16(_mm256_min_epi16(_mm256_add_epi16(r, d), v255), zero);
+            g = _mm256_max_epi16(_mm256_min_epi16(_mm256_add_epi16(g, d), v255), zero);
+            b = _mm256_max_epi16(_mm256_min_epi16(_mm256_add_epi16(b, d), v255), zero);
+        }
+
+        auto res = _mm256_srli_epi16(r, 3);
+
+        res = _mm256_or_si256(res, _mm256_slli_epi16(_mm256_srli_epi16(g, 3),  5));
+        res = _mm256_or_si256(res, _mm256_slli_epi16(_mm256_srli_epi16(b, 3), 10));
+        res = _mm256_or_si256(res, _mm256_slli_epi16(a, 15));
+
+        _mm256_store_si256((__m256i *)&out[16 * y], res);
+    }
+#elif defined(__SSE2__)
+    const auto mask = _mm_set1_epi32(0xFF);
+    const auto v255 = _mm_set1_epi16(255);
+    const auto zero = _mm_setzero_si128();
+
+    for (int i = 0; i < 256; i += 8) {
+        const auto p0 = _mm_load_si128((__m128i *)&in[i + 0]);
+        const auto p1 = _mm_load_si128((__m128i *)&in[i + 4]);
+
+        const auto unpack = [&](int shift) {
+            const auto c0 = _mm_and_si128(_mm_srli_epi32(p0, shift), mask);
+            const auto c1 = _mm_and_si128(_mm_srli_epi32(p1, shift), mask);
+
+            return _mm_packs_epi32(c0, c1);
+        };
+
+        auto r = unpack(0);
+        auto g = unpack(8);
+        auto b = unpack(16);
+
+        const auto a = _mm_cmpeq_epi16(unpack(24), _mm_set1_epi16(0x40));
+
+        if (isDithered) {
+            const auto d = _mm_load_si128((__m128i *)&ditherMatrix[(i >> 4) & 3][i & 8]);
+
+            r = _mm_max_epi16(_mm_min_epi16(_mm_add_epi16(r, d), v255), zero);
+            g = _mm_max_epi16(_mm_min_epi16(_mm_add_epi16(g, d), v255), zero);
+            b = _mm_max_epi16(_mm_min_epi16(_mm_add_epi16(b, d), v255), zero);
+        }
+
+        auto res = _mm_srli_epi16(r, 3);
+
+        res = _mm_or_si128(res, _mm_slli_epi16(_mm_srli_epi16(g, 3),  5));
+        res = _mm_or_si128(res, _mm_slli_epi16(_mm_srli_epi16(b, 3), 10));
+        res = _mm_or_si128(res, _mm_slli_epi16(a, 15));
+
+        _mm_store_si128((__m128i *)&out[i], res);
+    }
+#else
+    for (int i = 0; i < 256; i++) {
+        i32 r = (in[i] >>  0) & 0xFF;
+        i32 g = (in[i] >>  8) & 0xFF;
+        i32 b = (in[i] >> 16) & 0xFF;
+
+        const auto a = (in[i] >> 24) == 0x40;
+
+        if (isDithered) {
+            const auto d = ditherMatrix[(i >> 4) & 3][i & 15];
+
+            r = std::clamp(r + d, 0, 255);
+            g = std::clamp(g + d, 0, 255);
+            b = std::clamp(b + d, 0, 255);
+        }
+
+        out[i] = (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10) | (a << 15);
+    }
+#endif
+}
+
+/* Converts an RGB16 macroblock to INDX4, each pixel gets the closest VQ CLUT color */
+void convertINDX4(const u16 *in, u8 *out) {
+    alignas(16) i16 idx[256];
+
+#ifdef __SSE2__
+    const auto mask = _mm_set1_epi16(0x1F);
+
+    for (int i = 0; i < 256; i += 8) {
+        const auto p = _mm_load_si128((__m128i *)&in[i]);
+
+        const auto r = _mm_and_si128(p, mask);
+        const auto g = _mm_and_si128(_mm_srli_epi16(p,  5), mask);
+        const auto b = _mm_and_si128(_mm_srli_epi16(p, 10), mask);
+
+        auto minDist = _mm_set1_epi16(0x7FFF);
+        auto minIdx  = _mm_setzero_si128();
+
+        /* Distances fit in 16 bits, ties go to the lower index */
+        for (int j = 0; j < 16; j++) {
+            const auto dr = _mm_sub_epi16(r, _mm_set1_epi16((vqclut[j] >>  0) & 0x1F));
+            const auto dg = _mm_sub_epi16(g, _mm_set1_epi16((vqclut[j] >>  5) & 0x1F));
+            const auto db = _mm_sub_epi16(b, _mm_set1_epi16((vqclut[j] >> 10) & 0x1F));
+
+            const auto dist = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dr, dr), _mm_mullo_epi16(dg, dg)), _mm_mullo_epi16(db, db));
+
+            const auto isCloser = _mm_cmplt_epi16(dist, minDist);
+
+            minDist = _mm_or_si128(_mm_and_si128(isCloser, dist), _mm_andnot_si128(isCloser, minDist));
+            minIdx  = _mm_or_si128(_mm_and_si128(isCloser, _mm_set1_epi16(j)), _mm_andnot_si128(isCloser, minIdx));
+        }
+
+        _mm_store_si128((__m128i *)&idx[i], minIdx);
+    }
+#else
+    for (int i = 0; i < 256; i++) {
+        const i32 r = (in[i] >>  0) & 0x1F;
+        const i32 g = (in[i] >>  5) & 0x1F;
+        const i32 b = (in[i] >> 10) & 0x1F;
+
+        i32 minDist = 0x7FFF;
+
+        for (int j = 0; j < 16; j++) {
+            const auto dr = r - ((vqclut[j] >>  0) & 0x1F);
+            const auto dg = g - ((vqclut[j] >>  5) & 0x1F);
+            const auto db = b - ((vqclut[j] >> 10) & 0x1F);
+
+            const auto dist = dr * dr + dg * dg + db * db;
+
+            if (dist < minDist) {
+                minDist = dist;
+
+                idx[i] = j;
+            }
+        }
+    }
+#endif
+
+    for (int i = 0; i < 128; i++) out[i] = idx[2 * i] | (idx[2 * i + 1] << 4);
+}
+
+/* --- IPU commands --- */
+
+/* Converts a RAW8 macroblock and sends it to the OUT FIFO */
+void convertMacroblock(const MacroblockRAW8 &mb, bool isSigned, bool isDithered, bool isRGB16) {
+    alignas(32) u32 rgb32[256];
+
+    convertRGB32(mb, rgb32, isSigned);
+
+    if (isRGB16) {
+        alignas(32) u16 rgb16[256];
+
+        convertRGB16(rgb32, rgb16, isDithered);
+
+        pushOut(rgb16, 32);
+    } else {
+        pushOut(rgb32, 64);
+    }
+}
+
+/* Decodes a slice of intra macroblocks, returns true when the command has finished */
+bool doIDEC() {
+    const auto isFieldDCTCoded = cmd & (1 << 24);
+    const auto isSigned   = cmd & (1 << 25);
+    const auto isDithered = cmd & (1 << 26);
+    const auto isRGB16    = cmd & (1 << 27);
+
+    while (true) {
+        if (!hasOutputSpace(isRGB16 ? 32 : 64)) return false;
+
+        const auto saved = dec;
+
+        isUnderflow = isError = false;
+
+        if (dec.mbCount) {
+            /* The slice ends at the next start code */
+            if (!hasBits(23)) return false;
+
+            if (!peekBits(23)) {
+                ctrl.scd = true;
+
+                return true;
+            }
+
+            const auto inc = decodeMBA();
 
-/* --- IPU registers --- */
+            if (isUnderflow) {
+                dec = saved;
 
-enum class IPUReg {
-    CMD  = 0x10002000,
-    CTRL = 0x10002010,
-};
+                return false;
+            }
+
+            if (isError || (inc != 1)) {
+                std::printf("[IPU       ] IDEC: Invalid macroblock address increment %d\n", inc);
+
+                ctrl.ecd = true;
+
+                return true;
+            }
+        }
+
+        const auto type = decodeVLC(mbTypeLookup[0]);
+
+        bool isFieldDCT = false;
+
+        if (isFieldDCTCoded) isFieldDCT = getBits(1);
+
+        if (type & MB_QUANT) dec.qsc = getBits(5);
+
+        Macroblock mb;
+
+        decodeBlocks(mb, 0x3F, true, isFieldDCT);
+
+        if (isUnderflow) {
+            dec = saved;
+
+            return false;
+        }
+
+        if (isError) {
+            std::printf("[IPU       ] IDEC: Bit stream error\n");
+
+            ctrl.ecd = true;
+
+            return true;
+        }
+
+        MacroblockRAW8 raw;
+
+        toRAW8(mb, raw);
+
+        convertMacroblock(raw, isSigned, isDithered, isRGB16);
+
+        dec.mbCount++;
+
+        commit();
+    }
+}
+
+/* Decodes a single macroblock to RAW16 */
+bool doBDEC() {
+    if (!hasOutputSpace(48)) return false;
+
+    const auto saved = dec;
+
+    isUnderflow = isError = false;
+
+    const bool isIntra = cmd & (1 << 27);
+
+    const auto cbp = isIntra ? 0x3F : decodeVLC(cbpLookup);
+
+    Macroblock mb;
+
+    decodeBlocks(mb, cbp, isIntra, cmd & (1 << 25));
+
+    if (isUnderflow) {
+        dec = saved;
+
+        return false;
+    }
+
+    if (isError) {
+        std::printf("[IPU       ] BDEC: Bit stream error\n");
+
+        ctrl.ecd = true;
+
+        return true;
+    }
+
+    ctrl.cbp = cbp;
+
+    pushOut(&mb, 48);
+
+    commit();
+
+    return true;
+}
+
+/* Decodes a single VLC, IPU_CMD returns the decoded value and the code length */
+bool doVDEC() {
+    const auto saved = dec;
+
+    isUnderflow = isError = false;
+
+    i32 value = 0;
+
+    switch ((cmd >> 26) & 3) {
+        case 0: value = decodeMBA(); break;
+        case 1: value = decodeMBType(); break;
+        case 2: value = decodeMotionCode(); break;
+        case 3: value = decodeVLC(dmvLookup); break;
+    }
+
+    if (isUnderflow) {
+        dec = saved;
+
+        return false;
+    }
+
+    if (isError) ctrl.ecd = true;
+
+    cmdData = (value & 0xFFFF) | ((dec.bitPos - saved.bitPos) << 16);
+
+    commit();
+
+    return true;
+}
+
+/* Returns the next 32 bits in IPU_CMD */
+bool doFDEC() {
+    if (!hasBits(32)) return false;
+
+    cmdData = peekBits(32);
+
+    commit();
+
+    return true;
+}
+
+/* Loads a quantiser matrix (in zigzag order) */
+bool doSETIQ() {
+    u8 data[64];
+
+    if (!readBytes(data, sizeof(data))) return false;
+
+    auto matrix = (cmd & (1 << 27)) ? nonIntraMatrix : intraMatrix;
+
+    for (int i = 0; i < 64; i++) matrix[zigzagScan[i]] = data[i];
+
+    return true;
+}
+
+/* Loads the VQ CLUT */
+bool doSETVQ() {
+    return readBytes(vqclut, sizeof(vqclut));
+}
+
+/* Converts RAW8 macroblocks to RGB32/RGB16 */
+bool doCSC() {
+    const auto mbc = cmd & 0x7FF;
+
+    while (dec.mbCount < mbc) {
+        if (!hasOutputSpace((cmd & (1 << 27)) ? 32 : 64)) return false;
+
+        MacroblockRAW8 mb;
+
+        if (!readBytes(&mb, sizeof(mb))) return false;
+
+        convertMacroblock(mb, false, cmd & (1 << 26), cmd & (1 << 27));
+
+        dec.mbCount++;
+    }
+
+    return true;
+}
+
+/* Converts RGB32 macroblocks to RGB16/INDX4 */
+bool doPACK() {
+    const auto mbc = cmd & 0x7FF;
+
+    while (dec.mbCount < mbc) {
+        if (!hasOutputSpace((cmd & (1 << 27)) ? 32 : 8)) return false;
+
+        alignas(32) u32 rgb32[256];
+        alignas(32) u16 rgb16[256];
+
+        if (!readBytes(rgb32, sizeof(rgb32))) return false;
+
+        convertRGB16(rgb32, rgb16, cmd & (1 << 26));
+
+        if (cmd & (1 << 27)) {
+            pushOut(rgb16, 32);
+        } else {
+            alignas(16) u8 indx4[128];
+
+            convertINDX4(rgb16, indx4);
+
+            pushOut(indx4, 8);
+        }
+
+        dec.mbCount++;
+    }
+
+    return true;
+}
+
+/* Runs the current command as far as the IN FIFO allows */
+void process() {
+    if (!isBusy) return;
+
+    bool isDone;
+
+    switch (cmd >> 28) {
+        case Command::IDEC : isDone = doIDEC(); break;
+        case Command::BDEC : isDone = doBDEC(); break;
+        case Command::VDEC : isDone = doVDEC(); break;
+        case Command::FDEC : isDone = doFDEC(); break;
+        case Command::SETIQ: isDone = doSETIQ(); break;
+        case Command::SETVQ: isDone = doSETVQ(); break;
+        case Command::CSC  : isDone = doCSC(); break;
+        case Command::PACK : isDone = doPACK(); break;
+        default:
+            std::printf("[IPU       ] Unhandled command 0x%X\n", cmd >> 28);
+
+            exit(0);
+    }
+
+    if (isDone) {
+        isBusy = false;
+
+        /* Raised on the EE thread, see checkInterrupt() */
+        isIRQPending = true;
+    }
+}
 
 /* Sets up an IPU command */
 void doCmd(u32 data) {
-    const auto cmd = data >> 28;
+    const auto cmdID = data >> 28;
+
+    if (isBusy) {
+        std::printf("[IPU       ] Command 0x%X written while busy\n", cmdID);
+
+        exit(0);
+    }
 
-    switch (cmd) {
+    cmd = data;
+
+    ctrl.ecd = ctrl.scd = false;
+
+    switch (cmdID) {
         case Command::BCLR:
-            std::printf("[IPU       ] BCLR; BP = 0x%02X\n", data & 0xFF);
+            std::printf("[IPU       ] BCLR; BP = %u\n", data & 0x7F);
+
+            inFIFO.clear();
+
+            dec.bitPos = data & 0x7F;
+            return;
+        case Command::IDEC:
+            std::printf("[IPU       ] IDEC; FB = %u, QSC = %u, DTD = %u, SGN = %u, DTE = %u, OFM = %u\n", data & 0x3F, (data >> 16) & 0x1F, (data >> 24) & 1, (data >> 25) & 1, (data >> 26) & 1, (data >> 27) & 1);
+
+            dec.qsc = (data >> 16) & 0x1F;
+            dec.mbCount = 0;
+
+            resetDC();
+            break;
+        case Command::BDEC:
+            std::printf("[IPU       ] BDEC; FB = %u, QSC = %u, DT = %u, DCR = %u, MBI = %u\n", data & 0x3F, (data >> 16) & 0x1F, (data >> 25) & 1, (data >> 26) & 1, (data >> 27) & 1);
+
+            dec.qsc = (data >> 16) & 0x1F;
+
+            if (data & (1 << 26)) resetDC();
+            break;
+        case Command::VDEC:
+            std::printf("[IPU       ] VDEC; FB = %u, TBL = %u\n", data & 0x3F, (data >> 26) & 3);
+            break;
+        case Command::FDEC:
+            std::printf("[IPU       ] FDEC; FB = %u\n", data & 0x3F);
             break;
         case Command::SETIQ:
-            std::printf("[IPU       ] SETIQ; IQM = %u, FB = 0x%02X\n", (data >> 27) & 1, data & 0x1F);
+            std::printf("[IPU       ] SETIQ; IQM = %u, FB = %u\n", (data >> 27) & 1, data & 0x3F);
             break;
-        case Command::SETIQ + 1:
-            std::printf("[IPU       ] SETIQ\n");
+        case Command::SETVQ:
+            std::printf("[IPU       ] SETVQ; FB = %u\n", data & 0x3F);
             break;
-        case Command::SETTH:
-            std::printf("[IPU       ] SETTH; TH1 = 0x%02X, TH0 = 0x%02X\n", (data >> 16) & 0xFF, data & 0xFF);
+        case Command::CSC:
+            std::printf("[IPU       ] CSC; MBC = %u, DTE = %u, OFM = %u\n", data & 0x7FF, (data >> 26) & 1, (data >> 27) & 1);
+
+            dec.mbCount = 0;
+            break;
+        case Command::PACK:
+            std::printf("[IPU       ] PACK; MBC = %u, DTE = %u, OFM = %u\n", data & 0x7FF, (data >> 26) & 1, (data >> 27) & 1);
+
+            dec.mbCount = 0;
             break;
+        case Command::SETTH:
+            std::printf("[IPU       ] SETTH; TH1 = 0x%03X, TH0 = 0x%03X\n", (data >> 16) & 0x1FF, data & 0x1FF);
+
+            th0 = data & 0x1FF;
+            th1 = (data >> 16) & 0x1FF;
+            return;
         default:
-            std::printf("[IPU       ] Unhandled command 0x%X\n", cmd);
+            std::printf("[IPU       ] Unhandled command 0x%X\n", cmdID);
 
             exit(0);
     }
+
+    /* Skip FB bits, CSC and PACK take a macroblock count instead */
+    if ((cmdID != Command::CSC) && (cmdID != Command::PACK)) dec.bitPos += data & 0x3F;
+
+    isBusy = true;
+
+    process();
+}
+
+/* Writes IPU_CTRL */
+void writeCTRL(u32 data) {
+    ctrl.idp = (data >> 16) & 3;
+    ctrl.as  = data & (1 << 20);
+    ctrl.ivf = data & (1 << 21);
+    ctrl.qst = data & (1 << 22);
+    ctrl.mp1 = data & (1 << 23);
+    ctrl.pct = (data >> 24) & 7;
+
+    if (data & (1 << 30)) {
+        std::printf("[IPU       ] Reset\n");
+
+        reset();
+    }
+}
+
+/* Processes queued register writes and IN FIFO data */
+void drainQueue() {
+    const u128 *data;
+
+    while (const auto count = inQueue.peek(data)) {
+        if (queueLeft) {
+            const auto len = std::min<u64>(count, queueLeft);
+
+            inFIFO.insert(inFIFO.end(), (const u8 *)data, (const u8 *)(data + len));
+
+            inputCount += len;
+
+            process();
+
+            updateInputLimit();
+
+            queueLeft -= len;
+
+            /* Popping after processing lets sync() use the queue state alone */
+            inQueue.pop(len);
+
+            continue;
+        }
+
+        const auto header = data[0];
+
+        switch (header._u32[0]) {
+            case QueueCmd::WriteCMD : doCmd(header._u32[2]); break;
+            case QueueCmd::WriteCTRL: writeCTRL(header._u32[2]); break;
+            case QueueCmd::WriteFIFO: queueLeft = header._u32[1]; break;
+            case QueueCmd::Resume   : process(); break;
+            default:
+                std::printf("[IPU       ] Invalid queue entry %u\n", header._u32[0]);
+
+                exit(0);
+        }
+
+        updateInputLimit();
+
+        inQueue.pop(1);
+    }
+}
+
+/* Runs the decoder until shutdown() */
+void run() {
+    int idleCount = 0;
+
+    while (isActive.load(std::memory_order_relaxed)) {
+        if (inQueue.isEmpty()) {
+            if (++idleCount < SPIN_COUNT) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+
+            continue;
+        }
+
+        idleCount = 0;
+
+        drainQueue();
+    }
+
+    isStopped = true;
+}
+
+bool isRunning() {
+    return isActive.load(std::memory_order_relaxed);
+}
+
+/* Raises the IPU interrupt for finished commands (EE thread) */
+void checkInterrupt() {
+    if (isIRQPending.load(std::memory_order_relaxed) && isIRQPending.exchange(false)) intc::sendInterrupt(Interrupt::IPU);
+}
+
+/* Waits until the decoder has processed all queued writes (EE thread) */
+void sync() {
+    if (isRunning()) {
+        while (!inQueue.isEmpty()) std::this_thread::yield();
+    }
+
+    checkInterrupt();
+}
+
+/* Stops the IPU thread, queued data is dropped */
+void shutdown() {
+    if (!isActive) return;
+
+    isActive = false;
+
+    while (!isStopped) std::this_thread::yield();
+}
+
+/* Starts or stops the IPU thread */
+void setThreadEnabled(bool enabled) {
+    if (enabled == isActive) return;
+
+    if (!enabled) {
+        sync();
+        shutdown();
+
+        return;
+    }
+
+    std::printf("[IPU       ] Running the IPU on a separate thread\n");
+
+    isStopped = false;
+    isActive  = true;
+
+    /* Detached, so that exit() doesn't have to join it */
+    std::thread(run).detach();
+}
+
+/* Queues an entry header, the entry's data has to be pushed right after it (EE thread) */
+void queueHeader(QueueCmd qcmd, u32 qwc, u32 arg) {
+    u128 header;
+
+    header._u32[0] = qcmd;
+    header._u32[1] = qwc;
+    header._u32[2] = arg;
+    header._u32[3] = 0;
+
+    inQueue.push(&header, 1);
+}
+
+/* Processes queued entries right away if the IPU thread isn't running (EE thread) */
+void submit() {
+    if (isRunning()) return;
+
+    drainQueue();
+    checkInterrupt();
+}
+
+/* Returns the number of unread quadwords the guest sees in the IN FIFO, prefetched data isn't part of it */
+u32 getVisibleInputQWC() {
+    const auto qwc = getInputQWC();
+
+    return (qwc > prefetchQWC) ? qwc - prefetchQWC : 0;
+}
+
+u32 readCTRL() {
+    const auto ifc = std::min(getVisibleInputQWC(), 8u);
+    const auto ofc = std::min<u32>(outQueue.getCount(), 8);
+
+    return ifc | (ofc << 4) | ((u32)ctrl.cbp << 8) | ((u32)ctrl.ecd << 14) | ((u32)ctrl.scd << 15) | ((u32)ctrl.idp << 16)
+        | ((u32)ctrl.as << 20) | ((u32)ctrl.ivf << 21) | ((u32)ctrl.qst << 22) | ((u32)ctrl.mp1 << 23) | ((u32)ctrl.pct << 24)
+        | ((u32)isBusy << 31);
+}
+
+u32 readBP() {
+    /* FP is the number of quadwords in the bit stream buffer, the rest is in the IN FIFO */
+    const auto qwc = getVisibleInputQWC();
+    const auto fp  = std::min(qwc, 2u);
+
+    return (dec.bitPos & 0x7F) | (std::min(qwc - fp, 8u) << 8) | (fp << 16);
 }
 
 u32 read(u32 addr) {
+    sync();
+
     switch (addr) {
+        case static_cast<u32>(IPUReg::CMD):
+            return cmdData;
         case static_cast<u32>(IPUReg::CTRL):
-            std::printf("[IPU       ] 32-bit read @ CTRL\n");
-            return 0;
+            return readCTRL();
+        case static_cast<u32>(IPUReg::BP):
+            return readBP();
+        case static_cast<u32>(IPUReg::TOP):
+            return peekBits(32);
         default:
             std::printf("[IPU       ] Unhandled 32-bit read @ 0x%08X\n", addr);
 
@@ -60,17 +1973,92 @@ u32 read(u32 addr) {
     }
 }
 
+u64 read64(u32 addr) {
+    sync();
+
+    switch (addr) {
+        case static_cast<u32>(IPUReg::CMD):
+            return cmdData | ((u64)isBusy << 63);
+        case static_cast<u32>(IPUReg::TOP):
+            return peekBits(32) | ((u64)(isBusy || !hasBits(32)) << 63);
+        default:
+            return read(addr);
+    }
+}
+
+/* Reads up to qwc quadwords from the OUT FIFO, returns the number of quadwords read */
+u32 readFIFO(u128 *data, u32 qwc) {
+    u32 count = 0;
+
+    while (count < qwc) {
+        const u128 *src;
+
+        const auto len = std::min<u64>(outQueue.peek(src), qwc - count);
+
+        if (!len) break;
+
+        std::memcpy(&data[count], src, 16 * len);
+
+        outQueue.pop(len);
+
+        count += len;
+    }
+
+    /* Let a stalled command continue */
+    if (isOutputStalled.exchange(false)) {
+        queueHeader(QueueCmd::Resume, 0, 0);
+
+        submit();
+    }
+
+    return count;
+}
+
+/* Returns a quadword from the OUT FIFO */
+u128 readFIFO() {
+    u128 data;
+
+    if (readFIFO(&data, 1)) return data;
+
+    /* The IPU thread might still be decoding */
+    sync();
+
+    if (!readFIFO(&data, 1)) {
+        std::printf("[IPU       ] OUT FIFO is empty\n");
+
+        return u128::from64(0);
+    }
+
+    return data;
+}
+
 void write(u32 addr, u32 data) {
     switch (addr) {
         case static_cast<u32>(IPUReg::CMD):
             std::printf("[IPU       ] 32-bit write @ CMD = 0x%08X\n", data);
 
-            doCmd(data);
+            /* BCLR clears prefetched data along with the IN FIFO */
+            if ((data >> 28) == Command::BCLR) prefetchQWC = 0;
+
+            queueHeader(QueueCmd::WriteCMD, 0, data);
+            submit();
             break;
         case static_cast<u32>(IPUReg::CTRL):
             std::printf("[IPU       ] 32-bit write @ CTRL = 0x%08X\n", data);
 
-            if (data & (1 << 30)) std::printf("[IPU       ] Reset\n");
+            queueHeader(QueueCmd::WriteCTRL, 0, data);
+            submit();
+
+            if (data & (1 << 30)) {
+                prefetchQWC = 0;
+
+                /* Drop decoded data once the decoder has been reset */
+                sync();
+
+                const u128 *out;
+
+                while (const auto count = outQueue.peek(out)) outQueue.pop(count);
+            }
             break;
         default:
             std::printf("[IPU       ] Unhandled 32-bit write @ 0x%08X = 0x%08X\n", addr, data);
@@ -79,4 +2067,62 @@ void write(u32 addr, u32 data) {
     }
 }
 
+/* Returns the number of quadwords the IN FIFO has room for (EE thread) */
+u32 getInputSpace() {
+    const auto limit = inputLimit.load(std::memory_order_acquire);
+    const auto count = writeCount - prefetchQWC;
+
+    return (limit > count) ? limit - count : 0;
+}
+
+/* Returns the number of prefetched quadwords that aren't in the IN FIFO yet (EE thread) */
+u32 getPrefetchQWC() {
+    return prefetchQWC;
+}
+
+/* Returns the number of quadwords IPU_TO may prefetch (EE thread) */
+u32 getPrefetchSpace() {
+    /* Without the IPU thread, data is decoded as soon as it's written, reading ahead doesn't gain anything */
+    const u64 size = isRunning() ? std::max<u64>(RUN_AHEAD_SIZE, getInputSpace()) : getInputSpace();
+
+    return (size > prefetchQWC) ? size - prefetchQWC : 0;
+}
+
+/* Moves qwc prefetched quadwords to the IN FIFO, callers check for room with getInputSpace() (EE thread) */
+void acceptPrefetch(u32 qwc) {
+    assert(qwc <= prefetchQWC);
+
+    prefetchQWC -= qwc;
+}
+
+/* Writes quadwords to the IN FIFO, waits for the IPU thread if inQueue is full */
+void writeFIFO(const u128 *data, u32 qwc) {
+    writeCount += qwc;
+
+    while (qwc) {
+        const auto len = std::min(qwc, MAX_WRITE_SIZE);
+
+        queueHeader(QueueCmd::WriteFIFO, len, 0);
+
+        inQueue.push(data, len);
+
+        submit();
+
+        data += len;
+        qwc  -= len;
+    }
+}
+
+/* Writes a quadword to the IN FIFO */
+void writeFIFO(const u128 &data) {
+    writeFIFO(&data, 1);
+}
+
+/* Sends quadwords to the decoder ahead of the IN FIFO (EE thread) */
+void prefetchFIFO(const u128 *data, u32 qwc) {
+    writeFIFO(data, qwc);
+
+    prefetchQWC += qwc;
+}
+
 }
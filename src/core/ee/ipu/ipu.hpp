@@ -9,8 +9,33 @@
 
 namespace ps2::ee::ipu {
 
+void init();
+void shutdown();
+
+void setThreadEnabled(bool enabled);
+
+bool isRunning();
+
+void checkInterrupt();
+void sync();
+
 u32 read(u32 addr);
+u64 read64(u32 addr);
+
+u128 readFIFO();
+u32  readFIFO(u128 *data, u32 qwc);
 
 void write(u32 addr, u32 data);
 
+u32 getInputSpace();
+u32 getPrefetchQWC();
+u32 getPrefetchSpace();
+
+void acceptPrefetch(u32 qwc);
+
+void writeFIFO(const u128 &data);
+void writeFIFO(const u128 *data, u32 qwc);
+
+void prefetchFIFO(const u128 *data, u32 qwc);
+
 }
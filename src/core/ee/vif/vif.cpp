@@ -5,11 +5,24 @@
 
 #include "vif.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <utility>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "../gif/gif.hpp"
+#include "../vu/vu_thread.hpp"
 
 namespace ps2::ee::vif {
 
+constexpr auto doLog = false;
+
 /* --- VIF registers --- */
 
 enum VIFReg {
@@ -17,18 +30,427 @@ enum VIFReg {
     FBRST = 0x10003810,
     ERR   = 0x10003820,
     MARK  = 0x10003830,
+    CYCLE = 0x10003840,
+    MODE  = 0x10003850,
+    NUM   = 0x10003860,
+    MASK  = 0x10003870,
+    CODE  = 0x10003880,
+    ITOPS = 0x10003890,
+    BASE  = 0x100038A0,
+    OFST  = 0x100038B0,
+    TOPS  = 0x100038C0,
+    ITOP  = 0x100038D0,
+    TOP   = 0x100038E0,
+    R0    = 0x10003900,
+    R1    = 0x10003910,
+    R2    = 0x10003920,
+    R3    = 0x10003930,
+    C0    = 0x10003940,
+    C1    = 0x10003950,
+    C2    = 0x10003960,
+    C3    = 0x10003970,
+};
+
+/* --- VIFcodes --- */
+
+enum VIFCode {
+    NOP      = 0x00,
+    STCYCL   = 0x01,
+    OFFSET   = 0x02,
+    BASE_    = 0x03,
+    ITOP_    = 0x04,
+    STMOD    = 0x05,
+    MSKPATH3 = 0x06,
+    MARK_    = 0x07,
+    FLUSHE   = 0x10,
+    FLUSH    = 0x11,
+    FLUSHA   = 0x13,
+    MSCAL    = 0x14,
+    MSCALF   = 0x15,
+    MSCNT    = 0x17,
+    STMASK   = 0x20,
+    STROW    = 0x30,
+    STCOL    = 0x31,
+    MPG      = 0x4A,
+    DIRECT   = 0x50,
+    DIRECTHL = 0x51,
+    UNPACK   = 0x60,
+};
+
+/* UNPACK formats, VN:VL */
+enum Format {
+    S32, S16, S8, V2_32 = 4, V2_16, V2_8, V3_32 = 8, V3_16, V3_8, V4_32 = 12, V4_16, V4_8, V4_5,
+};
+
+/* Write modes (MODE) */
+enum WriteMode {
+    None, Offset, Difference,
+};
+
+/* Returns the size of an UNPACK vector in bits */
+constexpr u32 getVectorBits(u32 fmt) {
+    if (fmt == Format::V4_5) return 16;
+
+    return ((fmt >> 2) + 1) * (32 >> (fmt & 3));
+}
+
+/* --- UNPACK kernels --- */
+
+/*
+ * UNPACK data is expanded to 32-bit elements one vector at a time and written
+ * straight to VU data memory. Kernels are specialized on the format, sign
+ * extension and whether masking/write modes are used. V2 vectors write X/Y to
+ * Z/W as well, V3 vectors write 0 to W (both are undefined on hardware).
+ */
+
+/* UNPACK parameters, latched once per UNPACK */
+struct UnpackJob {
+    u128 *mem;
+    u32   memMask; // In quadwords
+
+    u32 addr, num;
+
+    u8 cl, wl;
+    u8 mode;
+
+    u32 mask; // Zero if masking is disabled
+
+    u32 *row;
+    const u32 *col;
+};
+
+template <typename T>
+inline T loadData(const u8 *src) {
+    T data;
+
+    std::memcpy(&data, src, sizeof(T));
+
+    return data;
+}
+
+#ifdef __SSE2__
+/* Sign or zero-extends the low 4 halfwords of a vector */
+template <bool usn>
+inline __m128i extend16(__m128i v) {
+    if constexpr (usn) return _mm_unpacklo_epi16(v, _mm_setzero_si128());
+
+    return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
+
+/* Sign or zero-extends the low 4 bytes of a vector */
+template <bool usn>
+inline __m128i extend8(__m128i v) {
+    if constexpr (usn) return extend16<usn>(_mm_unpacklo_epi8(v, _mm_setzero_si128()));
+
+    return extend16<usn>(_mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8));
+}
+
+/* Expands one UNPACK vector */
+template <u32 fmt, bool usn>
+inline __m128i expand(const u8 *src) {
+    const auto xyxy = _MM_SHUFFLE(1, 0, 1, 0);
+
+    switch (fmt) {
+        case Format::S32  : return _mm_set1_epi32(loadData<u32>(src));
+        case Format::S16  : return _mm_shuffle_epi32(extend16<usn>(_mm_cvtsi32_si128(loadData<u16>(src))), 0);
+        case Format::S8   : return _mm_shuffle_epi32(extend8<usn>(_mm_cvtsi32_si128(loadData<u8>(src))), 0);
+        case Format::V2_32: return _mm_shuffle_epi32(_mm_loadl_epi64((const __m128i *)src), xyxy);
+        case Format::V2_16: return _mm_shuffle_epi32(extend16<usn>(_mm_cvtsi32_si128(loadData<u32>(src))), xyxy);
+        case Format::V2_8 : return _mm_shuffle_epi32(extend8<usn>(_mm_cvtsi32_si128(loadData<u16>(src))), xyxy);
+        case Format::V3_32: return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)src), _mm_cvtsi32_si128(loadData<u32>(src + 8)));
+        case Format::V3_16:
+            {
+                const auto v = extend16<usn>(_mm_cvtsi64_si128(loadData<u32>(src) | ((u64)loadData<u16>(src + 4) << 32)));
+
+                return _mm_and_si128(v, _mm_setr_epi32(-1, -1, -1, 0));
+            }
+        case Format::V3_8:
+            {
+                const auto v = extend8<usn>(_mm_cvtsi32_si128(loadData<u16>(src) | (loadData<u8>(src + 2) << 16)));
+
+                return _mm_and_si128(v, _mm_setr_epi32(-1, -1, -1, 0));
+            }
+        case Format::V4_32: return _mm_loadu_si128((const __m128i *)src);
+        case Format::V4_16: return extend16<usn>(_mm_loadl_epi64((const __m128i *)src));
+        case Format::V4_8 : return extend8<usn>(_mm_cvtsi32_si128(loadData<u32>(src)));
+        case Format::V4_5:
+            {
+                /* Move each 5-bit field to the top of its lane, then shift the lanes down */
+                const u32 v = loadData<u16>(src);
+
+                const auto rgba = _mm_setr_epi32(v << 27, v << 22, v << 17, v << 16);
+
+                const auto rgb = _mm_srli_epi32(_mm_and_si128(rgba, _mm_set1_epi32(0xF8000000)), 24);
+                const auto a   = _mm_srli_epi32(_mm_and_si128(rgba, _mm_set1_epi32(0x80000000)), 24);
+
+                return _mm_or_si128(_mm_and_si128(rgb, _mm_setr_epi32(-1, -1, -1, 0)), _mm_and_si128(a, _mm_setr_epi32(0, 0, 0, -1)));
+            }
+        default:
+            return _mm_setzero_si128();
+    }
+}
+
+/* Returns an element select mask of a MASK row */
+inline __m128i getSelectMask(u32 rowMask, u32 sel) {
+    alignas(16) u32 lanes[4];
+
+    for (int e = 0; e < 4; e++) lanes[e] = (((rowMask >> (2 * e)) & 3) == sel) ? -1 : 0;
+
+    return _mm_load_si128((const __m128i *)lanes);
+}
+
+/* Masks and write mode of one cycle row */
+struct RowMasks {
+    __m128i data, row, col, protect;
 };
 
+/* Applies masking and the write mode to a vector, fill writes don't have data */
+inline __m128i applyMask(UnpackJob &job, const RowMasks &masks, __m128i v, bool isFill, __m128i &protect) {
+    auto row = _mm_load_si128((const __m128i *)job.row);
+
+    if (!isFill) {
+        switch (job.mode) {
+            case WriteMode::Offset:
+                v = _mm_add_epi32(v, row);
+                break;
+            case WriteMode::Difference:
+                /* ROW is only updated for data elements */
+                row = _mm_or_si128(_mm_andnot_si128(masks.data, row), _mm_and_si128(masks.data, _mm_add_epi32(v, row)));
+
+                _mm_store_si128((__m128i *)job.row, row);
+
+                v = row;
+                break;
+            default:
+                break;
+        }
+    }
+
+    /* masks.col already holds the column value in selected elements */
+    v = _mm_or_si128(_mm_and_si128(masks.data, v), _mm_and_si128(masks.row, row));
+    v = _mm_or_si128(v, masks.col);
+
+    /* Filling writes leave data elements untouched */
+    protect = (isFill) ? _mm_or_si128(masks.protect, masks.data) : masks.protect;
+
+    return v;
+}
+#endif
+
+/* Reads element i of an UNPACK vector */
+template <u32 fmt, bool usn>
+inline u32 readElement(const u8 *src, int i) {
+    switch (fmt & 3) {
+        case 0: return loadData<u32>(src + 4 * i);
+        case 1: return (usn) ? (u32)loadData<u16>(src + 2 * i) : (u32)(i32)loadData<i16>(src + 2 * i);
+        case 2: return (usn) ? (u32)loadData<u8>(src + i) : (u32)(i32)loadData<i8>(src + i);
+        default:
+            {
+                const u32 v = loadData<u16>(src);
+
+                return (i == 3) ? ((v >> 15) << 7) : (((v >> (5 * i)) & 0x1F) << 3);
+            }
+    }
+}
+
+/* Expands one UNPACK vector */
+template <u32 fmt, bool usn>
+inline void expand(const u8 *src, u32 *dst) {
+    if (fmt == Format::V4_5) {
+        for (int i = 0; i < 4; i++) dst[i] = readElement<fmt, usn>(src, i);
+
+        return;
+    }
+
+    switch (fmt >> 2) {
+        case 0: dst[0] = dst[1] = dst[2] = dst[3] = readElement<fmt, usn>(src, 0); break;
+        case 1:
+            dst[0] = dst[2] = readElement<fmt, usn>(src, 0);
+            dst[1] = dst[3] = readElement<fmt, usn>(src, 1);
+            break;
+        case 2:
+            for (int i = 0; i < 3; i++) dst[i] = readElement<fmt, usn>(src, i);
+
+            dst[3] = 0;
+            break;
+        case 3:
+            for (int i = 0; i < 4; i++) dst[i] = readElement<fmt, usn>(src, i);
+            break;
+    }
+}
+
+/* Unpacks vectors without masking or write modes */
+template <u32 fmt, bool usn>
+void unpackPlain(UnpackJob &job, const u8 *src) {
+    constexpr auto size = getVectorBits(fmt) / 8;
+
+    auto addr = job.addr;
+
+    for (u32 i = 0, cycle = 0; i < job.num; i++) {
+        auto &dst = job.mem[addr & job.memMask];
+
+#ifdef __SSE2__
+        _mm_storeu_si128((__m128i *)&dst, expand<fmt, usn>(src));
+#else
+        expand<fmt, usn>(src, dst._u32);
+#endif
+
+        src  += size;
+        addr += 1;
+
+        /* Skipping write */
+        if (++cycle == job.wl) {
+            addr += job.cl - job.wl;
+
+            cycle = 0;
+        }
+    }
+}
+
+/* Unpacks vectors with masking, write modes and filling writes */
+template <u32 fmt, bool usn>
+void unpackMasked(UnpackJob &job, const u8 *src) {
+    constexpr auto size = getVectorBits(fmt) / 8;
+
+    const auto isFilling = job.wl > job.cl;
+
+#ifdef __SSE2__
+    RowMasks masks[4];
+
+    for (int r = 0; r < 4; r++) {
+        const auto rowMask = (job.mask >> (8 * r)) & 0xFF;
+
+        masks[r].data    = getSelectMask(rowMask, 0);
+        masks[r].row     = getSelectMask(rowMask, 1);
+        masks[r].col     = _mm_and_si128(getSelectMask(rowMask, 2), _mm_set1_epi32(job.col[r]));
+        masks[r].protect = getSelectMask(rowMask, 3);
+    }
+#endif
+
+    auto addr = job.addr;
+
+    for (u32 i = 0, cycle = 0; i < job.num; i++) {
+        const auto isFill = isFilling && (cycle >= job.cl);
+
+        auto &dst = job.mem[addr & job.memMask];
+
+        const auto r = std::min(cycle, 3u);
+
+#ifdef __SSE2__
+        auto v = (isFill) ? _mm_setzero_si128() : expand<fmt, usn>(src);
+
+        __m128i protect;
+
+        v = applyMask(job, masks[r], v, isFill, protect);
+
+        const auto old = _mm_loadu_si128((const __m128i *)&dst);
+
+        _mm_storeu_si128((__m128i *)&dst, _mm_or_si128(_mm_and_si128(protect, old), _mm_andnot_si128(protect, v)));
+#else
+        u32 v[4] = {};
+
+        if (!isFill) expand<fmt, usn>(src, v);
+
+        const auto rowMask = (job.mask >> (8 * r)) & 0xFF;
+
+        for (int e = 0; e < 4; e++) {
+            switch ((rowMask >> (2 * e)) & 3) {
+                case 0: // Data, filling writes don't have any
+                    if (isFill) break;
+
+                    if (job.mode == WriteMode::Offset) {
+                        v[e] += job.row[e];
+                    } else if (job.mode == WriteMode::Difference) {
+                        v[e] = job.row[e] = v[e] + job.row[e];
+                    }
+
+                    dst._u32[e] = v[e];
+                    break;
+                case 1: dst._u32[e] = job.row[e]; break;
+                case 2: dst._u32[e] = job.col[r]; break;
+                default: // Write protected
+                    break;
+            }
+        }
+#endif
+
+        if (!isFill) src += size;
+
+        addr += 1;
+
+        if (++cycle == job.wl) {
+            if (!isFilling) addr += job.cl - job.wl;
+
+            cycle = 0;
+        }
+    }
+}
+
+using UnpackFn = void (*)(UnpackJob &, const u8 *);
+
+template <std::size_t idx>
+constexpr UnpackFn getUnpackFn() {
+    constexpr auto fmt = idx >> 2;
+    constexpr auto usn = (idx >> 1) & 1;
+
+    if constexpr (idx & 1) return &unpackMasked<fmt, usn>;
+
+    return &unpackPlain<fmt, usn>;
+}
+
+template <std::size_t... idx>
+constexpr std::array<UnpackFn, sizeof...(idx)> makeUnpackTable(std::index_sequence<idx...>) {
+    return {getUnpackFn<idx>()...};
+}
+
+/* Indexed by [VN:VL:USN:MASKED] */
+constexpr auto unpackTable = makeUnpackTable(std::make_index_sequence<16 * 2 * 2>());
+
+/* --- VIF --- */
+
 VectorInterface::VectorInterface(int vifID, VectorUnit *vu) {
     this->vifID = vifID;
     this->vu = vu;
+
+    cl = wl = 0;
+    mode = 0;
+    mask = code = mark = 0;
+    itops = base = ofst = tops = itop = top = 0;
+    dbf = false;
+
+    std::memset(row, 0, sizeof(row));
+    std::memset(col, 0, sizeof(col));
+
+    dataLeft = addr = num = 0;
+
+    directCount = 0;
 }
 
 u32 VectorInterface::read(u32 addr) {
+    if (vifID) vu::thread::sync();
+
     switch (addr & ~(1 << 10)) {
         case VIFReg::STAT:
-            std::printf("[VIF%d      ] 32-bit read @ STAT\n", vifID);
-            return 0;
+            if (doLog) std::printf("[VIF%d      ] 32-bit read @ STAT\n", vifID);
+
+            /* VPS = 1 while waiting for data, DBF is VIF1 only */
+            return ((dataLeft) ? 1 : 0) | (dbf << 7);
+        case VIFReg::MARK : return mark;
+        case VIFReg::CYCLE: return cl | (wl << 8);
+        case VIFReg::MODE : return mode;
+        case VIFReg::NUM  : return num;
+        case VIFReg::MASK : return mask;
+        case VIFReg::CODE : return code;
+        case VIFReg::ITOPS: return itops;
+        case VIFReg::BASE : return base;
+        case VIFReg::OFST : return ofst;
+        case VIFReg::TOPS : return tops;
+        case VIFReg::ITOP : return itop;
+        case VIFReg::TOP  : return top;
+        case VIFReg::R0: case VIFReg::R1: case VIFReg::R2: case VIFReg::R3:
+            return row[(addr >> 4) & 3];
+        case VIFReg::C0: case VIFReg::C1: case VIFReg::C2: case VIFReg::C3:
+            return col[(addr >> 4) & 3];
         default:
             std::printf("[VIF%d      ] Unhandled 32-bit read @ 0x%08X\n", vifID, addr);
 
@@ -37,6 +459,8 @@ u32 VectorInterface::read(u32 addr) {
 }
 
 void VectorInterface::write(u32 addr, u32 data) {
+    if (vifID) vu::thread::sync();
+
     switch (addr & ~(1 << 10)) {
         case VIFReg::STAT:
             std::printf("[VIF%d      ] 32-bit write @ STAT = 0x%08X\n", vifID, data);
@@ -44,7 +468,16 @@ void VectorInterface::write(u32 addr, u32 data) {
         case VIFReg::FBRST:
             std::printf("[VIF%d      ] 32-bit write @ FBRST = 0x%08X\n", vifID, data);
 
-            if (data & (1 << 0)) std::printf("[VIF%d      ] Reset\n", vifID);
+            if (data & (1 << 0)) {
+                std::printf("[VIF%d      ] Reset\n", vifID);
+
+                dataLeft = 0;
+
+                cmdBuf.clear();
+
+                directCount = 0;
+            }
+
             if (data & (1 << 1)) std::printf("[VIF%d      ] Force break\n", vifID);
             if (data & (1 << 2)) std::printf("[VIF%d      ] Stop\n", vifID);
             if (data & (1 << 3)) std::printf("[VIF%d      ] Stall cancel\n", vifID);
@@ -54,6 +487,8 @@ void VectorInterface::write(u32 addr, u32 data) {
             break;
         case VIFReg::MARK:
             std::printf("[VIF%d      ] 32-bit write @ MARK = 0x%08X\n", vifID, data);
+
+            mark = data & 0xFFFF;
             break;
         default:
             std::printf("[VIF%d      ] Unhandled 32-bit write @ 0x%08X = 0x%08X\n", vifID, addr, data);
@@ -62,4 +497,299 @@ void VectorInterface::write(u32 addr, u32 data) {
     }
 }
 
+/* Handles VIF FIFO writes */
+void VectorInterface::writeFIFO(const u128 &data) {
+    transfer(data._u32, 4);
+}
+
+/* Sends a block of VIF data, VIF1 data goes to the VU1 thread if it's running */
+void VectorInterface::transfer(const u32 *data, u32 count) {
+    if (vifID && vu::thread::isRunning()) return vu::thread::transfer(data, count);
+
+    process(data, count);
+}
+
+/* Processes a block of VIF data (VIFcodes and their data) */
+void VectorInterface::process(const u32 *data, u32 count) {
+    while (count) {
+        const auto len = doCmd(data, count);
+
+        data  += len;
+        count -= len;
+    }
+}
+
+/* Executes a VIFcode or passes data to the current one, returns the number of words used */
+u32 VectorInterface::doCmd(const u32 *data, u32 count) {
+    if (!dataLeft) {
+        decodeCmd(*data);
+
+        return 1;
+    }
+
+    const auto cmd = (code >> 24) & 0x7F;
+
+    if (cmd >= VIFCode::UNPACK) return doUNPACK(data, count);
+
+    switch (cmd) {
+        case VIFCode::MPG     : return doMPG(data, count);
+        case VIFCode::DIRECT  :
+        case VIFCode::DIRECTHL: return doDIRECT(data, count);
+        default:
+            {
+                /* STMASK/STROW/STCOL are executed once all data words have been received */
+                const auto len = std::min(dataLeft, count);
+
+                cmdBuf.insert(cmdBuf.end(), data, data + len);
+
+                dataLeft -= len;
+
+                if (!dataLeft) {
+                    doBufferedCmd(cmdBuf.data());
+
+                    cmdBuf.clear();
+                }
+
+                return len;
+            }
+    }
+}
+
+/* Decodes and executes VIFcodes */
+void VectorInterface::decodeCmd(u32 data) {
+    code = data;
+
+    const auto cmd = (data >> 24) & 0x7F;
+    const auto imm = data & 0xFFFF;
+
+    num = (data >> 16) & 0xFF;
+
+    if (cmd >= VIFCode::UNPACK) {
+        const auto fmt = cmd & 0xF;
+
+        assert(wl);
+
+        if (!num) num = 256;
+
+        /* Filling writes don't read data */
+        const auto vectors = (wl <= cl) ? num : ((num / wl) * cl + std::min(num % wl, (u32)cl));
+
+        addr = imm & 0x3FF;
+
+        if (vifID && (imm & (1 << 15))) addr += tops; // FLG
+
+        dataLeft = (vectors * getVectorBits(fmt) + 31) / 32;
+
+        if (doLog) std::printf("[VIF%d      ] UNPACK; FMT = 0x%X, ADDR = 0x%03X, NUM = %u\n", vifID, fmt, addr, num);
+
+        if (!dataLeft) unpack(nullptr);
+
+        return;
+    }
+
+    switch (cmd) {
+        case VIFCode::NOP:
+            break;
+        case VIFCode::STCYCL:
+            cl = imm;
+            wl = imm >> 8;
+            break;
+        case VIFCode::OFFSET:
+            if (doLog) std::printf("[VIF%d      ] OFFSET = 0x%03X\n", vifID, imm & 0x3FF);
+
+            ofst = imm & 0x3FF;
+
+            dbf  = false;
+            tops = base;
+            break;
+        case VIFCode::BASE_:
+            if (doLog) std::printf("[VIF%d      ] BASE = 0x%03X\n", vifID, imm & 0x3FF);
+
+            base = imm & 0x3FF;
+            break;
+        case VIFCode::ITOP_:
+            itops = imm & 0x3FF;
+            break;
+        case VIFCode::STMOD:
+            mode = imm & 3;
+            break;
+        case VIFCode::MSKPATH3:
+            if (doLog) std::printf("[VIF%d      ] MSKPATH3 = %d\n", vifID, (imm >> 15) & 1);
+
+            gif::setPATH3Mask(imm & (1 << 15));
+            break;
+        case VIFCode::MARK_:
+            mark = imm;
+            break;
+        case VIFCode::FLUSHE:
+        case VIFCode::FLUSH:
+        case VIFCode::FLUSHA:
+            break; // Micro programs and PATH transfers finish immediately
+        case VIFCode::MSCAL:
+        case VIFCode::MSCALF:
+        case VIFCode::MSCNT:
+            /* Latch the double buffer registers */
+            itop = itops;
+
+            if (vifID) {
+                top  = tops;
+                dbf  = !dbf;
+                tops = base + ((dbf) ? ofst : 0);
+            }
+
+            vu->setTOPS(top, itop);
+
+            /* MSCNT continues after the last E bit */
+            vu->startMicro((cmd == VIFCode::MSCNT) ? vu->getPC() : 8 * imm);
+            break;
+        case VIFCode::STMASK:
+            dataLeft = 1;
+            break;
+        case VIFCode::STROW:
+        case VIFCode::STCOL:
+            dataLeft = 4;
+            break;
+        case VIFCode::MPG:
+            if (!num) num = 256;
+
+            if (doLog) std::printf("[VIF%d      ] MPG; ADDR = 0x%04X, NUM = %u\n", vifID, 8 * imm, num);
+
+            addr = imm;
+
+            dataLeft = 2 * num;
+            break;
+        case VIFCode::DIRECT:
+        case VIFCode::DIRECTHL:
+            assert(vifID);
+
+            if (doLog) std::printf("[VIF%d      ] DIRECT%s; QWC = %u\n", vifID, (cmd == VIFCode::DIRECTHL) ? "HL" : "", (imm) ? imm : 65536);
+
+            dataLeft = 4 * ((imm) ? imm : 65536);
+            break;
+        default:
+            std::printf("[VIF%d      ] Unhandled VIFcode 0x%08X\n", vifID, data);
+
+            exit(0);
+    }
+}
+
+/* Executes VIFcodes with buffered data */
+void VectorInterface::doBufferedCmd(const u32 *data) {
+    switch ((code >> 24) & 0x7F) {
+        case VIFCode::STMASK:
+            mask = data[0];
+            break;
+        case VIFCode::STROW:
+            std::memcpy(row, data, sizeof(row));
+            break;
+        case VIFCode::STCOL:
+            std::memcpy(col, data, sizeof(col));
+            break;
+        default:
+            break;
+    }
+}
+
+/* Sends DIRECT data to GIF PATH2, returns the number of words used */
+u32 VectorInterface::doDIRECT(const u32 *data, u32 count) {
+    const auto len = std::min(dataLeft, count);
+
+    u32 i = 0;
+
+    /* Complete a quadword that was split across transfers */
+    while (directCount && (i < len)) {
+        directBuf._u32[directCount++] = data[i++];
+
+        if (directCount == 4) {
+            gif::writePATH2(&directBuf, 1);
+
+            directCount = 0;
+        }
+    }
+
+    const auto qwc = (len - i) / 4;
+
+    if (qwc) {
+        if ((uintptr_t)&data[i] & (alignof(u128) - 1)) {
+            for (u32 j = 0; j < qwc; j++) {
+                std::memcpy(&directBuf, &data[i + 4 * j], 16);
+
+                gif::writePATH2(&directBuf, 1);
+            }
+        } else {
+            gif::writePATH2((const u128 *)&data[i], qwc);
+        }
+
+        i += 4 * qwc;
+    }
+
+    while (i < len) directBuf._u32[directCount++] = data[i++];
+
+    dataLeft -= len;
+
+    return len;
+}
+
+/* Writes MPG data to micro memory, returns the number of words used */
+u32 VectorInterface::doMPG(const u32 *data, u32 count) {
+    const auto len = std::min(dataLeft, count);
+
+    for (u32 i = 0; i < len; i++) {
+        cmdBuf.push_back(data[i]);
+
+        if (cmdBuf.size() == 2) {
+            vu->writeMicro64(8 * addr++, cmdBuf[0] | ((u64)cmdBuf[1] << 32));
+
+            cmdBuf.clear();
+        }
+    }
+
+    dataLeft -= len;
+
+    return len;
+}
+
+/* Unpacks data to VU memory, returns the number of words used */
+u32 VectorInterface::doUNPACK(const u32 *data, u32 count) {
+    /* Unpack straight from the source if all data is there */
+    if (cmdBuf.empty() && (count >= dataLeft)) {
+        const auto len = dataLeft;
+
+        dataLeft = 0;
+
+        unpack((const u8 *)data);
+
+        return len;
+    }
+
+    const auto len = std::min(dataLeft, count);
+
+    cmdBuf.insert(cmdBuf.end(), data, data + len);
+
+    dataLeft -= len;
+
+    if (!dataLeft) {
+        unpack((const u8 *)cmdBuf.data());
+
+        cmdBuf.clear();
+    }
+
+    return len;
+}
+
+/* Runs the UNPACK kernel of the current VIFcode */
+void VectorInterface::unpack(const u8 *data) {
+    const auto cmd = (code >> 24) & 0x7F;
+    const auto usn = (code >> 14) & 1;
+
+    /* Masking is enabled by bit 4 of the command */
+    const auto isMasked = cmd & (1 << 4);
+
+    UnpackJob job{vu->getDataMem(), vu->getDataMask(), addr, num, cl, wl, mode, (isMasked) ? mask : 0, row, col};
+
+    const auto useMask = isMasked || (mode != WriteMode::None) || (wl > cl);
+
+    unpackTable[4 * (cmd & 0xF) + 2 * usn + useMask](job, data);
+}
+
 }
@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "../vu/vu.hpp"
 #include "../../../common/types.hpp"
 
@@ -16,13 +18,56 @@ struct VectorInterface {
     VectorInterface(int vifID, VectorUnit *vu);
 
     u32 read(u32 addr);
-    
+
     void write(u32 addr, u32 data);
 
+    void writeFIFO(const u128 &data);
+    void transfer(const u32 *data, u32 count);
+    void process(const u32 *data, u32 count); // Runs on the VU1 thread for VIF1 if it's enabled
+
 private:
     int vifID;
 
     VectorUnit *vu;
+
+    /* VIF registers */
+
+    u8  cl, wl;   // CYCLE
+    u8  mode;     // MODE
+    u32 mask;     // MASK
+    u32 code;     // Last VIFcode
+    u32 mark;     // MARK
+    u16 itops;    // ITOPS
+    u16 base;     // BASE (VIF1 only)
+    u16 ofst;     // OFST (VIF1 only)
+    u16 tops;     // TOPS (VIF1 only)
+    u16 itop;     // ITOP
+    u16 top;      // TOP (VIF1 only)
+    bool dbf;     // Double buffer flag (VIF1 only)
+
+    alignas(16) u32 row[4]; // Filling data (R0-R3)
+    alignas(16) u32 col[4]; // Filling data (C0-C3)
+
+    /* Command state */
+
+    u32 dataLeft; // Data words of the current command that haven't been received yet
+
+    u32 addr; // MPG: micro memory address in dwords, UNPACK: data memory address in quadwords
+    u32 num;  // Number of vectors/instructions
+
+    std::vector<u32> cmdBuf; // Data words of commands that are executed at once
+
+    u128 directBuf; // DIRECT data that doesn't fill a quadword yet
+    u32  directCount;
+
+    u32 doCmd(const u32 *data, u32 count);
+    u32 doDIRECT(const u32 *data, u32 count);
+    u32 doMPG(const u32 *data, u32 count);
+    u32 doUNPACK(const u32 *data, u32 count);
+
+    void decodeCmd(u32 data);
+    void doBufferedCmd(const u32 *data);
+    void unpack(const u8 *data);
 };
 
 }
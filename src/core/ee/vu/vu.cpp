@@ -7,38 +7,180 @@
 
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "vu_int.hpp"
+#include "vu_jit.hpp"
+#include "vu_thread.hpp"
+#include "../gif/gif.hpp"
 
 namespace ps2::ee::vu {
 
+constexpr auto doLog = false;
+
 /* --- VU registers --- */
 
 /* COP2 control registers */
 enum class ControlReg {
     SF      = 16,
+    MF      = 17,
     CF      = 18,
     R       = 20,
     I       = 21,
     Q       = 22,
+    TPC     = 26,
     CMSAR   = 27,
     FBRST   = 28,
     VPUSTAT = 29,
+    CMSAR1  = 31,
 };
 
-const f32 vf0Data[4] = {0.0, 0.0, 0.0, 1.0};
-
 VectorUnit::VectorUnit(int vuID, VectorUnit *otherVU) {
     this->vuID = vuID;
     this->otherVU = otherVU;
+
+    memMask = (vuID) ? 0x3FFF : 0xFFF;
+
+    std::memset(vf, 0, sizeof(vf));
+    std::memset(vi, 0, sizeof(vi));
+
+    q = i = p = 0.0;
+    r = 0x3F800000;
+
+    nextQ = nextP = 0.0;
+    qLatency = pLatency = 0;
+
+    mac = status = 0;
+    clip = 0;
+
+    hasPendingFlags = false;
+
+    cmsar = 0;
+
+    std::memset(microCache, 0, sizeof(microCache));
+
+    pc = branchTarget = 0;
+
+    isRunning = isBranchPending = inDelaySlot = false;
+
+    top = itop = 0;
+
+    vf[0]._u32[3] = 0x3F800000; // VF0 = (0.0, 0.0, 0.0, 1.0)
 }
 
 void VectorUnit::reset() {
     std::printf("[VU%d       ] Reset\n", vuID);
+
+    isRunning = isBranchPending = inDelaySlot = false;
 }
 
 void VectorUnit::forceBreak() {
     std::printf("[VU%d       ] Force break\n", vuID);
 }
 
+/* Runs a micro program until the instruction pair after the next E bit */
+void VectorUnit::startMicro(u32 addr) {
+    if (doLog) std::printf("[VU%d       ] Micro program start @ 0x%04X\n", vuID, addr & memMask);
+
+    pc = addr & memMask;
+
+    /* Compiled code writes MAC and status flags directly */
+    updatePendingFlags();
+
+    isRunning = true;
+
+    isBranchPending = inDelaySlot = false;
+
+    auto isEnd = false;
+
+    while (isRunning) {
+        /* Run compiled code until the next branch or E bit */
+        if (!inDelaySlot && !isEnd) {
+            const auto pairs = jit::run(this, pc);
+
+            if (pairs) {
+                pc = (pc + 8 * pairs) & memMask;
+
+                continue;
+            }
+        }
+
+        auto &instr = microCache[pc >> 3];
+
+        /* Pairs are only decoded once, micro memory writes invalidate them */
+        if (!instr.isValid) instr = interpreter::decodeMicro(this, pc);
+
+        pc = (pc + 8) & memMask;
+
+        const auto isBranchDelay = inDelaySlot;
+
+        inDelaySlot = false;
+
+        executePair(instr);
+
+        if (isBranchDelay) pc = branchTarget & memMask;
+
+        if (isBranchPending) {
+            isBranchPending = false;
+
+            inDelaySlot = true;
+        }
+
+        updateLatency();
+
+        /* The pair after the E bit is executed as well */
+        if (isEnd) isRunning = false;
+
+        isEnd = instr.isEnd;
+    }
+
+    /* Results still in flight are written when the program ends */
+    waitQ();
+    waitP();
+
+    if (doLog) std::printf("[VU%d       ] Micro program end @ 0x%04X\n", vuID, pc);
+}
+
+/* Executes an instruction pair, results are written as if both instructions ran in parallel */
+void VectorUnit::executePair(const MicroInstr &instr) {
+    switch (instr.order) {
+        case PairOrder::UpperFirst:
+            instr.upper(this, instr.upperInstr);
+            instr.lower(this, instr.lowerInstr);
+            break;
+        case PairOrder::LowerFirst:
+            instr.lower(this, instr.lowerInstr);
+            instr.upper(this, instr.upperInstr);
+            break;
+        case PairOrder::Stash:
+            {
+                /* Hide the upper result from the lower instruction */
+                const auto old = vf[instr.upperDst];
+
+                instr.upper(this, instr.upperInstr);
+
+                const auto res = vf[instr.upperDst];
+
+                vf[instr.upperDst] = old;
+
+                instr.lower(this, instr.lowerInstr);
+
+                vf[instr.upperDst] = res;
+            }
+            break;
+    }
+}
+
+/* Writes FDIV/EFU results whose latency is over, called after every pair */
+void VectorUnit::updateLatency() {
+    if (qLatency && !--qLatency) q = nextQ;
+    if (pLatency && !--pLatency) p = nextP;
+}
+
 /* Returns a COP2 control register (VU0 only) */
 u32 VectorUnit::getControl(u32 idx) {
     assert(!vuID);
@@ -46,9 +188,14 @@ u32 VectorUnit::getControl(u32 idx) {
     if (idx < 16) return vi[idx];
 
     switch (idx) {
-        case static_cast<u32>(ControlReg::SF):
-            std::printf("[VU%d       ] Read @ SF\n", vuID);
-            return 0;
+        case static_cast<u32>(ControlReg::SF   ): return getStatus();
+        case static_cast<u32>(ControlReg::MF   ): return getMAC();
+        case static_cast<u32>(ControlReg::CF   ): return clip;
+        case static_cast<u32>(ControlReg::R    ): return r;
+        case static_cast<u32>(ControlReg::I    ): return *(u32 *)&i;
+        case static_cast<u32>(ControlReg::Q    ): return *(u32 *)&q;
+        case static_cast<u32>(ControlReg::TPC  ): return pc >> 3;
+        case static_cast<u32>(ControlReg::CMSAR): return cmsar >> 3;
         case static_cast<u32>(ControlReg::FBRST):
             std::printf("[VU%d       ] Read @ FBRST\n", vuID);
             return 0;
@@ -64,12 +211,21 @@ u32 VectorUnit::getControl(u32 idx) {
 
 /* Returns VF register element */
 u32 VectorUnit::getVF(u32 idx, int e) {
-    return vf[idx][e];
+    return vf[idx]._u32[e];
 }
 
 /* Returns VF register element */
 f32 VectorUnit::getVF_F32(u32 idx, int e) {
-    return *(f32 *)&vf[idx][e];
+    f32 data;
+
+    std::memcpy(&data, &vf[idx]._u32[e], sizeof(f32));
+
+    return data;
+}
+
+/* Returns a VF register */
+u128 VectorUnit::getVF128(u32 idx) {
+    return vf[idx];
 }
 
 /* Returns an integer register */
@@ -82,17 +238,174 @@ f32 VectorUnit::getQ() {
     return q;
 }
 
+/* Returns I */
+f32 VectorUnit::getI() {
+    return i;
+}
+
+/* Returns P */
+f32 VectorUnit::getP() {
+    return p;
+}
+
+/* Returns R */
+u32 VectorUnit::getR() {
+    return r;
+}
+
+/* Returns the MAC flags */
+u16 VectorUnit::getMAC() {
+    updatePendingFlags();
+
+    return mac;
+}
+
+/* Returns the status flags */
+u16 VectorUnit::getStatus() {
+    updatePendingFlags();
+
+    return status;
+}
+
+/* Returns the clipping flags */
+u32 VectorUnit::getClip() {
+    return clip;
+}
+
+/* Returns the address of the next instruction pair */
+u32 VectorUnit::getPC() {
+    return pc;
+}
+
+/* Returns VIF TOP (VU1 only) */
+u16 VectorUnit::getTOP() {
+    return top;
+}
+
+/* Returns VIF ITOP */
+u16 VectorUnit::getITOP() {
+    return itop;
+}
+
+/* Returns true if a micro program is running */
+bool VectorUnit::isBusy() {
+    return isRunning;
+}
+
+/* Returns data memory, accesses wrap around at getDataMask() */
+u128 *VectorUnit::getDataMem() {
+    return vuMem;
+}
+
+/* Returns the data memory mask in quadwords */
+u32 VectorUnit::getDataMask() {
+    return memMask >> 4;
+}
+
+/* Returns the address of a VF register */
+u32 *VectorUnit::getVFAddr(u32 idx) {
+    return vf[idx]._u32;
+}
+
+/* Returns the address of a VI register */
+u16 *VectorUnit::getVIAddr(u32 idx) {
+    return &vi[idx];
+}
+
+/* Returns the address of Q */
+f32 *VectorUnit::getQAddr() {
+    return &q;
+}
+
+/* Returns the address of I */
+f32 *VectorUnit::getIAddr() {
+    return &i;
+}
+
+/* Returns the address of P */
+f32 *VectorUnit::getPAddr() {
+    return &p;
+}
+
+/* Returns the address of the next Q */
+f32 *VectorUnit::getNextQAddr() {
+    return &nextQ;
+}
+
+/* Returns the address of the next P */
+f32 *VectorUnit::getNextPAddr() {
+    return &nextP;
+}
+
+/* Returns the address of the Q latency */
+u32 *VectorUnit::getQLatencyAddr() {
+    return &qLatency;
+}
+
+/* Returns the address of the P latency */
+u32 *VectorUnit::getPLatencyAddr() {
+    return &pLatency;
+}
+
+/* Returns the address of the MAC flags */
+u16 *VectorUnit::getMACAddr() {
+    return &mac;
+}
+
+/* Returns the address of the status flags */
+u16 *VectorUnit::getStatusAddr() {
+    return &status;
+}
+
+/* Reads VU mem (32-bit) */
+u32 VectorUnit::readData32(u32 addr) {
+    if (!vuID && (addr & 0x4000)) { // VU1 registers are mapped to these addresses (VU0 only)
+        thread::sync();
+
+        if (addr < 0x4200) return otherVU->getVF((addr >> 4) & 0x1F, (addr >> 2) & 3);
+        if (addr < 0x4300) return ((addr >> 2) & 3) ? 0 : otherVU->getVI((addr >> 4) & 0xF);
+
+        std::printf("[VU%d       ] Unhandled 32-bit read @ 0x%04X\n", vuID, addr);
+
+        exit(0);
+    }
+
+    addr &= memMask;
+
+    return vuMem[addr >> 4]._u32[(addr >> 2) & 3];
+}
+
+/* Reads VU mem (128-bit) */
+u128 VectorUnit::readData128(u32 addr) {
+    if (!vuID && (addr & 0x4000)) {
+        u128 data;
+
+        for (int e = 0; e < 4; e++) data._u32[e] = readData32(addr + 4 * e);
+
+        return data;
+    }
+
+    return vuMem[(addr & memMask) >> 4];
+}
+
+/* Reads micro memory (64-bit), addr is in bytes */
+u64 VectorUnit::readMicro64(u32 addr) {
+    return microMem[(addr & memMask) >> 3];
+}
+
 /* Writes VU mem (32-bit) */
 void VectorUnit::writeData32(u32 addr, u32 data) {
-    if (addr > 0x4000) { // VU1 registers are mapped to these addresses (VU0 only)
+    if (!vuID && (addr & 0x4000)) { // VU1 registers are mapped to these addresses (VU0 only)
         assert(!vuID);
 
+        thread::sync();
+
         if (addr < 0x4200) {
             const auto idx = (addr >> 4) & 0x1F;
 
             const auto e = (addr >> 2) & 3; // VF element
 
-            return otherVU->setVF(idx, e, *(f32 *)&data);
+            return otherVU->setVF(idx, e, data);
         } else if (addr < 0x4300) {
             if ((addr >> 2) & 3) return; // VIs are mapped to 16-byte aligned addresses
 
@@ -112,9 +425,34 @@ void VectorUnit::writeData32(u32 addr, u32 data) {
         }
     }
 
-    std::printf("[VU%d       ] Unhandled 32-bit write @ 0x%04X = 0x%08X\n", vuID, addr, data);
+    addr &= memMask;
 
-    exit(0);
+    vuMem[addr >> 4]._u32[(addr >> 2) & 3] = data;
+}
+
+/* Writes VU mem (128-bit) */
+void VectorUnit::writeData128(u32 addr, const u128 &data) {
+    if (!vuID && (addr & 0x4000)) {
+        for (int e = 0; e < 4; e++) writeData32(addr + 4 * e, data._u32[e]);
+
+        return;
+    }
+
+    vuMem[(addr & memMask) >> 4] = data;
+}
+
+/* Writes micro memory (64-bit), addr is in bytes */
+void VectorUnit::writeMicro64(u32 addr, u64 data) {
+    const auto idx = (addr & memMask) >> 3;
+
+    microMem[idx] = data;
+
+    /* Invalidate the decoded pair and compiled code, earlier pairs may have looked at this one for flag liveness */
+    for (u32 i = 0; i < interpreter::FLAG_SCAN_PAIRS; i++) {
+        microCache[(idx - i) & (memMask >> 3)].isValid = false;
+    }
+
+    jit::invalidate(this);
 }
 
 /* Writes a COP2 control register (VU0 only) */
@@ -128,30 +466,51 @@ void VectorUnit::setControl(u32 idx, u32 data) {
     switch (idx) {
         case static_cast<u32>(ControlReg::SF):
             std::printf("[VU%d       ] Write @ SF = 0x%08X\n", vuID, data);
+
+            setStatus((getStatus() & 0x3F) | (data & 0xFC0)); // Only sticky flags are writable
             break;
         case static_cast<u32>(ControlReg::CF):
             std::printf("[VU%d       ] Write @ CF = 0x%08X\n", vuID, data);
+
+            clip = data & 0xFFFFFF;
             break;
         case static_cast<u32>(ControlReg::R):
             std::printf("[VU%d       ] Write @ R = 0x%08X\n", vuID, data);
+
+            r = (data & 0x7FFFFF) | 0x3F800000;
             break;
         case static_cast<u32>(ControlReg::I):
             std::printf("[VU%d       ] Write @ I = 0x%08X\n", vuID, data);
+
+            i = *(f32 *)&data;
             break;
         case static_cast<u32>(ControlReg::Q):
             std::printf("[VU%d       ] Write @ Q = 0x%08X\n", vuID, data);
+
+            setQ(*(f32 *)&data);
             break;
         case static_cast<u32>(ControlReg::CMSAR):
             std::printf("[VU%d       ] Write @ CMSAR = 0x%08X\n", vuID, data);
+
+            cmsar = (data & 0xFFFF) << 3;
             break;
         case static_cast<u32>(ControlReg::FBRST):
             std::printf("[VU%d       ] Write @ FBRST = 0x%08X\n", vuID, data);
 
+            if (data & (3 << 8)) thread::sync();
+
             if (data & (1 << 0)) forceBreak();
             if (data & (1 << 1)) reset();
             if (data & (1 << 8)) otherVU->forceBreak();
             if (data & (1 << 9)) otherVU->reset();
             break;
+        case static_cast<u32>(ControlReg::CMSAR1):
+            std::printf("[VU%d       ] Write @ CMSAR1 = 0x%08X\n", vuID, data);
+
+            thread::sync();
+
+            otherVU->startMicro((data & 0xFFFF) << 3);
+            break;
         default:
             std::printf("[VU%d       ] Unhandled control write @ %u = 0x%08X\n", vuID, idx, data);
 
@@ -159,46 +518,158 @@ void VectorUnit::setControl(u32 idx, u32 data) {
     }
 }
 
-/* Sets a VF register element */
+/* Sets a VF register element, VF0 is read-only */
 void VectorUnit::setVF(u32 idx, int e, u32 data) {
-    if (idx == 32) {
-        std::printf("[VU%d       ] ACC.%s = 0x%08X (%f)\n", vuID, elementStr[e], data, *(f32 *)&data);
-    } else {
-        std::printf("[VU%d       ] VF%u.%s = 0x%08X (%f)\n", vuID, idx, elementStr[e], data, *(f32 *)&data);
-    }
-
-    vf[idx][e] = data;
-
-    vf[0][e] = *(u32 *)&vf0Data[e];
+    if (idx) vf[idx]._u32[e] = data;
 }
 
-/* Sets a VF register element */
+/* Sets a VF register element, VF0 is read-only */
 void VectorUnit::setVF_F32(u32 idx, int e, f32 data) {
-    if (idx == 32) {
-        std::printf("[VU%d       ] ACC.%s = %f (0x%08X)\n", vuID, elementStr[e], data, *(u32 *)&data);
-    } else {
-        std::printf("[VU%d       ] VF%u.%s = %f (0x%08X)\n", vuID, idx, elementStr[e], data, *(u32 *)&data);
-    }
+    if (idx) std::memcpy(&vf[idx]._u32[e], &data, sizeof(f32));
+}
+
+/* Sets the dest elements of a VF register (dest bit 3 = X), VF0 is read-only */
+void VectorUnit::setVF128(u32 idx, u32 dest, const u128 &data) {
+    if (!idx) return;
 
-    vf[idx][e] = *(u32 *)&data;
+#ifdef __SSE2__
+    const auto bits = _mm_setr_epi32(8, 4, 2, 1);
+    const auto mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(dest), bits), bits);
 
-    vf[0][e] = *(u32 *)&vf0Data[e];
+    const auto res = _mm_or_si128(
+        _mm_and_si128(mask, _mm_loadu_si128((const __m128i *)&data)),
+        _mm_andnot_si128(mask, _mm_load_si128((const __m128i *)&vf[idx]))
+    );
+
+    _mm_store_si128((__m128i *)&vf[idx], res);
+#else
+    for (int e = 0; e < 4; e++) {
+        if (dest & (1 << (3 - e))) vf[idx]._u32[e] = data._u32[e];
+    }
+#endif
 }
 
 /* Sets a VI register */
 void VectorUnit::setVI(u32 idx, u16 data) {
-    std::printf("[VU%d       ] VI%u = 0x%04X\n", vuID, idx, data);
-
     vi[idx] = data;
 
     vi[0] = 0;
 }
 
-/* Sets Q */
+/* Sets Q, cancels FDIV results in flight */
 void VectorUnit::setQ(f32 data) {
-    std::printf("[VU%d       ] Q = %f\n", vuID, data);
+    q = nextQ = data;
+
+    qLatency = 0;
+}
+
+/* Sets I */
+void VectorUnit::setI(f32 data) {
+    i = data;
+}
+
+/* Sets P, cancels EFU results in flight */
+void VectorUnit::setP(f32 data) {
+    p = nextP = data;
+
+    pLatency = 0;
+}
+
+/* Starts an FDIV instruction, the previous result is written first */
+void VectorUnit::setNextQ(f32 data, u32 latency) {
+    q = nextQ;
+
+    nextQ = data;
+
+    qLatency = latency;
+}
+
+/* Starts an EFU instruction, the previous result is written first */
+void VectorUnit::setNextP(f32 data, u32 latency) {
+    p = nextP;
+
+    nextP = data;
+
+    pLatency = latency;
+}
+
+/* Writes the FDIV result in flight (WAITQ) */
+void VectorUnit::waitQ() {
+    q = nextQ;
+
+    qLatency = 0;
+}
+
+/* Writes the EFU result in flight (WAITP) */
+void VectorUnit::waitP() {
+    p = nextP;
+
+    pLatency = 0;
+}
+
+/* Sets R, the exponent is always 0 */
+void VectorUnit::setR(u32 data) {
+    r = (data & 0x7FFFFF) | 0x3F800000;
+}
+
+/* Sets the MAC flags */
+void VectorUnit::setMAC(u16 data) {
+    updatePendingFlags();
+
+    mac = data;
+}
+
+/* Sets the status flags */
+void VectorUnit::setStatus(u16 data) {
+    updatePendingFlags();
+
+    status = data;
+}
+
+/* Stores an FMAC result, MAC and status flags are only calculated if they're accessed */
+void VectorUnit::setPendingFlags(const u128 &res, u32 dest) {
+    /* MAC flags of the replaced result are dead, its sticky status flags aren't */
+    if (hasPendingFlags) status |= interpreter::getStickyFlags(pendingRes, pendingDest);
+
+    std::memcpy(pendingRes, &res, sizeof(pendingRes));
+
+    pendingDest = dest;
+
+    hasPendingFlags = true;
+}
+
+/* Calculates deferred MAC and status flags */
+void VectorUnit::updatePendingFlags() {
+    if (!hasPendingFlags) return;
+
+    hasPendingFlags = false;
+
+    interpreter::setFMACFlags(this, pendingRes, pendingDest);
+}
+
+/* Sets the clipping flags */
+void VectorUnit::setClip(u32 data) {
+    clip = data & 0xFFFFFF;
+}
+
+/* Sets up a branch, taken after the delay slot */
+void VectorUnit::setBranch(u32 target) {
+    branchTarget = target;
+
+    isBranchPending = true;
+}
+
+/* Latches VIF TOP/ITOP */
+void VectorUnit::setTOPS(u16 top, u16 itop) {
+    this->top  = top;
+    this->itop = itop;
+}
+
+/* Sends a GIF packet from data memory to PATH1 (VU1 only) */
+void VectorUnit::xgkick(u16 addr) {
+    assert(vuID);
 
-    q = data;
+    gif::writePATH1(vuMem, addr, memMask >> 4);
 }
 
 }
@@ -11,37 +11,158 @@ static const char *elementStr[4] = {"X", "Y", "Z", "W"};
 
 namespace ps2::ee::vu {
 
+struct VectorUnit;
+
+using MicroFn = void (*)(VectorUnit *, u32);
+
+/* Execution order of an upper/lower instruction pair */
+enum class PairOrder : u8 {
+    UpperFirst, // No conflicts
+    LowerFirst, // Lower instruction reads the upper destination
+    Stash,      // Both instructions read each other's destination
+};
+
+/* Pre-decoded micro instruction pair */
+struct MicroInstr {
+    MicroFn upper, lower;
+
+    u32 upperInstr, lowerInstr;
+
+    PairOrder order;
+
+    u8 upperDst; // Upper destination VF (Stash only)
+
+    bool isFlagLive; // Upper MAC/status flags are read later on
+    bool isEnd;      // E bit
+    bool isValid;
+};
+
 struct VectorUnit {
     VectorUnit(int vuID, VectorUnit *otherVU);
 
     void reset();
     void forceBreak();
 
+    void startMicro(u32 addr);
+
     u32 getControl(u32 idx); // VU0 only
-    u32 getVF(u32 idx, int e);
-    f32 getVF_F32(u32 idx, int e);
+    u32  getVF(u32 idx, int e);
+    f32  getVF_F32(u32 idx, int e);
+    u128 getVF128(u32 idx);
     u16 getVI(u32 idx);
 
     f32 getQ();
+    f32 getI();
+    f32 getP();
+    u32 getR();
+
+    u16 getMAC();
+    u16 getStatus();
+    u32 getClip();
+
+    u32 getPC();
+    u16 getTOP();
+    u16 getITOP();
+
+    bool isBusy(); // Micro program running
+
+    u128 *getDataMem();
+    u32   getDataMask(); // In quadwords
+
+    /* Register file addresses (JIT only) */
+    u32 *getVFAddr(u32 idx);
+    u16 *getVIAddr(u32 idx);
+    f32 *getQAddr();
+    f32 *getIAddr();
+    f32 *getPAddr();
+    f32 *getNextQAddr();
+    f32 *getNextPAddr();
+    u32 *getQLatencyAddr();
+    u32 *getPLatencyAddr();
+    u16 *getMACAddr();
+    u16 *getStatusAddr();
+
+    u32  readData32(u32 addr);
+    u128 readData128(u32 addr);
+    u64  readMicro64(u32 addr);
 
     void writeData32(u32 addr, u32 data);
+    void writeData128(u32 addr, const u128 &data);
+    void writeMicro64(u32 addr, u64 data);
 
     void setControl(u32 idx, u32 data); // VU0 only
     void setVF(u32 idx, int e, u32 data);
     void setVF_F32(u32 idx, int e, f32 data);
+    void setVF128(u32 idx, u32 dest, const u128 &data);
     void setVI(u32 idx, u16 data);
 
     void setQ(f32 data);
-    
+    void setI(f32 data);
+    void setP(f32 data);
+    void setR(u32 data);
+
+    void setNextQ(f32 data, u32 latency); // FDIV result, written to Q after latency pairs
+    void setNextP(f32 data, u32 latency); // EFU result, written to P after latency pairs
+    void waitQ();
+    void waitP();
+
+    void setMAC(u16 data);
+    void setStatus(u16 data);
+    void setClip(u32 data);
+
+    void setPendingFlags(const u128 &res, u32 dest); // FMAC result, flags are calculated on the next MAC/status access
+
+    void setBranch(u32 target);
+    void setTOPS(u16 top, u16 itop); // Set by VIF on micro program start
+
+    void xgkick(u16 addr); // VU1 only
+
     int vuID;
 
 private:
     VectorUnit *otherVU;
 
-    u32 vf[33][4]; // Floating-point registers (+ accumulator)
+    alignas(16) u128 vf[33]; // Floating-point registers (+ accumulator)
     u16 vi[16];    // Integer registers
 
-    f32 q;
+    f32 q, i, p;
+    u32 r;
+
+    /* FDIV/EFU results in flight, nextQ/nextP equal Q/P if nothing is pending */
+    f32 nextQ, nextP;
+    u32 qLatency, pLatency; // Pairs until Q/P are written
+
+    u16 mac, status; // MAC and status flags
+    u32 clip;        // Clipping flags
+
+    /* Deferred MAC and status flags */
+    f32  pendingRes[4];
+    u32  pendingDest;
+    bool hasPendingFlags;
+
+    u32 cmsar; // Micro program start address (VU0 only)
+
+    /* VU0 has 4 KB of data and micro memory, VU1 has 16 KB */
+    u128 vuMem[0x4000 / 16];
+    u64  microMem[0x4000 / 8];
+
+    u32 memMask;
+
+    /* Micro mode state */
+
+    MicroInstr microCache[0x4000 / 8]; // Decoded instruction pairs, indexed like microMem
+
+    u32 pc;
+    u32 branchTarget;
+
+    bool isRunning;
+    bool isBranchPending, inDelaySlot;
+
+    u16 top, itop; // VIF TOP/ITOP
+
+    void executePair(const MicroInstr &instr);
+    void updateLatency();
+    void updatePendingFlags();
 };
 
 }
@@ -5,46 +5,203 @@
 
 #include "vu_int.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <limits>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 namespace ps2::ee::vu::interpreter {
 
 /* --- VU constants --- */
 
-constexpr auto doDisasm = true;
+constexpr auto doDisasm = false;
 constexpr auto ACC = 32;
 
+constexpr u32 MAX_FLOAT = 0x7F7FFFFF; // Largest PS2 float, the VUs don't have Inf or NaN
+
 /* --- VU instructions --- */
 
+/* Upper instructions and COP2 SPECIAL1 */
 enum SPECIAL1Opcode {
-    VADDBC  = 0x00,
-    VSUBBC  = 0x04,
-    VMADDBC = 0x08,
-    VMULBC  = 0x18,
-    VMULQ   = 0x1C,
-    VADDQ   = 0x20,
-    VADD    = 0x28,
-    VMUL    = 0x2A,
-    VSUB    = 0x2C,
-    VOPMSUB = 0x2E,
-    VIADD   = 0x30,
+    VADDBC   = 0x00,
+    VSUBBC   = 0x04,
+    VMADDBC  = 0x08,
+    VMSUBBC  = 0x0C,
+    VMAXBC   = 0x10,
+    VMINIBC  = 0x14,
+    VMULBC   = 0x18,
+    VMULQ    = 0x1C,
+    VMAXI    = 0x1D,
+    VMULI    = 0x1E,
+    VMINII   = 0x1F,
+    VADDQ    = 0x20,
+    VMADDQ   = 0x21,
+    VADDI    = 0x22,
+    VMADDI   = 0x23,
+    VSUBQ    = 0x24,
+    VMSUBQ   = 0x25,
+    VSUBI    = 0x26,
+    VMSUBI   = 0x27,
+    VADD     = 0x28,
+    VMADD    = 0x29,
+    VMUL     = 0x2A,
+    VMAX     = 0x2B,
+    VSUB     = 0x2C,
+    VMSUB    = 0x2D,
+    VOPMSUB  = 0x2E,
+    VMINI    = 0x2F,
+    VIADD    = 0x30,
+    VISUB    = 0x31,
+    VIADDI   = 0x32,
+    VIAND    = 0x34,
+    VIOR     = 0x35,
+    VCALLMS  = 0x38,
+    VCALLMSR = 0x39,
 };
 
+/* Upper instructions and COP2 SPECIAL2 */
 enum SPECIAL2Opcode {
+    VADDABC  = 0x00,
+    VSUBABC  = 0x04,
     VMADDABC = 0x08,
+    VMSUBABC = 0x0C,
+    VITOF0   = 0x10,
+    VITOF4   = 0x11,
+    VITOF12  = 0x12,
+    VITOF15  = 0x13,
+    VFTOI0   = 0x14,
     VFTOI4   = 0x15,
+    VFTOI12  = 0x16,
+    VFTOI15  = 0x17,
     VMULABC  = 0x18,
+    VMULAQ   = 0x1C,
+    VABS     = 0x1D,
+    VMULAI   = 0x1E,
+    VCLIP    = 0x1F,
+    VADDAQ   = 0x20,
+    VMADDAQ  = 0x21,
+    VADDAI   = 0x22,
+    VMADDAI  = 0x23,
+    VSUBAQ   = 0x24,
+    VMSUBAQ  = 0x25,
+    VSUBAI   = 0x26,
+    VMSUBAI  = 0x27,
+    VADDA    = 0x28,
+    VMADDA   = 0x29,
+    VMULA    = 0x2A,
+    VSUBA    = 0x2C,
+    VMSUBA   = 0x2D,
     VOPMULA  = 0x2E,
     VNOP     = 0x2F,
     VMOVE    = 0x30,
     VMR32    = 0x31,
+    VLQI     = 0x34,
     VSQI     = 0x35,
+    VLQD     = 0x36,
+    VSQD     = 0x37,
     VDIV     = 0x38,
     VSQRT    = 0x39,
+    VRSQRT   = 0x3A,
     VWAITQ   = 0x3B,
+    VMTIR    = 0x3C,
+    VMFIR    = 0x3D,
+    VILWR    = 0x3E,
     VISWR    = 0x3F,
+    VRNEXT   = 0x40,
+    VRGET    = 0x41,
+    VRINIT   = 0x42,
+    VRXOR    = 0x43,
+    VMFP     = 0x64,
+    VXTOP    = 0x68,
+    VXITOP   = 0x69,
+    VXGKICK  = 0x6C,
+    VESADD   = 0x70,
+    VERSADD  = 0x71,
+    VELENG   = 0x72,
+    VERLENG  = 0x73,
+    VEATANXY = 0x74,
+    VEATANXZ = 0x75,
+    VESUM    = 0x76,
+    VESQRT   = 0x78,
+    VERSQRT  = 0x79,
+    VERCPR   = 0x7A,
+    VWAITP   = 0x7B,
+    VESIN    = 0x7C,
+    VEATAN   = 0x7D,
+    VEEXP    = 0x7E,
+};
+
+/* Lower instructions (micro mode only) */
+enum LowerOpcode {
+    LQ      = 0x00,
+    SQ      = 0x01,
+    ILW     = 0x04,
+    ISW     = 0x05,
+    IADDIU  = 0x08,
+    ISUBIU  = 0x09,
+    FCEQ    = 0x10,
+    FCSET   = 0x11,
+    FCAND   = 0x12,
+    FCOR    = 0x13,
+    FSEQ    = 0x14,
+    FSSET   = 0x15,
+    FSAND   = 0x16,
+    FSOR    = 0x17,
+    FMEQ    = 0x18,
+    FMAND   = 0x1A,
+    FMOR    = 0x1B,
+    FCGET   = 0x1C,
+    B       = 0x20,
+    BAL     = 0x21,
+    JR      = 0x24,
+    JALR    = 0x25,
+    IBEQ    = 0x28,
+    IBNE    = 0x29,
+    IBLTZ   = 0x2C,
+    IBGTZ   = 0x2D,
+    IBLEZ   = 0x2E,
+    IBGEZ   = 0x2F,
+    SPECIAL = 0x40,
+};
+
+/* Upper instruction bits */
+enum UpperBits {
+    E = 1 << 30,
+    I = 1 << 31,
+};
+
+/* Status flags */
+enum StatusFlag {
+    Z = 1 << 0,
+    S = 1 << 1,
+    U = 1 << 2,
+    O = 1 << 3,
+    IF = 1 << 4, // Invalid
+    DF = 1 << 5, // Divide by zero
+};
+
+/* FMAC operations */
+enum class FMACOp {
+    ADD, SUB, MUL, MADD, MSUB, MAX, MINI,
+};
+
+/* Second operand of FMAC operations */
+enum class Operand {
+    VF, BC, Q, I,
+};
+
+/* How FMAC instructions update MAC and status flags */
+enum class FlagMode {
+    Update, // Flags are read later on
+    Defer,  // Calculated on the next MAC/status access (COP2 macro mode)
+    Skip,   // Overwritten before they're read, only sticky status flags are set (micro mode)
 };
 
 /* --- VU instruction helpers --- */
@@ -58,6 +215,8 @@ const char *destStr[16] = {
 
 const char *bcStr[4] = { "x", "y", "z", "w" };
 
+const char *fmacNames[7] = { "ADD", "SUB", "MUL", "MADD", "MSUB", "MAX", "MINI" };
+
 /* Returns dest */
 u32 getDest(u32 instr) {
     return (instr >> 21) & 0xF;
@@ -78,169 +237,1115 @@ u32 getT(u32 instr) {
     return (instr >> 16) & 0x1F;
 }
 
+/* Returns fsf */
+u32 getFSF(u32 instr) {
+    return (instr >> 21) & 3;
+}
+
+/* Returns ftf */
+u32 getFTF(u32 instr) {
+    return (instr >> 23) & 3;
+}
+
+/* Returns the signed 11-bit immediate of lower instructions */
+i32 getImm11(u32 instr) {
+    return (i32)(instr << 21) >> 21;
+}
+
+/* Returns the signed 5-bit immediate of IADDI */
+i32 getImm5(u32 instr) {
+    return (i32)(instr << 21) >> 27;
+}
+
+/* Returns the unsigned 12-bit immediate of FS* instructions */
+u32 getImm12(u32 instr) {
+    return (instr & 0x7FF) | ((instr >> 10) & 0x800);
+}
+
+/* Returns the unsigned 15-bit immediate of IADDIU/ISUBIU */
+u32 getImm15(u32 instr) {
+    return (instr & 0x7FF) | ((instr >> 10) & 0x7800);
+}
+
+/* Returns true if element e is written */
+bool isDest(u32 dest, int e) {
+    return dest & (1 << (3 - e));
+}
+
+/* Returns the first element in dest */
+int getFirstDest(u32 dest) {
+    for (int e = 0; e < 4; e++) {
+        if (isDest(dest, e)) return e;
+    }
+
+    return 0;
+}
+
+/* Returns the second operand of an FMAC instruction */
+template <Operand op>
+f32 getOperand(VectorUnit *vu, u32 instr, int e) {
+    switch (op) {
+        case Operand::VF: return vu->getVF_F32(getT(instr), e);
+        case Operand::BC: return vu->getVF_F32(getT(instr), instr & 3);
+        case Operand::Q : return vu->getQ();
+        case Operand::I : return vu->getI();
+    }
+}
+
+#ifdef __SSE2__
+/* Returns a VF register */
+__m128 loadVF(VectorUnit *vu, u32 idx) {
+    const auto data = vu->getVF128(idx);
+
+    return _mm_loadu_ps((const f32 *)&data);
+}
+
+/* Writes the dest elements of a VF register */
+void storeVF(VectorUnit *vu, u32 idx, u32 dest, __m128 res) {
+    u128 data;
+
+    _mm_storeu_ps((f32 *)&data, res);
+
+    vu->setVF128(idx, dest, data);
+}
+
+/* Returns the second operand of an FMAC instruction (all elements) */
+template <Operand op>
+__m128 getOperandVec(VectorUnit *vu, u32 instr) {
+    switch (op) {
+        case Operand::VF: return loadVF(vu, getT(instr));
+        case Operand::BC: return _mm_set1_ps(vu->getVF_F32(getT(instr), instr & 3));
+        case Operand::Q : return _mm_set1_ps(vu->getQ());
+        case Operand::I : return _mm_set1_ps(vu->getI());
+    }
+}
+
+/* Clamps Inf and NaN to +/-MAX_FLOAT (NaN becomes +MAX_FLOAT) */
+__m128 clamp(__m128 res) {
+    const auto max = _mm_castsi128_ps(_mm_set1_epi32(MAX_FLOAT));
+    const auto min = _mm_castsi128_ps(_mm_set1_epi32(MAX_FLOAT | (1u << 31)));
+
+    return _mm_max_ps(_mm_min_ps(res, max), min);
+}
+
+/* Returns VFs.yzx * VFt.zxy (OPMULA/OPMSUB) */
+__m128 getOuterProduct(VectorUnit *vu, u32 fs, u32 ft) {
+    const auto s = loadVF(vu, fs);
+    const auto t = loadVF(vu, ft);
+
+    return _mm_mul_ps(_mm_shuffle_ps(s, s, 0xC9), _mm_shuffle_ps(t, t, 0xD2));
+}
+
+/* Returns the MAC flags of an FMAC result */
+u16 getMACFlags(__m128 res, u32 dest) {
+    /* Reverse the elements, MAC bit 3 is X */
+    const auto data = _mm_castps_si128(_mm_shuffle_ps(res, res, 0x1B));
+
+    const auto exp = _mm_and_si128(data, _mm_set1_epi32(0x7F800000));
+
+    const auto isZero   = _mm_cmpeq_epi32(exp, _mm_setzero_si128());
+    const auto isMaxExp = _mm_cmpeq_epi32(exp, _mm_set1_epi32(0x7F800000));
+    const auto isNoMant = _mm_cmpeq_epi32(_mm_and_si128(data, _mm_set1_epi32(0x7FFFFF)), _mm_setzero_si128());
+
+    const u16 zero  = _mm_movemask_ps(_mm_castsi128_ps(isZero));
+    const u16 sign  = _mm_movemask_ps(_mm_castsi128_ps(data));
+    const u16 under = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(isNoMant, isZero)));
+    const u16 over  = _mm_movemask_ps(_mm_castsi128_ps(isMaxExp));
+
+    return (zero | (sign << 4) | (under << 8) | (over << 12)) & (dest * 0x1111);
+}
+#else
+/* Clamps Inf and NaN to +/-MAX_FLOAT (NaN becomes +MAX_FLOAT) */
+f32 clamp(f32 res) {
+    f32 max;
+
+    std::memcpy(&max, &MAX_FLOAT, sizeof(f32));
+
+    res = (res < max) ? res : max;
+
+    return (res > -max) ? res : -max;
+}
+#endif
+
+/* Returns the Z/S/U/O status flags of MAC flags */
+u16 getStatusFlags(u16 mac) {
+    u16 flags = 0;
+
+    if (mac & 0x000F) flags |= StatusFlag::Z;
+    if (mac & 0x00F0) flags |= StatusFlag::S;
+    if (mac & 0x0F00) flags |= StatusFlag::U;
+    if (mac & 0xF000) flags |= StatusFlag::O;
+
+    return flags;
+}
+
+/* Updates MAC and status flags */
+void setMACFlags(VectorUnit *vu, u16 mac) {
+    vu->setMAC(mac);
+
+    const auto flags = getStatusFlags(mac);
+
+    vu->setStatus((vu->getStatus() & 0xFF0) | flags | (flags << 6));
+}
+
+/* Returns the MAC flags of an FMAC result */
+u16 getFMACFlags(const f32 *res, u32 dest) {
+#ifdef __SSE2__
+    return getMACFlags(_mm_loadu_ps(res), dest);
+#else
+    u16 mac = 0;
+
+    for (int e = 0; e < 4; e++) {
+        if (!isDest(dest, e)) continue;
+
+        u32 data;
+
+        std::memcpy(&data, &res[e], sizeof(u32));
+
+        const auto bit = 1 << (3 - e);
+        const auto exp = (data >> 23) & 0xFF;
+
+        if (!exp) {
+            mac |= bit; // Zero
+
+            if (data & 0x7FFFFF) mac |= bit << 8; // Underflow
+        } else if (exp == 0xFF) {
+            mac |= bit << 12; // Overflow
+        }
+
+        if (data >> 31) mac |= bit << 4; // Sign
+    }
+
+    return mac;
+#endif
+}
+
+/* Updates MAC and status flags with an FMAC result */
+void setFMACFlags(VectorUnit *vu, const f32 *res, u32 dest) {
+    setMACFlags(vu, getFMACFlags(res, dest));
+}
+
+/* Returns the sticky status flags an FMAC result sets */
+u16 getStickyFlags(const f32 *res, u32 dest) {
+    return getStatusFlags(getFMACFlags(res, dest)) << 6;
+}
+
+/* Sets the sticky status flags of an FMAC result whose MAC flags are dead */
+void setStickyFlags(VectorUnit *vu, const f32 *res, u32 dest) {
+    vu->setStatus(vu->getStatus() | getStickyFlags(res, dest));
+}
+
+#ifdef __SSE2__
+/* Updates or defers the MAC and status flags of an FMAC result */
+template <FlagMode mode>
+void updateFlags(VectorUnit *vu, __m128 res, u32 dest) {
+    switch (mode) {
+        case FlagMode::Update: setMACFlags(vu, getMACFlags(res, dest)); break;
+        case FlagMode::Defer:
+            {
+                u128 data;
+
+                _mm_storeu_ps((f32 *)&data, res);
+
+                vu->setPendingFlags(data, dest);
+            }
+            break;
+        case FlagMode::Skip: vu->setStatus(vu->getStatus() | (getStatusFlags(getMACFlags(res, dest)) << 6)); break;
+    }
+}
+#else
+/* Updates or defers the MAC and status flags of an FMAC result */
+template <FlagMode mode>
+void updateFlags(VectorUnit *vu, const f32 *res, u32 dest) {
+    switch (mode) {
+        case FlagMode::Update: setFMACFlags(vu, res, dest); break;
+        case FlagMode::Defer:
+            {
+                u128 data;
+
+                std::memcpy(&data, res, sizeof(u128));
+
+                vu->setPendingFlags(data, dest);
+            }
+            break;
+        case FlagMode::Skip: setStickyFlags(vu, res, dest); break;
+    }
+}
+#endif
+
+/* Updates the FDIV status flags */
+void setFDIVFlags(VectorUnit *vu, bool isInvalid, bool isDivZero) {
+    u16 flags = 0;
+
+    if (isInvalid) flags |= StatusFlag::IF;
+    if (isDivZero) flags |= StatusFlag::DF;
+
+    vu->setStatus((vu->getStatus() & ~(StatusFlag::IF | StatusFlag::DF)) | flags | (flags << 6));
+}
+
+/* Writes the dest elements of a result */
+void setVFResult(VectorUnit *vu, u32 idx, u32 dest, const f32 *res) {
+    u128 data;
+
+    std::memcpy(&data, res, sizeof(u128));
+
+    vu->setVF128(idx, dest, data);
+}
+
 /* --- VU instruction handlers --- */
 
-/* ADD */
-void iADD(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
+/* FMAC instructions (ADD, SUB, MUL, MADD, MSUB, MAX, MINI + BroadCast/Q/I/Accumulator variants) */
+template <FMACOp fop, Operand op, bool isACC, FlagMode mode>
+void iFMAC(VectorUnit *vu, u32 instr) {
+    const auto fd = (isACC) ? ACC : getD(instr);
+    const auto fs = getS(instr);
+    const auto ft = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    if (doDisasm) {
+        const char *suffix[4] = { "", bcStr[instr & 3], "q", "i" };
+        const char *t[4] = { "", bcStr[instr & 3], "", "" };
+
+        if (isACC) {
+            std::printf("[VU%d       ] %sA%s%s ACC, VF%u, ", vu->vuID, fmacNames[static_cast<int>(fop)], suffix[static_cast<int>(op)], destStr[dest], fs);
+        } else {
+            std::printf("[VU%d       ] %s%s%s VF%u, VF%u, ", vu->vuID, fmacNames[static_cast<int>(fop)], suffix[static_cast<int>(op)], destStr[dest], fd, fs);
+        }
+
+        switch (op) {
+            case Operand::Q: std::printf("Q\n"); break;
+            case Operand::I: std::printf("I\n"); break;
+            default        : std::printf("VF%u%s\n", ft, t[static_cast<int>(op)]); break;
+        }
+    }
+
+    /* MAX and MINI don't update flags, their results don't need clamping */
+    constexpr auto isArith = (fop != FMACOp::MAX) && (fop != FMACOp::MINI);
+
+#ifdef __SSE2__
+    const auto s = loadVF(vu, fs);
+    const auto t = getOperandVec<op>(vu, instr);
+
+    __m128 res;
+
+    switch (fop) {
+        case FMACOp::ADD : res = _mm_add_ps(s, t); break;
+        case FMACOp::SUB : res = _mm_sub_ps(s, t); break;
+        case FMACOp::MUL : res = _mm_mul_ps(s, t); break;
+        case FMACOp::MADD: res = _mm_add_ps(loadVF(vu, ACC), _mm_mul_ps(s, t)); break;
+        case FMACOp::MSUB: res = _mm_sub_ps(loadVF(vu, ACC), _mm_mul_ps(s, t)); break;
+        case FMACOp::MAX : res = _mm_max_ps(t, s); break; // Same NaN handling as std::max(s, t)
+        case FMACOp::MINI: res = _mm_min_ps(t, s); break;
+    }
+
+    if (isArith) {
+        updateFlags<mode>(vu, res, dest);
+
+        res = clamp(res);
+    }
+
+    storeVF(vu, fd, dest, res);
+#else
+    f32 res[4];
+
+    for (int e = 0; e < 4; e++) {
+        const auto s = vu->getVF_F32(fs, e);
+        const auto t = getOperand<op>(vu, instr, e);
+
+        switch (fop) {
+            case FMACOp::ADD : res[e] = s + t; break;
+            case FMACOp::SUB : res[e] = s - t; break;
+            case FMACOp::MUL : res[e] = s * t; break;
+            case FMACOp::MADD: res[e] = vu->getVF_F32(ACC, e) + s * t; break;
+            case FMACOp::MSUB: res[e] = vu->getVF_F32(ACC, e) - s * t; break;
+            case FMACOp::MAX : res[e] = std::max(s, t); break;
+            case FMACOp::MINI: res[e] = std::min(s, t); break;
+        }
+    }
+
+    if (isArith) {
+        updateFlags<mode>(vu, res, dest);
+
+        for (int e = 0; e < 4; e++) res[e] = clamp(res[e]);
+    }
+
+    setVFResult(vu, fd, dest, res);
+#endif
+}
+
+/* ABSolute */
+void iABS(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+    const auto ft = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ABS%s VF%u, VF%u\n", vu->vuID, destStr[dest], ft, fs);
+    }
+
+    auto data = vu->getVF128(fs);
+
+    for (int e = 0; e < 4; e++) data._u32[e] &= ~(1u << 31);
+
+    vu->setVF128(ft, dest, data);
+}
+
+/* Branch */
+void iB(VectorUnit *vu, u32 instr) {
+    const auto target = vu->getPC() + 8 * getImm11(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] B 0x%04X\n", vu->vuID, target);
+    }
+
+    vu->setBranch(target);
+}
+
+/* Branch And Link */
+void iBAL(VectorUnit *vu, u32 instr) {
+    const auto it = getT(instr);
+
+    const auto target = vu->getPC() + 8 * getImm11(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] BAL VI%u, 0x%04X\n", vu->vuID, it, target);
+    }
+
+    /* Return to the instruction after the delay slot */
+    vu->setVI(it, (vu->getPC() + 8) >> 3);
+
+    vu->setBranch(target);
+}
+
+/* CLIPping judgement */
+void iCLIP(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+    const auto ft = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] CLIP VF%u.xyz, VF%u.w\n", vu->vuID, fs, ft);
+    }
+
+    const auto w = std::fabs(vu->getVF_F32(ft, 3));
+
+    u32 flags = 0;
+
+    for (int e = 0; e < 3; e++) {
+        const auto s = vu->getVF_F32(fs, e);
+
+        if (s >  w) flags |= 1 << (2 * e + 0);
+        if (s < -w) flags |= 1 << (2 * e + 1);
+    }
+
+    vu->setClip((vu->getClip() << 6) | flags);
+}
+
+/* DIVide */
+void iDIV(VectorUnit *vu, u32 instr) {
     const auto fs = getS(instr);
     const auto ft = getT(instr);
 
-    const auto dest = getDest(instr);
+    const auto fsf = getFSF(instr);
+    const auto ftf = getFTF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] DIV Q, VF%u.%s, VF%u.%s\n", vu->vuID, fs, bcStr[fsf], ft, bcStr[ftf]);
+    }
+
+    const auto s = vu->getVF_F32(fs, fsf);
+    const auto t = vu->getVF_F32(ft, ftf);
+
+    if (t == 0.0) {
+        setFDIVFlags(vu, s == 0.0, s != 0.0);
+
+        vu->setNextQ(std::copysign(std::numeric_limits<f32>::max(), s * t), Latency::DIV);
+
+        return;
+    }
+
+    setFDIVFlags(vu, false, false);
+
+    vu->setNextQ(s / t, Latency::DIV);
+}
+
+/* Exponential Arc TANgent */
+void iEATAN(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] EATAN P, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
+    }
+
+    vu->setNextP(std::atan(vu->getVF_F32(fs, fsf)), Latency::EATAN);
+}
+
+/* Exponential Arc TANgent (Y/X) */
+void iEATANxy(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] EATANxy P, VF%u\n", vu->vuID, fs);
+    }
+
+    vu->setNextP(std::atan(vu->getVF_F32(fs, 1) / vu->getVF_F32(fs, 0)), Latency::EATANxy);
+}
+
+/* Exponential Arc TANgent (Z/X) */
+void iEATANxz(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] EATANxz P, VF%u\n", vu->vuID, fs);
+    }
+
+    vu->setNextP(std::atan(vu->getVF_F32(fs, 2) / vu->getVF_F32(fs, 0)), Latency::EATANxz);
+}
+
+/* Exponential EXPonent */
+void iEEXP(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] EEXP P, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
+    }
+
+    vu->setNextP(std::exp(-vu->getVF_F32(fs, fsf)), Latency::EEXP);
+}
+
+/* Returns the squared length of VFs.xyz */
+f32 getSquareSum(VectorUnit *vu, u32 fs) {
+    const auto x = vu->getVF_F32(fs, 0);
+    const auto y = vu->getVF_F32(fs, 1);
+    const auto z = vu->getVF_F32(fs, 2);
+
+    return x * x + y * y + z * z;
+}
+
+/* Exponential LENGth */
+void iELENG(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ELENG P, VF%u\n", vu->vuID, fs);
+    }
+
+    vu->setNextP(std::sqrt(getSquareSum(vu, fs)), Latency::ELENG);
+}
+
+/* Exponential ReCiPRocal */
+void iERCPR(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ERCPR P, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
+    }
+
+    vu->setNextP(1.0f / vu->getVF_F32(fs, fsf), Latency::ERCPR);
+}
+
+/* Exponential Reciprocal LENGth */
+void iERLENG(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ERLENG P, VF%u\n", vu->vuID, fs);
+    }
+
+    vu->setNextP(1.0f / std::sqrt(getSquareSum(vu, fs)), Latency::ERLENG);
+}
+
+/* Exponential Reciprocal Square ADD */
+void iERSADD(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ERSADD P, VF%u\n", vu->vuID, fs);
+    }
+
+    vu->setNextP(1.0f / getSquareSum(vu, fs), Latency::ERSADD);
+}
+
+/* Exponential Reciprocal SQuare RooT */
+void iERSQRT(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ERSQRT P, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
+    }
+
+    vu->setNextP(1.0f / std::sqrt(std::fabs(vu->getVF_F32(fs, fsf))), Latency::ERSQRT);
+}
+
+/* Exponential Square ADD */
+void iESADD(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ESADD P, VF%u\n", vu->vuID, fs);
+    }
+
+    vu->setNextP(getSquareSum(vu, fs), Latency::ESADD);
+}
+
+/* Exponential SINe */
+void iESIN(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ESIN P, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
+    }
+
+    vu->setNextP(std::sin(vu->getVF_F32(fs, fsf)), Latency::ESIN);
+}
+
+/* Exponential SQuare RooT */
+void iESQRT(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ESQRT P, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
+    }
+
+    vu->setNextP(std::sqrt(std::fabs(vu->getVF_F32(fs, fsf))), Latency::ESQRT);
+}
+
+/* Exponential SUM */
+void iESUM(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ESUM P, VF%u\n", vu->vuID, fs);
+    }
+
+    f32 sum = 0.0;
+
+    for (int e = 0; e < 4; e++) sum += vu->getVF_F32(fs, e);
+
+    vu->setNextP(sum, Latency::ESUM);
+}
+
+/* Flag Clip AND */
+void iFCAND(VectorUnit *vu, u32 instr) {
+    const auto imm = instr & 0xFFFFFF;
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FCAND VI1, 0x%06X\n", vu->vuID, imm);
+    }
+
+    vu->setVI(1, (vu->getClip() & imm) != 0);
+}
+
+/* Flag Clip EQual */
+void iFCEQ(VectorUnit *vu, u32 instr) {
+    const auto imm = instr & 0xFFFFFF;
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FCEQ VI1, 0x%06X\n", vu->vuID, imm);
+    }
+
+    vu->setVI(1, vu->getClip() == imm);
+}
+
+/* Flag Clip GET */
+void iFCGET(VectorUnit *vu, u32 instr) {
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FCGET VI%u\n", vu->vuID, it);
+    }
+
+    vu->setVI(it, vu->getClip() & 0xFFF);
+}
+
+/* Flag Clip OR */
+void iFCOR(VectorUnit *vu, u32 instr) {
+    const auto imm = instr & 0xFFFFFF;
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FCOR VI1, 0x%06X\n", vu->vuID, imm);
+    }
+
+    vu->setVI(1, (vu->getClip() | imm) == 0xFFFFFF);
+}
+
+/* Flag Clip SET */
+void iFCSET(VectorUnit *vu, u32 instr) {
+    const auto imm = instr & 0xFFFFFF;
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FCSET 0x%06X\n", vu->vuID, imm);
+    }
+
+    vu->setClip(imm);
+}
+
+/* Flag MAC AND */
+void iFMAND(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FMAND VI%u, VI%u\n", vu->vuID, it, is);
+    }
+
+    vu->setVI(it, vu->getMAC() & vu->getVI(is));
+}
+
+/* Flag MAC EQual */
+void iFMEQ(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FMEQ VI%u, VI%u\n", vu->vuID, it, is);
+    }
+
+    vu->setVI(it, vu->getMAC() == vu->getVI(is));
+}
+
+/* Flag MAC OR */
+void iFMOR(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FMOR VI%u, VI%u\n", vu->vuID, it, is);
+    }
+
+    vu->setVI(it, vu->getMAC() | vu->getVI(is));
+}
+
+/* Flag Status AND */
+void iFSAND(VectorUnit *vu, u32 instr) {
+    const auto it  = getT(instr);
+    const auto imm = getImm12(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FSAND VI%u, 0x%03X\n", vu->vuID, it, imm);
+    }
+
+    vu->setVI(it, vu->getStatus() & imm);
+}
+
+/* Flag Status EQual */
+void iFSEQ(VectorUnit *vu, u32 instr) {
+    const auto it  = getT(instr);
+    const auto imm = getImm12(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FSEQ VI%u, 0x%03X\n", vu->vuID, it, imm);
+    }
+
+    vu->setVI(it, vu->getStatus() == imm);
+}
+
+/* Flag Status OR */
+void iFSOR(VectorUnit *vu, u32 instr) {
+    const auto it  = getT(instr);
+    const auto imm = getImm12(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FSOR VI%u, 0x%03X\n", vu->vuID, it, imm);
+    }
+
+    vu->setVI(it, vu->getStatus() | imm);
+}
+
+/* Flag Status SET */
+void iFSSET(VectorUnit *vu, u32 instr) {
+    const auto imm = getImm12(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FSSET 0x%03X\n", vu->vuID, imm);
+    }
+
+    /* Only sticky flags are written */
+    vu->setStatus((vu->getStatus() & 0x3F) | (imm & 0xFC0));
+}
+
+/* Float TO Integer (fixed point with n fractional bits) */
+template <int n>
+void iFTOI(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+    const auto ft = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] FTOI%d%s VF%u, VF%u\n", vu->vuID, n, destStr[dest], ft, fs);
+    }
+
+    auto data = vu->getVF128(fs);
+
+    for (int e = 0; e < 4; e++) {
+        f32 s;
+
+        std::memcpy(&s, &data._u32[e], sizeof(f32));
+
+        /* Truncate and saturate */
+        data._u32[e] = (u32)(i32)std::clamp((f64)s * (1 << n), (f64)INT32_MIN, (f64)INT32_MAX);
+    }
+
+    vu->setVF128(ft, dest, data);
+}
+
+/* Integer ADD */
+void iIADD(VectorUnit *vu, u32 instr) {
+    const auto id = getD(instr);
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] IADD VI%u, VI%u, VI%u\n", vu->vuID, id, is, it);
+    }
+
+    vu->setVI(id, vu->getVI(is) + vu->getVI(it));
+}
+
+/* Integer ADD Immediate */
+void iIADDI(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto imm = getImm5(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] IADDI VI%u, VI%u, %d\n", vu->vuID, it, is, imm);
+    }
+
+    vu->setVI(it, vu->getVI(is) + imm);
+}
+
+/* Integer ADD Immediate Unsigned */
+void iIADDIU(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto imm = getImm15(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] IADDIU VI%u, VI%u, 0x%04X\n", vu->vuID, it, is, imm);
+    }
+
+    vu->setVI(it, vu->getVI(is) + imm);
+}
+
+/* Integer AND */
+void iIAND(VectorUnit *vu, u32 instr) {
+    const auto id = getD(instr);
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] IAND VI%u, VI%u, VI%u\n", vu->vuID, id, is, it);
+    }
+
+    vu->setVI(id, vu->getVI(is) & vu->getVI(it));
+}
+
+/* Integer Branch on condition */
+template <LowerOpcode cond>
+void iIB(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto target = vu->getPC() + 8 * getImm11(instr);
+
+    const auto s = (i16)vu->getVI(is);
+    const auto t = (i16)vu->getVI(it);
+
+    bool isTaken;
+
+    switch (cond) {
+        case LowerOpcode::IBEQ : isTaken = s == t; break;
+        case LowerOpcode::IBNE : isTaken = s != t; break;
+        case LowerOpcode::IBLTZ: isTaken = s <  0; break;
+        case LowerOpcode::IBGTZ: isTaken = s >  0; break;
+        case LowerOpcode::IBLEZ: isTaken = s <= 0; break;
+        default                : isTaken = s >= 0; break;
+    }
+
+    if (doDisasm) {
+        const char *names[8] = { "IBEQ", "IBNE", "", "", "IBLTZ", "IBGTZ", "IBLEZ", "IBGEZ" };
+
+        std::printf("[VU%d       ] %s VI%u, VI%u, 0x%04X; %s\n", vu->vuID, names[cond & 7], it, is, target, (isTaken) ? "taken" : "not taken");
+    }
+
+    if (isTaken) vu->setBranch(target);
+}
+
+/* Integer Load Word */
+void iILW(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    const auto addr = ((vu->getVI(is) + getImm11(instr)) << 4) + 4 * getFirstDest(dest);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ILW%s VI%u, %d(VI%u)\n", vu->vuID, destStr[dest], it, getImm11(instr), is);
+    }
+
+    vu->setVI(it, vu->readData32(addr));
+}
+
+/* Integer Load Word Register */
+void iILWR(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    const auto addr = (vu->getVI(is) << 4) + 4 * getFirstDest(dest);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ILWR%s VI%u, (VI%u)\n", vu->vuID, destStr[dest], it, is);
+    }
+
+    vu->setVI(it, vu->readData32(addr));
+}
+
+/* Integer OR */
+void iIOR(VectorUnit *vu, u32 instr) {
+    const auto id = getD(instr);
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] IOR VI%u, VI%u, VI%u\n", vu->vuID, id, is, it);
+    }
+
+    vu->setVI(id, vu->getVI(is) | vu->getVI(it));
+}
+
+/* Integer SUBtract */
+void iISUB(VectorUnit *vu, u32 instr) {
+    const auto id = getD(instr);
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ISUB VI%u, VI%u, VI%u\n", vu->vuID, id, is, it);
+    }
+
+    vu->setVI(id, vu->getVI(is) - vu->getVI(it));
+}
+
+/* Integer SUBtract Immediate Unsigned */
+void iISUBIU(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto imm = getImm15(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ISUBIU VI%u, VI%u, 0x%04X\n", vu->vuID, it, is, imm);
+    }
+
+    vu->setVI(it, vu->getVI(is) - imm);
+}
+
+/* Integer Store Word */
+void iISW(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    const auto addr = (vu->getVI(is) + getImm11(instr)) << 4;
+    const auto data = vu->getVI(it);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ISW%s VI%u, %d(VI%u)\n", vu->vuID, destStr[dest], it, getImm11(instr), is);
+    }
+
+    for (int e = 0; e < 4; e++) {
+        if (isDest(dest, e)) vu->writeData32(addr + 4 * e, data);
+    }
+}
+
+/* Integer Store Word Register */
+void iISWR(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    const auto addr = vu->getVI(is) << 4;
+    const auto data = vu->getVI(it);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ISWR%s VI%u, (VI%u)\n", vu->vuID, destStr[dest], it, is);
+    }
+
+    for (int e = 0; e < 4; e++) {
+        if (isDest(dest, e)) vu->writeData32(addr + 4 * e, data);
+    }
+}
+
+/* Integer TO Float (fixed point with n fractional bits) */
+template <int n>
+void iITOF(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+    const auto ft = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] ITOF%d%s VF%u, VF%u\n", vu->vuID, n, destStr[dest], ft, fs);
+    }
+
+    const auto data = vu->getVF128(fs);
+
+    f32 res[4];
+
+    for (int e = 0; e < 4; e++) res[e] = (f32)(i32)data._u32[e] / (f32)(1 << n);
+
+    setVFResult(vu, ft, dest, res);
+}
+
+/* Jump And Link Register */
+void iJALR(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
+    const auto it = getT(instr);
 
-    if (doDisasm) {
-        std::printf("[VU%d       ] ADD%s VF%u, VF%u, VF%u\n", vu->vuID, destStr[dest], fd, fs, ft);
-    }
+    const auto target = vu->getVI(is) << 3;
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) + vu->getVF_F32(ft, i));
+    if (doDisasm) {
+        std::printf("[VU%d       ] JALR VI%u, VI%u; PC = 0x%04X\n", vu->vuID, it, is, target);
     }
-}
 
-/* ADD with BroadCast */
-void iADDbc(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
-    const auto ft = getT(instr);
+    vu->setVI(it, (vu->getPC() + 8) >> 3);
 
-    const auto dest = getDest(instr);
+    vu->setBranch(target);
+}
 
-    const auto bc = instr & 3;
+/* Jump Register */
+void iJR(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
 
-    const auto t = vu->getVF_F32(ft, bc);
+    const auto target = vu->getVI(is) << 3;
 
     if (doDisasm) {
-        std::printf("[VU%d       ] ADD%s%s VF%u, VF%u, VF%u\n", vu->vuID, bcStr[bc], destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] JR VI%u; PC = 0x%04X\n", vu->vuID, is, target);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) + t);
-    }
+    vu->setBranch(target);
 }
 
-/* ADD Q */
-void iADDQ(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
+/* LOad I (I bit) */
+void iLOI(VectorUnit *vu, u32 instr) {
+    f32 data;
 
-    const auto dest = getDest(instr);
+    std::memcpy(&data, &instr, sizeof(f32));
 
     if (doDisasm) {
-        std::printf("[VU%d       ] ADD%s VF%u, VF%u, Q\n", vu->vuID, destStr[dest], fd, fs);
+        std::printf("[VU%d       ] LOI %f\n", vu->vuID, data);
     }
 
-    const auto q = vu->getQ();
-
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) + q);
-    }
+    vu->setI(data);
 }
 
-/* DIVide */
-void iDIV(VectorUnit *vu, u32 instr) {
-    const auto fs = getS(instr);
-    const auto ft = getT(instr);
+/* Loads a quadword into the dest elements of VFt */
+void loadQuad(VectorUnit *vu, u32 ft, u32 dest, u32 addr) {
+    vu->setVF128(ft, dest, vu->readData128(addr));
+}
 
-    const auto dest = getDest(instr);
+/* Stores the dest elements of VFs */
+void storeQuad(VectorUnit *vu, u32 fs, u32 dest, u32 addr) {
+    const auto data = vu->getVF128(fs);
 
-    const auto fsf = dest & 3;
-    const auto ftf = dest >> 2;
+    if (dest == 0xF) return vu->writeData128(addr, data);
 
-    if (doDisasm) {
-        std::printf("[VU%d       ] DIV Q, VF%u.%s, VF%u.%s\n", vu->vuID, fs, bcStr[fsf], ft, bcStr[ftf]);
+    for (int e = 0; e < 4; e++) {
+        if (isDest(dest, e)) vu->writeData32(addr + 4 * e, data._u32[e]);
     }
-
-    vu->setQ(vu->getVF_F32(fs, fsf) / vu->getVF_F32(ft, ftf));
 }
 
-/* Float to Integer (28:)4 */
-void iFTOI4(VectorUnit *vu, u32 instr) {
-    const auto fs = getS(instr);
+/* Load Quadword */
+void iLQ(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
     const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] FTOI4%s VF%u, VF%u\n", vu->vuID, destStr[dest], fs, ft);
+        std::printf("[VU%d       ] LQ%s VF%u, %d(VI%u)\n", vu->vuID, destStr[dest], ft, getImm11(instr), is);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF(ft, i, (u32)(i32)std::round((vu->getVF_F32(fs, i)) * 16.0));
-    }
+    loadQuad(vu, ft, dest, (vu->getVI(is) + getImm11(instr)) << 4);
 }
 
-/* Integer ADD */
-void iIADD(VectorUnit *vu, u32 instr) {
-    const auto id = getD(instr);
+/* Load Quadword Decrement */
+void iLQD(VectorUnit *vu, u32 instr) {
     const auto is = getS(instr);
-    const auto it = getT(instr);
+    const auto ft = getT(instr);
+
+    const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] IADD VI%u, VI%u, VI%u\n", vu->vuID, id, is, it);
+        std::printf("[VU%d       ] LQD%s VF%u, --(VI%u)\n", vu->vuID, destStr[dest], ft, is);
     }
 
-    vu->setVI(id, vu->getVI(is) + vu->getVI(it));
+    vu->setVI(is, vu->getVI(is) - 1);
+
+    loadQuad(vu, ft, dest, vu->getVI(is) << 4);
 }
 
-/* Integer Store Word Register */
-void iISWR(VectorUnit *vu, u32 instr) {
+/* Load Quadword Increment */
+void iLQI(VectorUnit *vu, u32 instr) {
     const auto is = getS(instr);
-    const auto it = getT(instr);
+    const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
-    const auto addr = vu->getVI(is) << 4;
-    const auto data = vu->getVI(it);
-
     if (doDisasm) {
-        std::printf("[VU%d       ] ISWR%s VI%u, (VI%u)\n", vu->vuID, destStr[dest], it, is);
+        std::printf("[VU%d       ] LQI%s VF%u, (VI%u)++\n", vu->vuID, destStr[dest], ft, is);
     }
 
-    if (dest & (1 << 0)) vu->writeData32(addr + 0xC, data);
-    if (dest & (1 << 1)) vu->writeData32(addr + 0x8, data);
-    if (dest & (1 << 2)) vu->writeData32(addr + 0x4, data);
-    if (dest & (1 << 3)) vu->writeData32(addr + 0x0, data);
+    loadQuad(vu, ft, dest, vu->getVI(is) << 4);
+
+    vu->setVI(is, vu->getVI(is) + 1);
 }
 
-/* Multiply-ADD to Accumulator with BroadCast */
-void iMADDAbc(VectorUnit *vu, u32 instr) {
-    const auto fs = getS(instr);
+/* Move From Integer Register */
+void iMFIR(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
     const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
-    const auto bc = instr & 3;
-
-    const auto t = vu->getVF_F32(ft, bc);
-
     if (doDisasm) {
-        std::printf("[VU%d       ] MADDA%s%s ACC, VF%u, VF%u\n", vu->vuID, bcStr[bc], destStr[dest], fs, ft);
+        std::printf("[VU%d       ] MFIR%s VF%u, VI%u\n", vu->vuID, destStr[dest], ft, is);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(ACC, i, vu->getVF_F32(fs, i) * t + vu->getVF_F32(ACC, i));
-    }
+    const auto data = (u32)(i16)vu->getVI(is);
+
+    vu->setVF128(ft, dest, u128{._u32 = {data, data, data, data}});
 }
 
-/* Multiply-ADD with BroadCast */
-void iMADDbc(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
+/* Move From P */
+void iMFP(VectorUnit *vu, u32 instr) {
     const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
-    const auto bc = instr & 3;
-
-    const auto t = vu->getVF_F32(ft, bc);
-
     if (doDisasm) {
-        std::printf("[VU%d       ] MADD%s%s VF%u, VF%u, VF%u\n", vu->vuID, bcStr[bc], destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] MFP%s VF%u, P\n", vu->vuID, destStr[dest], ft);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) * t + vu->getVF_F32(ACC, i));
-    }
+    const f32 res[4] = { vu->getP(), vu->getP(), vu->getP(), vu->getP() };
+
+    setVFResult(vu, ft, dest, res);
 }
 
 /* MOVE */
@@ -251,12 +1356,10 @@ void iMOVE(VectorUnit *vu, u32 instr) {
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] MOVE%s VF%u, VF%u\n", vu->vuID, destStr[dest], fs, ft);
+        std::printf("[VU%d       ] MOVE%s VF%u, VF%u\n", vu->vuID, destStr[dest], ft, fs);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fs, i, vu->getVF_F32(ft, i));
-    }
+    vu->setVF128(ft, dest, vu->getVF128(fs));
 }
 
 /* Move Rotate 32 */
@@ -267,16 +1370,40 @@ void iMR32(VectorUnit *vu, u32 instr) {
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] MR32%s VF%u, VF%u\n", vu->vuID, destStr[dest], fs, ft);
+        std::printf("[VU%d       ] MR32%s VF%u, VF%u\n", vu->vuID, destStr[dest], ft, fs);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fs, i, vu->getVF_F32(ft, (i + 1) & 3));
+    const auto data = vu->getVF128(fs);
+
+    vu->setVF128(ft, dest, u128{._u32 = {data._u32[1], data._u32[2], data._u32[3], data._u32[0]}});
+}
+
+/* Move To Integer Register */
+void iMTIR(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+    const auto it = getT(instr);
+
+    const auto fsf = getFSF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] MTIR VI%u, VF%u.%s\n", vu->vuID, it, fs, bcStr[fsf]);
+    }
+
+    vu->setVI(it, vu->getVF(fs, fsf));
+}
+
+/* NOP*/
+void iNOP(VectorUnit *vu, u32 instr) {
+    (void)instr;
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] NOP\n", vu->vuID);
     }
 }
 
-/* MULtiply */
-void iMUL(VectorUnit *vu, u32 instr) {
+/* Outer Product Multiply-SUBtract */
+template <FlagMode mode>
+void iOPMSUB(VectorUnit *vu, u32 instr) {
     const auto fd = getD(instr);
     const auto fs = getS(instr);
     const auto ft = getT(instr);
@@ -284,111 +1411,180 @@ void iMUL(VectorUnit *vu, u32 instr) {
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] MUL%s VF%u, VF%u, VF%u\n", vu->vuID, destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] OPMSUB%s VF%u, VF%u, VF%u\n", vu->vuID, destStr[dest], fd, fs, ft);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) * vu->getVF_F32(ft, i));
-    }
+#ifdef __SSE2__
+    const auto res = _mm_sub_ps(loadVF(vu, ACC), getOuterProduct(vu, fs, ft));
+
+    updateFlags<mode>(vu, res, 0xE);
+
+    storeVF(vu, fd, 0xE, clamp(res));
+#else
+    f32 res[4];
+
+    res[0] = vu->getVF_F32(ACC, 0) - vu->getVF_F32(fs, 1) * vu->getVF_F32(ft, 2);
+    res[1] = vu->getVF_F32(ACC, 1) - vu->getVF_F32(fs, 2) * vu->getVF_F32(ft, 0);
+    res[2] = vu->getVF_F32(ACC, 2) - vu->getVF_F32(fs, 0) * vu->getVF_F32(ft, 1);
+    res[3] = 0.0;
+
+    updateFlags<mode>(vu, res, 0xE);
+
+    for (int e = 0; e < 3; e++) res[e] = clamp(res[e]);
+
+    setVFResult(vu, fd, 0xE, res);
+#endif
 }
 
-/* MULtiply to Accumulator with BroadCast */
-void iMULAbc(VectorUnit *vu, u32 instr) {
+/* Outer Product MULtiply to Accumulator */
+template <FlagMode mode>
+void iOPMULA(VectorUnit *vu, u32 instr) {
     const auto fs = getS(instr);
     const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
-    const auto bc = instr & 3;
-
-    const auto t = vu->getVF_F32(ft, bc);
-
     if (doDisasm) {
-        std::printf("[VU%d       ] MULA%s%s ACC, VF%u, VF%u\n", vu->vuID, bcStr[bc], destStr[dest], fs, ft);
+        std::printf("[VU%d       ] OPMULA%s ACC, VF%u, VF%u\n", vu->vuID, destStr[dest], fs, ft);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(ACC, i, vu->getVF_F32(fs, i) * t);
-    }
+#ifdef __SSE2__
+    const auto res = getOuterProduct(vu, fs, ft);
+
+    updateFlags<mode>(vu, res, 0xE);
+
+    storeVF(vu, ACC, 0xE, clamp(res));
+#else
+    f32 res[4];
+
+    res[0] = vu->getVF_F32(fs, 1) * vu->getVF_F32(ft, 2);
+    res[1] = vu->getVF_F32(fs, 2) * vu->getVF_F32(ft, 0);
+    res[2] = vu->getVF_F32(fs, 0) * vu->getVF_F32(ft, 1);
+    res[3] = 0.0;
+
+    updateFlags<mode>(vu, res, 0xE);
+
+    for (int e = 0; e < 3; e++) res[e] = clamp(res[e]);
+
+    setVFResult(vu, ACC, 0xE, res);
+#endif
 }
 
-/* MULtiply with BroadCast */
-void iMULbc(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
+/* R GET */
+void iRGET(VectorUnit *vu, u32 instr) {
     const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
-    const auto bc = instr & 3;
+    if (doDisasm) {
+        std::printf("[VU%d       ] RGET%s VF%u, R\n", vu->vuID, destStr[dest], ft);
+    }
+
+    const auto r = vu->getR();
+
+    vu->setVF128(ft, dest, u128{._u32 = {r, r, r, r}});
+}
 
-    const auto t = vu->getVF_F32(ft, bc);
+/* R INIT */
+void iRINIT(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] MUL%s%s VF%u, VF%u, VF%u\n", vu->vuID, bcStr[bc], destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] RINIT R, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) * t);
-    }
+    vu->setR(vu->getVF(fs, fsf));
 }
 
-/* MULtiply Q */
-void iMULQ(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
+/* R NEXT */
+void iRNEXT(VectorUnit *vu, u32 instr) {
+    const auto ft = getT(instr);
 
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] MUL%s VF%u, VF%u, Q\n", vu->vuID, destStr[dest], fd, fs);
+        std::printf("[VU%d       ] RNEXT%s VF%u, R\n", vu->vuID, destStr[dest], ft);
     }
 
-    const auto q = vu->getQ();
+    /* 23-bit LFSR */
+    const auto r = vu->getR();
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) * q);
-    }
+    vu->setR((r << 1) | (((r >> 4) ^ (r >> 22)) & 1));
+
+    const auto data = vu->getR();
+
+    vu->setVF128(ft, dest, u128{._u32 = {data, data, data, data}});
 }
 
-/* NOP*/
-void iNOP(VectorUnit *vu) {
+/* R XOR */
+void iRXOR(VectorUnit *vu, u32 instr) {
+    const auto fs  = getS(instr);
+    const auto fsf = getFSF(instr);
+
     if (doDisasm) {
-        std::printf("[VU%d       ] NOP\n", vu->vuID);
+        std::printf("[VU%d       ] RXOR R, VF%u.%s\n", vu->vuID, fs, bcStr[fsf]);
     }
+
+    vu->setR(vu->getR() ^ vu->getVF(fs, fsf));
 }
 
-/* Outer Product Multiply-SUBtract */
-void iOPMSUB(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
+/* Reciprocal SQuare RooT */
+void iRSQRT(VectorUnit *vu, u32 instr) {
     const auto fs = getS(instr);
     const auto ft = getT(instr);
 
+    const auto fsf = getFSF(instr);
+    const auto ftf = getFTF(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] RSQRT Q, VF%u.%s, VF%u.%s\n", vu->vuID, fs, bcStr[fsf], ft, bcStr[ftf]);
+    }
+
+    const auto s = vu->getVF_F32(fs, fsf);
+    const auto t = vu->getVF_F32(ft, ftf);
+
+    if (t == 0.0) {
+        setFDIVFlags(vu, s == 0.0, s != 0.0);
+
+        vu->setNextQ(std::copysign(std::numeric_limits<f32>::max(), s), Latency::RSQRT);
+
+        return;
+    }
+
+    setFDIVFlags(vu, t < 0.0, false);
+
+    vu->setNextQ(s / std::sqrt(std::fabs(t)), Latency::RSQRT);
+}
+
+/* Store Quadword */
+void iSQ(VectorUnit *vu, u32 instr) {
+    const auto fs = getS(instr);
+    const auto it = getT(instr);
+
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] OPMSUB%s VF%u, VF%u, VF%u\n", vu->vuID, destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] SQ%s VF%u, %d(VI%u)\n", vu->vuID, destStr[dest], fs, getImm11(instr), it);
     }
 
-    vu->setVF_F32(fd, 0, vu->getVF_F32(ACC, 0) - vu->getVF_F32(fs, 1) * vu->getVF_F32(ft, 2));
-    vu->setVF_F32(fd, 1, vu->getVF_F32(ACC, 1) - vu->getVF_F32(fs, 2) * vu->getVF_F32(ft, 0));
-    vu->setVF_F32(fd, 2, vu->getVF_F32(ACC, 2) - vu->getVF_F32(fs, 0) * vu->getVF_F32(ft, 1));
+    storeQuad(vu, fs, dest, (vu->getVI(it) + getImm11(instr)) << 4);
 }
 
-/* Outer Product MULtiply to Accumulator */
-void iOPMULA(VectorUnit *vu, u32 instr) {
+/* Store Quadword Decrement */
+void iSQD(VectorUnit *vu, u32 instr) {
     const auto fs = getS(instr);
-    const auto ft = getT(instr);
+    const auto it = getT(instr);
 
     const auto dest = getDest(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] OPMULA%s ACC, VF%u, VF%u\n", vu->vuID, destStr[dest], fs, ft);
+        std::printf("[VU%d       ] SQD%s VF%u, --(VI%u)\n", vu->vuID, destStr[dest], fs, it);
     }
 
-    vu->setVF_F32(ACC, 0, vu->getVF_F32(fs, 1) * vu->getVF_F32(ft, 2));
-    vu->setVF_F32(ACC, 1, vu->getVF_F32(fs, 2) * vu->getVF_F32(ft, 0));
-    vu->setVF_F32(ACC, 2, vu->getVF_F32(fs, 0) * vu->getVF_F32(ft, 1));
+    vu->setVI(it, vu->getVI(it) - 1);
+
+    storeQuad(vu, fs, dest, vu->getVI(it) << 4);
 }
 
 /* Store Quadword Increment */
@@ -398,19 +1594,11 @@ void iSQI(VectorUnit *vu, u32 instr) {
 
     const auto dest = getDest(instr);
 
-    const auto addr = vu->getVI(it) << 4;
-
     if (doDisasm) {
-        std::printf("[VU%d       ] SQI%s VF%u%s, (VI%u)++\n", vu->vuID, destStr[dest], fs, destStr[dest], it);
+        std::printf("[VU%d       ] SQI%s VF%u, (VI%u)++\n", vu->vuID, destStr[dest], fs, it);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) {
-            const auto data = vu->getVF_F32(fs, i);
-
-            vu->writeData32(addr + 4 * i, *(u32 *)&data);
-        }
-    }
+    storeQuad(vu, fs, dest, vu->getVI(it) << 4);
 
     vu->setVI(it, vu->getVI(it) + 1);
 }
@@ -419,92 +1607,195 @@ void iSQI(VectorUnit *vu, u32 instr) {
 void iSQRT(VectorUnit *vu, u32 instr) {
     const auto ft = getT(instr);
 
-    const auto ftf = getDest(instr) >> 2;
+    const auto ftf = getFTF(instr);
 
     if (doDisasm) {
         std::printf("[VU%d       ] SQRT Q, VF%u.%s\n", vu->vuID, ft, bcStr[ftf]);
     }
 
-    vu->setQ(std::sqrtf(vu->getVF_F32(ft, ftf)));
+    const auto t = vu->getVF_F32(ft, ftf);
+
+    setFDIVFlags(vu, t < 0.0, false);
+
+    vu->setNextQ(std::sqrt(std::fabs(t)), Latency::SQRT);
 }
 
-/* SUBtract */
-void iSUB(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
-    const auto ft = getT(instr);
+/* Call Micro Subroutine (VU0 only) */
+void iVCALLMS(VectorUnit *vu, u32 instr) {
+    const auto addr = ((instr >> 6) & 0x7FFF) << 3;
 
-    const auto dest = getDest(instr);
+    if (doDisasm) {
+        std::printf("[VU%d       ] VCALLMS 0x%04X\n", vu->vuID, addr);
+    }
+
+    vu->startMicro(addr);
+}
+
+/* Call Micro Subroutine Register (VU0 only) */
+void iVCALLMSR(VectorUnit *vu, u32 instr) {
+    (void)instr;
 
     if (doDisasm) {
-        std::printf("[VU%d       ] SUB%s VF%u, VF%u, VF%u\n", vu->vuID, destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] VCALLMSR\n", vu->vuID);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF_F32(fd, i, vu->getVF_F32(fs, i) - vu->getVF_F32(ft, i));
+    vu->startMicro(vu->getControl(27) << 3); // CMSAR
+}
+
+/* WAIT P */
+void iWAITP(VectorUnit *vu, u32 instr) {
+    (void)instr;
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] WAITP\n", vu->vuID);
     }
+
+    vu->waitP();
 }
 
-/* SUBtract with BroadCast */
-void iSUBbc(VectorUnit *vu, u32 instr) {
-    const auto fd = getD(instr);
-    const auto fs = getS(instr);
-    const auto ft = getT(instr);
+/* WAIT Q */
+void iWAITQ(VectorUnit *vu, u32 instr) {
+    (void)instr;
 
-    const auto dest = getDest(instr);
+    if (doDisasm) {
+        std::printf("[VU%d       ] WAITQ\n", vu->vuID);
+    }
 
-    const auto bc = instr & 3;
+    vu->waitQ();
+}
 
-    const auto t = vu->getVF_F32(ft, bc);
+/* eXecute GIF KICK */
+void iXGKICK(VectorUnit *vu, u32 instr) {
+    const auto is = getS(instr);
 
     if (doDisasm) {
-        std::printf("[VU%d       ] SUB%s%s VF%u, VF%u, VF%u\n", vu->vuID, bcStr[bc], destStr[dest], fd, fs, ft);
+        std::printf("[VU%d       ] XGKICK VI%u\n", vu->vuID, is);
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (dest & (1 << (3 - i))) vu->setVF(fd, i, vu->getVF_F32(fs, i) - t);
+    vu->xgkick(vu->getVI(is));
+}
+
+/* eXecute ITOP */
+void iXITOP(VectorUnit *vu, u32 instr) {
+    const auto it = getT(instr);
+
+    if (doDisasm) {
+        std::printf("[VU%d       ] XITOP VI%u\n", vu->vuID, it);
     }
+
+    vu->setVI(it, vu->getITOP());
 }
 
-/* WAIT Q */
-void iWAITQ(VectorUnit *vu) {
+/* eXecute TOP */
+void iXTOP(VectorUnit *vu, u32 instr) {
+    const auto it = getT(instr);
+
     if (doDisasm) {
-        std::printf("[VU%d       ] WAITQ\n", vu->vuID);
+        std::printf("[VU%d       ] XTOP VI%u\n", vu->vuID, it);
     }
+
+    vu->setVI(it, vu->getTOP());
 }
 
-/* Executes a COP2 instruction (VU0 only) */
-void executeMacro(VectorUnit *vu, u32 instr) {
-    assert(!vu->vuID);
+/* --- VU instruction decoder --- */
 
+/* Returns the handler of a SPECIAL1/SPECIAL2 instruction (upper instructions, lower instructions with opcode 0x40 and COP2 macro instructions) */
+template <FlagMode mode>
+MicroFn decodeSpecial(u32 instr) {
     if ((instr & 0x3C) == 0x3C) {
         const auto opcode = ((instr >> 4) & 0x7C) | (instr & 3);
 
         switch (opcode) {
+            case SPECIAL2Opcode::VADDABC + 0:
+            case SPECIAL2Opcode::VADDABC + 1:
+            case SPECIAL2Opcode::VADDABC + 2:
+            case SPECIAL2Opcode::VADDABC + 3:
+                return &iFMAC<FMACOp::ADD, Operand::BC, true, mode>;
+            case SPECIAL2Opcode::VSUBABC + 0:
+            case SPECIAL2Opcode::VSUBABC + 1:
+            case SPECIAL2Opcode::VSUBABC + 2:
+            case SPECIAL2Opcode::VSUBABC + 3:
+                return &iFMAC<FMACOp::SUB, Operand::BC, true, mode>;
             case SPECIAL2Opcode::VMADDABC + 0:
             case SPECIAL2Opcode::VMADDABC + 1:
             case SPECIAL2Opcode::VMADDABC + 2:
             case SPECIAL2Opcode::VMADDABC + 3:
-                iMADDAbc(vu, instr);
-                break;
-            case SPECIAL2Opcode::VFTOI4     : iFTOI4(vu, instr); break;
+                return &iFMAC<FMACOp::MADD, Operand::BC, true, mode>;
+            case SPECIAL2Opcode::VMSUBABC + 0:
+            case SPECIAL2Opcode::VMSUBABC + 1:
+            case SPECIAL2Opcode::VMSUBABC + 2:
+            case SPECIAL2Opcode::VMSUBABC + 3:
+                return &iFMAC<FMACOp::MSUB, Operand::BC, true, mode>;
+            case SPECIAL2Opcode::VITOF0 : return &iITOF<0>;
+            case SPECIAL2Opcode::VITOF4 : return &iITOF<4>;
+            case SPECIAL2Opcode::VITOF12: return &iITOF<12>;
+            case SPECIAL2Opcode::VITOF15: return &iITOF<15>;
+            case SPECIAL2Opcode::VFTOI0 : return &iFTOI<0>;
+            case SPECIAL2Opcode::VFTOI4 : return &iFTOI<4>;
+            case SPECIAL2Opcode::VFTOI12: return &iFTOI<12>;
+            case SPECIAL2Opcode::VFTOI15: return &iFTOI<15>;
             case SPECIAL2Opcode::VMULABC + 0:
             case SPECIAL2Opcode::VMULABC + 1:
             case SPECIAL2Opcode::VMULABC + 2:
             case SPECIAL2Opcode::VMULABC + 3:
-                iMULAbc(vu, instr);
-                break;
-            case SPECIAL2Opcode::VOPMULA: iOPMULA(vu, instr); break;
-            case SPECIAL2Opcode::VNOP   : iNOP(vu); break;
-            case SPECIAL2Opcode::VMOVE  : iMOVE(vu, instr); break;
-            case SPECIAL2Opcode::VMR32  : iMR32(vu, instr); break;
-            case SPECIAL2Opcode::VSQI   : iSQI(vu, instr); break;
-            case SPECIAL2Opcode::VDIV   : iDIV(vu, instr); break;
-            case SPECIAL2Opcode::VSQRT  : iSQRT(vu, instr); break;
-            case SPECIAL2Opcode::VWAITQ : iWAITQ(vu); break;
-            case SPECIAL2Opcode::VISWR  : iISWR(vu, instr); break;
+                return &iFMAC<FMACOp::MUL, Operand::BC, true, mode>;
+            case SPECIAL2Opcode::VMULAQ  : return &iFMAC<FMACOp::MUL, Operand::Q, true, mode>;
+            case SPECIAL2Opcode::VABS    : return &iABS;
+            case SPECIAL2Opcode::VMULAI  : return &iFMAC<FMACOp::MUL, Operand::I, true, mode>;
+            case SPECIAL2Opcode::VCLIP   : return &iCLIP;
+            case SPECIAL2Opcode::VADDAQ  : return &iFMAC<FMACOp::ADD, Operand::Q, true, mode>;
+            case SPECIAL2Opcode::VMADDAQ : return &iFMAC<FMACOp::MADD, Operand::Q, true, mode>;
+            case SPECIAL2Opcode::VADDAI  : return &iFMAC<FMACOp::ADD, Operand::I, true, mode>;
+            case SPECIAL2Opcode::VMADDAI : return &iFMAC<FMACOp::MADD, Operand::I, true, mode>;
+            case SPECIAL2Opcode::VSUBAQ  : return &iFMAC<FMACOp::SUB, Operand::Q, true, mode>;
+            case SPECIAL2Opcode::VMSUBAQ : return &iFMAC<FMACOp::MSUB, Operand::Q, true, mode>;
+            case SPECIAL2Opcode::VSUBAI  : return &iFMAC<FMACOp::SUB, Operand::I, true, mode>;
+            case SPECIAL2Opcode::VMSUBAI : return &iFMAC<FMACOp::MSUB, Operand::I, true, mode>;
+            case SPECIAL2Opcode::VADDA   : return &iFMAC<FMACOp::ADD, Operand::VF, true, mode>;
+            case SPECIAL2Opcode::VMADDA  : return &iFMAC<FMACOp::MADD, Operand::VF, true, mode>;
+            case SPECIAL2Opcode::VMULA   : return &iFMAC<FMACOp::MUL, Operand::VF, true, mode>;
+            case SPECIAL2Opcode::VSUBA   : return &iFMAC<FMACOp::SUB, Operand::VF, true, mode>;
+            case SPECIAL2Opcode::VMSUBA  : return &iFMAC<FMACOp::MSUB, Operand::VF, true, mode>;
+            case SPECIAL2Opcode::VOPMULA : return &iOPMULA<mode>;
+            case SPECIAL2Opcode::VNOP    : return &iNOP;
+            case SPECIAL2Opcode::VMOVE   : return &iMOVE;
+            case SPECIAL2Opcode::VMR32   : return &iMR32;
+            case SPECIAL2Opcode::VLQI    : return &iLQI;
+            case SPECIAL2Opcode::VSQI    : return &iSQI;
+            case SPECIAL2Opcode::VLQD    : return &iLQD;
+            case SPECIAL2Opcode::VSQD    : return &iSQD;
+            case SPECIAL2Opcode::VDIV    : return &iDIV;
+            case SPECIAL2Opcode::VSQRT   : return &iSQRT;
+            case SPECIAL2Opcode::VRSQRT  : return &iRSQRT;
+            case SPECIAL2Opcode::VWAITQ  : return &iWAITQ;
+            case SPECIAL2Opcode::VMTIR   : return &iMTIR;
+            case SPECIAL2Opcode::VMFIR   : return &iMFIR;
+            case SPECIAL2Opcode::VILWR   : return &iILWR;
+            case SPECIAL2Opcode::VISWR   : return &iISWR;
+            case SPECIAL2Opcode::VRNEXT  : return &iRNEXT;
+            case SPECIAL2Opcode::VRGET   : return &iRGET;
+            case SPECIAL2Opcode::VRINIT  : return &iRINIT;
+            case SPECIAL2Opcode::VRXOR   : return &iRXOR;
+            case SPECIAL2Opcode::VMFP    : return &iMFP;
+            case SPECIAL2Opcode::VXTOP   : return &iXTOP;
+            case SPECIAL2Opcode::VXITOP  : return &iXITOP;
+            case SPECIAL2Opcode::VXGKICK : return &iXGKICK;
+            case SPECIAL2Opcode::VESADD  : return &iESADD;
+            case SPECIAL2Opcode::VERSADD : return &iERSADD;
+            case SPECIAL2Opcode::VELENG  : return &iELENG;
+            case SPECIAL2Opcode::VERLENG : return &iERLENG;
+            case SPECIAL2Opcode::VEATANXY: return &iEATANxy;
+            case SPECIAL2Opcode::VEATANXZ: return &iEATANxz;
+            case SPECIAL2Opcode::VESUM   : return &iESUM;
+            case SPECIAL2Opcode::VESQRT  : return &iESQRT;
+            case SPECIAL2Opcode::VERSQRT : return &iERSQRT;
+            case SPECIAL2Opcode::VERCPR  : return &iERCPR;
+            case SPECIAL2Opcode::VWAITP  : return &iWAITP;
+            case SPECIAL2Opcode::VESIN   : return &iESIN;
+            case SPECIAL2Opcode::VEATAN  : return &iEATAN;
+            case SPECIAL2Opcode::VEEXP   : return &iEEXP;
             default:
-                std::printf("[VU%d       ] Unhandled SPECIAL2 macro instruction 0x%02X (0x%08X)\n", vu->vuID, opcode, instr);
+                std::printf("[VU        ] Unhandled SPECIAL2 instruction 0x%02X (0x%08X)\n", opcode, instr);
 
                 exit(0);
         }
@@ -516,39 +1807,301 @@ void executeMacro(VectorUnit *vu, u32 instr) {
             case SPECIAL1Opcode::VADDBC + 1:
             case SPECIAL1Opcode::VADDBC + 2:
             case SPECIAL1Opcode::VADDBC + 3:
-                iADDbc(vu, instr);
-                break;
+                return &iFMAC<FMACOp::ADD, Operand::BC, false, mode>;
             case SPECIAL1Opcode::VSUBBC + 0:
             case SPECIAL1Opcode::VSUBBC + 1:
             case SPECIAL1Opcode::VSUBBC + 2:
             case SPECIAL1Opcode::VSUBBC + 3:
-                iSUBbc(vu, instr);
-                break;
+                return &iFMAC<FMACOp::SUB, Operand::BC, false, mode>;
             case SPECIAL1Opcode::VMADDBC + 0:
             case SPECIAL1Opcode::VMADDBC + 1:
             case SPECIAL1Opcode::VMADDBC + 2:
             case SPECIAL1Opcode::VMADDBC + 3:
-                iMADDbc(vu, instr);
-                break;
+                return &iFMAC<FMACOp::MADD, Operand::BC, false, mode>;
+            case SPECIAL1Opcode::VMSUBBC + 0:
+            case SPECIAL1Opcode::VMSUBBC + 1:
+            case SPECIAL1Opcode::VMSUBBC + 2:
+            case SPECIAL1Opcode::VMSUBBC + 3:
+                return &iFMAC<FMACOp::MSUB, Operand::BC, false, mode>;
+            case SPECIAL1Opcode::VMAXBC + 0:
+            case SPECIAL1Opcode::VMAXBC + 1:
+            case SPECIAL1Opcode::VMAXBC + 2:
+            case SPECIAL1Opcode::VMAXBC + 3:
+                return &iFMAC<FMACOp::MAX, Operand::BC, false, mode>;
+            case SPECIAL1Opcode::VMINIBC + 0:
+            case SPECIAL1Opcode::VMINIBC + 1:
+            case SPECIAL1Opcode::VMINIBC + 2:
+            case SPECIAL1Opcode::VMINIBC + 3:
+                return &iFMAC<FMACOp::MINI, Operand::BC, false, mode>;
             case SPECIAL1Opcode::VMULBC + 0:
             case SPECIAL1Opcode::VMULBC + 1:
             case SPECIAL1Opcode::VMULBC + 2:
             case SPECIAL1Opcode::VMULBC + 3:
-                iMULbc(vu, instr);
-                break;
-            case SPECIAL1Opcode::VMULQ  : iMULQ(vu, instr); break;
-            case SPECIAL1Opcode::VADDQ  : iADDQ(vu, instr); break;
-            case SPECIAL1Opcode::VADD   : iADD(vu, instr); break;
-            case SPECIAL1Opcode::VMUL   : iMUL(vu, instr); break;
-            case SPECIAL1Opcode::VSUB   : iSUB(vu, instr); break;
-            case SPECIAL1Opcode::VOPMSUB: iOPMSUB(vu, instr); break;
-            case SPECIAL1Opcode::VIADD  : iIADD(vu, instr); break;
+                return &iFMAC<FMACOp::MUL, Operand::BC, false, mode>;
+            case SPECIAL1Opcode::VMULQ   : return &iFMAC<FMACOp::MUL, Operand::Q, false, mode>;
+            case SPECIAL1Opcode::VMAXI   : return &iFMAC<FMACOp::MAX, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VMULI   : return &iFMAC<FMACOp::MUL, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VMINII  : return &iFMAC<FMACOp::MINI, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VADDQ   : return &iFMAC<FMACOp::ADD, Operand::Q, false, mode>;
+            case SPECIAL1Opcode::VMADDQ  : return &iFMAC<FMACOp::MADD, Operand::Q, false, mode>;
+            case SPECIAL1Opcode::VADDI   : return &iFMAC<FMACOp::ADD, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VMADDI  : return &iFMAC<FMACOp::MADD, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VSUBQ   : return &iFMAC<FMACOp::SUB, Operand::Q, false, mode>;
+            case SPECIAL1Opcode::VMSUBQ  : return &iFMAC<FMACOp::MSUB, Operand::Q, false, mode>;
+            case SPECIAL1Opcode::VSUBI   : return &iFMAC<FMACOp::SUB, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VMSUBI  : return &iFMAC<FMACOp::MSUB, Operand::I, false, mode>;
+            case SPECIAL1Opcode::VADD    : return &iFMAC<FMACOp::ADD, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VMADD   : return &iFMAC<FMACOp::MADD, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VMUL    : return &iFMAC<FMACOp::MUL, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VMAX    : return &iFMAC<FMACOp::MAX, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VSUB    : return &iFMAC<FMACOp::SUB, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VMSUB   : return &iFMAC<FMACOp::MSUB, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VOPMSUB : return &iOPMSUB<mode>;
+            case SPECIAL1Opcode::VMINI   : return &iFMAC<FMACOp::MINI, Operand::VF, false, mode>;
+            case SPECIAL1Opcode::VIADD   : return &iIADD;
+            case SPECIAL1Opcode::VISUB   : return &iISUB;
+            case SPECIAL1Opcode::VIADDI  : return &iIADDI;
+            case SPECIAL1Opcode::VIAND   : return &iIAND;
+            case SPECIAL1Opcode::VIOR    : return &iIOR;
+            case SPECIAL1Opcode::VCALLMS : return &iVCALLMS;
+            case SPECIAL1Opcode::VCALLMSR: return &iVCALLMSR;
             default:
-                std::printf("[VU%d       ] Unhandled SPECIAL1 macro instruction 0x%02X (0x%08X)\n", vu->vuID, opcode, instr);
+                std::printf("[VU        ] Unhandled SPECIAL1 instruction 0x%02X (0x%08X)\n", opcode, instr);
 
                 exit(0);
         }
     }
 }
 
+/* Returns the handler of a lower instruction */
+MicroFn decodeLower(u32 instr) {
+    const auto opcode = instr >> 25;
+
+    switch (opcode) {
+        case LowerOpcode::LQ     : return &iLQ;
+        case LowerOpcode::SQ     : return &iSQ;
+        case LowerOpcode::ILW    : return &iILW;
+        case LowerOpcode::ISW    : return &iISW;
+        case LowerOpcode::IADDIU : return &iIADDIU;
+        case LowerOpcode::ISUBIU : return &iISUBIU;
+        case LowerOpcode::FCEQ   : return &iFCEQ;
+        case LowerOpcode::FCSET  : return &iFCSET;
+        case LowerOpcode::FCAND  : return &iFCAND;
+        case LowerOpcode::FCOR   : return &iFCOR;
+        case LowerOpcode::FSEQ   : return &iFSEQ;
+        case LowerOpcode::FSSET  : return &iFSSET;
+        case LowerOpcode::FSAND  : return &iFSAND;
+        case LowerOpcode::FSOR   : return &iFSOR;
+        case LowerOpcode::FMEQ   : return &iFMEQ;
+        case LowerOpcode::FMAND  : return &iFMAND;
+        case LowerOpcode::FMOR   : return &iFMOR;
+        case LowerOpcode::FCGET  : return &iFCGET;
+        case LowerOpcode::B      : return &iB;
+        case LowerOpcode::BAL    : return &iBAL;
+        case LowerOpcode::JR     : return &iJR;
+        case LowerOpcode::JALR   : return &iJALR;
+        case LowerOpcode::IBEQ   : return &iIB<LowerOpcode::IBEQ>;
+        case LowerOpcode::IBNE   : return &iIB<LowerOpcode::IBNE>;
+        case LowerOpcode::IBLTZ  : return &iIB<LowerOpcode::IBLTZ>;
+        case LowerOpcode::IBGTZ  : return &iIB<LowerOpcode::IBGTZ>;
+        case LowerOpcode::IBLEZ  : return &iIB<LowerOpcode::IBLEZ>;
+        case LowerOpcode::IBGEZ  : return &iIB<LowerOpcode::IBGEZ>;
+        case LowerOpcode::SPECIAL: return decodeSpecial<FlagMode::Update>(instr);
+        default:
+            std::printf("[VU        ] Unhandled lower instruction 0x%02X (0x%08X)\n", opcode, instr);
+
+            exit(0);
+    }
+}
+
+/* Returns a mask of VF registers read by an upper instruction (ACC excluded) */
+u64 getUpperSources(u32 instr) {
+    if ((instr & 0x3C) == 0x3C) {
+        const auto opcode = ((instr >> 4) & 0x7C) | (instr & 3);
+
+        if (opcode == SPECIAL2Opcode::VNOP) return 0;
+    }
+
+    return (1ull << getS(instr)) | (1ull << getT(instr));
+}
+
+/* Returns the VF register written by an upper instruction, 0 if none */
+u32 getUpperDest(u32 instr) {
+    if ((instr & 0x3C) != 0x3C) return getD(instr);
+
+    const auto opcode = ((instr >> 4) & 0x7C) | (instr & 3);
+
+    switch (opcode) {
+        case SPECIAL2Opcode::VITOF0: case SPECIAL2Opcode::VITOF4: case SPECIAL2Opcode::VITOF12: case SPECIAL2Opcode::VITOF15:
+        case SPECIAL2Opcode::VFTOI0: case SPECIAL2Opcode::VFTOI4: case SPECIAL2Opcode::VFTOI12: case SPECIAL2Opcode::VFTOI15:
+        case SPECIAL2Opcode::VABS:
+            return getT(instr);
+        case SPECIAL2Opcode::VCLIP:
+        case SPECIAL2Opcode::VNOP:
+            return 0;
+        default:
+            return ACC;
+    }
+}
+
+/* Returns a mask of VF registers read by a lower instruction */
+u64 getLowerSources(u32 instr) {
+    switch (instr >> 25) {
+        case LowerOpcode::SQ     : return 1ull << getS(instr);
+        case LowerOpcode::SPECIAL: return (1ull << getS(instr)) | (1ull << getT(instr));
+        default                  : return 0;
+    }
+}
+
+/* Returns the VF register written by a lower instruction, 0 if none */
+u32 getLowerDest(u32 instr) {
+    switch (instr >> 25) {
+        case LowerOpcode::LQ: return getT(instr);
+        case LowerOpcode::SPECIAL:
+            if ((instr & 0x3C) != 0x3C) return 0;
+
+            switch (((instr >> 4) & 0x7C) | (instr & 3)) {
+                case SPECIAL2Opcode::VMOVE:
+                case SPECIAL2Opcode::VMR32:
+                case SPECIAL2Opcode::VLQI:
+                case SPECIAL2Opcode::VLQD:
+                case SPECIAL2Opcode::VMFIR:
+                case SPECIAL2Opcode::VRNEXT:
+                case SPECIAL2Opcode::VRGET:
+                case SPECIAL2Opcode::VMFP:
+                    return getT(instr);
+                default:
+                    return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+/* Returns true if an upper instruction writes MAC and status flags */
+bool isFlagWriter(u32 instr) {
+    const auto opcode = ((instr & 0x3C) == 0x3C) ? (((instr >> 4) & 0x7C) | (instr & 3)) : (instr & 0x3F);
+
+    /* SPECIAL1 and SPECIAL2 use the same encoding for FMAC instructions (ADD, MADDA, OPMSUB, OPMULA...) */
+    if (opcode < 0x10) return true;
+
+    switch (opcode) {
+        case 0x18: case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1E:
+        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
+        case 0x28: case 0x29: case 0x2A: case 0x2C: case 0x2D: case 0x2E:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Returns true if a lower instruction reads MAC or status flags */
+bool isFlagReader(u32 instr) {
+    switch (instr >> 25) {
+        case LowerOpcode::FSEQ:
+        case LowerOpcode::FSSET:
+        case LowerOpcode::FSAND:
+        case LowerOpcode::FSOR:
+        case LowerOpcode::FMEQ:
+        case LowerOpcode::FMAND:
+        case LowerOpcode::FMOR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Returns true if a lower instruction is a branch or jump */
+bool isBranch(u32 instr) {
+    const auto opcode = instr >> 25;
+
+    return (opcode >= LowerOpcode::B) && (opcode <= LowerOpcode::IBGEZ);
+}
+
+/*
+ * Returns true if the MAC and status flags written by the upper instruction at addr can be read.
+ *
+ * Flags are dead once another FMAC instruction overwrites them before any FMAND/FSAND...
+ * Sticky status flags are always set (see FlagMode::Skip), so they don't keep a result alive.
+ * Branches, the end of the micro program and the end of the scan window keep flags
+ * that haven't been overwritten alive.
+ */
+bool isFlagLive(VectorUnit *vu, u32 addr) {
+    const auto memMask = (vu->getDataMask() << 4) | 0xF;
+
+    for (u32 i = 0; i < FLAG_SCAN_PAIRS; i++) {
+        const auto instr = vu->readMicro64((addr + 8 * i) & memMask);
+
+        const auto upper = (u32)(instr >> 32);
+        const auto lower = (u32)instr;
+
+        const auto hasLower = !(upper & UpperBits::I);
+
+        if (hasLower && isFlagReader(lower)) return true;
+
+        if (i && isFlagWriter(upper)) return false;
+
+        if ((upper & UpperBits::E) || (hasLower && isBranch(lower))) return true;
+    }
+
+    return true;
+}
+
+/* Decodes the micro instruction pair at addr */
+MicroInstr decodeMicro(VectorUnit *vu, u32 addr) {
+    MicroInstr microInstr;
+
+    const auto instr = vu->readMicro64(addr);
+
+    const auto upper = (u32)(instr >> 32);
+    const auto lower = (u32)instr;
+
+    microInstr.upperInstr = upper;
+    microInstr.lowerInstr = lower;
+
+    microInstr.isFlagLive = isFlagWriter(upper) && isFlagLive(vu, addr);
+
+    microInstr.upper = (microInstr.isFlagLive) ? decodeSpecial<FlagMode::Update>(upper) : decodeSpecial<FlagMode::Skip>(upper);
+    microInstr.lower = (upper & UpperBits::I) ? &iLOI : decodeLower(lower);
+
+    microInstr.isEnd = upper & UpperBits::E;
+
+    /* Find an execution order that keeps both instructions from seeing each other's results */
+    const auto upperDst = getUpperDest(upper);
+    const auto lowerDst = (upper & UpperBits::I) ? 0 : getLowerDest(lower);
+
+    const auto lowerSrcs = (upper & UpperBits::I) ? 0 : getLowerSources(lower);
+
+    const auto isLowerReadingUpper = upperDst && (upperDst != ACC) && (lowerSrcs & (1ull << upperDst));
+    const auto isUpperReadingLower = lowerDst && (getUpperSources(upper) & (1ull << lowerDst));
+
+    /* If both instructions write the same register, the upper result is kept */
+    const auto isSameDst = lowerDst && (lowerDst == upperDst);
+
+    if ((isLowerReadingUpper || isSameDst) && isUpperReadingLower) {
+        microInstr.order = PairOrder::Stash;
+    } else if (isLowerReadingUpper || isSameDst) {
+        microInstr.order = PairOrder::LowerFirst;
+    } else {
+        microInstr.order = PairOrder::UpperFirst;
+    }
+
+    microInstr.upperDst = upperDst;
+
+    microInstr.isValid = true;
+
+    return microInstr;
+}
+
+/* Executes a COP2 instruction (VU0 only) */
+void executeMacro(VectorUnit *vu, u32 instr) {
+    assert(!vu->vuID);
+
+    /* Macro flags are only calculated if the EE (CFC2) or a micro program reads them */
+    decodeSpecial<FlagMode::Defer>(instr)(vu, instr);
+
+    /* FDIV latency isn't emulated in macro mode */
+    vu->waitQ();
+}
+
 }
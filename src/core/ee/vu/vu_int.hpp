@@ -10,6 +10,36 @@
 
 namespace ps2::ee::vu::interpreter {
 
+/* Number of pairs the flag liveness analysis looks ahead */
+constexpr u32 FLAG_SCAN_PAIRS = 16;
+
+/* FDIV/EFU latencies, Q and P are written this many pairs after the instruction */
+enum Latency : u32 {
+    DIV     = 7,
+    SQRT    = 7,
+    RSQRT   = 13,
+    EATAN   = 54,
+    EATANxy = 54,
+    EATANxz = 54,
+    EEXP    = 44,
+    ELENG   = 18,
+    ERCPR   = 12,
+    ERLENG  = 24,
+    ERSADD  = 18,
+    ERSQRT  = 18,
+    ESADD   = 11,
+    ESIN    = 29,
+    ESQRT   = 12,
+    ESUM    = 12,
+};
+
+MicroInstr decodeMicro(VectorUnit *vu, u32 addr);
+
 void executeMacro(VectorUnit *vu, u32 instr);
 
+void setFMACFlags(VectorUnit *vu, const f32 *res, u32 dest);
+
+u16 getStickyFlags(const f32 *res, u32 dest);
+void setStickyFlags(VectorUnit *vu, const f32 *res, u32 dest);
+
 }
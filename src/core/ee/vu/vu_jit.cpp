@@ -0,0 +1,1384 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#include "vu_jit.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define VU_JIT_X64
+
+#include <sys/mman.h>
+#endif
+
+#include "vu_int.hpp"
+
+namespace ps2::ee::vu::jit {
+
+#ifdef VU_JIT_X64
+
+/* --- JIT constants --- */
+
+constexpr u64 CODE_SIZE = 4 << 20; // Per VU
+
+constexpr u32 MAX_BLOCK_PAIRS = 256;
+
+constexpr u32 ACC = 32;
+
+/* XMM0-XMM3 are scratch registers, XMM4-XMM15 hold VF registers */
+constexpr int FIRST_CACHE_XMM = 4;
+constexpr int CACHE_XMMS = 12;
+
+/* --- x86-64 registers and opcodes --- */
+
+enum Reg {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSI = 6,
+    RDI = 7,
+};
+
+/* ALU opcode extensions (0x81) */
+enum ALUExt {
+    ADD = 0,
+    OR  = 1,
+    AND = 4,
+    SUB = 5,
+};
+
+/* Shift opcode extensions (0xC1) */
+enum ShiftExt {
+    SHL = 4,
+    SHR = 5,
+};
+
+enum SSEOpcode {
+    MOVUPS_LOAD  = 0x10,
+    MOVUPS_STORE = 0x11,
+    MOVAPS       = 0x28,
+    MOVMSKPS     = 0x50,
+    SQRTPS       = 0x51,
+    ANDPS        = 0x54,
+    ANDNPS       = 0x55,
+    ORPS         = 0x56,
+    XORPS        = 0x57,
+    ADDPS        = 0x58,
+    MULPS        = 0x59,
+    SUBPS        = 0x5C,
+    MINPS        = 0x5D,
+    DIVPS        = 0x5E,
+    MAXPS        = 0x5F,
+    CMPPS        = 0xC2,
+    SHUFPS       = 0xC6,
+    PCMPEQD      = 0x76, // 0x66 prefix
+    PXOR         = 0xEF, // 0x66 prefix
+};
+
+/* Upper instruction bits */
+enum UpperBits {
+    E = 1 << 30,
+    I = 1 << 31,
+};
+
+enum class FMACOp {
+    ADD, SUB, MUL, MADD, MSUB, MAX, MINI,
+};
+
+enum class Operand {
+    VF, BC, Q, I,
+};
+
+/* Decoded FMAC instruction */
+struct FMACInfo {
+    FMACOp op;
+    Operand operand;
+
+    bool isACC;
+};
+
+/* Compiled block, covers a run of instruction pairs without control flow */
+struct Block {
+    const u8 *code;
+
+    u32 pairs;
+
+    bool isValid;
+};
+
+/* Blocks compiled from one micro memory image */
+struct Program {
+    std::vector<Block> blocks; // Indexed like micro memory
+};
+
+/* Per-VU JIT state */
+struct JITState {
+    u8 *codeBase, *codePtr;
+
+    std::unordered_map<u64, Program> programs; // Keyed by micro memory hash
+
+    Program *program;
+
+    bool isDirty; // Set by micro memory writes
+};
+
+/* Q or P pipeline of the block being compiled */
+struct Pipeline {
+    bool isKnown; // An FDIV/EFU instruction or WAITQ/WAITP was compiled, results from earlier blocks are tracked at run time
+
+    u32 latency; // Pairs until the result is written
+};
+
+/* VF register held in a host XMM register */
+struct CachedVF {
+    int idx; // -1 if the XMM register is free
+
+    bool isDirty; // Has to be written back
+
+    u32 lastUse;
+};
+
+/* Lane masks for every dest value */
+alignas(16) constexpr auto destMasks = [] {
+    std::array<std::array<u32, 4>, 16> masks{};
+
+    for (u32 dest = 0; dest < 16; dest++) {
+        for (int e = 0; e < 4; e++) masks[dest][e] = (dest & (1 << (3 - e))) ? 0xFFFFFFFF : 0;
+    }
+
+    return masks;
+}();
+
+/* FMAC results are clamped to +/-MAX_FLOAT like in the interpreter */
+struct alignas(16) JITConsts {
+    u32 clampMax[4], clampMin[4];
+    u32 expMask[4], mantMask[4]; // Flag calculation
+    u32 signMask[4], absMask[4];
+    u32 one[4];
+};
+
+constexpr JITConsts jitConsts = {
+    {0x7F7FFFFF, 0x7F7FFFFF, 0x7F7FFFFF, 0x7F7FFFFF},
+    {0xFF7FFFFF, 0xFF7FFFFF, 0xFF7FFFFF, 0xFF7FFFFF},
+    {0x7F800000, 0x7F800000, 0x7F800000, 0x7F800000},
+    {0x007FFFFF, 0x007FFFFF, 0x007FFFFF, 0x007FFFFF},
+    {0x80000000, 0x80000000, 0x80000000, 0x80000000},
+    {0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF},
+    {0x3F800000, 0x3F800000, 0x3F800000, 0x3F800000},
+};
+
+JITState state[2];
+
+bool isEnabled = true;
+
+thread_local u8 *code; // Emitter output
+
+/* VF registers cached by the block being compiled, written back on handler calls and at the end of the block */
+thread_local std::array<CachedVF, CACHE_XMMS> vfCache;
+thread_local u32 useCounter;
+
+thread_local Pipeline qPipe, pPipe;
+
+/* --- Code emitter --- */
+
+void emit8(u8 data) {
+    *code++ = data;
+}
+
+void emit32(u32 data) {
+    std::memcpy(code, &data, sizeof(u32));
+
+    code += sizeof(u32);
+}
+
+void emit64(u64 data) {
+    std::memcpy(code, &data, sizeof(u64));
+
+    code += sizeof(u64);
+}
+
+/* Emits a REX prefix if XMM8-XMM15 are used */
+void emitREX(int reg, int rm) {
+    if ((reg | rm) & 8) emit8(0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+}
+
+/* Emits [RBX + disp32] */
+void emitBase(u32 reg, i32 disp) {
+    emit8(0x80 | ((reg & 7) << 3) | Reg::RBX);
+    emit32(disp);
+}
+
+/* Emits [RBX + RAX + disp32] */
+void emitBaseIndex(u32 reg, i32 disp) {
+    emit8(0x84 | ((reg & 7) << 3));
+    emit8((Reg::RAX << 3) | Reg::RBX);
+    emit32(disp);
+}
+
+/* MOV r64, imm64 */
+void emitMovImm64(Reg reg, u64 imm) {
+    emit8(0x48);
+    emit8(0xB8 + reg);
+    emit64(imm);
+}
+
+/* MOV r32, imm32 */
+void emitMovImm32(Reg reg, u32 imm) {
+    emit8(0xB8 + reg);
+    emit32(imm);
+}
+
+/* CALL through RAX */
+void emitCall(const void *fn) {
+    emitMovImm64(Reg::RAX, (u64)fn);
+
+    emit8(0xFF);
+    emit8(0xD0);
+}
+
+/* MOVZX r32, WORD [RBX + disp32] */
+void emitLoad16(Reg reg, i32 disp) {
+    emit8(0x0F);
+    emit8(0xB7);
+    emitBase(reg, disp);
+}
+
+/* MOV WORD [RBX + disp32], r16 */
+void emitStore16(Reg reg, i32 disp) {
+    emit8(0x66);
+    emit8(0x89);
+    emitBase(reg, disp);
+}
+
+/* MOV r32, DWORD [RBX + disp32] */
+void emitLoad32(Reg reg, i32 disp) {
+    emit8(0x8B);
+    emitBase(reg, disp);
+}
+
+/* MOV DWORD [RBX + disp32], r32 */
+void emitStore32(Reg reg, i32 disp) {
+    emit8(0x89);
+    emitBase(reg, disp);
+}
+
+/* MOV DWORD [RBX + disp32], imm32 */
+void emitStoreImm32(i32 disp, u32 imm) {
+    emit8(0xC7);
+    emitBase(0, disp);
+    emit32(imm);
+}
+
+/* Jcc rel8 (JZ = 0x74, JNZ = 0x75), returns the displacement to patch */
+u8 *emitJcc8(u8 opcode) {
+    emit8(opcode);
+    emit8(0);
+
+    return code - 1;
+}
+
+/* Points a Jcc rel8 at the current emitter position */
+void setJumpTarget(u8 *disp) {
+    *disp = (u8)(code - (disp + 1));
+}
+
+/* ALU EAX, imm32 (ADD = 0x05, SUB = 0x2D, AND = 0x25) */
+void emitALUImm(u8 opcode, u32 imm) {
+    emit8(opcode);
+    emit32(imm);
+}
+
+/* ALU EAX, ECX (ADD = 0x01, SUB = 0x29, AND = 0x21, OR = 0x09) */
+void emitALU(u8 opcode) {
+    emit8(opcode);
+    emit8(0xC0 | (Reg::RCX << 3) | Reg::RAX);
+}
+
+/* SHL EAX, imm8 */
+void emitShl(u8 imm) {
+    emit8(0xC1);
+    emit8(0xE0);
+    emit8(imm);
+}
+
+/* ALU r32, imm32 */
+void emitALURegImm(ALUExt ext, Reg reg, u32 imm) {
+    emit8(0x81);
+    emit8(0xC0 | (ext << 3) | reg);
+    emit32(imm);
+}
+
+/* ALU r32, r32 (ADD = 0x01, OR = 0x09, AND = 0x21, MOV = 0x89) */
+void emitALUReg(u8 opcode, Reg dst, Reg src) {
+    emit8(opcode);
+    emit8(0xC0 | (src << 3) | dst);
+}
+
+/* Shift r32, imm8 */
+void emitShiftReg(ShiftExt ext, Reg reg, u8 imm) {
+    emit8(0xC1);
+    emit8(0xC0 | (ext << 3) | reg);
+    emit8(imm);
+}
+
+/* SSE xmm, xmm */
+void emitSSE(SSEOpcode opcode, int dst, int src) {
+    emitREX(dst, src);
+    emit8(0x0F);
+    emit8(opcode);
+    emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+/* SSE scalar xmm, xmm */
+void emitSSEScalar(SSEOpcode opcode, int dst, int src) {
+    emit8(0xF3);
+    emitSSE(opcode, dst, src);
+}
+
+/* CMPPS xmm, xmm, imm8 (EQ = 0, LT = 1) */
+void emitCmpps(int dst, int src, u8 pred) {
+    emitSSE(SSEOpcode::CMPPS, dst, src);
+    emit8(pred);
+}
+
+/* SSE2 integer xmm, xmm */
+void emitSSE2(SSEOpcode opcode, int dst, int src) {
+    emit8(0x66);
+    emitSSE(opcode, dst, src);
+}
+
+/* SSE xmm, [RBX + disp32] */
+void emitSSEBase(SSEOpcode opcode, int xmm, i32 disp) {
+    emitREX(xmm, 0);
+    emit8(0x0F);
+    emit8(opcode);
+    emitBase(xmm, disp);
+}
+
+/* SSE xmm, [RBX + RAX + disp32] */
+void emitSSEBaseIndex(SSEOpcode opcode, int xmm, i32 disp) {
+    emitREX(xmm, 0);
+    emit8(0x0F);
+    emit8(opcode);
+    emitBaseIndex(xmm, disp);
+}
+
+/* SSE xmm, [RAX + disp8] (XMM0-XMM7 only) */
+void emitSSERAX(SSEOpcode opcode, int xmm, u8 disp) {
+    emit8(0x0F);
+    emit8(opcode);
+    emit8(0x40 | (xmm << 3) | Reg::RAX);
+    emit8(disp);
+}
+
+/* MOVMSKPS r32, xmm (XMM0-XMM7 only) */
+void emitMovmskps(Reg reg, int xmm) {
+    emit8(0x0F);
+    emit8(SSEOpcode::MOVMSKPS);
+    emit8(0xC0 | (reg << 3) | xmm);
+}
+
+/* SHUFPS xmm, xmm, imm8 */
+void emitShufps(int dst, int src, u8 imm) {
+    emitSSE(SSEOpcode::SHUFPS, dst, src);
+    emit8(imm);
+}
+
+/* MOVSS xmm, [RBX + disp32] */
+void emitMovssLoad(int xmm, i32 disp) {
+    emit8(0xF3);
+    emitSSEBase(SSEOpcode::MOVUPS_LOAD, xmm, disp);
+}
+
+/* MOVSS [RBX + disp32], xmm */
+void emitMovssStore(int xmm, i32 disp) {
+    emit8(0xF3);
+    emitSSEBase(SSEOpcode::MOVUPS_STORE, xmm, disp);
+}
+
+/* MOVUPS xmm, [RAX] */
+void emitLoadRAX(int xmm) {
+    emit8(0x0F);
+    emit8(SSEOpcode::MOVUPS_LOAD);
+    emit8((xmm << 3) | Reg::RAX);
+}
+
+/* MOVUPS [RAX], xmm */
+void emitStoreRAX(int xmm) {
+    emit8(0x0F);
+    emit8(SSEOpcode::MOVUPS_STORE);
+    emit8((xmm << 3) | Reg::RAX);
+}
+
+/* Merges the dest elements of XMM0 into XMM2, result in XMM0 */
+void emitBlend(u32 dest) {
+    emitMovImm64(Reg::RAX, (u64)destMasks[dest].data());
+    emitLoadRAX(3);
+
+    emitSSE(SSEOpcode::ANDPS, 0, 3);
+    emitSSE(SSEOpcode::ANDNPS, 3, 2);
+    emitSSE(SSEOpcode::ORPS, 0, 3);
+}
+
+/* --- Register file offsets --- */
+
+i32 getVFOffset(VectorUnit *vu, u32 idx) {
+    return (i32)((u8 *)vu->getVFAddr(idx) - (u8 *)vu);
+}
+
+i32 getVIOffset(VectorUnit *vu, u32 idx) {
+    return (i32)((u8 *)vu->getVIAddr(idx) - (u8 *)vu);
+}
+
+i32 getMemOffset(VectorUnit *vu) {
+    return (i32)((u8 *)vu->getDataMem() - (u8 *)vu);
+}
+
+/* Q/P register, result in flight and latency offsets */
+i32 getPipeOffset(VectorUnit *vu, bool isP) {
+    return (i32)((u8 *)((isP) ? vu->getPAddr() : vu->getQAddr()) - (u8 *)vu);
+}
+
+i32 getNextOffset(VectorUnit *vu, bool isP) {
+    return (i32)((u8 *)((isP) ? vu->getNextPAddr() : vu->getNextQAddr()) - (u8 *)vu);
+}
+
+i32 getLatencyOffset(VectorUnit *vu, bool isP) {
+    return (i32)((u8 *)((isP) ? vu->getPLatencyAddr() : vu->getQLatencyAddr()) - (u8 *)vu);
+}
+
+i32 getMACOffset(VectorUnit *vu) {
+    return (i32)((u8 *)vu->getMACAddr() - (u8 *)vu);
+}
+
+i32 getStatusOffset(VectorUnit *vu) {
+    return (i32)((u8 *)vu->getStatusAddr() - (u8 *)vu);
+}
+
+/* --- VF register cache --- */
+
+/* Empties the VF register cache */
+void resetVFCache() {
+    for (auto &c : vfCache) c = {-1, false, 0};
+}
+
+/* Writes back dirty VF registers, empties the cache if the XMM registers get clobbered */
+void flushVFCache(VectorUnit *vu, bool isClobbered) {
+    for (int i = 0; i < CACHE_XMMS; i++) {
+        auto &c = vfCache[i];
+
+        if (c.idx < 0) continue;
+
+        if (c.isDirty) emitSSEBase(SSEOpcode::MOVUPS_STORE, FIRST_CACHE_XMM + i, getVFOffset(vu, c.idx));
+
+        c.isDirty = false;
+
+        if (isClobbered) c.idx = -1;
+    }
+}
+
+/* Returns the XMM register holding a VF register, the register isn't loaded if it's about to be overwritten */
+int getCachedVF(VectorUnit *vu, u32 idx, bool isLoad) {
+    int slot = 0;
+
+    /* Free XMM registers have rank 0, otherwise the least recently used one is replaced */
+    const auto rank = [](const CachedVF &c) { return (c.idx < 0) ? 0 : c.lastUse; };
+
+    for (int i = 0; i < CACHE_XMMS; i++) {
+        if (vfCache[i].idx == (int)idx) {
+            vfCache[i].lastUse = ++useCounter;
+
+            return FIRST_CACHE_XMM + i;
+        }
+
+        if (rank(vfCache[i]) < rank(vfCache[slot])) slot = i;
+    }
+
+    auto &c = vfCache[slot];
+
+    const auto xmm = FIRST_CACHE_XMM + slot;
+
+    if ((c.idx >= 0) && c.isDirty) emitSSEBase(SSEOpcode::MOVUPS_STORE, xmm, getVFOffset(vu, c.idx));
+
+    if (isLoad) emitSSEBase(SSEOpcode::MOVUPS_LOAD, xmm, getVFOffset(vu, idx));
+
+    c = {(int)idx, false, ++useCounter};
+
+    return xmm;
+}
+
+/* Copies a VF register to a scratch XMM register */
+void emitLoadVF(VectorUnit *vu, int xmm, u32 idx) {
+    emitSSE(SSEOpcode::MOVAPS, xmm, getCachedVF(vu, idx, true));
+}
+
+/* Writes the dest elements of XMM0 to a VF register (clobbers XMM2, XMM3 and RAX) */
+void emitStoreVF(VectorUnit *vu, u32 idx, u32 dest) {
+    /* VF0 is read-only */
+    if (!idx || !dest) return;
+
+    const auto xmm = getCachedVF(vu, idx, dest != 0xF);
+
+    if (dest != 0xF) {
+        emitSSE(SSEOpcode::MOVAPS, 2, xmm);
+        emitBlend(dest);
+    }
+
+    emitSSE(SSEOpcode::MOVAPS, xmm, 0);
+
+    vfCache[xmm - FIRST_CACHE_XMM].isDirty = true;
+}
+
+/* --- Q/P pipelines --- */
+
+/* Longest FDIV/EFU latencies */
+constexpr u32 MAX_Q_LATENCY = interpreter::Latency::RSQRT;
+constexpr u32 MAX_P_LATENCY = interpreter::Latency::EATAN;
+
+/* Writes the result in flight to Q/P */
+void emitWriteResult(VectorUnit *vu, bool isP) {
+    emitLoad32(Reg::RAX, getNextOffset(vu, isP));
+    emitStore32(Reg::RAX, getPipeOffset(vu, isP));
+}
+
+/* Starts an FDIV/EFU instruction with the result in XMM0, the previous result is written first */
+void emitStartResult(VectorUnit *vu, bool isP, u32 latency) {
+    emitWriteResult(vu, isP);
+    emitMovssStore(0, getNextOffset(vu, isP));
+
+    ((isP) ? pPipe : qPipe) = {true, latency};
+}
+
+/* WAITQ/WAITP */
+void emitWait(VectorUnit *vu, bool isP) {
+    emitWriteResult(vu, isP);
+    emitStoreImm32(getLatencyOffset(vu, isP), 0);
+
+    ((isP) ? pPipe : qPipe) = {true, 0};
+}
+
+/* Advances a pipeline by one pair, same as VectorUnit::updateLatency */
+void emitUpdateLatency(VectorUnit *vu, bool isP, u32 pair) {
+    auto &pipe = (isP) ? pPipe : qPipe;
+
+    if (pipe.isKnown) {
+        if (pipe.latency && !--pipe.latency) {
+            emitWriteResult(vu, isP);
+            emitStoreImm32(getLatencyOffset(vu, isP), 0);
+        }
+
+        return;
+    }
+
+    /* Results started before this block are written within the longest latency */
+    if (pair >= ((isP) ? MAX_P_LATENCY : MAX_Q_LATENCY)) return;
+
+    emitLoad32(Reg::RAX, getLatencyOffset(vu, isP));
+
+    emit8(0x85);
+    emit8(0xC0); // TEST EAX, EAX
+
+    const auto isIdle = emitJcc8(0x74);
+
+    emitALURegImm(ALUExt::SUB, Reg::RAX, 1);
+    emitStore32(Reg::RAX, getLatencyOffset(vu, isP));
+
+    const auto isPending = emitJcc8(0x75);
+
+    emitWriteResult(vu, isP);
+
+    setJumpTarget(isIdle);
+    setJumpTarget(isPending);
+}
+
+/* Stores the latency of results started in this block */
+void emitPipelineExit(VectorUnit *vu, bool isP) {
+    const auto &pipe = (isP) ? pPipe : qPipe;
+
+    if (pipe.isKnown && pipe.latency) emitStoreImm32(getLatencyOffset(vu, isP), pipe.latency);
+}
+
+/* --- Instruction fields --- */
+
+u32 getDest(u32 instr) {
+    return (instr >> 21) & 0xF;
+}
+
+u32 getD(u32 instr) {
+    return (instr >> 6) & 0x1F;
+}
+
+u32 getS(u32 instr) {
+    return (instr >> 11) & 0x1F;
+}
+
+u32 getT(u32 instr) {
+    return (instr >> 16) & 0x1F;
+}
+
+i32 getImm11(u32 instr) {
+    return (i32)(instr << 21) >> 21;
+}
+
+i32 getImm5(u32 instr) {
+    return (i32)(instr << 21) >> 27;
+}
+
+u32 getImm15(u32 instr) {
+    return (instr & 0x7FF) | ((instr >> 10) & 0x7800);
+}
+
+/* Returns the SPECIAL1/SPECIAL2 opcode, SPECIAL2 opcodes have bit 8 set */
+u32 getSpecialOpcode(u32 instr) {
+    if ((instr & 0x3C) == 0x3C) return 0x100 | ((instr >> 4) & 0x7C) | (instr & 3);
+
+    return instr & 0x3F;
+}
+
+/* Decodes FMAC instructions, returns false for everything else */
+bool getFMACInfo(u32 instr, FMACInfo &info) {
+    constexpr FMACOp bcOps[7] = {
+        FMACOp::ADD, FMACOp::SUB, FMACOp::MADD, FMACOp::MSUB, FMACOp::MAX, FMACOp::MINI, FMACOp::MUL,
+    };
+
+    /* ADDq, MADDq, ADDi, MADDi, SUBq, MSUBq, SUBi, MSUBi */
+    constexpr FMACOp qiOps[8] = {
+        FMACOp::ADD, FMACOp::MADD, FMACOp::ADD, FMACOp::MADD, FMACOp::SUB, FMACOp::MSUB, FMACOp::SUB, FMACOp::MSUB,
+    };
+
+    /* ADD, MADD, MUL, MAX, SUB, MSUB, (OPMSUB), MINI */
+    constexpr FMACOp vfOps[8] = {
+        FMACOp::ADD, FMACOp::MADD, FMACOp::MUL, FMACOp::MAX, FMACOp::SUB, FMACOp::MSUB, FMACOp::SUB, FMACOp::MINI,
+    };
+
+    const auto opcode = getSpecialOpcode(instr);
+
+    if (!(opcode & 0x100)) {
+        if (opcode < 0x1C) {
+            info = {bcOps[opcode >> 2], Operand::BC, false};
+        } else if (opcode < 0x20) {
+            constexpr FMACOp ops[4] = {FMACOp::MUL, FMACOp::MAX, FMACOp::MUL, FMACOp::MINI};
+
+            info = {ops[opcode & 3], (opcode == 0x1C) ? Operand::Q : Operand::I, false};
+        } else if (opcode < 0x28) {
+            info = {qiOps[opcode & 7], (opcode & 2) ? Operand::I : Operand::Q, false};
+        } else if ((opcode < 0x30) && (opcode != 0x2E)) {
+            info = {vfOps[opcode & 7], Operand::VF, false};
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    const auto op2 = opcode & 0xFF;
+
+    if (op2 < 0x10) {
+        info = {bcOps[op2 >> 2], Operand::BC, true};
+    } else if ((op2 >= 0x18) && (op2 < 0x1C)) {
+        info = {FMACOp::MUL, Operand::BC, true};
+    } else if ((op2 == 0x1C) || (op2 == 0x1E)) {
+        info = {FMACOp::MUL, (op2 & 2) ? Operand::I : Operand::Q, true};
+    } else if ((op2 >= 0x20) && (op2 < 0x28)) {
+        info = {qiOps[op2 & 7], (op2 & 2) ? Operand::I : Operand::Q, true};
+    } else if ((op2 >= 0x28) && (op2 < 0x2E) && (op2 != 0x2B)) {
+        info = {vfOps[op2 & 7], Operand::VF, true};
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/* --- Instruction emitters --- */
+
+/* Calls an interpreter handler, cached VF registers are written back and reloaded afterwards */
+void emitHandler(VectorUnit *vu, MicroFn fn, u32 instr) {
+    flushVFCache(vu, true);
+
+    emitMovImm64(Reg::RDI, (u64)vu);
+    emitMovImm32(Reg::RSI, instr);
+    emitCall((const void *)fn);
+}
+
+/* Calculates MAC and status flags of the result in XMM0, only sticky status flags are set if MAC flags are dead */
+void emitFMACFlags(VectorUnit *vu, u32 dest, bool isFlagLive) {
+    /* Reverse the elements, MAC bit 3 is X */
+    emitSSE(SSEOpcode::MOVAPS, 1, 0);
+    emitShufps(1, 1, 0x1B);
+
+    emitMovImm64(Reg::RAX, (u64)&jitConsts);
+
+    emitSSE(SSEOpcode::MOVAPS, 2, 1);
+    emitSSERAX(SSEOpcode::ANDPS, 2, offsetof(JITConsts, expMask));
+    emitSSE(SSEOpcode::MOVAPS, 3, 1);
+    emitSSERAX(SSEOpcode::ANDPS, 3, offsetof(JITConsts, mantMask));
+
+    emitMovmskps(Reg::RSI, 1); // Sign
+
+    emitSSE2(SSEOpcode::PXOR, 1, 1);
+    emitSSE2(SSEOpcode::PCMPEQD, 3, 1); // No mantissa
+    emitSSE2(SSEOpcode::PCMPEQD, 1, 2); // Zero
+
+    emit8(0x66);
+    emitSSERAX(SSEOpcode::PCMPEQD, 2, offsetof(JITConsts, expMask)); // Max exponent
+
+    emitSSE(SSEOpcode::ANDNPS, 3, 1); // Underflow
+
+    emitMovmskps(Reg::RCX, 1);
+    emitMovmskps(Reg::RDI, 3);
+    emitMovmskps(Reg::RDX, 2);
+
+    constexpr Reg flagRegs[4] = {Reg::RCX, Reg::RSI, Reg::RDI, Reg::RDX}; // Z, S, U, O
+
+    for (auto reg : flagRegs) emitALURegImm(ALUExt::AND, reg, dest);
+
+    if (isFlagLive) {
+        emitALUReg(0x89, Reg::RAX, Reg::RDX);
+
+        for (int i = 2; i >= 0; i--) {
+            emitShiftReg(ShiftExt::SHL, Reg::RAX, 4);
+            emitALUReg(0x09, Reg::RAX, flagRegs[i]);
+        }
+
+        emitStore16(Reg::RAX, getMACOffset(vu));
+    }
+
+    /* Status flags are set if any element sets them, (flags + 15) >> 4 is 1 for all non-zero flags */
+    for (int i = 0; i < 4; i++) {
+        emitALURegImm(ALUExt::ADD, flagRegs[i], 15);
+        emitShiftReg(ShiftExt::SHR, flagRegs[i], 4);
+
+        if (i) {
+            emitShiftReg(ShiftExt::SHL, flagRegs[i], i);
+            emitALUReg(0x09, Reg::RCX, flagRegs[i]);
+        }
+    }
+
+    emitLoad16(Reg::RAX, getStatusOffset(vu));
+
+    if (isFlagLive) {
+        emitALURegImm(ALUExt::AND, Reg::RAX, 0xFF0);
+        emitALUReg(0x09, Reg::RAX, Reg::RCX);
+    }
+
+    emitShiftReg(ShiftExt::SHL, Reg::RCX, 6);
+    emitALUReg(0x09, Reg::RAX, Reg::RCX);
+
+    emitStore16(Reg::RAX, getStatusOffset(vu));
+}
+
+/* Emits an FMAC instruction, operands are loaded into XMM0 and XMM1 */
+void emitFMAC(VectorUnit *vu, const FMACInfo &info, u32 instr, bool isFlagLive) {
+    const auto fd = (info.isACC) ? ACC : getD(instr);
+    const auto fs = getS(instr);
+    const auto ft = getT(instr);
+
+    const auto dest = getDest(instr);
+
+    emitLoadVF(vu, 0, fs);
+
+    switch (info.operand) {
+        case Operand::VF:
+            emitLoadVF(vu, 1, ft);
+            break;
+        case Operand::BC:
+            emitLoadVF(vu, 1, ft);
+            emitShufps(1, 1, 0x55 * (instr & 3));
+            break;
+        case Operand::Q:
+            emitMovssLoad(1, (i32)((u8 *)vu->getQAddr() - (u8 *)vu));
+            emitShufps(1, 1, 0);
+            break;
+        case Operand::I:
+            emitMovssLoad(1, (i32)((u8 *)vu->getIAddr() - (u8 *)vu));
+            emitShufps(1, 1, 0);
+            break;
+    }
+
+    switch (info.op) {
+        case FMACOp::ADD : emitSSE(SSEOpcode::ADDPS, 0, 1); break;
+        case FMACOp::SUB : emitSSE(SSEOpcode::SUBPS, 0, 1); break;
+        case FMACOp::MUL : emitSSE(SSEOpcode::MULPS, 0, 1); break;
+        case FMACOp::MAX :
+        case FMACOp::MINI:
+            /* MAXPS/MINPS return the second operand if one of them is NaN */
+            emitSSE((info.op == FMACOp::MAX) ? SSEOpcode::MAXPS : SSEOpcode::MINPS, 1, 0);
+            emitSSE(SSEOpcode::MOVAPS, 0, 1);
+            break;
+        case FMACOp::MADD:
+        case FMACOp::MSUB:
+            emitSSE(SSEOpcode::MULPS, 0, 1);
+            emitLoadVF(vu, 2, ACC);
+            emitSSE((info.op == FMACOp::MADD) ? SSEOpcode::ADDPS : SSEOpcode::SUBPS, 2, 0);
+            emitSSE(SSEOpcode::MOVAPS, 0, 2);
+            break;
+    }
+
+    /* MAX and MINI don't update flags */
+    if ((info.op != FMACOp::MAX) && (info.op != FMACOp::MINI)) {
+        /* Flags are set from the unclamped result, dead MAC flags only set sticky status flags */
+        emitFMACFlags(vu, dest, isFlagLive);
+
+        emitMovImm64(Reg::RAX, (u64)&jitConsts);
+        emitSSERAX(SSEOpcode::MINPS, 0, offsetof(JITConsts, clampMax));
+        emitSSERAX(SSEOpcode::MAXPS, 0, offsetof(JITConsts, clampMin));
+    }
+
+    emitStoreVF(vu, fd, dest);
+}
+
+/* Emits the upper instruction of a pair */
+void emitUpper(VectorUnit *vu, const MicroInstr &instr) {
+    /* NOP */
+    if (getSpecialOpcode(instr.upperInstr) == 0x12F) return;
+
+    FMACInfo info;
+
+    if (getFMACInfo(instr.upperInstr, info)) return emitFMAC(vu, info, instr.upperInstr, instr.isFlagLive);
+
+    /* The handler was picked with flag liveness in mind */
+    emitHandler(vu, instr.upper, instr.upperInstr);
+}
+
+/* Loads element e of a VF register into every element of a scratch XMM register */
+void emitLoadElement(VectorUnit *vu, int xmm, u32 idx, u32 e) {
+    emitLoadVF(vu, xmm, idx);
+    emitShufps(xmm, xmm, 0x55 * e);
+}
+
+/* Emits DIV, SQRT and RSQRT with the same results and flags as the interpreter */
+void emitFDIV(VectorUnit *vu, u32 special, u32 instr) {
+    const auto isDIV  = special == 0x138;
+    const auto isSQRT = special == 0x139;
+
+    /* S in XMM0, T in XMM1 */
+    if (!isSQRT) emitLoadElement(vu, 0, getS(instr), (instr >> 21) & 3);
+
+    emitLoadElement(vu, 1, getT(instr), (instr >> 23) & 3);
+
+    /* ECX = T is zero, EDX = S is zero, ESI = T is negative */
+    emitSSE(SSEOpcode::XORPS, 2, 2);
+
+    emitSSE(SSEOpcode::MOVAPS, 3, 1);
+    emitCmpps(3, 2, 0);
+    emitMovmskps(Reg::RCX, 3);
+    emitALURegImm(ALUExt::AND, Reg::RCX, 1);
+
+    if (!isSQRT) {
+        emitSSE(SSEOpcode::MOVAPS, 3, 0);
+        emitCmpps(3, 2, 0);
+        emitMovmskps(Reg::RDX, 3);
+        emitALURegImm(ALUExt::AND, Reg::RDX, 1);
+    }
+
+    if (!isDIV) {
+        emitSSE(SSEOpcode::MOVAPS, 3, 1);
+        emitCmpps(3, 2, 1);
+        emitMovmskps(Reg::RSI, 3);
+        emitALURegImm(ALUExt::AND, Reg::RSI, 1);
+    }
+
+    /* EAX = invalid, ECX = divide by zero */
+    if (isSQRT) {
+        emitALUReg(0x89, Reg::RAX, Reg::RSI);
+        emitALUReg(0x31, Reg::RCX, Reg::RCX);
+    } else {
+        /* 0/0 is invalid, x/0 divides by zero */
+        emitALUReg(0x89, Reg::RAX, Reg::RCX);
+        emitALUReg(0x21, Reg::RAX, Reg::RDX);
+        emitALUReg(0x29, Reg::RCX, Reg::RAX);
+
+        if (!isDIV) emitALUReg(0x09, Reg::RAX, Reg::RSI);
+    }
+
+    /* Same as setFDIVFlags */
+    emitShiftReg(ShiftExt::SHL, Reg::RAX, 4);
+    emitShiftReg(ShiftExt::SHL, Reg::RCX, 5);
+    emitALUReg(0x09, Reg::RAX, Reg::RCX);
+
+    emitLoad16(Reg::RCX, getStatusOffset(vu));
+    emitALURegImm(ALUExt::AND, Reg::RCX, ~0x30u);
+    emitALUReg(0x09, Reg::RCX, Reg::RAX);
+    emitShiftReg(ShiftExt::SHL, Reg::RAX, 6);
+    emitALUReg(0x09, Reg::RCX, Reg::RAX);
+    emitStore16(Reg::RCX, getStatusOffset(vu));
+
+    emitMovImm64(Reg::RAX, (u64)&jitConsts);
+
+    if (isSQRT) {
+        emitSSE(SSEOpcode::MOVAPS, 0, 1);
+        emitSSERAX(SSEOpcode::ANDPS, 0, offsetof(JITConsts, absMask));
+        emitSSE(SSEOpcode::SQRTPS, 0, 0);
+
+        return emitStartResult(vu, false, interpreter::Latency::SQRT);
+    }
+
+    /* Results of a zero T are +/-MAX_FLOAT, signed like S * T (DIV) or S (RSQRT) */
+    emitSSE(SSEOpcode::MOVAPS, 2, 0);
+
+    if (isDIV) emitSSE(SSEOpcode::MULPS, 2, 1);
+
+    emitSSERAX(SSEOpcode::ANDPS, 2, offsetof(JITConsts, signMask));
+    emitSSERAX(SSEOpcode::ORPS, 2, offsetof(JITConsts, clampMax));
+
+    if (isDIV) {
+        emitSSE(SSEOpcode::DIVPS, 0, 1);
+    } else {
+        emitSSE(SSEOpcode::MOVAPS, 3, 1);
+        emitSSERAX(SSEOpcode::ANDPS, 3, offsetof(JITConsts, absMask));
+        emitSSE(SSEOpcode::SQRTPS, 3, 3);
+        emitSSE(SSEOpcode::DIVPS, 0, 3);
+    }
+
+    emitSSE(SSEOpcode::XORPS, 3, 3);
+    emitCmpps(3, 1, 0);
+
+    emitSSE(SSEOpcode::ANDPS, 2, 3);
+    emitSSE(SSEOpcode::ANDNPS, 3, 0);
+    emitSSE(SSEOpcode::ORPS, 3, 2);
+    emitSSE(SSEOpcode::MOVAPS, 0, 3);
+
+    emitStartResult(vu, false, (isDIV) ? interpreter::Latency::DIV : interpreter::Latency::RSQRT);
+}
+
+/* Emits EFU instructions, returns false for EATAN, EEXP and ESIN */
+bool emitEFU(VectorUnit *vu, u32 special, u32 instr) {
+    using interpreter::Latency;
+
+    const auto fs = getS(instr);
+
+    u32 latency;
+
+    switch (special) {
+        case 0x170: // ESADD
+        case 0x171: // ERSADD
+        case 0x172: // ELENG
+        case 0x173: // ERLENG
+            {
+                constexpr u32 latencies[4] = {Latency::ESADD, Latency::ERSADD, Latency::ELENG, Latency::ERLENG};
+
+                latency = latencies[special & 3];
+
+                /* x * x + y * y + z * z */
+                emitLoadVF(vu, 0, fs);
+                emitSSE(SSEOpcode::MULPS, 0, 0);
+
+                emitSSE(SSEOpcode::MOVAPS, 1, 0);
+                emitShufps(1, 1, 0x55);
+                emitSSEScalar(SSEOpcode::ADDPS, 0, 1);
+
+                emitSSE(SSEOpcode::MOVAPS, 1, 0);
+                emitShufps(1, 1, 0xAA);
+                emitSSEScalar(SSEOpcode::ADDPS, 0, 1);
+
+                if (special & 2) emitSSEScalar(SSEOpcode::SQRTPS, 0, 0);
+
+                if (special & 1) {
+                    emitMovImm64(Reg::RAX, (u64)jitConsts.one);
+                    emitLoadRAX(1);
+                    emitSSEScalar(SSEOpcode::DIVPS, 1, 0);
+                    emitSSE(SSEOpcode::MOVAPS, 0, 1);
+                }
+            }
+            break;
+        case 0x176: // ESUM
+            latency = Latency::ESUM;
+
+            /* 0 + x + y + z + w */
+            emitLoadVF(vu, 2, fs);
+            emitSSE(SSEOpcode::XORPS, 0, 0);
+
+            for (int e = 0; e < 4; e++) {
+                emitSSE(SSEOpcode::MOVAPS, 1, 2);
+                emitShufps(1, 1, 0x55 * e);
+                emitSSEScalar(SSEOpcode::ADDPS, 0, 1);
+            }
+            break;
+        case 0x178: // ESQRT
+        case 0x179: // ERSQRT
+        case 0x17A: // ERCPR
+            latency = (special == 0x178) ? Latency::ESQRT : (special == 0x179) ? Latency::ERSQRT : Latency::ERCPR;
+
+            emitLoadElement(vu, 0, fs, (instr >> 21) & 3);
+
+            emitMovImm64(Reg::RAX, (u64)&jitConsts);
+
+            if (special != 0x17A) {
+                emitSSERAX(SSEOpcode::ANDPS, 0, offsetof(JITConsts, absMask));
+                emitSSEScalar(SSEOpcode::SQRTPS, 0, 0);
+            }
+
+            if (special != 0x178) {
+                emitSSERAX(SSEOpcode::MOVUPS_LOAD, 1, offsetof(JITConsts, one));
+                emitSSEScalar(SSEOpcode::DIVPS, 1, 0);
+                emitSSE(SSEOpcode::MOVAPS, 0, 1);
+            }
+            break;
+        default:
+            return false;
+    }
+
+    emitStartResult(vu, true, latency);
+
+    return true;
+}
+
+/* Calculates a data memory address from a VI and an immediate, result in EAX */
+void emitAddress(VectorUnit *vu, u32 idx, i32 imm) {
+    emitLoad16(Reg::RAX, getVIOffset(vu, idx));
+    emitALUImm(0x05, (u32)imm);
+    emitShl(4);
+    emitALUImm(0x25, vu->getDataMask() << 4);
+}
+
+/* Emits a lower instruction */
+void emitLower(VectorUnit *vu, MicroFn fn, u32 instr) {
+    const auto opcode = instr >> 25;
+
+    const auto dest = getDest(instr);
+
+    switch (opcode) {
+        case 0x00: // LQ
+            {
+                const auto ft = getT(instr);
+
+                if (!vu->vuID) break; // VU0 maps VU1 registers into data memory
+
+                if (!ft || !dest) return;
+
+                emitAddress(vu, getS(instr), getImm11(instr));
+
+                emitSSEBaseIndex(SSEOpcode::MOVUPS_LOAD, 0, getMemOffset(vu));
+
+                emitStoreVF(vu, ft, dest);
+            }
+            return;
+        case 0x01: // SQ
+            if (!vu->vuID) break;
+
+            if (!dest) return;
+
+            emitLoadVF(vu, 0, getS(instr));
+
+            emitAddress(vu, getT(instr), getImm11(instr));
+
+            if (dest != 0xF) {
+                emitSSEBaseIndex(SSEOpcode::MOVUPS_LOAD, 2, getMemOffset(vu));
+
+                /* Blend clobbers RAX */
+                emit8(0x89);
+                emit8(0xC0 | (Reg::RAX << 3) | Reg::RCX); // MOV ECX, EAX
+
+                emitBlend(dest);
+
+                emit8(0x89);
+                emit8(0xC0 | (Reg::RCX << 3) | Reg::RAX); // MOV EAX, ECX
+            }
+
+            emitSSEBaseIndex(SSEOpcode::MOVUPS_STORE, 0, getMemOffset(vu));
+            return;
+        case 0x08: // IADDIU
+        case 0x09: // ISUBIU
+            {
+                const auto it = getT(instr);
+
+                if (!it) return;
+
+                emitLoad16(Reg::RAX, getVIOffset(vu, getS(instr)));
+                emitALUImm((opcode == 0x08) ? 0x05 : 0x2D, getImm15(instr));
+                emitStore16(Reg::RAX, getVIOffset(vu, it));
+            }
+            return;
+        case 0x40: // SPECIAL
+            {
+                const auto special = getSpecialOpcode(instr);
+
+                switch (special) {
+                    case 0x30: // IADD
+                    case 0x31: // ISUB
+                    case 0x34: // IAND
+                    case 0x35: // IOR
+                        {
+                            constexpr u8 aluOps[6] = {0x01, 0x29, 0, 0, 0x21, 0x09};
+
+                            const auto id = getD(instr);
+
+                            if (!id) return;
+
+                            emitLoad16(Reg::RAX, getVIOffset(vu, getS(instr)));
+                            emitLoad16(Reg::RCX, getVIOffset(vu, getT(instr)));
+                            emitALU(aluOps[special & 7]);
+                            emitStore16(Reg::RAX, getVIOffset(vu, id));
+                        }
+                        return;
+                    case 0x32: // IADDI
+                        {
+                            const auto it = getT(instr);
+
+                            if (!it) return;
+
+                            emitLoad16(Reg::RAX, getVIOffset(vu, getS(instr)));
+                            emitALUImm(0x05, (u32)getImm5(instr));
+                            emitStore16(Reg::RAX, getVIOffset(vu, it));
+                        }
+                        return;
+                    case 0x138: // DIV
+                    case 0x139: // SQRT
+                    case 0x13A: // RSQRT
+                        return emitFDIV(vu, special, instr);
+                    case 0x13B: // WAITQ
+                        return emitWait(vu, false);
+                    case 0x17B: // WAITP
+                        return emitWait(vu, true);
+                    case 0x174: // EATANxy
+                    case 0x175: // EATANxz
+                    case 0x17C: // ESIN
+                    case 0x17D: // EATAN
+                    case 0x17E: // EEXP
+                        {
+                            using interpreter::Latency;
+
+                            constexpr u32 latencies[16] = {
+                                0, 0, 0, 0, Latency::EATANxy, Latency::EATANxz, 0, 0,
+                                0, 0, 0, 0, Latency::ESIN, Latency::EATAN, Latency::EEXP, 0,
+                            };
+
+                            /* The handler starts the EFU instruction */
+                            emitHandler(vu, fn, instr);
+
+                            pPipe = {true, latencies[special & 0xF]};
+                        }
+                        return;
+                    case 0x130: // MOVE
+                    case 0x131: // MR32
+                        {
+                            const auto ft = getT(instr);
+
+                            if (!ft || !dest) return;
+
+                            emitLoadVF(vu, 0, getS(instr));
+
+                            if (special == 0x131) emitShufps(0, 0, 0x39);
+
+                            emitStoreVF(vu, ft, dest);
+                        }
+                        return;
+                    default:
+                        if (emitEFU(vu, special, instr)) return;
+                        break;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    emitHandler(vu, fn, instr);
+}
+
+/* Returns true if a pair can't be part of a block */
+bool isBlockEnd(const MicroInstr &instr) {
+    if (instr.isEnd || (instr.order == PairOrder::Stash)) return true;
+
+    /* Branches and jumps */
+    if (instr.upperInstr & UpperBits::I) return false;
+
+    const auto opcode = instr.lowerInstr >> 25;
+
+    return (opcode >= 0x20) && (opcode < 0x30);
+}
+
+/* Compiles a block starting at pc, returns false if the pair at pc ends blocks */
+bool compile(VectorUnit *vu, u32 pc, Block &block) {
+    auto &s = state[vu->vuID];
+
+    const auto memMask = (vu->getDataMask() << 4) | 0xF;
+
+    /* Worst case is an FMAC instruction with flag updates, FDIV or a handler call that writes back every cached register and Q/P updates */
+    constexpr u64 MAX_PAIR_SIZE = 1024;
+    constexpr u64 MAX_EXIT_SIZE = 256;
+
+    if ((u64)(s.codePtr - s.codeBase) + MAX_BLOCK_PAIRS * MAX_PAIR_SIZE + MAX_EXIT_SIZE > CODE_SIZE) {
+        std::printf("[VU%d       ] JIT code cache full, flushing\n", vu->vuID);
+
+        s.codePtr = s.codeBase;
+
+        s.programs.clear();
+
+        s.program = NULL;
+        s.isDirty = true;
+
+        return false;
+    }
+
+    code = s.codePtr;
+
+    const auto start = code;
+
+    /* PUSH RBX; MOV RBX, vu */
+    emit8(0x53);
+    emitMovImm64(Reg::RBX, (u64)vu);
+
+    resetVFCache();
+
+    qPipe = pPipe = {false, 0};
+
+    u32 pairs = 0;
+
+    while (pairs < MAX_BLOCK_PAIRS) {
+        const auto instr = interpreter::decodeMicro(vu, pc);
+
+        if (isBlockEnd(instr)) break;
+
+        if (instr.upperInstr & UpperBits::I) {
+            /* LOI, the lower instruction is an immediate */
+            emitUpper(vu, instr);
+
+            emitMovImm32(Reg::RAX, instr.lowerInstr);
+            emitStore32(Reg::RAX, (i32)((u8 *)vu->getIAddr() - (u8 *)vu));
+        } else if (instr.order == PairOrder::UpperFirst) {
+            emitUpper(vu, instr);
+            emitLower(vu, instr.lower, instr.lowerInstr);
+        } else {
+            emitLower(vu, instr.lower, instr.lowerInstr);
+            emitUpper(vu, instr);
+        }
+
+        emitUpdateLatency(vu, false, pairs);
+        emitUpdateLatency(vu, true, pairs);
+
+        pairs++;
+
+        /* Blocks don't wrap around */
+        pc += 8;
+
+        if (pc > memMask) break;
+    }
+
+    if (!pairs) return false;
+
+    emitPipelineExit(vu, false);
+    emitPipelineExit(vu, true);
+
+    flushVFCache(vu, false);
+
+    /* POP RBX; RET */
+    emit8(0x5B);
+    emit8(0xC3);
+
+    s.codePtr = code;
+
+    block.code  = start;
+    block.pairs = pairs;
+
+    return true;
+}
+
+/* Hashes micro memory */
+u64 hashMicro(VectorUnit *vu) {
+    const auto size = ((vu->getDataMask() + 1) << 4) >> 3;
+
+    u64 hash = 0xCBF29CE484222325;
+
+    for (u32 idx = 0; idx < size; idx++) {
+        hash = (hash ^ vu->readMicro64(8 * idx)) * 0x100000001B3;
+        hash ^= hash >> 29;
+    }
+
+    return hash;
+}
+
+/* Allocates executable memory for both VUs */
+void init() {
+    for (auto &s : state) {
+        s.codeBase = (u8 *)mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (s.codeBase == MAP_FAILED) {
+            std::printf("[VU JIT    ] Unable to allocate code cache, using the interpreter\n");
+
+            s.codeBase = NULL;
+        }
+
+        s.codePtr = s.codeBase;
+
+        s.program = NULL;
+        s.isDirty = true;
+    }
+}
+
+/* Marks the current program as stale (micro memory was written) */
+void invalidate(VectorUnit *vu) {
+    state[vu->vuID].isDirty = true;
+}
+
+/* Runs a compiled block at pc, returns the number of executed pairs (0 if pc has to be interpreted) */
+u32 run(VectorUnit *vu, u32 pc) {
+    auto &s = state[vu->vuID];
+
+    if (!isEnabled || !s.codeBase) return 0;
+
+    /* Programs are re-uploaded through MPG all the time, look up existing code by content */
+    if (s.isDirty) {
+        auto &program = s.programs[hashMicro(vu)];
+
+        if (program.blocks.empty()) program.blocks.resize((vu->getDataMask() + 1) * 2);
+
+        s.program = &program;
+        s.isDirty = false;
+    }
+
+    auto &block = s.program->blocks[pc >> 3];
+
+    if (!block.isValid) {
+        block.isValid = true;
+
+        if (!compile(vu, pc, block)) {
+            if (!s.program) return 0; // Code cache was flushed
+
+            block.pairs = 0;
+        }
+    }
+
+    if (!block.pairs) return 0;
+
+    ((void (*)())block.code)();
+
+    return block.pairs;
+}
+
+#else
+
+void init() {}
+
+void invalidate(VectorUnit *vu) {
+    (void)vu;
+}
+
+/* No JIT on this host, everything is interpreted */
+u32 run(VectorUnit *vu, u32 pc) {
+    (void)vu;
+    (void)pc;
+
+    return 0;
+}
+
+#endif
+
+void setEnabled(bool enabled) {
+    #ifdef VU_JIT_X64
+    isEnabled = enabled;
+    #else
+    (void)enabled;
+    #endif
+}
+
+}
@@ -0,0 +1,21 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#pragma once
+
+#include "vu.hpp"
+#include "../../../common/types.hpp"
+
+namespace ps2::ee::vu::jit {
+
+void init();
+
+void setEnabled(bool enabled);
+
+void invalidate(VectorUnit *vu);
+
+u32 run(VectorUnit *vu, u32 pc);
+
+}
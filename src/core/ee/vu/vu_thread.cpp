@@ -0,0 +1,146 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#include "vu_thread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "../gif/gif.hpp"
+#include "../vif/vif.hpp"
+#include "../../../common/ring_buffer.hpp"
+
+namespace ps2::ee::vu::thread {
+
+/*
+ * VU1 runs VIF1 data (UNPACK, MPG, MSCAL...) on its own thread.
+ *
+ * The EE thread only queues VIF1 DMA data, VU1 XGKICKs and VIF1 DIRECT packets
+ * are queued for the EE thread by the GIF (see gif::setQueued()).
+ * Anything that looks at VIF1 or VU1 state from the EE side has to call sync() first.
+ */
+
+/* --- VU1 thread constants --- */
+
+constexpr u64 WORK_QUEUE_SIZE = 1 << 20; // In words
+
+constexpr int SPIN_COUNT = 1024; // Empty polls before the thread starts sleeping
+
+vif::VectorInterface *vif1;
+
+RingBuffer<u32, WORK_QUEUE_SIZE> workQueue; // VIF1 data
+
+std::atomic<bool> isActive = false, isStopped = true;
+
+std::thread::id threadID;
+
+/* Processes VIF1 data until shutdown() */
+void run() {
+    int idleCount = 0;
+
+    while (isActive.load(std::memory_order_relaxed)) {
+        const u32 *data;
+
+        const auto count = workQueue.peek(data);
+
+        if (!count) {
+            if (++idleCount < SPIN_COUNT) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+
+            continue;
+        }
+
+        idleCount = 0;
+
+        vif1->process(data, count);
+
+        /* Popping after processing lets sync() use the queue state alone */
+        workQueue.pop(count);
+    }
+
+    isStopped = true;
+}
+
+void init(vif::VectorInterface *vif1) {
+    thread::vif1 = vif1;
+}
+
+/* Stops the VU1 thread, queued data is dropped */
+void shutdown() {
+    if (!isActive) return;
+
+    isActive = false;
+
+    while (!isStopped) std::this_thread::yield();
+}
+
+/* Starts or stops the VU1 thread */
+void setEnabled(bool enabled) {
+    if (enabled == isActive) return;
+
+    if (!enabled) {
+        sync();
+        shutdown();
+
+        gif::setQueued(false);
+
+        return;
+    }
+
+    std::printf("[VU1       ] Running VU1 on a separate thread\n");
+
+    gif::setQueued(true);
+
+    isStopped = false;
+    isActive  = true;
+
+    std::thread vu1Thread(run);
+
+    threadID = vu1Thread.get_id();
+
+    /* Detached, so that exit() doesn't have to join it */
+    vu1Thread.detach();
+}
+
+bool isRunning() {
+    return isActive.load(std::memory_order_relaxed);
+}
+
+/* Queues VIF1 data (EE thread) */
+void transfer(const u32 *data, u32 count) {
+    while (count) {
+        const auto len = workQueue.tryPush(data, count);
+
+        if (!len) {
+            /* VU1 might be waiting for the GIF queue to drain */
+            gif::flushQueue();
+
+            std::this_thread::yield();
+        }
+
+        data  += len;
+        count -= len;
+    }
+}
+
+/* Waits until VU1 has processed all queued data and its GIF packets have been sent (EE thread) */
+void sync() {
+    if (!isRunning() || (std::this_thread::get_id() == threadID)) return;
+
+    while (!workQueue.isEmpty()) {
+        gif::flushQueue();
+
+        std::this_thread::yield();
+    }
+
+    gif::flushQueue();
+}
+
+}
@@ -0,0 +1,27 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#pragma once
+
+#include "../../../common/types.hpp"
+
+namespace ps2::ee::vif {
+    struct VectorInterface;
+}
+
+namespace ps2::ee::vu::thread {
+
+void init(vif::VectorInterface *vif1);
+void shutdown();
+
+void setEnabled(bool enabled);
+
+bool isRunning();
+
+void transfer(const u32 *data, u32 count);
+
+void sync();
+
+}
@@ -6,11 +6,23 @@
 #include "gs.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdarg>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <queue>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "recorder.hpp"
 #include "../intc.hpp"
 #include "../moestation.hpp"
 #include "../scheduler.hpp"
@@ -22,12 +34,36 @@ namespace ps2::gs {
 using Interrupt = intc::Interrupt;
 using IOPInterrupt = intc::IOPInterrupt;
 
+bool isLogEnabled = true;
+
+/* Prints a GS log message, skips formatting entirely while logging is disabled */
+[[gnu::format(printf, 1, 2)]]
+void printLog(const char *fmt, ...) {
+    if (!isLogEnabled) return;
+
+    std::va_list args;
+
+    va_start(args, fmt);
+    std::vprintf(fmt, args);
+    va_end(args);
+}
+
 /* --- GS constants --- */
 
 constexpr i64 CYCLES_PER_SCANLINE = 2 * 9370; // NTSC, converted to EE clock
 constexpr i64 SCANLINES_PER_VDRAW = 240;
 constexpr i64 SCANLINES_PER_FRAME = 262;
 
+constexpr u32 VRAM_MASK = (1 << 20) - 1; // VRAM size in words - 1
+constexpr u32 VRAM_PAGES = (VRAM_MASK + 1) >> 11; // Number of 8 KB pages
+
+constexpr i32 OUTPUT_WIDTH  = 640;
+constexpr i32 OUTPUT_HEIGHT = 480;
+
+constexpr i64 MAX_SPAN = 2048; // Maximum number of pixels per span
+
+constexpr u32 VTX_BUF_SIZE = 4096; // Maximum number of vertices per batch
+
 static const i32 primVertexCount[8] = { 1, 2, 2, 3, 3, 3, 2, 1 };
 
 /* GS primitives */
@@ -43,10 +79,11 @@ enum PSM {
     PSMCT16S = 0x0A,
     PSMCT8   = 0x13,
     PSMCT4   = 0x14,
+    PSMCT8H  = 0x1B,
     PSMCT4HL = 0x24,
     PSMCT4HH = 0x2C,
     PSMZ32   = 0x30,
-    PSMZ24   = 0x32,
+    PSMZ24   = 0x31,
     PSMZ16   = 0x32,
     PSMZ16S  = 0x3A,
 };
@@ -64,18 +101,29 @@ enum class ZTest {
     Never, Always, GEqual, Greater,
 };
 
+/* Alpha test method */
+enum class ATest {
+    Never, Always, Less, LEqual, Equal, GEqual, Greater, NotEqual,
+};
+
+/* Alpha test fail processing */
+enum class AFail {
+    Keep, FBOnly, ZBOnly, RGBOnly,
+};
+
 struct Vertex {
-    /* Coordinates */
+    /* Coordinates, XYOFFSET is already applied */
 
-    i64 x, y, z;
+    i32 x, y;
+    u32 z;
 
     /* Colors */
 
-    i64 r, g, b, a, f;
+    u8 r, g, b, a, f;
 
     /* Texel coordinates */
 
-    i64 u, v;
+    u16 u, v;
 
     /* Texture coordinates */
 
@@ -153,11 +201,14 @@ enum PrivReg {
     SYNCH1   = 0x12000040,
     SYNCH2   = 0x12000050,
     SYNCV    = 0x12000060,
+    DISPFB1  = 0x12000070,
+    DISPLAY1 = 0x12000080,
     DISPFB2  = 0x12000090,
     DISPLAY2 = 0x120000A0,
     BGCOLOR  = 0x120000E0,
     CSR      = 0x12001000,
     IMR      = 0x12001010,
+    BUSDIR   = 0x12001040,
 };
 
 /* Bit blit buffers */
@@ -170,6 +221,43 @@ struct BITBLTBUF {
     u8  dpsm; // Destination pixel storage mode
 };
 
+/* PCRTC mode setting */
+struct PMode {
+    bool en1;  // Read circuit 1 enable
+    bool en2;  // Read circuit 2 enable
+    bool mmod; // Alpha value select (0 = circuit 1 alpha, 1 = ALP)
+    bool slbg; // Blend background select (0 = circuit 2, 1 = BGCOLOR)
+    u8   alp;  // Fixed alpha value
+};
+
+/* PCRTC mode setting 2 */
+struct SMode2 {
+    bool intl; // Interlace mode
+    bool ffmd; // Interlace read mode (0 = field mode, every other line per field; 1 = frame mode, every line per field)
+};
+
+/* Display frame buffer setting */
+struct DISPFB {
+    u32 fbp; // Frame buffer pointer
+    u32 fbw; // Frame buffer width
+    u8  psm; // Pixel storage mode
+    u32 dbx; // Upper left X coordinate
+    u32 dby; // Upper left Y coordinate
+};
+
+/* Display area setting */
+struct DISPLAY {
+    u32 dx, dy; // Display position
+    u32 magh;   // Horizontal magnification
+    u32 magv;   // Vertical magnification
+    u32 dw, dh; // Display area size
+};
+
+/* Background color */
+struct BGColor {
+    u8 r, g, b;
+};
+
 /* Frame buffer control */
 struct FRAME {
     u32 fbp;   // Frame buffer pointer
@@ -191,6 +279,20 @@ struct PRIM {
     bool fix;  // Fixed fragment value
 };
 
+/* Distant fog color */
+struct FOGCOL {
+    u8 fcr, fcg, fcb;
+};
+
+/* Alpha blending setting, Cv = (A - B) * C >> 7 + D */
+struct ALPHA {
+    u8 a;   // Cs, Cd, 0
+    u8 b;   // Cs, Cd, 0
+    u8 c;   // As, Ad, FIX
+    u8 d;   // Cs, Cd, 0
+    u8 fix; // Fixed alpha value
+};
+
 /* Vertex color setting */
 struct RGBAQ {
     u8  r, g, b, a;
@@ -233,6 +335,44 @@ struct TEX {
     u8   cld;  // CLUT load control
 };
 
+/* Texture information */
+struct TEX1 {
+    bool lcm;  // LOD calculation method
+    u8   mxl;  // Maximum mipmap level
+    bool mmag; // Linear magnification filter
+    u8   mmin; // Minification filter
+    bool mtba; // Automatic mipmap base pointers
+    u8   l;    // LOD parameter L
+    i32  k;    // LOD parameter K, signed 7.4 fixed point
+};
+
+/* Texture wrap mode */
+struct CLAMP {
+    u8  wms, wmt;
+    u32 minu, maxu;
+    u32 minv, maxv;
+};
+
+/* Mipmap base pointers and widths of levels 1-6 */
+struct MIPTBP {
+    u32 tbp[6];
+    u32 tbw[6];
+};
+
+/* CLUT position for CSM2 */
+struct TEXCLUT {
+    u32 cbw; // CLUT buffer width
+    u32 cou; // CLUT offset (U)
+    u32 cov; // CLUT offset (V)
+};
+
+/* Texture alpha values for 24-bit and 16-bit textures */
+struct TEXA {
+    u8   ta0;
+    bool aem; // Black pixels are transparent
+    u8   ta1;
+};
+
 /* Transmission area position */
 struct TRXPOS {
     u32 ssax;
@@ -248,6 +388,12 @@ struct TRXREG {
     u32 rrh;
 };
 
+/* Texture coordinates */
+struct ST {
+    f32 s;
+    f32 t;
+};
+
 /* Texel coordinates */
 struct UV {
     i64 u;
@@ -269,12 +415,18 @@ struct ZBUF {
 
 /* GS context */
 struct Context {
+    ALPHA    alpha;
+    CLAMP    clamp;
     FRAME    frame;
+    MIPTBP   miptbp;
     SCISSOR  scissor;
     TEST     test;
     TEX      tex0;
+    TEX1     tex1;
     XYOFFSET xyoffset;
     ZBUF     zbuf;
+
+    bool fba; // Set alpha MSB of written pixels
 };
 
 /* Transmission info */
@@ -292,20 +444,46 @@ PRIM *cmode; // Current primitive mode
 
 RGBAQ rgbaq;
 
+ST st;
 UV uv;
 
+u8 fog; // Fog coefficient
+
+u64 primReg; // Last value written to PRIM
+
+FOGCOL fogcol;
+
 BITBLTBUF bitbltbuf;
 TRXPOS    trxpos;
 TRXREG    trxreg;
 u8        trxdir;
 
+TEXA    texa;
+TEXCLUT texclut;
+
+/* CLUT buffer, 32-bit entries keep their lower halves in 0-255 and their upper halves in 256-511 */
+u16 clutBuffer[512];
+u32 cbp0, cbp1; // CBPs of the last CLUT loads with CLD = 2/3
+
 bool colclamp;
+bool dthe; // Dithering
+bool pabe; // Per-pixel alpha blending
+
+i8 dimx[4][4]; // Dither matrix
 
 u64 csr;
 
+PMode   pmode;
+SMode2  smode2;
+DISPFB  dispfb[2];
+DISPLAY display[2];
+BGColor bgcolor;
+
 std::vector<u32> vram;
 
-Vertex vtxQueue[3];
+std::vector<u32> outputBuf; // Display output in host format (XBGR8888)
+
+u16 vtxQueue[3]; // Vertex buffer indices of the current primitive
 i32 vtxCount;
 
 i64 lineCounter = 0;
@@ -314,7 +492,20 @@ i64 lineCounter = 0;
 u64 idHBLANK;
 
 void doTransmission();
-void drawSprite();
+void flushBatch();
+void flushDeferred();
+void loadCLUT(const TEX &tex0);
+void invalidateHiZ(u32 addr, u32 n);
+void resetHiZ();
+void kickVertex(u64 data, bool hasFog, bool isDrawingKick);
+void endFrame();
+void updateDisplay();
+
+template <PSM psm>
+u32 readVRAM(u32 base, u32 width, u32 x, u32 y);
+
+template <PSM psm>
+void writeVRAM(u32 base, u32 width, u32 x, u32 y, u32 data);
 
 /* Handles HBLANK events */
 void hblankEvent(i64 c) {
@@ -332,7 +523,9 @@ void hblankEvent(i64 c) {
         csr |= 1 << 3;  // VBLANK
         csr ^= 1 << 13; // FIELD
 
-        update((u8 *)vram.data());
+        endFrame();
+
+        recorder::onVBLANK();
     } else if (lineCounter == SCANLINES_PER_FRAME) {
         intc::sendInterrupt(Interrupt::VBLANKEnd);
         intc::sendInterruptIOP(IOPInterrupt::VBLANKEnd);
@@ -345,7 +538,9 @@ void hblankEvent(i64 c) {
 
 /* Registers GS events */
 void init() {
-    vram.resize(2048 * 2048 / 4); // 4 MB
+    vram.resize(VRAM_WORDS); // 4 MB
+
+    outputBuf.resize(OUTPUT_WIDTH * OUTPUT_HEIGHT);
 
     idHBLANK = scheduler::registerEvent([](int, i64 c) { hblankEvent(c); });
 
@@ -353,6 +548,8 @@ void init() {
 }
 
 void initQ() {
+    recorder::onInitQ();
+
     rgbaq.q = 1.0;
 }
 
@@ -370,44 +567,89 @@ u64 readPriv(u32 addr) {
 
 /* Writes a GS privileged register */
 void writePriv(u32 addr, u64 data) {
+    recorder::onWritePriv(addr, data);
+
     switch (addr) {
         case PrivReg::PMODE:
-            std::printf("[GS        ] 64-bit write @ PMODE = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ PMODE = 0x%016llX\n", data);
+
+            pmode.en1  = data & (1 << 0);
+            pmode.en2  = data & (1 << 1);
+            pmode.mmod = data & (1 << 5);
+            pmode.slbg = data & (1 << 7);
+            pmode.alp  = data >> 8;
             break;
         case PrivReg::SMODE1:
-            std::printf("[GS        ] 64-bit write @ SMODE1 = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ SMODE1 = 0x%016llX\n", data);
             break;
         case PrivReg::SMODE2:
-            std::printf("[GS        ] 64-bit write @ SMODE2 = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ SMODE2 = 0x%016llX\n", data);
+
+            smode2.intl = data & (1 << 0);
+            smode2.ffmd = data & (1 << 1);
             break;
         case PrivReg::SRFSH:
-            std::printf("[GS        ] 64-bit write @ SRFSH = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ SRFSH = 0x%016llX\n", data);
             break;
         case PrivReg::SYNCH1:
-            std::printf("[GS        ] 64-bit write @ SYNCH1 = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ SYNCH1 = 0x%016llX\n", data);
             break;
         case PrivReg::SYNCH2:
-            std::printf("[GS        ] 64-bit write @ SYNCH2 = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ SYNCH2 = 0x%016llX\n", data);
             break;
         case PrivReg::SYNCV:
-            std::printf("[GS        ] 64-bit write @ SYNCV = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ SYNCV = 0x%016llX\n", data);
             break;
+        case PrivReg::DISPFB1:
         case PrivReg::DISPFB2:
-            std::printf("[GS        ] 64-bit write @ DISPFB2 = 0x%016llX\n", data);
+            {
+                const auto idx = addr == PrivReg::DISPFB2;
+
+                printLog("[GS        ] 64-bit write @ DISPFB%d = 0x%016llX\n", idx + 1, data);
+
+                auto &fb = dispfb[idx];
+
+                fb.fbp = 2048 * (data & 0x1FF);
+                fb.fbw = 64 * ((data >> 9) & 0x3F);
+                fb.psm = (data >> 15) & 0x1F;
+                fb.dbx = (data >> 32) & 0x7FF;
+                fb.dby = (data >> 43) & 0x7FF;
+            }
             break;
+        case PrivReg::DISPLAY1:
         case PrivReg::DISPLAY2:
-            std::printf("[GS        ] 64-bit write @ DISPLAY2 = 0x%016llX\n", data);
+            {
+                const auto idx = addr == PrivReg::DISPLAY2;
+
+                printLog("[GS        ] 64-bit write @ DISPLAY%d = 0x%016llX\n", idx + 1, data);
+
+                auto &disp = display[idx];
+
+                disp.dx   = (data >>  0) & 0xFFF;
+                disp.dy   = (data >> 12) & 0x7FF;
+                disp.magh = (data >> 23) & 0xF;
+                disp.magv = (data >> 27) & 3;
+                disp.dw   = (data >> 32) & 0xFFF;
+                disp.dh   = (data >> 44) & 0x7FF;
+            }
             break;
         case PrivReg::BGCOLOR:
-            std::printf("[GS        ] 64-bit write @ BGCOLOR = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ BGCOLOR = 0x%016llX\n", data);
+
+            bgcolor.r = data >>  0;
+            bgcolor.g = data >>  8;
+            bgcolor.b = data >> 16;
             break;
         case PrivReg::CSR:
-            std::printf("[GS        ] 64-bit write @ CSR = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ CSR = 0x%016llX\n", data);
 
             csr = data;
             break;
         case PrivReg::IMR:
-            std::printf("[GS        ] 64-bit write @ IMR = 0x%016llX\n", data);
+            printLog("[GS        ] 64-bit write @ IMR = 0x%016llX\n", data);
+            break;
+        case PrivReg::BUSDIR:
+            printLog("[GS        ] 64-bit write @ BUSDIR = 0x%016llX\n", data);
             break;
         default:
             std::printf("[GS        ] Unhandled 64-bit write @ 0x%08X = 0x%016llX\n", addr, data);
@@ -416,11 +658,38 @@ void writePriv(u32 addr, u64 data) {
     }
 }
 
+/* Returns true if writing a register can change how batched primitives are drawn */
+bool isStateChange(u8 addr, u64 data) {
+    switch (addr) {
+        case static_cast<u8>(GSReg::RGBAQ)    :
+        case static_cast<u8>(GSReg::ST)       :
+        case static_cast<u8>(GSReg::UV)       :
+        case static_cast<u8>(GSReg::XYZF2)    :
+        case static_cast<u8>(GSReg::XYZ2)     :
+        case static_cast<u8>(GSReg::FOG)      :
+        case static_cast<u8>(GSReg::XYZF3)    :
+        case static_cast<u8>(GSReg::XYZ3)     :
+        case static_cast<u8>(GSReg::NOP)      :
+        case static_cast<u8>(GSReg::BITBLTBUF):
+        case static_cast<u8>(GSReg::TRXPOS)   :
+        case static_cast<u8>(GSReg::TRXREG)   :
+            return false;
+        case static_cast<u8>(GSReg::PRIM):
+            return (data & 0x7FF) != primReg; // Rewriting the same PRIM value doesn't end a batch
+        default:
+            return true;
+    }
+}
+
 /* Writes data to an internal GS register */
 void write(u8 addr, u64 data) {
+    recorder::onWrite(addr, data);
+
+    if (isStateChange(addr, data)) flushBatch();
+
     switch (addr) {
         case static_cast<u8>(GSReg::PRIM):
-            std::printf("[GS        ] Write @ PRIM = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ PRIM = 0x%016llX\n", data);
 
             prim.prim = data & 7;
             prim.iip  = data & (1 << 3);
@@ -433,10 +702,14 @@ void write(u8 addr, u64 data) {
             prim.fix  = data & (1 << 10);
 
             cctx = &ctx[cmode->ctxt]; // Set active context
+
+            primReg = data & 0x7FF;
+
+            vtxCount = 0; // Writing PRIM resets the vertex queue
             break;
         case static_cast<u8>(GSReg::RGBAQ):
             {
-                std::printf("[GS        ] Write @ RGBAQ = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ RGBAQ = 0x%016llX\n", data);
 
                 rgbaq.r = (data >>  0);
                 rgbaq.g = (data >>  8);
@@ -448,55 +721,53 @@ void write(u8 addr, u64 data) {
                 rgbaq.q = *(f32 *)&q;
             }
             break;
+        case static_cast<u8>(GSReg::ST):
+            {
+                printLog("[GS        ] Write @ ST = 0x%016llX\n", data);
+
+                const auto s = (u32)(data >>  0) & ~0xFF;
+                const auto t = (u32)(data >> 32) & ~0xFF;
+
+                std::memcpy(&st.s, &s, 4);
+                std::memcpy(&st.t, &t, 4);
+            }
+            break;
         case static_cast<u8>(GSReg::UV):
-            std::printf("[GS        ] Write @ UV = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ UV = 0x%016llX\n", data);
 
             uv.u = (i64)((data >>  0) & 0x3FFF);
             uv.v = (i64)((data >> 16) & 0x3FFF);
             break;
-        case static_cast<u8>(GSReg::XYZ2):
-            {
-                std::printf("[GS        ] Write @ XYZ2 = 0x%016llX\n", data);
-
-                assert(vtxCount < 4);
-
-                Vertex vtx;
-
-                vtx.x = (i64)((data >>  0) & 0xFFFF);
-                vtx.y = (i64)((data >> 16) & 0xFFFF);
+        case static_cast<u8>(GSReg::XYZF2):
+            printLog("[GS        ] Write @ XYZF2 = 0x%016llX\n", data);
 
-                vtx.z = (i64)(data >> 32);
-
-                vtx.r = rgbaq.r;
-                vtx.g = rgbaq.g;
-                vtx.b = rgbaq.b;
-                vtx.a = rgbaq.a;
-
-                vtx.u = uv.u;
-                vtx.v = uv.v;
-
-                //vtx.s = st.s;
-                //vtx.t = st.t;
-                vtx.q = rgbaq.q;
+            kickVertex(data, true, true);
+            break;
+        case static_cast<u8>(GSReg::XYZ2):
+            printLog("[GS        ] Write @ XYZ2 = 0x%016llX\n", data);
 
-                vtxQueue[vtxCount++] = vtx;
+            kickVertex(data, false, true);
+            break;
+        case static_cast<u8>(GSReg::FOG):
+            printLog("[GS        ] Write @ FOG = 0x%016llX\n", data);
 
-                if (vtxCount == primVertexCount[prim.prim]) {
-                    switch (prim.prim) {
-                        case Primitive::Sprite: drawSprite(); break;
-                        default:
-                            std::printf("[GS        ] Unhandled primitive %u\n", prim.prim);
+            fog = data >> 56;
+            break;
+        case static_cast<u8>(GSReg::XYZF3):
+            printLog("[GS        ] Write @ XYZF3 = 0x%016llX\n", data);
 
-                            exit(0);
-                    }
+            kickVertex(data, true, false);
+            break;
+        case static_cast<u8>(GSReg::XYZ3):
+            printLog("[GS        ] Write @ XYZ3 = 0x%016llX\n", data);
 
-                    vtxCount = 0;
-                }
-            }
+            kickVertex(data, false, false);
+            break;
+        case static_cast<u8>(GSReg::NOP):
             break;
         case static_cast<u8>(GSReg::TEX0_1):
             {
-                std::printf("[GS        ] Write @ TEX0_1 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ TEX0_1 = 0x%016llX\n", data);
 
                 auto &tex0 = ctx[0].tex0;
 
@@ -511,12 +782,14 @@ void write(u8 addr, u64 data) {
                 tex0.cpsm = (data >> 51) & 0xF;
                 tex0.csm  = data & (1ull << 55);
                 tex0.csa  = 16 * ((data >> 56) & 0x1F);
-                tex0.cld  = (data > 61) & 3;
+                tex0.cld  = (data >> 61) & 7;
+
+                loadCLUT(tex0);
             }
             break;
         case static_cast<u8>(GSReg::TEX0_2):
             {
-                std::printf("[GS        ] Write @ TEX0_2 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ TEX0_2 = 0x%016llX\n", data);
 
                 auto &tex0 = ctx[1].tex0;
 
@@ -531,12 +804,170 @@ void write(u8 addr, u64 data) {
                 tex0.cpsm = (data >> 51) & 0xF;
                 tex0.csm  = data & (1ull << 55);
                 tex0.csa  = 16 * ((data >> 56) & 0x1F);
-                tex0.cld  = (data > 61) & 3;
+                tex0.cld  = (data >> 61) & 7;
+
+                loadCLUT(tex0);
+            }
+            break;
+        case static_cast<u8>(GSReg::CLAMP_1):
+            {
+                printLog("[GS        ] Write @ CLAMP1 = 0x%016llX\n", data);
+
+                auto &clamp = ctx[0].clamp;
+
+                clamp.wms  = (data >>  0) & 3;
+                clamp.wmt  = (data >>  2) & 3;
+                clamp.minu = (data >>  4) & 0x3FF;
+                clamp.maxu = (data >> 14) & 0x3FF;
+                clamp.minv = (data >> 24) & 0x3FF;
+                clamp.maxv = (data >> 34) & 0x3FF;
+            }
+            break;
+        case static_cast<u8>(GSReg::CLAMP_2):
+            {
+                printLog("[GS        ] Write @ CLAMP2 = 0x%016llX\n", data);
+
+                auto &clamp = ctx[1].clamp;
+
+                clamp.wms  = (data >>  0) & 3;
+                clamp.wmt  = (data >>  2) & 3;
+                clamp.minu = (data >>  4) & 0x3FF;
+                clamp.maxu = (data >> 14) & 0x3FF;
+                clamp.minv = (data >> 24) & 0x3FF;
+                clamp.maxv = (data >> 34) & 0x3FF;
+            }
+            break;
+        case static_cast<u8>(GSReg::TEX1_1):
+            {
+                printLog("[GS        ] Write @ TEX1_1 = 0x%016llX\n", data);
+
+                auto &tex1 = ctx[0].tex1;
+
+                tex1.lcm  = data & 1;
+                tex1.mxl  = std::min((u32)((data >> 2) & 7), 6u);
+                tex1.mmag = data & (1 << 5);
+                tex1.mmin = (data >> 6) & 7;
+                tex1.mtba = data & (1 << 9);
+                tex1.l    = (data >> 19) & 3;
+                tex1.k    = (i32)((data >> 32) & 0xFFF) << 20 >> 20; // Sign extend
+            }
+            break;
+        case static_cast<u8>(GSReg::TEX1_2):
+            {
+                printLog("[GS        ] Write @ TEX1_2 = 0x%016llX\n", data);
+
+                auto &tex1 = ctx[1].tex1;
+
+                tex1.lcm  = data & 1;
+                tex1.mxl  = std::min((u32)((data >> 2) & 7), 6u);
+                tex1.mmag = data & (1 << 5);
+                tex1.mmin = (data >> 6) & 7;
+                tex1.mtba = data & (1 << 9);
+                tex1.l    = (data >> 19) & 3;
+                tex1.k    = (i32)((data >> 32) & 0xFFF) << 20 >> 20; // Sign extend
+            }
+            break;
+        case static_cast<u8>(GSReg::TEX2_1):
+            {
+                printLog("[GS        ] Write @ TEX2_1 = 0x%016llX\n", data);
+
+                /* Same layout as TEX0, only writes PSM and the CLUT fields */
+
+                auto &tex0 = ctx[0].tex0;
+
+                tex0.psm  = (data >> 20) & 0x3F;
+                tex0.cbp  = 64 * ((data >> 37) & 0x3FFF);
+                tex0.cpsm = (data >> 51) & 0xF;
+                tex0.csm  = data & (1ull << 55);
+                tex0.csa  = 16 * ((data >> 56) & 0x1F);
+                tex0.cld  = (data >> 61) & 7;
+
+                loadCLUT(tex0);
+            }
+            break;
+        case static_cast<u8>(GSReg::TEX2_2):
+            {
+                printLog("[GS        ] Write @ TEX2_2 = 0x%016llX\n", data);
+
+                /* Same layout as TEX0, only writes PSM and the CLUT fields */
+
+                auto &tex0 = ctx[1].tex0;
+
+                tex0.psm  = (data >> 20) & 0x3F;
+                tex0.cbp  = 64 * ((data >> 37) & 0x3FFF);
+                tex0.cpsm = (data >> 51) & 0xF;
+                tex0.csm  = data & (1ull << 55);
+                tex0.csa  = 16 * ((data >> 56) & 0x1F);
+                tex0.cld  = (data >> 61) & 7;
+
+                loadCLUT(tex0);
+            }
+            break;
+        case static_cast<u8>(GSReg::MIPTBP1_1):
+            {
+                printLog("[GS        ] Write @ MIPTBP1_1 = 0x%016llX\n", data);
+
+                auto &miptbp = ctx[0].miptbp;
+
+                for (int i = 0; i < 3; i++) {
+                    miptbp.tbp[0 + i] = 64 * ((data >> (20 * i)) & 0x3FFF);
+                    miptbp.tbw[0 + i] = 64 * ((data >> (20 * i + 14)) & 0x3F);
+                }
+            }
+            break;
+        case static_cast<u8>(GSReg::MIPTBP2_1):
+            {
+                printLog("[GS        ] Write @ MIPTBP2_1 = 0x%016llX\n", data);
+
+                auto &miptbp = ctx[0].miptbp;
+
+                for (int i = 0; i < 3; i++) {
+                    miptbp.tbp[3 + i] = 64 * ((data >> (20 * i)) & 0x3FFF);
+                    miptbp.tbw[3 + i] = 64 * ((data >> (20 * i + 14)) & 0x3F);
+                }
+            }
+            break;
+        case static_cast<u8>(GSReg::MIPTBP1_2):
+            {
+                printLog("[GS        ] Write @ MIPTBP1_2 = 0x%016llX\n", data);
+
+                auto &miptbp = ctx[1].miptbp;
+
+                for (int i = 0; i < 3; i++) {
+                    miptbp.tbp[0 + i] = 64 * ((data >> (20 * i)) & 0x3FFF);
+                    miptbp.tbw[0 + i] = 64 * ((data >> (20 * i + 14)) & 0x3F);
+                }
+            }
+            break;
+        case static_cast<u8>(GSReg::MIPTBP2_2):
+            {
+                printLog("[GS        ] Write @ MIPTBP2_2 = 0x%016llX\n", data);
+
+                auto &miptbp = ctx[1].miptbp;
+
+                for (int i = 0; i < 3; i++) {
+                    miptbp.tbp[3 + i] = 64 * ((data >> (20 * i)) & 0x3FFF);
+                    miptbp.tbw[3 + i] = 64 * ((data >> (20 * i + 14)) & 0x3F);
+                }
             }
             break;
+        case static_cast<u8>(GSReg::TEXCLUT):
+            printLog("[GS        ] Write @ TEXCLUT = 0x%016llX\n", data);
+
+            texclut.cbw = 64 * (data & 0x3F);
+            texclut.cou = 16 * ((data >> 6) & 0x3F);
+            texclut.cov = (data >> 12) & 0x3FF;
+            break;
+        case static_cast<u8>(GSReg::TEXA):
+            printLog("[GS        ] Write @ TEXA = 0x%016llX\n", data);
+
+            texa.ta0 = data;
+            texa.aem = data & (1 << 15);
+            texa.ta1 = data >> 32;
+            break;
         case static_cast<u8>(GSReg::XYOFFSET_1):
             {
-                std::printf("[GS        ] Write @ XYOFFSET1 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ XYOFFSET1 = 0x%016llX\n", data);
 
                 auto &xyoffset = ctx[0].xyoffset;
 
@@ -546,7 +977,7 @@ void write(u8 addr, u64 data) {
             break;
         case static_cast<u8>(GSReg::XYOFFSET_2):
             {
-                std::printf("[GS        ] Write @ XYOFFSET2 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ XYOFFSET2 = 0x%016llX\n", data);
 
                 auto &xyoffset = ctx[1].xyoffset;
 
@@ -555,30 +986,39 @@ void write(u8 addr, u64 data) {
             }
             break;
         case static_cast<u8>(GSReg::PRMODECONT):
-            std::printf("[GS        ] Write @ PRMODECONT = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ PRMODECONT = 0x%016llX\n", data);
 
             cmode = (data & 1) ? &prim : &prmode;
 
             cctx = &ctx[cmode->ctxt]; // Set active context
             break;
+        case static_cast<u8>(GSReg::FOGCOL):
+            printLog("[GS        ] Write @ FOGCOL = 0x%016llX\n", data);
+
+            fogcol.fcr = (data >>  0);
+            fogcol.fcg = (data >>  8);
+            fogcol.fcb = (data >> 16);
+            break;
         case static_cast<u8>(GSReg::TEXFLUSH):
-            std::printf("[GS        ] Write @ TEXFLUSH = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ TEXFLUSH = 0x%016llX\n", data);
             break;
         case static_cast<u8>(GSReg::SCISSOR_1):
             {
-                std::printf("[GS        ] Write @ SCISSOR1 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ SCISSOR1 = 0x%016llX\n", data);
 
                 auto &scissor = ctx[0].scissor;
 
-                scissor.scax0 = (i64)((data >>  0) & 0x7FF);
-                scissor.scax1 = (i64)((data >> 16) & 0x7FF);
-                scissor.scay0 = (i64)((data >> 32) & 0x7FF);
-                scissor.scay1 = (i64)((data >> 48) & 0x7FF);
+                /* Multiply by 16 so we don't have to do this later */
+
+                scissor.scax0 = (i64)((data >>  0) & 0x7FF) << 4;
+                scissor.scax1 = (i64)((data >> 16) & 0x7FF) << 4;
+                scissor.scay0 = (i64)((data >> 32) & 0x7FF) << 4;
+                scissor.scay1 = (i64)((data >> 48) & 0x7FF) << 4;
             }
             break;
         case static_cast<u8>(GSReg::SCISSOR_2):
             {
-                std::printf("[GS        ] Write @ SCISSOR2 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ SCISSOR2 = 0x%016llX\n", data);
 
                 auto &scissor = ctx[1].scissor;
 
@@ -590,17 +1030,68 @@ void write(u8 addr, u64 data) {
                 scissor.scay1 = (i64)((data >> 48) & 0x7FF) << 4;
             }
             break;
+        case static_cast<u8>(GSReg::ALPHA_1):
+            {
+                printLog("[GS        ] Write @ ALPHA1 = 0x%016llX\n", data);
+
+                auto &alpha = ctx[0].alpha;
+
+                alpha.a   = (data >> 0) & 3;
+                alpha.b   = (data >> 2) & 3;
+                alpha.c   = (data >> 4) & 3;
+                alpha.d   = (data >> 6) & 3;
+                alpha.fix = data >> 32;
+            }
+            break;
+        case static_cast<u8>(GSReg::ALPHA_2):
+            {
+                printLog("[GS        ] Write @ ALPHA2 = 0x%016llX\n", data);
+
+                auto &alpha = ctx[1].alpha;
+
+                alpha.a   = (data >> 0) & 3;
+                alpha.b   = (data >> 2) & 3;
+                alpha.c   = (data >> 4) & 3;
+                alpha.d   = (data >> 6) & 3;
+                alpha.fix = data >> 32;
+            }
+            break;
+        case static_cast<u8>(GSReg::DIMX):
+            printLog("[GS        ] Write @ DIMX = 0x%016llX\n", data);
+
+            /* Each entry is a signed 3-bit value */
+            for (int i = 0; i < 16; i++) {
+                dimx[i >> 2][i & 3] = (i8)(((data >> (4 * i)) & 7) << 5) >> 5;
+            }
+            break;
         case static_cast<u8>(GSReg::DTHE):
-            std::printf("[GS        ] Write @ DTHE = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ DTHE = 0x%016llX\n", data);
+
+            dthe = data & 1;
             break;
         case static_cast<u8>(GSReg::COLCLAMP):
-            std::printf("[GS        ] Write @ COLCLAMP = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ COLCLAMP = 0x%016llX\n", data);
 
             colclamp = data & 1;
             break;
+        case static_cast<u8>(GSReg::PABE):
+            printLog("[GS        ] Write @ PABE = 0x%016llX\n", data);
+
+            pabe = data & 1;
+            break;
+        case static_cast<u8>(GSReg::FBA_1):
+            printLog("[GS        ] Write @ FBA1 = 0x%016llX\n", data);
+
+            ctx[0].fba = data & 1;
+            break;
+        case static_cast<u8>(GSReg::FBA_2):
+            printLog("[GS        ] Write @ FBA2 = 0x%016llX\n", data);
+
+            ctx[1].fba = data & 1;
+            break;
         case static_cast<u8>(GSReg::TEST_1):
             {
-                std::printf("[GS        ] Write @ TEST1 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ TEST1 = 0x%016llX\n", data);
 
                 auto &test = ctx[0].test;
 
@@ -616,7 +1107,7 @@ void write(u8 addr, u64 data) {
             break;
         case static_cast<u8>(GSReg::TEST_2):
             {
-                std::printf("[GS        ] Write @ TEST2 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ TEST2 = 0x%016llX\n", data);
 
                 auto &test = ctx[1].test;
 
@@ -632,7 +1123,7 @@ void write(u8 addr, u64 data) {
             break;
         case static_cast<u8>(GSReg::FRAME_1):
             {
-                std::printf("[GS        ] Write @ FRAME1 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ FRAME1 = 0x%016llX\n", data);
 
                 auto &frame = ctx[0].frame;
 
@@ -644,7 +1135,7 @@ void write(u8 addr, u64 data) {
             break;
         case static_cast<u8>(GSReg::FRAME_2):
             {
-                std::printf("[GS        ] Write @ FRAME2 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ FRAME2 = 0x%016llX\n", data);
                 
                 auto &frame = ctx[1].frame;
 
@@ -656,7 +1147,7 @@ void write(u8 addr, u64 data) {
             break;
         case static_cast<u8>(GSReg::ZBUF_1):
             {
-                std::printf("[GS        ] Write @ ZBUF1 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ ZBUF1 = 0x%016llX\n", data);
 
                 auto &zbuf = ctx[0].zbuf;
 
@@ -667,7 +1158,7 @@ void write(u8 addr, u64 data) {
             break;
         case static_cast<u8>(GSReg::ZBUF_2):
             {
-                std::printf("[GS        ] Write @ ZBUF2 = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ ZBUF2 = 0x%016llX\n", data);
 
                 auto &zbuf = ctx[1].zbuf;
 
@@ -677,7 +1168,7 @@ void write(u8 addr, u64 data) {
             }
             break;
         case static_cast<u8>(GSReg::BITBLTBUF):
-            std::printf("[GS        ] Write @ BITBLTBUF = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ BITBLTBUF = 0x%016llX\n", data);
 
             bitbltbuf.sbp   = 64 * (data & 0x1FFF);       // Multiply by 2048 now so we don't have to do this every time we read/write VRAM
             bitbltbuf.sbw   = 64 * ((data >> 16) & 0x3F); // Same as above
@@ -687,7 +1178,7 @@ void write(u8 addr, u64 data) {
             bitbltbuf.dpsm  = (data >> 56) & 0x3F;
             break;
         case static_cast<u8>(GSReg::TRXPOS):
-            std::printf("[GS        ] Write @ TRXPOS = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ TRXPOS = 0x%016llX\n", data);
 
             trxpos.ssax = (data >>  0) & 0x7FF;
             trxpos.ssay = (data >> 16) & 0x7FF;
@@ -696,22 +1187,25 @@ void write(u8 addr, u64 data) {
             trxpos.dir  = (data >> 59) & 3;
             break;
         case static_cast<u8>(GSReg::TRXREG):
-            std::printf("[GS        ] Write @ TRXREG = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ TRXREG = 0x%016llX\n", data);
 
             trxreg.rrw = (data >>  0) & 0xFFF;
             trxreg.rrh = (data >> 32) & 0xFFF;
             break;
         case static_cast<u8>(GSReg::TRXDIR):
             {
-                std::printf("[GS        ] Write @ TRXDIR = 0x%016llX\n", data);
+                printLog("[GS        ] Write @ TRXDIR = 0x%016llX\n", data);
 
                 trxdir = data & 3;
 
                 doTransmission();
             }
             break;
+        case static_cast<u8>(GSReg::HWREG):
+            writeHWREG(&data, 1);
+            break;
         case static_cast<u8>(GSReg::FINISH):
-            std::printf("[GS        ] Write @ FINISH = 0x%016llX\n", data);
+            printLog("[GS        ] Write @ FINISH = 0x%016llX\n", data);
             break;
         default:
             std::printf("[GS        ] Unhandled write @ 0x%02X = 0x%016llX\n", addr, data);
@@ -720,55 +1214,218 @@ void write(u8 addr, u64 data) {
     }
 }
 
+/*
+ * PACKED writes are converted to the equivalent 64-bit register writes, so they
+ * go through the same path (and the GS recorder) as A+D and REGLIST data.
+ */
+
+/* Returns the RGBAQ register with Q replaced */
+u64 getRGBAQ(u32 q) {
+    return (u32)(rgbaq.r | (rgbaq.g << 8) | (rgbaq.b << 16) | (rgbaq.a << 24)) | ((u64)q << 32);
+}
+
+/* Returns the raw bits of the current Q */
+u32 getQ() {
+    u32 q;
+
+    std::memcpy(&q, &rgbaq.q, 4);
+
+    return q;
+}
+
 /* Unpacks data to an internal GS register */
-void writePACKED(u8 addr, const u128 &data) {
+template <u8 addr>
+void writePACKED(const u128 &data) {
     switch (addr) {
-        case static_cast<u8>(GSReg::ADDRDATA):
-            write(data._u8[8], data._u64[0]);
+        case static_cast<u8>(GSReg::PRIM):
+            write(addr, data._u64[0] & 0x7FF);
             break;
-        default:
-            std::printf("[GS        ] Unhandled PACKED write @ 0x%02X = 0x%016llX%016llX\n", addr, data._u64[1], data._u64[0]);
-
-            exit(0);
-    }
-}
+        case static_cast<u8>(GSReg::RGBAQ): // Q comes from the last ST write
+            {
+                const auto r = (u64)(data._u32[0] & 0xFF);
+                const auto g = (u64)(data._u32[1] & 0xFF);
+                const auto b = (u64)(data._u32[2] & 0xFF);
+                const auto a = (u64)(data._u32[3] & 0xFF);
 
-/* --- VRAM accessors --- */
+                write(addr, r | (g << 8) | (b << 16) | (a << 24) | ((u64)getQ() << 32));
+            }
+            break;
+        case static_cast<u8>(GSReg::ST):
+            write(addr, data._u64[0]);
 
-template <PSM psm>
-u32 readVRAM(u32 base, u32 width, u32 x, u32 y) {
-    u32 addr = base;
-    switch (psm) {
-        case PSM::PSMCT32 :
-        case PSM::PSMCT24 :
-        case PSM::PSMCT4HL:
-        case PSM::PSMCT4HH:
-        case PSM::PSMZ24  :
-            addr += x + width * y;
+            write(static_cast<u8>(GSReg::RGBAQ), getRGBAQ(data._u32[2]));
             break;
-        case PSM::PSMCT16 :
-        case PSM::PSMCT16S:
-        case PSM::PSMZ16S :
-            addr += (x >> 1) + ((width * y) >> 1);
+        case static_cast<u8>(GSReg::UV):
+            write(addr, (data._u32[0] & 0x3FFF) | ((u64)(data._u32[1] & 0x3FFF) << 16));
             break;
-        default:
-            std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
+        case static_cast<u8>(GSReg::XYZF2):
+        case static_cast<u8>(GSReg::XYZF3):
+            {
+                /* ADC selects the drawing kick */
+                const auto reg = (data._u32[3] & (1 << 15)) ? static_cast<u8>(GSReg::XYZF3) : addr;
 
-            exit(0);
-    }
+                const auto x = (u64)(data._u32[0] & 0xFFFF);
+                const auto y = (u64)(data._u32[1] & 0xFFFF);
+                const auto z = (u64)((data._u32[2] >> 4) & 0xFFFFFF);
+                const auto f = (u64)((data._u32[3] >> 4) & 0xFF);
 
-    addr &= 0xFFFFFF;
+                write(reg, x | (y << 16) | (z << 32) | (f << 56));
+            }
+            break;
+        case static_cast<u8>(GSReg::XYZ2):
+        case static_cast<u8>(GSReg::XYZ3):
+            {
+                const auto reg = (data._u32[3] & (1 << 15)) ? static_cast<u8>(GSReg::XYZ3) : addr;
+
+                const auto x = (u64)(data._u32[0] & 0xFFFF);
+                const auto y = (u64)(data._u32[1] & 0xFFFF);
+
+                write(reg, x | (y << 16) | ((u64)data._u32[2] << 32));
+            }
+            break;
+        case static_cast<u8>(GSReg::TEX0_1):
+        case static_cast<u8>(GSReg::TEX0_2):
+        case static_cast<u8>(GSReg::CLAMP_1):
+        case static_cast<u8>(GSReg::CLAMP_2):
+            write(addr, data._u64[0]);
+            break;
+        case static_cast<u8>(GSReg::FOG):
+            write(addr, (u64)((data._u32[3] >> 4) & 0xFF) << 56);
+            break;
+        case static_cast<u8>(GSReg::ADDRDATA):
+            write(data._u8[8], data._u64[0]);
+            break;
+        default: // 0x0B and NOP
+            break;
+    }
+}
+
+template <std::size_t... idx>
+constexpr std::array<PACKEDFn, sizeof...(idx)> makePACKEDTable(std::index_sequence<idx...>) {
+    return {&writePACKED<idx>...};
+}
+
+constexpr auto packedTable = makePACKEDTable(std::make_index_sequence<16>());
+
+/* Returns the PACKED handler of a register descriptor */
+PACKEDFn getPACKEDFn(u8 addr) {
+    return packedTable[addr & 0xF];
+}
+
+void writePACKED(u8 addr, const u128 &data) {
+    packedTable[addr & 0xF](data);
+}
+
+/* --- VRAM accessors --- */
+
+/* VRAM pages written since the last display update */
+std::array<bool, VRAM_PAGES> dirtyPages;
+
+/* Marks the pages holding n words starting at addr as written */
+void markPagesDirty(u32 addr, u32 n) {
+    if (!n) return;
+
+    const auto first = (addr & VRAM_MASK) >> 11;
+    const auto count = std::min(((((addr & 2047) + n) - 1) >> 11) + 1, VRAM_PAGES);
+
+    for (u32 i = 0; i < count; i++) {
+        dirtyPages[(first + i) % VRAM_PAGES] = true;
+    }
+}
+
+/* Marks n words starting at addr as written, must not be used by the pixel pipeline */
+void markDirty(u32 addr, u32 n) {
+    if (!n) return;
+
+    invalidateHiZ(addr, n);
+    markPagesDirty(addr, n);
+}
+
+/* Returns true if any of the n words starting at addr has been written */
+bool isDirty(u32 addr, u32 n) {
+    if (!n) return false;
+
+    const auto first = (addr & VRAM_MASK) >> 11;
+    const auto count = std::min(((((addr & 2047) + n) - 1) >> 11) + 1, VRAM_PAGES);
+
+    for (u32 i = 0; i < count; i++) {
+        if (dirtyPages[(first + i) % VRAM_PAGES]) return true;
+    }
+
+    return false;
+}
+
+/* Copies VRAM to dst */
+void getVRAM(u32 *dst) {
+    flushBatch();
+    flushDeferred();
+
+    std::memcpy(dst, vram.data(), 4 * VRAM_WORDS);
+}
+
+/* Overwrites VRAM with src */
+void setVRAM(const u32 *src) {
+    flushBatch();
+    flushDeferred();
+
+    std::memcpy(vram.data(), src, 4 * VRAM_WORDS);
+
+    dirtyPages.fill(true);
+
+    resetHiZ();
+}
+
+template <PSM psm>
+u32 readVRAM(u32 base, u32 width, u32 x, u32 y) {
+    u32 addr = base;
+    switch (psm) {
+        case PSM::PSMCT32 :
+        case PSM::PSMCT24 :
+        case PSM::PSMCT8H :
+        case PSM::PSMCT4HL:
+        case PSM::PSMCT4HH:
+        case PSM::PSMZ32  :
+        case PSM::PSMZ24  :
+            addr += x + width * y;
+            break;
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            addr += (x >> 1) + ((width * y) >> 1);
+            break;
+        case PSM::PSMCT8:
+            addr += (x >> 2) + ((width * y) >> 2);
+            break;
+        case PSM::PSMCT4:
+            addr += (x >> 3) + ((width * y) >> 3);
+            break;
+        default:
+            std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
+
+            exit(0);
+    }
+
+    addr &= VRAM_MASK;
 
     switch (psm) {
         case PSM::PSMCT32:
+        case PSM::PSMZ32 :
             return vram[addr];
         case PSM::PSMCT24:
         case PSM::PSMZ24 :
             return vram[addr] & 0xFFFFFF;
         case PSM::PSMCT16 :
         case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
         case PSM::PSMZ16S :
             return (vram[addr] >> (16 * (x & 1))) & 0xFFFF;
+        case PSM::PSMCT8:
+            return (vram[addr] >> (8 * (x & 3))) & 0xFF;
+        case PSM::PSMCT4:
+            return (vram[addr] >> (4 * (x & 7))) & 0xF;
+        case PSM::PSMCT8H:
+            return vram[addr] >> 24;
         case PSM::PSMCT4HL:
             return (vram[addr] >> 24) & 0xF;
             break;
@@ -788,34 +1445,45 @@ void writeVRAM(u32 base, u32 width, u32 x, u32 y, u32 data) {
     switch (psm) {
         case PSM::PSMCT32 :
         case PSM::PSMCT24 :
+        case PSM::PSMCT8H :
         case PSM::PSMCT4HL:
         case PSM::PSMCT4HH:
+        case PSM::PSMZ32  :
         case PSM::PSMZ24  :
             addr += x + width * y;
             break;
         case PSM::PSMCT16 :
         case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
         case PSM::PSMZ16S :
             addr += (x >> 1) + ((width * y) >> 1);
             break;
+        case PSM::PSMCT8:
+            addr += (x >> 2) + ((width * y) >> 2);
+            break;
+        case PSM::PSMCT4:
+            addr += (x >> 3) + ((width * y) >> 3);
+            break;
         default:
             std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
 
             exit(0);
     }
 
-    addr &= 0xFFFFFF;
+    addr &= VRAM_MASK;
 
     switch (psm) {
         case PSM::PSMCT32:
+        case PSM::PSMZ32 :
             vram[addr] = data;
             break;
         case PSM::PSMCT24:
         case PSM::PSMZ24 :
-            vram[addr] = (vram[addr] & ~0xFF) | (data & 0xFFFFFF);
+            vram[addr] = (vram[addr] & 0xFF000000) | (data & 0xFFFFFF);
             break;
         case PSM::PSMCT16 :
         case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
         case PSM::PSMZ16S :
             if (x & 1) {
                 vram[addr] &= 0xFFFF;
@@ -825,6 +1493,15 @@ void writeVRAM(u32 base, u32 width, u32 x, u32 y, u32 data) {
                 vram[addr] |= data & 0xFFFF;
             }
             break;
+        case PSM::PSMCT8:
+            vram[addr] = (vram[addr] & ~(0xFFu << (8 * (x & 3)))) | ((data & 0xFF) << (8 * (x & 3)));
+            break;
+        case PSM::PSMCT4:
+            vram[addr] = (vram[addr] & ~(0xFu << (4 * (x & 7)))) | ((data & 0xF) << (4 * (x & 7)));
+            break;
+        case PSM::PSMCT8H:
+            vram[addr] = (vram[addr] & 0xFFFFFF) | (data << 24);
+            break;
         case PSM::PSMCT4HL:
             vram[addr] = (vram[addr] & ~(0xF << 24)) | (data << 24);
             break;
@@ -838,191 +1515,3810 @@ void writeVRAM(u32 base, u32 width, u32 x, u32 y, u32 data) {
     }
 }
 
-/* Writes data to HWREG */
-void writeHWREG(u64 data) {
-    std::printf("[GS        ] Write @ HWREG = 0x%016llX\n", data);
+/* Marks the pages of n pixels in row y as written, doesn't invalidate HiZ (used by the pixel pipeline) */
+template <PSM psm>
+void markSpanDirty(u32 base, u32 width, i64 x, i64 y, i64 n) {
+    if (n <= 0) return;
 
-    if (trxdir != TRXDIR::HostToLocal) return;
+    u32 shift = 0; // Pixels per word (log2)
+    switch (psm) {
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            shift = 1;
+            break;
+        case PSM::PSMCT8:
+            shift = 2;
+            break;
+        case PSM::PSMCT4:
+            shift = 3;
+            break;
+        default:
+            break;
+    }
 
-    const auto x = trxpos.dsax + dstTrx.x;
-    const auto y = trxpos.dsay + dstTrx.y;
+    const auto first = (u32)((x + width * y) >> shift);
+    const auto last  = (u32)((x + n - 1 + width * y) >> shift);
 
-    /* Unpack data according to PSM */
+    markPagesDirty(base + first, last - first + 1);
+}
 
-    switch (bitbltbuf.dpsm) {
-        case PSM::PSMCT32:
-            writeVRAM<PSM::PSMCT32>(bitbltbuf.dbp, bitbltbuf.dbw, x + 0, y, data);
-            writeVRAM<PSM::PSMCT32>(bitbltbuf.dbp, bitbltbuf.dbw, x + 1, y, data);
+/* --- Transmission helpers --- */
 
-            dstTrx.x += 2;
-            break;
-        case PSM::PSMCT16:
-            for (int i = 0; i < 4; i++) {
-                writeVRAM<PSM::PSMCT16>(bitbltbuf.dbp, bitbltbuf.dbw, x + i, y, (data >> (16 * i)) & 0xFFFF);
-            }
+/*
+ * All transmissions move rows of pixels in transmission format, i.e. packed
+ * pixels the way they appear in HWREG data. Row readers/writers exist for every
+ * transferable PSM, Local->Local transmissions between PSMs of different sizes
+ * go through a row converter.
+ */
 
-            dstTrx.x += 4;
-            break;
+/* Storage modes that can be transmitted, in table order */
+constexpr PSM trxPSMs[13] = {
+    PSM::PSMCT32, PSM::PSMCT24, PSM::PSMCT16, PSM::PSMCT16S, PSM::PSMCT8, PSM::PSMCT4, PSM::PSMCT8H, PSM::PSMCT4HL, PSM::PSMCT4HH,
+    PSM::PSMZ32, PSM::PSMZ24, PSM::PSMZ16, PSM::PSMZ16S,
+};
+
+/* Returns the size of a pixel in bits */
+template <PSM psm>
+constexpr u32 getBitsPerPixel() {
+    switch (psm) {
+        case PSM::PSMCT24 :
+        case PSM::PSMZ24  :
+            return 24;
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            return 16;
+        case PSM::PSMCT8 :
+        case PSM::PSMCT8H:
+            return 8;
+        case PSM::PSMCT4  :
         case PSM::PSMCT4HL:
-            for (int i = 0; i < 16; i++) {
-                writeVRAM<PSM::PSMCT4HL>(bitbltbuf.dbp, bitbltbuf.dbw, x + i, y, (data >> (4 * i)) & 0xF);
-            }
+        case PSM::PSMCT4HH:
+            return 4;
+        default:
+            return 32;
+    }
+}
 
-            dstTrx.x += 16;
-            break;
+/* Returns the size of a pixel in bits */
+u32 getBitsPerPixel(u8 psm) {
+    switch (psm) {
+        case PSM::PSMCT24 :
+        case PSM::PSMZ24  :
+            return 24;
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            return 16;
+        case PSM::PSMCT8 :
+        case PSM::PSMCT8H:
+            return 8;
+        case PSM::PSMCT4  :
+        case PSM::PSMCT4HL:
         case PSM::PSMCT4HH:
-            for (int i = 0; i < 16; i++) {
-                writeVRAM<PSM::PSMCT4HH>(bitbltbuf.dbp, bitbltbuf.dbw, x + i, y, (data >> (4 * i)) & 0xF);
-            }
+            return 4;
+        default:
+            return 32;
+    }
+}
 
-            dstTrx.x += 16;
-            break;
+/* Returns true if psm is a Z buffer format */
+constexpr bool isDepthPSM(u8 psm) {
+    return (psm & 0x30) == 0x30;
+}
+
+/* Returns true if psm is an indexed texture format */
+constexpr bool isIndexedPSM(u8 psm) {
+    switch (psm) {
+        case PSM::PSMCT8  :
+        case PSM::PSMCT4  :
+        case PSM::PSMCT8H :
+        case PSM::PSMCT4HL:
+        case PSM::PSMCT4HH:
+            return true;
         default:
-            std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", bitbltbuf.dpsm);
+            return false;
+    }
+}
 
-            exit(0);
+/* Returns the table index of a transferable storage mode */
+int getTRXPSMIndex(u8 psm) {
+    for (int i = 0; i < 13; i++) {
+        if (trxPSMs[i] == psm) return i;
     }
 
-    if (dstTrx.x >= trxreg.rrw) {
-        dstTrx.y++;
+    std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
 
-        if (dstTrx.y >= trxreg.rrh) {
-            std::printf("[GS        ] Host->Local transmission end\n");
+    exit(0);
+}
 
-            trxdir = TRXDIR::Deactivated;
+/* Copies a row of 32-bit pixels to VRAM */
+void copyRow32(u32 addr, const u8 *src, u32 n) {
+    markDirty(addr, n);
 
-            return;
-        }
+    while (n) {
+        addr &= VRAM_MASK;
 
-        dstTrx.x = 0;
+        /* Split the copy if it wraps around the end of VRAM */
+        const auto len = std::min(n, (VRAM_MASK + 1) - addr);
+
+        std::memcpy(&vram[addr], src, 4 * len);
+
+        addr += len;
+        src  += 4 * len;
+        n    -= len;
     }
 }
 
-/* Performs a depth test */
-bool depthTest(i64 x, i64 y, i64 z) {
-    if (!cctx->test.zte) return true; // Shouldn't happen
+/* Copies a row of 32-bit pixels from VRAM */
+void readRow32(u32 addr, u8 *dst, u32 n) {
+    while (n) {
+        addr &= VRAM_MASK;
 
-    u32 oldZ;
-    switch (cctx->zbuf.psm) {
-        //case PSM::PSMZ24 : oldZ = readVRAM<PSM::PSMZ24 >(cctx->zbuf.zbp, cctx->frame.fbw, x, y); break;
-        case PSM::PSMZ16S: oldZ = readVRAM<PSM::PSMZ16S>(cctx->zbuf.zbp, cctx->frame.fbw, x, y); break;
-        default:
-            std::printf("[GS        ] Unhandled depth storage mode 0x%02X\n", cctx->zbuf.psm);
+        const auto len = std::min(n, (VRAM_MASK + 1) - addr);
 
-            exit(0);
+        std::memcpy(dst, &vram[addr], 4 * len);
+
+        addr += len;
+        dst  += 4 * len;
+        n    -= len;
     }
+}
 
-    switch (cctx->test.ztst) {
-        case static_cast<u8>(ZTest::Never) : return false;
-        case static_cast<u8>(ZTest::Always): break;
-        case static_cast<u8>(ZTest::GEqual):
-            switch (cctx->zbuf.psm) {
-                //case PSM::PSMZ24 : z &= 0xFFFFFF; break;
-                case PSM::PSMZ16S: z &= 0xFFFF; break;
-                default:
-                    std::printf("[GS        ] Unhandled depth storage mode 0x%02X\n", cctx->zbuf.psm);
+/* Copies a row of 16-bit pixels to VRAM, addr is a halfword address */
+void copyRow16(u32 addr, const u8 *src, u32 n) {
+    constexpr u32 VRAM_MASK16 = (VRAM_MASK << 1) | 1;
 
-                    exit(0);
-            }
+    markDirty(addr >> 1, ((addr & 1) + n + 1) >> 1);
 
-            if ((u32)z < oldZ) return false;
-            break;
-        case static_cast<u8>(ZTest::Greater):
-            switch (cctx->zbuf.psm) {
-                //case PSM::PSMZ24 : z &= 0xFFFFFF; break;
-                case PSM::PSMZ16S: z &= 0xFFFF; break;
-                default:
-                    std::printf("[GS        ] Unhandled depth storage mode 0x%02X\n", cctx->zbuf.psm);
+    while (n) {
+        addr &= VRAM_MASK16;
 
-                    exit(0);
-            }
+        const auto len = std::min(n, (VRAM_MASK16 + 1) - addr);
 
-            if ((u32)z <= oldZ) return false;
-            break;
+        std::memcpy((u8 *)vram.data() + 2 * addr, src, 2 * len);
+
+        addr += len;
+        src  += 2 * len;
+        n    -= len;
     }
+}
 
-    if (!cctx->zbuf.zmsk) { // TODO: check alpha test result
-        switch (cctx->zbuf.psm) {
-            //case PSM::PSMZ24 : writeVRAM<PSM::PSMZ24 >(cctx->zbuf.zbp, cctx->frame.fbw, x, y, z); break;
-            case PSM::PSMZ16S: writeVRAM<PSM::PSMZ16S>(cctx->zbuf.zbp, cctx->frame.fbw, x, y, z); break;
-            default:
-                std::printf("[GS        ] Unhandled depth storage mode 0x%02X\n", cctx->zbuf.psm);
+/* Copies a row of 16-bit pixels from VRAM, addr is a halfword address */
+void readRow16(u32 addr, u8 *dst, u32 n) {
+    constexpr u32 VRAM_MASK16 = (VRAM_MASK << 1) | 1;
 
-                exit(0);
-        }
+    while (n) {
+        addr &= VRAM_MASK16;
+
+        const auto len = std::min(n, (VRAM_MASK16 + 1) - addr);
+
+        std::memcpy(dst, (u8 *)vram.data() + 2 * addr, 2 * len);
+
+        addr += len;
+        dst  += 2 * len;
+        n    -= len;
     }
+}
 
-    return true;
+/* Copies a row of 24-bit pixels to VRAM, keeps the upper 8 bits of each word */
+void copyRow24(u32 addr, const u8 *src, u32 n) {
+    markDirty(addr, n);
+
+    u32 i = 0;
+
+#ifdef __SSSE3__
+    /* Expand four packed 24-bit pixels per iteration */
+    const auto shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const auto rgbMask = _mm_set1_epi32(0xFFFFFF);
+
+    /* Only read 16 bytes while at least 16 source bytes are left */
+    for (; (i + 6) <= n; i += 4) {
+        const auto wordAddr = (addr + i) & VRAM_MASK;
+
+        if ((wordAddr + 4) > (VRAM_MASK + 1)) break;
+
+        const auto rgb = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), shuffle);
+        const auto old = _mm_loadu_si128((const __m128i *)&vram[wordAddr]);
+
+        _mm_storeu_si128((__m128i *)&vram[wordAddr], _mm_or_si128(_mm_andnot_si128(rgbMask, old), rgb));
+    }
+#endif
+
+    for (; i < n; i++) {
+        const auto wordAddr = (addr + i) & VRAM_MASK;
+
+        const u32 rgb = src[3 * i] | (src[3 * i + 1] << 8) | (src[3 * i + 2] << 16);
+
+        vram[wordAddr] = (vram[wordAddr] & 0xFF000000) | rgb;
+    }
 }
 
-void drawSprite() {
-    std::printf("Drawing sprite...\n");
+/* Copies a row of 24-bit pixels from VRAM */
+void readRow24(u32 addr, u8 *dst, u32 n) {
+    u32 i = 0;
 
-    assert(!cmode->iip);
-    assert(!cmode->tme); // TODO: add texture mapping
-    assert(!cmode->fge); // TODO: add fog
-    assert(!cmode->abe); // TODO: add alpha blending
-    assert(!cmode->fst);
+#ifdef __SSSE3__
+    /* Pack four 24-bit pixels per iteration */
+    const auto shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
 
-    /* Get two vertices */
+    /* Only store 16 bytes while at least 16 destination bytes are left */
+    for (; (i + 6) <= n; i += 4) {
+        const auto wordAddr = (addr + i) & VRAM_MASK;
 
-    Vertex v0 = vtxQueue[0];
-    Vertex v1 = vtxQueue[1];
+        if ((wordAddr + 4) > (VRAM_MASK + 1)) break;
 
-    /* Offset coordinates */
+        _mm_storeu_si128((__m128i *)(dst + 3 * i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&vram[wordAddr]), shuffle));
+    }
+#endif
 
-    v0.x -= cctx->xyoffset.ofx;
-    v0.y -= cctx->xyoffset.ofy;
-    v1.x -= cctx->xyoffset.ofx;
-    v1.y -= cctx->xyoffset.ofy;
+    for (; i < n; i++) {
+        const auto data = vram[(addr + i) & VRAM_MASK];
 
-    /* Calculate "bounding box" */
+        dst[3 * i + 0] = data >>  0;
+        dst[3 * i + 1] = data >>  8;
+        dst[3 * i + 2] = data >> 16;
+    }
+}
 
-    const auto xMin = (std::max(std::min(v0.x, v1.x), cctx->scissor.scax0) >> 4) << 4;
-    const auto xMax = (std::min(std::max(v0.x, v1.x), (cctx->scissor.scax1 + 0x10)) >> 4) << 4;
-    const auto yMin = (std::max(std::min(v0.y, v1.y), cctx->scissor.scay0) >> 4) << 4;
-    const auto yMax = (std::min(std::max(v0.y, v1.y), (cctx->scissor.scay1 + 0x10)) >> 4) << 4;
+/* Copies a row of 4-bit pixels to VRAM, starting at nibble `nibble` of src */
+template <u32 shift>
+void copyRow4(u32 addr, const u8 *src, u32 nibble, u32 n) {
+    markDirty(addr, n);
 
-    std::printf("v0 = [%lld, %lld], v1 = [%lld, %lld]\n", v0.x >> 4, v0.y >> 4, v1.x >> 4, v1.y >> 4);
+    for (u32 i = 0; i < n; i++, nibble++) {
+        const auto wordAddr = (addr + i) & VRAM_MASK;
 
-    /* Start drawing */
+        const u32 data = (src[nibble >> 1] >> (4 * (nibble & 1))) & 0xF;
 
-    for (auto y = yMin >> 4; y < (yMax >> 4); y++) {
-        for (auto x = xMin >> 4; x < (xMax >> 4); x++) {
-            u32 color = (v1.a << 24) | (v1.b << 16) | (v1.g << 8) | v1.r;
+        vram[wordAddr] = (vram[wordAddr] & ~(0xFu << shift)) | (data << shift);
+    }
+}
 
-            /* Skip to next pixel if Z test fails */
-            if (!depthTest(x, y, v1.z)) continue;
+/* Copies a row of 4-bit pixels from VRAM, starting at nibble `nibble` of dst */
+template <u32 shift>
+void readRow4(u32 addr, u8 *dst, u32 nibble, u32 n) {
+    for (u32 i = 0; i < n; i++, nibble++) {
+        const u8 data = (vram[(addr + i) & VRAM_MASK] >> shift) & 0xF;
 
-            /* Draw pixel */
-            switch (cctx->frame.psm) {
-            case PSM::PSMCT24: writeVRAM<PSM::PSMCT24>(cctx->zbuf.zbp, cctx->frame.fbw, x, y, color); break;
-                default:
-                    std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", cctx->frame.psm);
+        auto &byte = dst[nibble >> 1];
 
-                    exit(0);
-            }
+        if (nibble & 1) {
+            byte = (byte & 0xF) | (data << 4);
+        } else {
+            byte = (byte & 0xF0) | data;
         }
     }
 }
 
-/* --- Transmission handlers --- */
+/* Copies a row of 8-bit pixels to VRAM, addr is a byte address */
+void copyRow8(u32 addr, const u8 *src, u32 n) {
+    constexpr u32 VRAM_MASK8 = (VRAM_MASK << 2) | 3;
 
-void doTransmission() {
-    switch (trxdir) {
-        case TRXDIR::HostToLocal: // Handled via HWREG writes
-            std::printf("[GS        ] Host->Local transmission\n");
+    markDirty(addr >> 2, ((addr & 3) + n + 3) >> 2);
 
-            dstTrx.x = 0;
-            dstTrx.y = 0;
+    while (n) {
+        addr &= VRAM_MASK8;
+
+        const auto len = std::min(n, (VRAM_MASK8 + 1) - addr);
+
+        std::memcpy((u8 *)vram.data() + addr, src, len);
+
+        addr += len;
+        src  += len;
+        n    -= len;
+    }
+}
+
+/* Copies a row of 8-bit pixels from VRAM, addr is a byte address */
+void readRow8(u32 addr, u8 *dst, u32 n) {
+    constexpr u32 VRAM_MASK8 = (VRAM_MASK << 2) | 3;
+
+    while (n) {
+        addr &= VRAM_MASK8;
+
+        const auto len = std::min(n, (VRAM_MASK8 + 1) - addr);
+
+        std::memcpy(dst, (u8 *)vram.data() + addr, len);
+
+        addr += len;
+        dst  += len;
+        n    -= len;
+    }
+}
+
+/* Copies a row of 8-bit pixels to the upper 8 bits of VRAM words */
+void copyRow8H(u32 addr, const u8 *src, u32 n) {
+    markDirty(addr, n);
+
+    for (u32 i = 0; i < n; i++) {
+        const auto wordAddr = (addr + i) & VRAM_MASK;
+
+        vram[wordAddr] = (vram[wordAddr] & 0xFFFFFF) | ((u32)src[i] << 24);
+    }
+}
+
+/* Copies a row of 8-bit pixels from the upper 8 bits of VRAM words */
+void readRow8H(u32 addr, u8 *dst, u32 n) {
+    for (u32 i = 0; i < n; i++) dst[i] = vram[(addr + i) & VRAM_MASK] >> 24;
+}
+
+/* Copies a row of packed 4-bit pixels to VRAM, addr is a nibble address */
+void copyRowPacked4(u32 addr, const u8 *src, u32 nibble, u32 n) {
+    constexpr u32 VRAM_MASK4 = (VRAM_MASK << 3) | 7;
+
+    markDirty((addr & VRAM_MASK4) >> 3, ((addr & 7) + n + 7) >> 3);
+
+    for (u32 i = 0; i < n; i++, nibble++) {
+        const auto pos   = (addr + i) & VRAM_MASK4;
+        const auto shift = 4 * (pos & 7);
+
+        const u32 data = (src[nibble >> 1] >> (4 * (nibble & 1))) & 0xF;
+
+        vram[pos >> 3] = (vram[pos >> 3] & ~(0xFu << shift)) | (data << shift);
+    }
+}
+
+/* Copies a row of packed 4-bit pixels from VRAM, addr is a nibble address */
+void readRowPacked4(u32 addr, u8 *dst, u32 nibble, u32 n) {
+    constexpr u32 VRAM_MASK4 = (VRAM_MASK << 3) | 7;
+
+    for (u32 i = 0; i < n; i++, nibble++) {
+        const auto pos = (addr + i) & VRAM_MASK4;
+
+        const u8 data = (vram[pos >> 3] >> (4 * (pos & 7))) & 0xF;
+
+        auto &byte = dst[nibble >> 1];
+
+        if (nibble & 1) {
+            byte = (byte & 0xF) | (data << 4);
+        } else {
+            byte = (byte & 0xF0) | data;
+        }
+    }
+}
+
+/* Writes a row of pixels in transmission format to VRAM */
+template <PSM psm>
+void writeTRXRow(u32 base, u32 width, u32 x, u32 y, const u8 *src, u32 nibble, u32 n) {
+    switch (psm) {
+        case PSM::PSMCT32 :
+        case PSM::PSMZ32  :
+            copyRow32(base + x + width * y, src, n);
             break;
-        case TRXDIR::Deactivated:
-            std::printf("[GS        ] Transmission deactivated\n");
+        case PSM::PSMCT24 :
+        case PSM::PSMZ24  :
+            copyRow24(base + x + width * y, src, n);
+            break;
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            copyRow16(2 * base + x + width * y, src, n);
+            break;
+        case PSM::PSMCT8:
+            copyRow8(4 * base + x + width * y, src, n);
+            break;
+        case PSM::PSMCT4:
+            copyRowPacked4(8 * base + x + width * y, src, nibble, n);
+            break;
+        case PSM::PSMCT8H:
+            copyRow8H(base + x + width * y, src, n);
+            break;
+        case PSM::PSMCT4HL:
+            copyRow4<24>(base + x + width * y, src, nibble, n);
+            break;
+        case PSM::PSMCT4HH:
+            copyRow4<28>(base + x + width * y, src, nibble, n);
             break;
         default:
-            std::printf("[GS        ] Unhandled transmission direction %u\n", trxdir);
+            std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
+
             exit(0);
     }
 }
 
+/* Reads a row of pixels from VRAM in transmission format */
+template <PSM psm>
+void readTRXRow(u32 base, u32 width, u32 x, u32 y, u8 *dst, u32 nibble, u32 n) {
+    switch (psm) {
+        case PSM::PSMCT32 :
+        case PSM::PSMZ32  :
+            readRow32(base + x + width * y, dst, n);
+            break;
+        case PSM::PSMCT24 :
+        case PSM::PSMZ24  :
+            readRow24(base + x + width * y, dst, n);
+            break;
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            readRow16(2 * base + x + width * y, dst, n);
+            break;
+        case PSM::PSMCT8:
+            readRow8(4 * base + x + width * y, dst, n);
+            break;
+        case PSM::PSMCT4:
+            readRowPacked4(8 * base + x + width * y, dst, nibble, n);
+            break;
+        case PSM::PSMCT8H:
+            readRow8H(base + x + width * y, dst, n);
+            break;
+        case PSM::PSMCT4HL:
+            readRow4<24>(base + x + width * y, dst, nibble, n);
+            break;
+        case PSM::PSMCT4HH:
+            readRow4<28>(base + x + width * y, dst, nibble, n);
+            break;
+        default:
+            std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
+
+            exit(0);
+    }
+}
+
+/* Writes a whole transmission row, wraps around at x = 2048 */
+template <PSM psm>
+void writeRow(u32 base, u32 width, u32 x, u32 y, const u8 *src, u32 n) {
+    constexpr auto bpp = getBitsPerPixel<psm>();
+
+    u32 pos = 0;
+
+    while (pos < n) {
+        const auto len = std::min(n - pos, 2048 - x);
+
+        writeTRXRow<psm>(base, width, x, y, src + ((bpp * pos) >> 3), (bpp == 4) ? (pos & 1) : 0, len);
+
+        pos += len;
+
+        x = 0;
+    }
+}
+
+/* Reads a whole transmission row, wraps around at x = 2048 */
+template <PSM psm>
+void readRow(u32 base, u32 width, u32 x, u32 y, u8 *dst, u32 n) {
+    constexpr auto bpp = getBitsPerPixel<psm>();
+
+    u32 pos = 0;
+
+    while (pos < n) {
+        const auto len = std::min(n - pos, 2048 - x);
+
+        readTRXRow<psm>(base, width, x, y, dst + ((bpp * pos) >> 3), (bpp == 4) ? (pos & 1) : 0, len);
+
+        pos += len;
+
+        x = 0;
+    }
+}
+
+using RowWriteFn = void (*)(u32, u32, u32, u32, const u8 *, u32);
+using RowReadFn  = void (*)(u32, u32, u32, u32, u8 *, u32);
+
+template <std::size_t... idx>
+constexpr std::array<RowWriteFn, sizeof...(idx)> makeRowWriteTable(std::index_sequence<idx...>) {
+    return { &writeRow<trxPSMs[idx]>... };
+}
+
+template <std::size_t... idx>
+constexpr std::array<RowReadFn, sizeof...(idx)> makeRowReadTable(std::index_sequence<idx...>) {
+    return { &readRow<trxPSMs[idx]>... };
+}
+
+/* Indexed by trxPSMs */
+constexpr auto rowWriteTable = makeRowWriteTable(std::make_index_sequence<13>());
+constexpr auto rowReadTable  = makeRowReadTable(std::make_index_sequence<13>());
+
+/* Converts a row of pixels between transmission formats of different sizes */
+template <u32 srcBPP, u32 dstBPP, bool isColor>
+void convertRow(const u8 *src, u8 *dst, u32 n) {
+    for (u32 i = 0; i < n; i++) {
+        u32 data = 0;
+
+        std::memcpy(&data, src + i * (srcBPP >> 3), srcBPP >> 3);
+
+        if constexpr (isColor && (srcBPP == 16)) {
+            /* A1B5G5R5 -> A8B8G8R8 */
+            data = ((data & 0x1F) << 3) | ((data & (0x1F << 5)) << 6) | ((data & (0x1F << 10)) << 9) | ((data & (1 << 15)) ? (0x80u << 24) : 0);
+        }
+
+        if constexpr (isColor && (dstBPP == 16)) {
+            data = ((data >> 3) & 0x1F) | ((data >> 6) & (0x1F << 5)) | ((data >> 9) & (0x1F << 10)) | ((data >> 16) & (1 << 15));
+        } else if constexpr (!isColor && (dstBPP < srcBPP)) {
+            /* Saturate Z values */
+            data = std::min(data, (1u << dstBPP) - 1);
+        }
+
+        std::memcpy(dst + i * (dstBPP >> 3), &data, dstBPP >> 3);
+    }
+}
+
+using RowConvertFn = void (*)(const u8 *, u8 *, u32);
+
+/* Indexed by [src size][dst size][color], sizes are 32, 24 and 16 bits */
+constexpr RowConvertFn rowConvertTable[3][3][2] = {
+    {
+        { nullptr, nullptr },
+        { &convertRow<32, 24, false>, &convertRow<32, 24, true> },
+        { &convertRow<32, 16, false>, &convertRow<32, 16, true> },
+    },
+    {
+        { &convertRow<24, 32, false>, &convertRow<24, 32, true> },
+        { nullptr, nullptr },
+        { &convertRow<24, 16, false>, &convertRow<24, 16, true> },
+    },
+    {
+        { &convertRow<16, 32, false>, &convertRow<16, 32, true> },
+        { &convertRow<16, 24, false>, &convertRow<16, 24, true> },
+        { nullptr, nullptr },
+    },
+};
+
+/* Returns the row converter table index of a pixel size */
+int getConvertIndex(u32 bpp) {
+    switch (bpp) {
+        case 32: return 0;
+        case 24: return 1;
+        case 16: return 2;
+        default:
+            std::printf("[GS        ] Unhandled pixel conversion from/to %u-bit pixels\n", bpp);
+
+            exit(0);
+    }
+}
+
+/* --- Host->Local transmission --- */
+
+/* Host->Local bytes that don't make up a whole pixel yet */
+u8  trxBuf[4];
+u32 trxBufSize;
+
+/* Advances the destination position of a Host->Local transmission, returns false when the transmission ends */
+bool stepTRX(u32 n) {
+    dstTrx.x += n;
+
+    if (dstTrx.x >= trxreg.rrw) {
+        dstTrx.x = 0;
+        dstTrx.y++;
+
+        if (dstTrx.y >= trxreg.rrh) {
+            printLog("[GS        ] Host->Local transmission end\n");
+
+            trxdir = TRXDIR::Deactivated;
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Writes a block of Host->Local data to VRAM */
+template <PSM psm>
+void doHostToLocal(const u8 *src, u64 size) {
+    constexpr auto bpp = getBitsPerPixel<psm>();
+
+    const auto base  = bitbltbuf.dbp;
+    const auto width = bitbltbuf.dbw;
+
+    /* Complete a pixel that was split across two writes */
+    if (trxBufSize) {
+        const auto len = std::min((u64)((bpp >> 3) - trxBufSize), size);
+
+        std::memcpy(&trxBuf[trxBufSize], src, len);
+
+        trxBufSize += len;
+
+        src  += len;
+        size -= len;
+
+        if (trxBufSize < (bpp >> 3)) return;
+
+        trxBufSize = 0;
+
+        writeTRXRow<psm>(base, width, (trxpos.dsax + dstTrx.x) & 2047, (trxpos.dsay + dstTrx.y) & 2047, trxBuf, 0, 1);
+
+        if (!stepTRX(1)) return;
+    }
+
+    auto pixels = (8 * size) / bpp;
+
+    u32 nibble = 0;
+
+    while (pixels) {
+        /* Destination coordinates wrap around at 2048 */
+        const auto x = (trxpos.dsax + dstTrx.x) & 2047;
+        const auto y = (trxpos.dsay + dstTrx.y) & 2047;
+
+        const auto n = (u32)std::min({pixels, (u64)(trxreg.rrw - dstTrx.x), (u64)(2048 - x)});
+
+        writeTRXRow<psm>(base, width, x, y, src, nibble, n);
+
+        if constexpr (bpp == 4) {
+            src   += (nibble + n) >> 1;
+            nibble = (nibble + n) & 1;
+        } else {
+            src += n * (bpp >> 3);
+        }
+
+        pixels -= n;
+
+        if (!stepTRX(n)) return;
+    }
+
+    /* Save incomplete pixel */
+    if constexpr (bpp == 24) {
+        trxBufSize = (8 * size - 24 * ((8 * size) / 24)) >> 3;
+
+        std::memcpy(trxBuf, src, trxBufSize);
+    }
+}
+
+/* Writes data to HWREG */
+void writeHWREG(const u64 *data, u64 count) {
+    recorder::onWriteHWREG(data, count);
+
+    flushBatch();
+
+    if (trxdir != TRXDIR::HostToLocal) return;
+
+    const auto src  = (const u8 *)data;
+    const auto size = 8 * count;
+
+    switch (bitbltbuf.dpsm) {
+        case PSM::PSMCT32 : doHostToLocal<PSM::PSMCT32 >(src, size); break;
+        case PSM::PSMCT24 : doHostToLocal<PSM::PSMCT24 >(src, size); break;
+        case PSM::PSMCT16 : doHostToLocal<PSM::PSMCT16 >(src, size); break;
+        case PSM::PSMCT16S: doHostToLocal<PSM::PSMCT16S>(src, size); break;
+        case PSM::PSMCT8  : doHostToLocal<PSM::PSMCT8  >(src, size); break;
+        case PSM::PSMCT4  : doHostToLocal<PSM::PSMCT4  >(src, size); break;
+        case PSM::PSMCT8H : doHostToLocal<PSM::PSMCT8H >(src, size); break;
+        case PSM::PSMCT4HL: doHostToLocal<PSM::PSMCT4HL>(src, size); break;
+        case PSM::PSMCT4HH: doHostToLocal<PSM::PSMCT4HH>(src, size); break;
+        case PSM::PSMZ32  : doHostToLocal<PSM::PSMZ32  >(src, size); break;
+        case PSM::PSMZ24  : doHostToLocal<PSM::PSMZ24  >(src, size); break;
+        case PSM::PSMZ16  : doHostToLocal<PSM::PSMZ16  >(src, size); break;
+        case PSM::PSMZ16S : doHostToLocal<PSM::PSMZ16S >(src, size); break;
+        default:
+            std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", bitbltbuf.dpsm);
+
+            exit(0);
+    }
+}
+
+/* --- Local->Host transmission --- */
+
+/* Local->Host data, read by VIF1 downloads */
+std::vector<u8> readbackBuf;
+u64 readbackPos;
+
+/* Reads the whole source rectangle into the readback buffer */
+void doLocalToHost() {
+    const auto readFn = rowReadTable[getTRXPSMIndex(bitbltbuf.spsm)];
+
+    const auto rowSize = (trxreg.rrw * getBitsPerPixel(bitbltbuf.spsm)) >> 3;
+
+    /* Round up to whole quadwords, rows don't have to be byte aligned for 4-bit pixels */
+    readbackBuf.assign(((((u64)trxreg.rrw * trxreg.rrh * getBitsPerPixel(bitbltbuf.spsm)) >> 3) + 15) & ~15, 0);
+    readbackPos = 0;
+
+    if (getBitsPerPixel(bitbltbuf.spsm) == 4) {
+        /* Rows of odd width start in the middle of a byte, go through a temporary row */
+        std::vector<u8> row((trxreg.rrw + 1) >> 1);
+
+        u64 nibble = 0;
+
+        for (u32 y = 0; y < trxreg.rrh; y++) {
+            readFn(bitbltbuf.sbp, bitbltbuf.sbw, trxpos.ssax, (trxpos.ssay + y) & 2047, row.data(), trxreg.rrw);
+
+            for (u32 x = 0; x < trxreg.rrw; x++, nibble++) {
+                const u8 data = (row[x >> 1] >> (4 * (x & 1))) & 0xF;
+
+                readbackBuf[nibble >> 1] |= data << (4 * (nibble & 1));
+            }
+        }
+    } else {
+        for (u32 y = 0; y < trxreg.rrh; y++) {
+            readFn(bitbltbuf.sbp, bitbltbuf.sbw, trxpos.ssax, (trxpos.ssay + y) & 2047, &readbackBuf[y * rowSize], trxreg.rrw);
+        }
+    }
+}
+
+/* Reads Local->Host data */
+void readHWREG(u64 *data, u64 count) {
+    recorder::onReadHWREG(count);
+
+    flushBatch();
+
+    const auto size = 8 * count;
+
+    const auto len = (trxdir == TRXDIR::LocalToHost) ? std::min(size, (u64)readbackBuf.size() - readbackPos) : 0;
+
+    std::memcpy(data, readbackBuf.data() + readbackPos, len);
+    std::memset((u8 *)data + len, 0, size - len);
+
+    readbackPos += len;
+
+    if ((trxdir == TRXDIR::LocalToHost) && (readbackPos == readbackBuf.size())) {
+        printLog("[GS        ] Local->Host transmission end\n");
+
+        trxdir = TRXDIR::Deactivated;
+    }
+}
+
+/* --- Local->Local transmission --- */
+
+/* Copies the source rectangle to the destination rectangle */
+void doLocalToLocal() {
+    const auto srcIdx = getTRXPSMIndex(bitbltbuf.spsm);
+    const auto dstIdx = getTRXPSMIndex(bitbltbuf.dpsm);
+
+    const auto srcBPP = getBitsPerPixel(bitbltbuf.spsm);
+    const auto dstBPP = getBitsPerPixel(bitbltbuf.dpsm);
+
+    const auto w = trxreg.rrw;
+    const auto h = trxreg.rrh;
+
+    if (!w || !h) return;
+
+    RowConvertFn convert = nullptr;
+
+    if (srcBPP != dstBPP) {
+        convert = rowConvertTable[getConvertIndex(srcBPP)][getConvertIndex(dstBPP)][!isDepthPSM(bitbltbuf.spsm)];
+    }
+
+    /* Rows of the same size that don't wrap around can be moved directly */
+    const auto noWrap = ((trxpos.ssax + w) <= 2048) && ((trxpos.dsax + w) <= 2048);
+    const auto direct = noWrap && !convert && ((srcBPP == 32) || (srcBPP == 16));
+
+    static std::vector<u8> row, convRow;
+
+    row.resize(4 * 2048);
+    convRow.resize(4 * 2048);
+
+    /* TRXPOS.DIR selects the row order, which matters for overlapping rectangles */
+    const auto bottomUp = trxpos.dir & 1;
+
+    for (u32 i = 0; i < h; i++) {
+        const auto y = bottomUp ? (h - 1 - i) : i;
+
+        const auto sy = (trxpos.ssay + y) & 2047;
+        const auto dy = (trxpos.dsay + y) & 2047;
+
+        if (direct) {
+            auto srcAddr = bitbltbuf.sbp + trxpos.ssax + bitbltbuf.sbw * sy;
+            auto dstAddr = bitbltbuf.dbp + trxpos.dsax + bitbltbuf.dbw * dy;
+
+            if (srcBPP == 16) {
+                srcAddr = 2 * bitbltbuf.sbp + trxpos.ssax + bitbltbuf.sbw * sy;
+                dstAddr = 2 * bitbltbuf.dbp + trxpos.dsax + bitbltbuf.dbw * dy;
+            }
+
+            const auto size  = (w * srcBPP) >> 3;
+            const auto limit = (srcBPP == 16) ? 2 * (VRAM_MASK + 1) : (VRAM_MASK + 1);
+
+            if (((srcAddr + w) <= limit) && ((dstAddr + w) <= limit)) {
+                /* memmove handles rows that overlap themselves */
+                const auto mem = (u8 *)vram.data();
+
+                markDirty((dstAddr * (srcBPP >> 3)) >> 2, (size + 7) >> 2);
+
+                std::memmove(mem + dstAddr * (srcBPP >> 3), mem + srcAddr * (srcBPP >> 3), size);
+
+                continue;
+            }
+        }
+
+        /* Buffering the whole row takes care of overlap within a row */
+        rowReadTable[srcIdx](bitbltbuf.sbp, bitbltbuf.sbw, trxpos.ssax, sy, row.data(), w);
+
+        if (convert) {
+            convert(row.data(), convRow.data(), w);
+
+            rowWriteTable[dstIdx](bitbltbuf.dbp, bitbltbuf.dbw, trxpos.dsax, dy, convRow.data(), w);
+        } else {
+            rowWriteTable[dstIdx](bitbltbuf.dbp, bitbltbuf.dbw, trxpos.dsax, dy, row.data(), w);
+        }
+    }
+}
+
+/* --- Hierarchical Z --- */
+
+/*
+ * Every 8x8 block of the current Z buffer has a summary that bounds the Z
+ * values stored in it. Spans are split at block boundaries, and the Z test of
+ * a whole segment can often be decided from the summary alone. A summary only
+ * becomes usable once every row of its block has been fully written by the
+ * pixel pipeline; writes by transmissions drop the affected summaries.
+ */
+
+constexpr i64 HIZ_BLOCK_SIZE = 8;
+constexpr u32 HIZ_BLOCKS = 2048 / HIZ_BLOCK_SIZE; // Blocks per row/column
+
+/* Z test outcome of a span segment */
+enum HiZResult : u8 {
+    Test, Reject, Accept,
+};
+
+/* Z summary of a block */
+struct HiZBlock {
+    u32  gen;      // Block is reset if this doesn't match hizGen
+    bool isKnown;  // minZ and maxZ bound all Z values of the block
+    u8   fullRows; // Rows that have been fully written since newMinZ/newMaxZ were reset
+
+    u32 minZ, maxZ;
+    u32 newMinZ, newMaxZ; // Bounds of the values written since the last reset
+};
+
+std::vector<HiZBlock> hizBlocks(HIZ_BLOCKS * HIZ_BLOCKS);
+
+u32 hizGen = 1;
+
+/* Z buffer the summaries describe */
+u32  hizZBP, hizWidth;
+u8   hizPSM;
+bool hizEnabled;
+
+/* Drops all summaries */
+void resetHiZ() {
+    hizGen++;
+}
+
+/* Returns the block containing pixel (x, y) */
+HiZBlock &getHiZBlock(i64 x, i64 y) {
+    auto &block = hizBlocks[((y / HIZ_BLOCK_SIZE) % HIZ_BLOCKS) * HIZ_BLOCKS + ((x / HIZ_BLOCK_SIZE) % HIZ_BLOCKS)];
+
+    if (block.gen != hizGen) {
+        block.gen      = hizGen;
+        block.isKnown  = false;
+        block.fullRows = 0;
+        block.newMinZ  = 0xFFFFFFFF;
+        block.newMaxZ  = 0;
+    }
+
+    return block;
+}
+
+/* Returns the size of a Z buffer row in words */
+u32 getHiZRowSize() {
+    switch (hizPSM) {
+        case PSM::PSMZ16 :
+        case PSM::PSMZ16S:
+            return hizWidth >> 1;
+        default:
+            return hizWidth;
+    }
+}
+
+/* Drops the summaries of all blocks in VRAM words [addr, addr + n) */
+void invalidateHiZ(u32 addr, u32 n) {
+    if (!hizWidth) return;
+
+    const auto rowSize = getHiZRowSize();
+
+    const u64 zStart = hizZBP;
+    const u64 zEnd   = zStart + (u64)rowSize * 2048;
+
+    const u64 start = addr & VRAM_MASK;
+    const u64 end   = start + n;
+
+    if ((end <= zStart) || (start >= zEnd)) return;
+
+    const auto firstRow = (std::max(start, zStart) - zStart) / rowSize;
+    const auto lastRow  = (std::min(end, zEnd) - 1 - zStart) / rowSize;
+
+    const auto blockCount = (hizWidth + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+
+    for (auto by = firstRow / HIZ_BLOCK_SIZE; by <= (lastRow / HIZ_BLOCK_SIZE); by++) {
+        for (u32 bx = 0; bx < blockCount; bx++) {
+            hizBlocks[by * HIZ_BLOCKS + bx].gen = 0;
+        }
+    }
+}
+
+/* Selects the Z buffer for the next primitives */
+void setHiZTarget(u32 zbp, u32 width, u8 zpsm, u32 fbp, u8 fpsm, u32 height) {
+    if ((zbp != hizZBP) || (width != hizWidth) || (zpsm != hizPSM)) {
+        hizZBP   = zbp;
+        hizWidth = width;
+        hizPSM   = zpsm;
+
+        resetHiZ();
+    }
+
+    /* Frame buffer writes to Z memory would bypass the summaries */
+    const u64 fbSize = (u64)((getBitsPerPixel(fpsm) == 16) ? (width >> 1) : width) * height;
+    const u64 zSize  = (u64)getHiZRowSize() * height;
+
+    hizEnabled = ((fbp + fbSize) <= zbp) || ((zbp + zSize) <= fbp);
+
+    if (!hizEnabled) resetHiZ();
+}
+
+/* Decides the Z test of a segment with Z values in [zMin, zMax] */
+HiZResult classifyHiZ(i64 x, i64 y, u32 zMin, u32 zMax, u8 ztst) {
+    const auto &block = getHiZBlock(x, y);
+
+    if (!block.isKnown) return HiZResult::Test;
+
+    if (ztst == static_cast<u8>(ZTest::GEqual)) {
+        if (zMax <  block.minZ) return HiZResult::Reject;
+        if (zMin >= block.maxZ) return HiZResult::Accept;
+    } else {
+        if (zMax <= block.minZ) return HiZResult::Reject;
+        if (zMin >  block.maxZ) return HiZResult::Accept;
+    }
+
+    return HiZResult::Test;
+}
+
+/* Adds Z values written to a block row to its summary */
+void updateHiZ(i64 x, i64 y, u32 zMin, u32 zMax, bool isFullRow) {
+    auto &block = getHiZBlock(x, y);
+
+    block.newMinZ = std::min(block.newMinZ, zMin);
+    block.newMaxZ = std::max(block.newMaxZ, zMax);
+
+    if (block.isKnown) {
+        block.minZ = std::min(block.minZ, zMin);
+        block.maxZ = std::max(block.maxZ, zMax);
+    }
+
+    if (!isFullRow) return;
+
+    block.fullRows |= 1 << (y % HIZ_BLOCK_SIZE);
+
+    /* Every value in the block has been written since the last reset */
+    if (block.fullRows == 0xFF) {
+        block.isKnown = true;
+
+        block.minZ = block.newMinZ;
+        block.maxZ = block.newMaxZ;
+
+        block.fullRows = 0;
+        block.newMinZ  = 0xFFFFFFFF;
+        block.newMaxZ  = 0;
+    }
+}
+
+/* --- Texture sampling --- */
+
+/*
+ * Texture coordinates are converted to texels with 8 fractional bits before
+ * sampling. Mipmap level, filter and wrap parameters are resolved once per
+ * primitive, the per-pixel work is coordinate wrapping, texel fetches and
+ * filtering. With AVX2, 8 pixels are sampled at once with gathers.
+ */
+
+/* Texture function */
+enum class TFX {
+    Modulate, Decal, Highlight, Highlight2,
+};
+
+/* Texture wrap mode */
+enum class Wrap {
+    Repeat, Clamp, RegionClamp, RegionRepeat,
+};
+
+/* Texture filters (MMIN, MMAG only uses the first two) */
+enum TexFilter : u8 {
+    Nearest, Linear, NearestMipNearest, NearestMipLinear, LinearMipNearest, LinearMipLinear,
+};
+
+/* Storage modes with a specialized sampler, in table order */
+constexpr PSM texturePSMs[9] = {
+    PSM::PSMCT32, PSM::PSMCT24, PSM::PSMCT16, PSM::PSMCT16S, PSM::PSMCT8, PSM::PSMCT4, PSM::PSMCT8H, PSM::PSMCT4HL, PSM::PSMCT4HH,
+};
+
+/* Sampling state of a mipmap level */
+struct TexLevel {
+    u32 tbp, tbw;
+
+    /* Wrapped coordinate = clamp((coordinate & mask) | fix, min, max), indexed by [U/V] */
+    i32 mask[2], fix[2];
+    i32 min[2], max[2];
+};
+
+/* Per-primitive texture state */
+struct TexState {
+    TexLevel levels[7];
+
+    f32 width, height; // Size of level 0, used to scale STQ coordinates
+
+    bool fst;  // UV coordinates
+    bool lcm;  // Fixed LOD
+    u8   mxl;  // Maximum mipmap level
+    u8   mmag; // Magnification filter
+    u8   mmin; // Minification filter
+
+    f32 l, k; // LOD = K - log2(|Q|) * 2^L
+
+    u32  ta0, ta1;
+    bool aem;
+
+    alignas(32) u32 clut[256]; // Colors of indexed textures, CSA already applied
+};
+
+/* Converts an A1B5G5R5 color to 32 bits, A = 0x80 if the alpha bit is set */
+inline u32 fromRGBA16(u32 color) {
+    return ((color & 0x1F) << 3) | ((color & (0x1F << 5)) << 6) | ((color & (0x1F << 10)) << 9) | ((color & (1 << 15)) << 16);
+}
+
+/* Approximates log2 like the GS, from the exponent and the linear mantissa */
+inline f32 fastLog2(f32 x) {
+    u32 bits;
+
+    std::memcpy(&bits, &x, 4);
+
+    return (f32)((i32)((bits >> 23) & 0xFF) - 127) + (f32)(bits & 0x7FFFFF) / (1 << 23);
+}
+
+/* Returns the LOD of a pixel */
+inline f32 getLOD(const TexState &ts, f32 q) {
+    if (ts.lcm) return ts.k;
+
+    return ts.k - fastLog2(std::abs(q)) * ts.l;
+}
+
+/* Wraps a texel coordinate */
+inline i32 wrapCoord(const TexLevel &level, int i, i32 coord) {
+    return std::clamp((coord & level.mask[i]) | level.fix[i], level.min[i], level.max[i]);
+}
+
+/* Converts a texel to a 32-bit color */
+template <PSM tpsm>
+inline u32 convertTexel(const TexState &ts, u32 texel) {
+    switch (tpsm) {
+        case PSM::PSMCT24:
+            return texel | (((ts.aem && !texel) ? 0 : ts.ta0) << 24);
+        case PSM::PSMCT16:
+        case PSM::PSMCT16S:
+            {
+                const auto color = fromRGBA16(texel) & 0xFFFFFF;
+
+                if (texel & (1 << 15)) return color | (ts.ta1 << 24);
+
+                return color | (((ts.aem && !color) ? 0 : ts.ta0) << 24);
+            }
+        case PSM::PSMCT8  :
+        case PSM::PSMCT4  :
+        case PSM::PSMCT8H :
+        case PSM::PSMCT4HL:
+        case PSM::PSMCT4HH:
+            return ts.clut[texel];
+        default:
+            return texel;
+    }
+}
+
+/* Fetches a wrapped texel */
+template <PSM tpsm>
+inline u32 fetchTexel(const TexState &ts, const TexLevel &level, i32 u, i32 v) {
+    return convertTexel<tpsm>(ts, readVRAM<tpsm>(level.tbp, level.tbw, wrapCoord(level, 0, u), wrapCoord(level, 1, v)));
+}
+
+/* Interpolates between two colors, w = 0..128 */
+inline u32 lerpRGBA(u32 a, u32 b, i32 w) {
+    u32 color = 0;
+
+    for (int i = 0; i < 32; i += 8) {
+        const i32 ca = (a >> i) & 0xFF, cb = (b >> i) & 0xFF;
+
+        color |= (u32)(ca + (((cb - ca) * w) >> 7)) << i;
+    }
+
+    return color;
+}
+
+/* Samples a mipmap level, u and v have 8 fractional bits */
+template <PSM tpsm>
+u32 sampleLevel(const TexState &ts, const TexLevel &level, i32 u, i32 v, bool isLinear) {
+    if (!isLinear) return fetchTexel<tpsm>(ts, level, u >> 8, v >> 8);
+
+    /* Texel centers are at +0.5 */
+    u -= 0x80;
+    v -= 0x80;
+
+    const auto u0 = u >> 8, v0 = v >> 8;
+    const auto uf = (u & 0xFF) >> 1, vf = (v & 0xFF) >> 1;
+
+    const auto c0 = lerpRGBA(fetchTexel<tpsm>(ts, level, u0, v0), fetchTexel<tpsm>(ts, level, u0 + 1, v0), uf);
+    const auto c1 = lerpRGBA(fetchTexel<tpsm>(ts, level, u0, v0 + 1), fetchTexel<tpsm>(ts, level, u0 + 1, v0 + 1), uf);
+
+    return lerpRGBA(c0, c1, vf);
+}
+
+/* Texel lookup resolved from a LOD */
+struct TexLookup {
+    i32  level;
+    bool isLinear;
+    bool isTrilinear; // Blend with the next level
+    i32  weight;      // Weight of the next level, 0..128
+};
+
+/* Selects mipmap level(s) and filter for a LOD */
+inline TexLookup getTexLookup(const TexState &ts, f32 lod) {
+    TexLookup lookup = {};
+
+    if (lod < 0) {
+        lookup.isLinear = ts.mmag;
+
+        return lookup;
+    }
+
+    switch (ts.mmin) {
+        case TexFilter::Nearest: return lookup;
+        case TexFilter::Linear : lookup.isLinear = true; return lookup;
+        default: break;
+    }
+
+    lookup.isLinear = (ts.mmin == TexFilter::LinearMipNearest) || (ts.mmin == TexFilter::LinearMipLinear);
+
+    const auto isMipLinear = (ts.mmin == TexFilter::NearestMipLinear) || (ts.mmin == TexFilter::LinearMipLinear);
+
+    if (lod >= ts.mxl) {
+        lookup.level = ts.mxl;
+    } else if (isMipLinear) {
+        lookup.level  = (i32)lod;
+        lookup.weight = (i32)((lod - lookup.level) * 128);
+
+        lookup.isTrilinear = lookup.weight != 0;
+    } else {
+        lookup.level = (i32)(lod + 0.5f);
+    }
+
+    return lookup;
+}
+
+/* Samples a texture, u and v are level 0 texels with 8 fractional bits */
+template <PSM tpsm>
+u32 sampleTexture(const TexState &ts, const TexLookup &lookup, i32 u, i32 v) {
+    const auto n = lookup.level;
+
+    const auto color = sampleLevel<tpsm>(ts, ts.levels[n], u >> n, v >> n, lookup.isLinear);
+
+    if (!lookup.isTrilinear) return color;
+
+    return lerpRGBA(color, sampleLevel<tpsm>(ts, ts.levels[n + 1], u >> (n + 1), v >> (n + 1), lookup.isLinear), lookup.weight);
+}
+
+#if defined(__AVX2__)
+/* Wraps 8 texel coordinates */
+inline __m256i wrapCoord(const TexLevel &level, int i, __m256i coord) {
+    coord = _mm256_or_si256(_mm256_and_si256(coord, _mm256_set1_epi32(level.mask[i])), _mm256_set1_epi32(level.fix[i]));
+
+    return _mm256_min_epi32(_mm256_max_epi32(coord, _mm256_set1_epi32(level.min[i])), _mm256_set1_epi32(level.max[i]));
+}
+
+/* Fetches 8 wrapped texels */
+template <PSM tpsm>
+inline __m256i fetchTexels(const TexState &ts, const TexLevel &level, __m256i u, __m256i v) {
+    u = wrapCoord(level, 0, u);
+    v = wrapCoord(level, 1, v);
+
+    const auto offset = _mm256_add_epi32(u, _mm256_mullo_epi32(v, _mm256_set1_epi32(level.tbw)));
+
+    const auto mask = _mm256_set1_epi32(VRAM_MASK);
+
+    if constexpr ((tpsm == PSM::PSMCT8) || (tpsm == PSM::PSMCT4)) {
+        /* Byte/nibble addresses */
+        constexpr auto shift = (tpsm == PSM::PSMCT8) ? 2 : 3;
+
+        const auto addr = _mm256_add_epi32(_mm256_set1_epi32(level.tbp << shift), offset);
+
+        const auto words = _mm256_i32gather_epi32((const int *)vram.data(), _mm256_and_si256(_mm256_srli_epi32(addr, shift), mask), 4);
+
+        const auto bits = _mm256_slli_epi32(_mm256_and_si256(addr, _mm256_set1_epi32((1 << shift) - 1)), 5 - shift);
+
+        const auto index = _mm256_and_si256(_mm256_srlv_epi32(words, bits), _mm256_set1_epi32((tpsm == PSM::PSMCT8) ? 0xFF : 0xF));
+
+        return _mm256_i32gather_epi32((const int *)ts.clut, index, 4);
+    } else if constexpr ((tpsm == PSM::PSMCT16) || (tpsm == PSM::PSMCT16S)) {
+        /* Halfword addresses */
+        const auto addr = _mm256_add_epi32(_mm256_set1_epi32(2 * level.tbp), offset);
+
+        const auto words = _mm256_i32gather_epi32((const int *)vram.data(), _mm256_and_si256(_mm256_srli_epi32(addr, 1), mask), 4);
+
+        const auto shift = _mm256_slli_epi32(_mm256_and_si256(addr, _mm256_set1_epi32(1)), 4);
+
+        const auto texel = _mm256_and_si256(_mm256_srlv_epi32(words, shift), _mm256_set1_epi32(0xFFFF));
+
+        /* A1B5G5R5 -> A8B8G8R8 */
+        const auto c5 = _mm256_set1_epi32(0x1F);
+
+        auto color = _mm256_slli_epi32(_mm256_and_si256(texel, c5), 3);
+
+        color = _mm256_or_si256(color, _mm256_slli_epi32(_mm256_and_si256(texel, _mm256_slli_epi32(c5,  5)),  6));
+        color = _mm256_or_si256(color, _mm256_slli_epi32(_mm256_and_si256(texel, _mm256_slli_epi32(c5, 10)),  9));
+
+        auto alpha = _mm256_set1_epi32(ts.ta0 << 24);
+
+        if (ts.aem) alpha = _mm256_andnot_si256(_mm256_cmpeq_epi32(color, _mm256_setzero_si256()), alpha);
+
+        const auto isSet = _mm256_cmpeq_epi32(_mm256_and_si256(texel, _mm256_set1_epi32(1 << 15)), _mm256_set1_epi32(1 << 15));
+
+        return _mm256_or_si256(color, _mm256_blendv_epi8(alpha, _mm256_set1_epi32(ts.ta1 << 24), isSet));
+    } else {
+        const auto addr = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(level.tbp), offset), mask);
+
+        const auto texel = _mm256_i32gather_epi32((const int *)vram.data(), addr, 4);
+
+        if constexpr (tpsm == PSM::PSMCT24) {
+            const auto color = _mm256_and_si256(texel, _mm256_set1_epi32(0xFFFFFF));
+
+            auto alpha = _mm256_set1_epi32(ts.ta0 << 24);
+
+            if (ts.aem) alpha = _mm256_andnot_si256(_mm256_cmpeq_epi32(color, _mm256_setzero_si256()), alpha);
+
+            return _mm256_or_si256(color, alpha);
+        } else if constexpr (tpsm == PSM::PSMCT8H) {
+            return _mm256_i32gather_epi32((const int *)ts.clut, _mm256_srli_epi32(texel, 24), 4);
+        } else if constexpr (tpsm == PSM::PSMCT4HL) {
+            return _mm256_i32gather_epi32((const int *)ts.clut, _mm256_and_si256(_mm256_srli_epi32(texel, 24), _mm256_set1_epi32(0xF)), 4);
+        } else if constexpr (tpsm == PSM::PSMCT4HH) {
+            return _mm256_i32gather_epi32((const int *)ts.clut, _mm256_srli_epi32(texel, 28), 4);
+        } else {
+            return texel;
+        }
+    }
+}
+
+/* Interpolates between 8 pairs of colors, w = 0..128 per pixel */
+inline __m256i lerpRGBA(__m256i a, __m256i b, __m256i w) {
+    /* Repeat each weight in both 16-bit halves of its pixel */
+    w = _mm256_or_si256(w, _mm256_slli_epi32(w, 16));
+
+    /* Expand per-pixel weights to 16-bit RGBA lanes, pixels 0-3 and 4-7 */
+    const auto wLo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(w));
+    const auto wHi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(w, 1));
+
+    const auto w16Lo = _mm256_or_si256(wLo, _mm256_slli_epi64(wLo, 32));
+    const auto w16Hi = _mm256_or_si256(wHi, _mm256_slli_epi64(wHi, 32));
+
+    const auto aLo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a)), aHi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1));
+    const auto bLo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(b)), bHi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(b, 1));
+
+    const auto lo = _mm256_add_epi16(aLo, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(bLo, aLo), w16Lo), 7));
+    const auto hi = _mm256_add_epi16(aHi, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(bHi, aHi), w16Hi), 7));
+
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+/* Samples 8 pixels from a mipmap level, u and v have 8 fractional bits */
+template <PSM tpsm>
+__m256i sampleLevel(const TexState &ts, const TexLevel &level, __m256i u, __m256i v, bool isLinear) {
+    if (!isLinear) return fetchTexels<tpsm>(ts, level, _mm256_srai_epi32(u, 8), _mm256_srai_epi32(v, 8));
+
+    /* Texel centers are at +0.5 */
+    u = _mm256_sub_epi32(u, _mm256_set1_epi32(0x80));
+    v = _mm256_sub_epi32(v, _mm256_set1_epi32(0x80));
+
+    const auto u0 = _mm256_srai_epi32(u, 8), v0 = _mm256_srai_epi32(v, 8);
+    const auto u1 = _mm256_add_epi32(u0, _mm256_set1_epi32(1)), v1 = _mm256_add_epi32(v0, _mm256_set1_epi32(1));
+
+    const auto uf = _mm256_srli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(0xFF)), 1);
+    const auto vf = _mm256_srli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0xFF)), 1);
+
+    const auto c0 = lerpRGBA(fetchTexels<tpsm>(ts, level, u0, v0), fetchTexels<tpsm>(ts, level, u1, v0), uf);
+    const auto c1 = lerpRGBA(fetchTexels<tpsm>(ts, level, u0, v1), fetchTexels<tpsm>(ts, level, u1, v1), uf);
+
+    return lerpRGBA(c0, c1, vf);
+}
+
+/* Samples 8 pixels, u and v are level 0 texels with 8 fractional bits */
+template <PSM tpsm>
+__m256i sampleTexture(const TexState &ts, const TexLookup &lookup, __m256i u, __m256i v) {
+    const auto n = lookup.level;
+
+    const auto color = sampleLevel<tpsm>(ts, ts.levels[n], _mm256_srai_epi32(u, n), _mm256_srai_epi32(v, n), lookup.isLinear);
+
+    if (!lookup.isTrilinear) return color;
+
+    const auto next = sampleLevel<tpsm>(ts, ts.levels[n + 1], _mm256_srai_epi32(u, n + 1), _mm256_srai_epi32(v, n + 1), lookup.isLinear);
+
+    return lerpRGBA(color, next, _mm256_set1_epi32(lookup.weight));
+}
+#elif defined(__SSE2__)
+/* Broadcasts the alpha lane of each pixel to its color lanes */
+inline __m128i broadcastAlpha(__m128i c) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xFF), 0xFF);
+}
+
+/* Returns a where mask is set, b everywhere else */
+inline __m128i selectLanes(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* Fetches 4 wrapped texels, SSE2 has no gathers */
+template <PSM tpsm>
+inline __m128i fetchTexels(const TexState &ts, const TexLevel &level, __m128i u, __m128i v) {
+    alignas(16) i32 us[4], vs[4];
+    alignas(16) u32 texels[4];
+
+    _mm_store_si128((__m128i *)us, u);
+    _mm_store_si128((__m128i *)vs, v);
+
+    for (int i = 0; i < 4; i++) texels[i] = fetchTexel<tpsm>(ts, level, us[i], vs[i]);
+
+    return _mm_load_si128((const __m128i *)texels);
+}
+
+/* Interpolates between 4 pairs of colors, w = 0..128 per pixel */
+inline __m128i lerpRGBA(__m128i a, __m128i b, __m128i w) {
+    const auto zero = _mm_setzero_si128();
+
+    /* Repeat each weight in all 16-bit lanes of its pixel, pixels 0-1 and 2-3 */
+    w = _mm_or_si128(w, _mm_slli_epi32(w, 16));
+
+    const auto wLo = _mm_unpacklo_epi32(w, w);
+    const auto wHi = _mm_unpackhi_epi32(w, w);
+
+    const auto aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+    const auto bLo = _mm_unpacklo_epi8(b, zero), bHi = _mm_unpackhi_epi8(b, zero);
+
+    const auto lo = _mm_add_epi16(aLo, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(bLo, aLo), wLo), 7));
+    const auto hi = _mm_add_epi16(aHi, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(bHi, aHi), wHi), 7));
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* Samples 4 pixels from a mipmap level, u and v have 8 fractional bits */
+template <PSM tpsm>
+__m128i sampleLevel(const TexState &ts, const TexLevel &level, __m128i u, __m128i v, bool isLinear) {
+    if (!isLinear) return fetchTexels<tpsm>(ts, level, _mm_srai_epi32(u, 8), _mm_srai_epi32(v, 8));
+
+    /* Texel centers are at +0.5 */
+    u = _mm_sub_epi32(u, _mm_set1_epi32(0x80));
+    v = _mm_sub_epi32(v, _mm_set1_epi32(0x80));
+
+    const auto u0 = _mm_srai_epi32(u, 8), v0 = _mm_srai_epi32(v, 8);
+    const auto u1 = _mm_add_epi32(u0, _mm_set1_epi32(1)), v1 = _mm_add_epi32(v0, _mm_set1_epi32(1));
+
+    const auto uf = _mm_srli_epi32(_mm_and_si128(u, _mm_set1_epi32(0xFF)), 1);
+    const auto vf = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xFF)), 1);
+
+    const auto c0 = lerpRGBA(fetchTexels<tpsm>(ts, level, u0, v0), fetchTexels<tpsm>(ts, level, u1, v0), uf);
+    const auto c1 = lerpRGBA(fetchTexels<tpsm>(ts, level, u0, v1), fetchTexels<tpsm>(ts, level, u1, v1), uf);
+
+    return lerpRGBA(c0, c1, vf);
+}
+
+/* Samples 4 pixels, u and v are level 0 texels with 8 fractional bits */
+template <PSM tpsm>
+__m128i sampleTexture(const TexState &ts, const TexLookup &lookup, __m128i u, __m128i v) {
+    const auto n = lookup.level;
+
+    const auto color = sampleLevel<tpsm>(ts, ts.levels[n], _mm_srai_epi32(u, n), _mm_srai_epi32(v, n), lookup.isLinear);
+
+    if (!lookup.isTrilinear) return color;
+
+    const auto next = sampleLevel<tpsm>(ts, ts.levels[n + 1], _mm_srai_epi32(u, n + 1), _mm_srai_epi32(v, n + 1), lookup.isLinear);
+
+    return lerpRGBA(color, next, _mm_set1_epi32(lookup.weight));
+}
+
+/* Rounds 4 floats towards negative infinity, SSE2 can only truncate */
+inline __m128i floorToInt(__m128 x) {
+    const auto i = _mm_cvttps_epi32(x);
+
+    /* Subtract 1 where truncation rounded up */
+    return _mm_add_epi32(i, _mm_castps_si128(_mm_cmplt_ps(x, _mm_cvtepi32_ps(i))));
+}
+#endif
+
+/* Sets up the wrap parameters of a mipmap level */
+void setWrap(TexLevel &level, int i, u8 wm, i32 size, i32 min, i32 max, int n) {
+    switch (wm) {
+        case static_cast<u8>(Wrap::Repeat):
+            level.mask[i] = size - 1;
+            level.fix[i]  = 0;
+            level.min[i]  = 0;
+            level.max[i]  = size - 1;
+            break;
+        case static_cast<u8>(Wrap::Clamp):
+            level.mask[i] = -1;
+            level.fix[i]  = 0;
+            level.min[i]  = 0;
+            level.max[i]  = size - 1;
+            break;
+        case static_cast<u8>(Wrap::RegionClamp):
+            level.mask[i] = -1;
+            level.fix[i]  = 0;
+            level.min[i]  = min >> n;
+            level.max[i]  = std::max(max >> n, min >> n);
+            break;
+        case static_cast<u8>(Wrap::RegionRepeat): // MIN is the mask, MAX the fixed bits
+            level.mask[i] = min;
+            level.fix[i]  = max;
+            level.min[i]  = 0;
+            level.max[i]  = 2047;
+            break;
+    }
+}
+
+/* Returns the table index of a texture storage mode */
+int getTexturePSMIndex(u8 psm) {
+    for (int i = 0; i < 9; i++) {
+        if (texturePSMs[i] == psm) return i;
+    }
+
+    std::printf("[GS        ] Unhandled texture storage mode 0x%02X\n", psm);
+
+    exit(0);
+}
+
+/* Latches the texture state of the current context */
+void setTexState(TexState &ts) {
+    const auto &tex0 = cctx->tex0;
+    const auto &tex1 = cctx->tex1;
+
+    const auto &clamp = cctx->clamp;
+
+    ts.width  = (f32)(1 << tex0.tw);
+    ts.height = (f32)(1 << tex0.th);
+
+    ts.fst  = cmode->fst;
+    ts.lcm  = tex1.lcm;
+    ts.mxl  = tex1.mxl;
+    ts.mmag = tex1.mmag;
+    ts.mmin = tex1.mmin;
+
+    ts.l = (f32)(1 << tex1.l);
+    ts.k = tex1.k / 16.0f;
+
+    ts.ta0 = texa.ta0;
+    ts.ta1 = texa.ta1;
+    ts.aem = texa.aem;
+
+    for (int n = 0; n <= ts.mxl; n++) {
+        auto &level = ts.levels[n];
+
+        level.tbp = (n == 0) ? tex0.tbp0 : cctx->miptbp.tbp[n - 1];
+        level.tbw = (n == 0) ? tex0.tbw  : cctx->miptbp.tbw[n - 1];
+
+        setWrap(level, 0, clamp.wms, std::max((1 << tex0.tw) >> n, 1), clamp.minu, clamp.maxu, n);
+        setWrap(level, 1, clamp.wmt, std::max((1 << tex0.th) >> n, 1), clamp.minv, clamp.maxv, n);
+    }
+
+    if (!isIndexedPSM(tex0.psm)) return;
+
+    /* Resolve the CLUT entries of indexed textures, 16-bit entries go through TEXA like 16-bit texels */
+    const auto count = (getBitsPerPixel(tex0.psm) == 8) ? 256u : 16u;
+
+    for (u32 i = 0; i < count; i++) {
+        if (tex0.cpsm == PSM::PSMCT32) {
+            const auto entry = (tex0.csa + i) & 0xFF;
+
+            ts.clut[i] = clutBuffer[entry] | ((u32)clutBuffer[entry + 256] << 16);
+        } else {
+            ts.clut[i] = convertTexel<PSM::PSMCT16>(ts, clutBuffer[(tex0.csa + i) & 0x1FF]);
+        }
+    }
+}
+
+/* --- Pixel pipeline --- */
+
+/*
+ * Pixels are drawn in horizontal spans. Each span runs through three stages
+ * (shading, pixel tests, blending and frame buffer output), plus texture
+ * mapping and the destination alpha test if they're enabled. Every stage is a template
+ * specialized on the drawing state it depends on. The specializations for the
+ * current state are looked up once per primitive, so the per-pixel loops
+ * don't branch on PSMs or test methods.
+ */
+
+/* Frame buffer write mode of a pixel */
+enum PixelWrite : u8 {
+    Skip, RGBA, RGB,
+};
+
+/* Blending color selectors (A, B, D) */
+enum BlendColor : u8 {
+    Cs, Cd, Zero,
+};
+
+/* Blending alpha selectors (C) */
+enum BlendAlpha : u8 {
+    As, Ad, Fix,
+};
+
+/* Per-primitive drawing state */
+struct DrawState {
+    u32 fbp, fbw, fbmsk;
+    u32 zbp, zmax;
+
+    u8 fpsm, zpsm;
+
+    SCISSOR scissor;
+
+    u8 ztst;
+
+    u8 aref, afail;
+
+    FOGCOL fogcol;
+
+    ALPHA alpha;
+
+    bool pabe, fba, colclamp;
+    bool date, datm; // Destination alpha test
+    bool dthe;       // Only set for 16-bit frame buffers
+
+    alignas(32) i16 dither[4][4][16]; // Dither values of 4 pixels in 16-bit RGBA lanes, indexed by [y & 3][x & 3]
+
+    TexState tex;
+};
+
+/* Horizontal run of pixels, attributes are given at x0 and stepped once per pixel */
+struct Span {
+    i64 x0, x1, y;
+
+    f64 z, dz;
+
+    f32 r, g, b, a, f;
+    f32 dr, dg, db, da, df;
+
+    /* Texture coordinates, texels = S / Q and T / Q */
+    f32 s, t, q;
+    f32 ds, dt, dq;
+};
+
+/* Fragments of the current span */
+struct SpanBuffer {
+    alignas(32) u32 color[MAX_SPAN];
+    alignas(32) u8  write[MAX_SPAN];
+
+    u8 hiz[MAX_SPAN / HIZ_BLOCK_SIZE + 1]; // HiZResult per block segment
+};
+
+using ShadeFn  = void (*)(const DrawState &, const Span &, SpanBuffer &);
+using TestFn   = void (*)(const DrawState &, const Span &, SpanBuffer &);
+using OutputFn = void (*)(const DrawState &, const Span &, const SpanBuffer &);
+
+/* Pixel pipeline selected for a primitive */
+struct Pipeline {
+    ShadeFn  shade;
+    ShadeFn  texture;
+    TestFn   dstTest;
+    TestFn   test;
+    OutputFn output;
+};
+
+/* Drawing state a pipeline is specialized on */
+struct PipelineKey {
+    u8   fpsm, zpsm;
+    u8   ztst, atst;
+    bool zmsk, date;
+    bool abe, tme, fge, iip;
+    u8   tpsm, tfx;
+    bool tcc;
+};
+
+SpanBuffer spanBuf;
+
+u64 pixelCount; // Number of pixels sent through the pipeline
+
+DrawState drawState;
+
+/* Storage modes with a specialized pipeline, in table order */
+constexpr PSM framePSMs[4] = { PSM::PSMCT32, PSM::PSMCT24, PSM::PSMCT16, PSM::PSMCT16S };
+constexpr PSM depthPSMs[4] = { PSM::PSMZ32, PSM::PSMZ24, PSM::PSMZ16, PSM::PSMZ16S };
+
+/* Packs 8-bit color components */
+inline u32 packRGBA(u32 r, u32 g, u32 b, u32 a) {
+    return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+/* Converts a 32-bit color to A1B5G5R5 */
+inline u32 toRGBA16(u32 color) {
+    return ((color >> 3) & 0x1F) | ((color >> 6) & (0x1F << 5)) | ((color >> 9) & (0x1F << 10)) | ((color >> 16) & (1 << 15));
+}
+
+/* Returns the largest Z value a Z buffer format can store */
+template <PSM zpsm>
+constexpr u32 maxZ() {
+    switch (zpsm) {
+        case PSM::PSMZ32: return 0xFFFFFFFF;
+        case PSM::PSMZ24: return 0xFFFFFF;
+        default:          return 0xFFFF;
+    }
+}
+
+/* Returns the largest Z value a Z buffer format can store */
+u32 getMaxZ(u8 zpsm) {
+    switch (zpsm) {
+        case PSM::PSMZ32: return 0xFFFFFFFF;
+        case PSM::PSMZ24: return 0xFFFFFF;
+        default:          return 0xFFFF;
+    }
+}
+
+/* Performs an alpha test */
+template <ATest atst>
+inline bool alphaTest(u32 a, u32 aref) {
+    switch (atst) {
+        case ATest::Never   : return false;
+        case ATest::Always  : return true;
+        case ATest::Less    : return a <  aref;
+        case ATest::LEqual  : return a <= aref;
+        case ATest::Equal   : return a == aref;
+        case ATest::GEqual  : return a >= aref;
+        case ATest::Greater : return a >  aref;
+        case ATest::NotEqual: return a != aref;
+    }
+
+    return true;
+}
+
+/* Blends a color with the fog color */
+inline u32 applyFog(const DrawState &ds, u32 color, u32 f) {
+    const auto cr = (f * ((color >>  0) & 0xFF) + (255 - f) * ds.fogcol.fcr) >> 8;
+    const auto cg = (f * ((color >>  8) & 0xFF) + (255 - f) * ds.fogcol.fcg) >> 8;
+    const auto cb = (f * ((color >> 16) & 0xFF) + (255 - f) * ds.fogcol.fcb) >> 8;
+
+    return packRGBA(cr, cg, cb, color >> 24);
+}
+
+/* Calculates fragment colors, fogging is done after texture mapping if it's enabled */
+template <bool iip, bool fge>
+void shadeSpan(const DrawState &ds, const Span &span, SpanBuffer &buf) {
+    const auto count = span.x1 - span.x0;
+
+    f32 r = span.r, g = span.g, b = span.b, a = span.a, f = span.f;
+
+    for (i64 i = 0; i < count; i++) {
+        buf.color[i] = packRGBA((u32)r, (u32)g, (u32)b, (u32)a);
+
+        if constexpr (fge) {
+            buf.color[i] = applyFog(ds, buf.color[i], (u32)f);
+
+            f += span.df;
+        }
+
+        if constexpr (iip) {
+            r += span.dr;
+            g += span.dg;
+            b += span.db;
+            a += span.da;
+        }
+    }
+}
+
+/* Performs alpha and depth tests, writes Z values */
+template <bool date, PSM zpsm, ZTest ztst, bool zmsk, ATest atst>
+void testSpan(const DrawState &ds, const Span &span, SpanBuffer &buf) {
+    const auto count = span.x1 - span.x0;
+
+    if constexpr (ztst == ZTest::Never) {
+        std::memset(buf.write, PixelWrite::Skip, count);
+
+        return;
+    }
+
+    constexpr auto hasZRead = (ztst == ZTest::GEqual) || (ztst == ZTest::Greater);
+
+    /* Process the span in segments that don't cross HiZ block boundaries if HiZ is used */
+    const auto isSegmented = hasZRead || (!zmsk && hizEnabled);
+
+    bool hasZWrite = false;
+
+    for (i64 i = 0, seg = 0; i < count; seg++) {
+        const auto segStart = i;
+        const auto segEnd   = isSegmented ? std::min(count, i + HIZ_BLOCK_SIZE - ((span.x0 + i) % HIZ_BLOCK_SIZE)) : count;
+
+        const auto result = hasZRead ? static_cast<HiZResult>(buf.hiz[seg]) : HiZResult::Accept;
+
+        if (result == HiZResult::Reject) {
+            std::memset(&buf.write[i], PixelWrite::Skip, segEnd - i);
+
+            i = segEnd;
+
+            continue;
+        }
+
+        u32 zMin = 0xFFFFFFFF, zMax = 0;
+
+        i64 zWriteCount = 0;
+
+        for (; i < segEnd; i++) {
+            const auto x = span.x0 + i;
+
+            if constexpr (date) {
+                if (buf.write[i] == PixelWrite::Skip) continue; // Failed destination alpha test
+            }
+
+            auto write  = PixelWrite::RGBA;
+            auto zWrite = !zmsk;
+
+            if constexpr (atst != ATest::Always) {
+                if (!alphaTest<atst>(buf.color[i] >> 24, ds.aref)) {
+                    switch (ds.afail) {
+                        case static_cast<u8>(AFail::Keep)   : write = PixelWrite::Skip; zWrite = false; break;
+                        case static_cast<u8>(AFail::FBOnly) : zWrite = false; break;
+                        case static_cast<u8>(AFail::ZBOnly) : write = PixelWrite::Skip; break;
+                        case static_cast<u8>(AFail::RGBOnly): write = PixelWrite::RGB; zWrite = false; break;
+                    }
+                }
+            }
+
+            const auto newZ = (u32)std::min(span.z + i * span.dz, (f64)maxZ<zpsm>());
+
+            if constexpr (hasZRead) {
+                if (result == HiZResult::Test) {
+                    const auto oldZ = readVRAM<zpsm>(ds.zbp, ds.fbw, x, span.y);
+
+                    if ((ztst == ZTest::GEqual) ? (newZ < oldZ) : (newZ <= oldZ)) {
+                        buf.write[i] = PixelWrite::Skip;
+
+                        continue;
+                    }
+                }
+            }
+
+            if (zWrite) {
+                writeVRAM<zpsm>(ds.zbp, ds.fbw, x, span.y, newZ);
+
+                zMin = std::min(zMin, newZ);
+                zMax = std::max(zMax, newZ);
+
+                zWriteCount++;
+            }
+
+            buf.write[i] = write;
+        }
+
+        if (!zmsk && hizEnabled && zWriteCount) {
+            updateHiZ(span.x0 + segStart, span.y, zMin, zMax, zWriteCount == HIZ_BLOCK_SIZE);
+        }
+
+        hasZWrite |= zWriteCount != 0;
+    }
+
+    if (hasZWrite) markSpanDirty<zpsm>(ds.zbp, ds.fbw, span.x0, span.y, count);
+}
+
+/* Applies a texture function to a vertex color and a texel */
+template <TFX tfx, bool tcc>
+inline u32 applyTFX(u32 cv, u32 ct) {
+    const auto av = cv >> 24, at = ct >> 24;
+
+    u32 color = 0;
+
+    for (int i = 0; i < 24; i += 8) {
+        const auto v = (cv >> i) & 0xFF, t = (ct >> i) & 0xFF;
+
+        u32 c;
+        switch (tfx) {
+            case TFX::Modulate  : c = (v * t) >> 7; break;
+            case TFX::Decal     : c = t; break;
+            case TFX::Highlight :
+            case TFX::Highlight2: c = ((v * t) >> 7) + av; break;
+        }
+
+        color |= std::min(c, 0xFFu) << i;
+    }
+
+    u32 a = av;
+
+    if constexpr (tcc) {
+        switch (tfx) {
+            case TFX::Modulate : a = (av * at) >> 7; break;
+            case TFX::Highlight: a = at + av; break;
+            default            : a = at; break;
+        }
+    }
+
+    return color | (std::min(a, 0xFFu) << 24);
+}
+
+#if defined(__AVX2__)
+/* Applies a texture function to 8 vertex colors and texels */
+template <TFX tfx, bool tcc>
+inline __m256i applyTFX(__m256i cv, __m256i ct) {
+    /* Alpha of each pixel in all 16-bit lanes */
+    const auto alphaShuf = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15, 6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+
+    const auto applyLanes = [&](__m128i v, __m128i t) {
+        const auto v16 = _mm256_cvtepu8_epi16(v);
+        const auto t16 = _mm256_cvtepu8_epi16(t);
+
+        /* Products are at most 0xFE01, the low 16 bits are exact */
+        const auto vt = _mm256_srli_epi16(_mm256_mullo_epi16(v16, t16), 7);
+
+        __m256i c;
+        switch (tfx) {
+            case TFX::Modulate  : c = vt; break;
+            case TFX::Decal     : c = t16; break;
+            case TFX::Highlight :
+            case TFX::Highlight2: c = _mm256_add_epi16(vt, _mm256_shuffle_epi8(v16, alphaShuf)); break;
+        }
+
+        __m256i a = v16;
+
+        if constexpr (tcc) {
+            switch (tfx) {
+                case TFX::Modulate : a = vt; break;
+                case TFX::Highlight: a = _mm256_add_epi16(t16, v16); break;
+                default            : a = t16; break;
+            }
+        }
+
+        return _mm256_blend_epi16(c, a, 0x88);
+    };
+
+    const auto lo = applyLanes(_mm256_castsi256_si128(cv), _mm256_castsi256_si128(ct));
+    const auto hi = applyLanes(_mm256_extracti128_si256(cv, 1), _mm256_extracti128_si256(ct, 1));
+
+    /* Saturating pack clamps to 255 */
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+#elif defined(__SSE2__)
+/* Applies a texture function to 4 vertex colors and texels */
+template <TFX tfx, bool tcc>
+inline __m128i applyTFX(__m128i cv, __m128i ct) {
+    const auto applyLanes = [&](__m128i v16, __m128i t16) {
+        /* Products are at most 0xFE01, the low 16 bits are exact */
+        const auto vt = _mm_srli_epi16(_mm_mullo_epi16(v16, t16), 7);
+
+        __m128i c;
+        switch (tfx) {
+            case TFX::Modulate  : c = vt; break;
+            case TFX::Decal     : c = t16; break;
+            case TFX::Highlight :
+            case TFX::Highlight2: c = _mm_add_epi16(vt, broadcastAlpha(v16)); break;
+        }
+
+        __m128i a = v16;
+
+        if constexpr (tcc) {
+            switch (tfx) {
+                case TFX::Modulate : a = vt; break;
+                case TFX::Highlight: a = _mm_add_epi16(t16, v16); break;
+                default            : a = t16; break;
+            }
+        }
+
+        return selectLanes(_mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1), a, c);
+    };
+
+    const auto zero = _mm_setzero_si128();
+
+    const auto lo = applyLanes(_mm_unpacklo_epi8(cv, zero), _mm_unpacklo_epi8(ct, zero));
+    const auto hi = applyLanes(_mm_unpackhi_epi8(cv, zero), _mm_unpackhi_epi8(ct, zero));
+
+    /* Saturating pack clamps to 255 */
+    return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+/* Samples the texture and applies the texture function and fog */
+template <PSM tpsm, TFX tfx, bool tcc, bool fge>
+void textureSpan(const DrawState &ds, const Span &span, SpanBuffer &buf) {
+    const auto &ts = ds.tex;
+
+    const auto count = span.x1 - span.x0;
+
+    /* Use one lookup for the whole span if the LOD can't change the level or filter */
+    const auto isMinLinear = ts.mmin == TexFilter::Linear || ts.mmin == TexFilter::LinearMipNearest || ts.mmin == TexFilter::LinearMipLinear;
+    const auto isFixedLOD  = ts.lcm || (span.dq == 0) || ((ts.mxl == 0) && (ts.mmag == isMinLinear));
+
+    const auto spanLookup = getTexLookup(ts, getLOD(ts, span.q));
+
+    i64 i = 0;
+
+#if defined(__AVX2__)
+    if (isFixedLOD) {
+        const auto step = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+        const auto scale = _mm256_set1_ps(256.0f);
+
+        for (; (i + 8) <= count; i += 8) {
+            const auto idx = _mm256_add_ps(_mm256_set1_ps((f32)i), step);
+
+            auto s = _mm256_add_ps(_mm256_set1_ps(span.s), _mm256_mul_ps(idx, _mm256_set1_ps(span.ds)));
+            auto t = _mm256_add_ps(_mm256_set1_ps(span.t), _mm256_mul_ps(idx, _mm256_set1_ps(span.dt)));
+
+            if (!ts.fst) {
+                const auto q = _mm256_add_ps(_mm256_set1_ps(span.q), _mm256_mul_ps(idx, _mm256_set1_ps(span.dq)));
+
+                s = _mm256_div_ps(s, q);
+                t = _mm256_div_ps(t, q);
+            }
+
+            const auto u = _mm256_cvtps_epi32(_mm256_floor_ps(_mm256_mul_ps(s, scale)));
+            const auto v = _mm256_cvtps_epi32(_mm256_floor_ps(_mm256_mul_ps(t, scale)));
+
+            const auto ct = sampleTexture<tpsm>(ts, spanLookup, u, v);
+
+            const auto color = applyTFX<tfx, tcc>(_mm256_load_si256((const __m256i *)&buf.color[i]), ct);
+
+            _mm256_store_si256((__m256i *)&buf.color[i], color);
+        }
+    }
+#elif defined(__SSE2__)
+    if (isFixedLOD) {
+        const auto step = _mm_setr_ps(0, 1, 2, 3);
+
+        const auto scale = _mm_set1_ps(256.0f);
+
+        for (; (i + 4) <= count; i += 4) {
+            const auto idx = _mm_add_ps(_mm_set1_ps((f32)i), step);
+
+            auto s = _mm_add_ps(_mm_set1_ps(span.s), _mm_mul_ps(idx, _mm_set1_ps(span.ds)));
+            auto t = _mm_add_ps(_mm_set1_ps(span.t), _mm_mul_ps(idx, _mm_set1_ps(span.dt)));
+
+            if (!ts.fst) {
+                const auto q = _mm_add_ps(_mm_set1_ps(span.q), _mm_mul_ps(idx, _mm_set1_ps(span.dq)));
+
+                s = _mm_div_ps(s, q);
+                t = _mm_div_ps(t, q);
+            }
+
+            const auto u = floorToInt(_mm_mul_ps(s, scale));
+            const auto v = floorToInt(_mm_mul_ps(t, scale));
+
+            const auto ct = sampleTexture<tpsm>(ts, spanLookup, u, v);
+
+            const auto color = applyTFX<tfx, tcc>(_mm_load_si128((const __m128i *)&buf.color[i]), ct);
+
+            _mm_store_si128((__m128i *)&buf.color[i], color);
+        }
+    }
+#endif
+
+    /* Remaining pixels, and spans with a per-pixel LOD */
+    for (; i < count; i++) {
+        auto s = span.s + i * span.ds;
+        auto t = span.t + i * span.dt;
+        auto q = span.q + i * span.dq;
+
+        if (!ts.fst) {
+            s /= q;
+            t /= q;
+        }
+
+        const auto lookup = isFixedLOD ? spanLookup : getTexLookup(ts, getLOD(ts, q));
+
+        const auto ct = sampleTexture<tpsm>(ts, lookup, (i32)std::floor(256.0f * s), (i32)std::floor(256.0f * t));
+
+        buf.color[i] = applyTFX<tfx, tcc>(buf.color[i], ct);
+    }
+
+    if constexpr (fge) {
+        for (i = 0; i < count; i++) buf.color[i] = applyFog(ds, buf.color[i], (u32)(span.f + i * span.df));
+    }
+}
+
+/* Performs the destination alpha test, initializes the pixel write modes */
+template <PSM fpsm>
+void dstTestSpan(const DrawState &ds, const Span &span, SpanBuffer &buf) {
+    const auto count = span.x1 - span.x0;
+
+    for (i64 i = 0; i < count; i++) {
+        const auto color = readVRAM<fpsm>(ds.fbp, ds.fbw, span.x0 + i, span.y);
+
+        bool a;
+        if constexpr ((fpsm == PSM::PSMCT16) || (fpsm == PSM::PSMCT16S)) {
+            a = color & (1 << 15);
+        } else {
+            a = color >> 31;
+        }
+
+        buf.write[i] = (a == ds.datm) ? PixelWrite::RGBA : PixelWrite::Skip;
+    }
+}
+
+/* Reads n pixels from the frame buffer as 32-bit colors */
+template <PSM fpsm>
+void readFrame(const DrawState &ds, i64 x, i64 y, u32 *dst, i64 n) {
+    for (i64 i = 0; i < n; i++) {
+        const auto color = readVRAM<fpsm>(ds.fbp, ds.fbw, x + i, y);
+
+        if constexpr ((fpsm == PSM::PSMCT16) || (fpsm == PSM::PSMCT16S)) {
+            dst[i] = fromRGBA16(color);
+        } else if constexpr (fpsm == PSM::PSMCT24) {
+            dst[i] = color | (0x80 << 24); // Ad is 1.0 for 24-bit frame buffers
+        } else {
+            dst[i] = color;
+        }
+    }
+}
+
+/* Writes n 32-bit colors to the frame buffer */
+template <PSM fpsm>
+void writeFrame(const DrawState &ds, i64 x, i64 y, const u32 *src, i64 n) {
+    if constexpr (fpsm == PSM::PSMCT32) {
+        const auto addr = (ds.fbp + x + ds.fbw * y) & VRAM_MASK;
+
+        /* Pixels are contiguous unless the span wraps around the end of VRAM */
+        if ((addr + n) <= VRAM_WORDS) {
+            std::memcpy(&vram[addr], src, 4 * n);
+
+            dirtyPages[addr >> 11] = true;
+            dirtyPages[(addr + n - 1) >> 11] = true;
+
+            return;
+        }
+    }
+
+    for (i64 i = 0; i < n; i++) {
+        if constexpr ((fpsm == PSM::PSMCT16) || (fpsm == PSM::PSMCT16S)) {
+            writeVRAM<fpsm>(ds.fbp, ds.fbw, x + i, y, toRGBA16(src[i]));
+        } else {
+            writeVRAM<fpsm>(ds.fbp, ds.fbw, x + i, y, src[i]);
+        }
+    }
+
+    markSpanDirty<fpsm>(ds.fbp, ds.fbw, x, y, n);
+}
+
+/* Selects a blending color */
+inline i32 getBlendColor(u8 sel, i32 cs, i32 cd) {
+    switch (sel) {
+        case BlendColor::Cs: return cs;
+        case BlendColor::Cd: return cd;
+        default:             return 0;
+    }
+}
+
+/* Blends n fragments with the frame buffer, applies dithering and color clamping */
+template <bool abe>
+void blendPixels(const DrawState &ds, i64 x, i64 y, u32 *src, const u32 *dst, i64 n) {
+    const auto &alpha = ds.alpha;
+
+    for (i64 i = 0; i < n; i++) {
+        const auto cs = src[i], cd = dst[i];
+
+        i32 c;
+        switch (alpha.c) {
+            case BlendAlpha::As: c = cs >> 24; break;
+            case BlendAlpha::Ad: c = cd >> 24; break;
+            default:             c = alpha.fix; break;
+        }
+
+        const auto isBlended = abe && (!ds.pabe || (cs & (1u << 31)));
+
+        u32 color = cs & 0xFF000000;
+
+        for (int j = 0; j < 24; j += 8) {
+            const i32 s = (cs >> j) & 0xFF, d = (cd >> j) & 0xFF;
+
+            i32 v = s;
+
+            if (isBlended) v = (((getBlendColor(alpha.a, s, d) - getBlendColor(alpha.b, s, d)) * c) >> 7) + getBlendColor(alpha.d, s, d);
+
+            if (ds.dthe) v += ds.dither[y & 3][(x + i) & 3][0];
+
+            v = ds.colclamp ? std::clamp(v, 0, 0xFF) : (v & 0xFF);
+
+            color |= v << j;
+        }
+
+        src[i] = color;
+    }
+}
+
+#if defined(__AVX2__)
+/* Selects a blending color */
+inline __m256i getBlendColor(u8 sel, __m256i cs, __m256i cd) {
+    switch (sel) {
+        case BlendColor::Cs: return cs;
+        case BlendColor::Cd: return cd;
+        default:             return _mm256_setzero_si256();
+    }
+}
+
+/* Blends 4 fragments in 16-bit RGBA lanes */
+template <bool abe>
+inline __m256i blendLanes(const DrawState &ds, i64 x, i64 y, __m128i src, __m128i dst) {
+    const auto &alpha = ds.alpha;
+
+    /* Broadcasts the alpha lane of each pixel to its color lanes */
+    const auto alphaShuf = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15, 6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+
+    const auto cs = _mm256_cvtepu8_epi16(src);
+    const auto cd = _mm256_cvtepu8_epi16(dst);
+
+    auto cv = cs;
+
+    if constexpr (abe) {
+        const auto as = _mm256_shuffle_epi8(cs, alphaShuf);
+
+        __m256i c;
+        switch (alpha.c) {
+            case BlendAlpha::As: c = as; break;
+            case BlendAlpha::Ad: c = _mm256_shuffle_epi8(cd, alphaShuf); break;
+            default:             c = _mm256_set1_epi16(alpha.fix); break;
+        }
+
+        /* ((A - B) << 4) * (C << 5) >> 16 == (A - B) * C >> 7, and neither factor overflows 16 bits */
+        const auto ab = _mm256_slli_epi16(_mm256_sub_epi16(getBlendColor(alpha.a, cs, cd), getBlendColor(alpha.b, cs, cd)), 4);
+
+        cv = _mm256_add_epi16(_mm256_mulhi_epi16(ab, _mm256_slli_epi16(c, 5)), getBlendColor(alpha.d, cs, cd));
+
+        if (ds.pabe) cv = _mm256_blendv_epi8(cs, cv, _mm256_cmpgt_epi16(as, _mm256_set1_epi16(0x7F)));
+    }
+
+    if (ds.dthe) cv = _mm256_add_epi16(cv, _mm256_load_si256((const __m256i *)ds.dither[y & 3][x & 3]));
+
+    cv = _mm256_blend_epi16(cv, cs, 0x88); // Keep As
+
+    if (!ds.colclamp) cv = _mm256_and_si256(cv, _mm256_set1_epi16(0xFF));
+
+    return cv;
+}
+
+/* Blends 8 fragments with the frame buffer, applies dithering and color clamping */
+template <bool abe>
+void blendPixels8(const DrawState &ds, i64 x, i64 y, u32 *src, const u32 *dst) {
+    const auto s = _mm256_load_si256((const __m256i *)src);
+    const auto d = abe ? _mm256_load_si256((const __m256i *)dst) : s; // Frame buffer isn't read without blending
+
+    const auto lo = blendLanes<abe>(ds, x, y, _mm256_castsi256_si128(s), _mm256_castsi256_si128(d));
+    const auto hi = blendLanes<abe>(ds, x, y, _mm256_extracti128_si256(s, 1), _mm256_extracti128_si256(d, 1));
+
+    /* Saturating pack clamps to 0..255, then restore pixel order */
+    const auto cv = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+
+    _mm256_store_si256((__m256i *)src, cv);
+}
+#elif defined(__SSE2__)
+/* Selects a blending color */
+inline __m128i getBlendColor(u8 sel, __m128i cs, __m128i cd) {
+    switch (sel) {
+        case BlendColor::Cs: return cs;
+        case BlendColor::Cd: return cd;
+        default:             return _mm_setzero_si128();
+    }
+}
+
+/* Blends 2 fragments in 16-bit RGBA lanes, dither points to the dither values of both pixels */
+template <bool abe>
+inline __m128i blendLanes(const DrawState &ds, __m128i cs, __m128i cd, const i16 *dither) {
+    const auto &alpha = ds.alpha;
+
+    auto cv = cs;
+
+    if constexpr (abe) {
+        const auto as = broadcastAlpha(cs);
+
+        __m128i c;
+        switch (alpha.c) {
+            case BlendAlpha::As: c = as; break;
+            case BlendAlpha::Ad: c = broadcastAlpha(cd); break;
+            default:             c = _mm_set1_epi16(alpha.fix); break;
+        }
+
+        /* ((A - B) << 4) * (C << 5) >> 16 == (A - B) * C >> 7, and neither factor overflows 16 bits */
+        const auto ab = _mm_slli_epi16(_mm_sub_epi16(getBlendColor(alpha.a, cs, cd), getBlendColor(alpha.b, cs, cd)), 4);
+
+        cv = _mm_add_epi16(_mm_mulhi_epi16(ab, _mm_slli_epi16(c, 5)), getBlendColor(alpha.d, cs, cd));
+
+        if (ds.pabe) cv = selectLanes(_mm_cmpgt_epi16(as, _mm_set1_epi16(0x7F)), cv, cs);
+    }
+
+    if (ds.dthe) cv = _mm_add_epi16(cv, _mm_load_si128((const __m128i *)dither));
+
+    cv = selectLanes(_mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1), cs, cv); // Keep As
+
+    if (!ds.colclamp) cv = _mm_and_si128(cv, _mm_set1_epi16(0xFF));
+
+    return cv;
+}
+
+/* Blends 8 fragments with the frame buffer, applies dithering and color clamping */
+template <bool abe>
+void blendPixels8(const DrawState &ds, i64 x, i64 y, u32 *src, const u32 *dst) {
+    const auto zero = _mm_setzero_si128();
+
+    /* Dither values repeat every 4 pixels */
+    const auto dither = ds.dither[y & 3][x & 3];
+
+    for (int i = 0; i < 8; i += 4) {
+        const auto s = _mm_load_si128((const __m128i *)&src[i]);
+        const auto d = abe ? _mm_load_si128((const __m128i *)&dst[i]) : s; // Frame buffer isn't read without blending
+
+        const auto lo = blendLanes<abe>(ds, _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), &dither[0]);
+        const auto hi = blendLanes<abe>(ds, _mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), &dither[8]);
+
+        /* Saturating pack clamps to 0..255 */
+        _mm_store_si128((__m128i *)&src[i], _mm_packus_epi16(lo, hi));
+    }
+}
+#endif
+
+/* Blends fragments and writes them to the frame buffer */
+template <PSM fpsm, bool abe>
+void outputSpan(const DrawState &ds, const Span &span, const SpanBuffer &buf) {
+    const auto count = span.x1 - span.x0;
+
+    for (i64 i = 0; i < count; i += 8) {
+        const auto n = std::min((i64)8, count - i);
+        const auto x = span.x0 + i;
+
+        alignas(32) u32 src[8], dst[8], mask[8];
+
+        /* Always process 8 pixels, the write mode of pixels past the end of the span is ignored */
+        u32 maskAnd = 0xFFFFFFFF, maskOr = 0;
+
+        for (int j = 0; j < 8; j++) {
+            const auto write = (j < n) ? buf.write[i + j] : static_cast<u8>(PixelWrite::Skip);
+
+            mask[j] = (write == PixelWrite::RGBA) ? ds.fbmsk : ((write == PixelWrite::RGB) ? (ds.fbmsk | 0xFF000000) : 0xFFFFFFFF);
+
+            maskAnd &= mask[j];
+            maskOr  |= mask[j];
+        }
+
+        if (maskAnd == 0xFFFFFFFF) continue; // No pixel is written
+
+        const auto hasDst = abe || (maskOr != 0);
+
+        std::memcpy(src, &buf.color[i], sizeof(src));
+
+        if (hasDst) readFrame<fpsm>(ds, x, span.y, dst, n);
+
+        if (abe || ds.dthe) {
+#if defined(__SSE2__)
+            if (n == 8) {
+                blendPixels8<abe>(ds, x, span.y, src, dst);
+            } else {
+                blendPixels<abe>(ds, x, span.y, src, dst, n);
+            }
+#else
+            blendPixels<abe>(ds, x, span.y, src, dst, n);
+#endif
+        }
+
+        if (ds.fba) {
+            for (int j = 0; j < 8; j++) src[j] |= 1u << 31;
+        }
+
+        if (hasDst) {
+            for (int j = 0; j < 8; j++) src[j] = (dst[j] & mask[j]) | (src[j] & ~mask[j]);
+        }
+
+        writeFrame<fpsm>(ds, x, span.y, src, n);
+    }
+}
+
+/* --- Pipeline dispatch tables --- */
+
+template <std::size_t idx>
+constexpr ShadeFn getShadeFn() {
+    return &shadeSpan<(idx >> 1) & 1, idx & 1>;
+}
+
+template <std::size_t idx>
+constexpr TestFn getTestFn() {
+    return &testSpan<(idx >> 8) & 1, depthPSMs[(idx >> 6) & 3], static_cast<ZTest>((idx >> 4) & 3), (idx >> 3) & 1, static_cast<ATest>(idx & 7)>;
+}
+
+template <std::size_t idx>
+constexpr ShadeFn getTextureFn() {
+    return &textureSpan<texturePSMs[idx >> 4], static_cast<TFX>((idx >> 2) & 3), (idx >> 1) & 1, idx & 1>;
+}
+
+template <std::size_t idx>
+constexpr TestFn getDstTestFn() {
+    return &dstTestSpan<framePSMs[idx]>;
+}
+
+template <std::size_t idx>
+constexpr OutputFn getOutputFn() {
+    return &outputSpan<framePSMs[(idx >> 1) & 3], idx & 1>;
+}
+
+template <std::size_t... idx>
+constexpr std::array<ShadeFn, sizeof...(idx)> makeShadeTable(std::index_sequence<idx...>) {
+    return { getShadeFn<idx>()... };
+}
+
+template <std::size_t... idx>
+constexpr std::array<TestFn, sizeof...(idx)> makeTestTable(std::index_sequence<idx...>) {
+    return { getTestFn<idx>()... };
+}
+
+template <std::size_t... idx>
+constexpr std::array<ShadeFn, sizeof...(idx)> makeTextureTable(std::index_sequence<idx...>) {
+    return { getTextureFn<idx>()... };
+}
+
+template <std::size_t... idx>
+constexpr std::array<TestFn, sizeof...(idx)> makeDstTestTable(std::index_sequence<idx...>) {
+    return { getDstTestFn<idx>()... };
+}
+
+template <std::size_t... idx>
+constexpr std::array<OutputFn, sizeof...(idx)> makeOutputTable(std::index_sequence<idx...>) {
+    return { getOutputFn<idx>()... };
+}
+
+/* Indexed by [IIP:FGE] */
+constexpr auto shadeTable = makeShadeTable(std::make_index_sequence<2 * 2>());
+
+/* Indexed by [DATE:ZPSM:ZTST:ZMSK:ATST] */
+constexpr auto testTable = makeTestTable(std::make_index_sequence<2 * 4 * 4 * 2 * 8>());
+
+/* Indexed by [TPSM:TFX:TCC:FGE] */
+constexpr auto textureTable = makeTextureTable(std::make_index_sequence<9 * 4 * 2 * 2>());
+
+/* Indexed by [FPSM] */
+constexpr auto dstTestTable = makeDstTestTable(std::make_index_sequence<4>());
+
+/* Indexed by [FPSM:ABE] */
+constexpr auto outputTable = makeOutputTable(std::make_index_sequence<4 * 2>());
+
+/* Returns the table index of a frame buffer storage mode */
+int getFramePSMIndex(u8 psm) {
+    for (int i = 0; i < 4; i++) {
+        if (framePSMs[i] == psm) return i;
+    }
+
+    std::printf("[GS        ] Unhandled pixel storage mode 0x%02X\n", psm);
+
+    exit(0);
+}
+
+/* Returns the table index of a Z buffer storage mode */
+int getDepthPSMIndex(u8 psm) {
+    for (int i = 0; i < 4; i++) {
+        if (depthPSMs[i] == psm) return i;
+    }
+
+    std::printf("[GS        ] Unhandled depth storage mode 0x%02X\n", psm);
+
+    exit(0);
+}
+
+/* Returns the pipeline key for the current drawing state */
+PipelineKey getPipelineKey(bool iip) {
+    const auto &test = cctx->test;
+
+    PipelineKey key;
+
+    key.fpsm = cctx->frame.psm;
+    key.zpsm = cctx->zbuf.psm;
+
+    /* ZTE = 0 behaves like ZTST = ALWAYS */
+    key.ztst = test.zte ? test.ztst : static_cast<u8>(ZTest::Always);
+    key.zmsk = cctx->zbuf.zmsk;
+
+    /* ATE = 0 behaves like ATST = ALWAYS */
+    key.atst = test.ate ? test.atst : static_cast<u8>(ATest::Always);
+
+    /* 24-bit frame buffers have no alpha to test */
+    key.date = test.date && (key.fpsm != PSM::PSMCT24);
+
+    key.abe = cmode->abe;
+    key.tme = cmode->tme;
+    key.fge = cmode->fge;
+    key.iip = iip;
+
+    key.tpsm = cctx->tex0.psm;
+    key.tfx  = cctx->tex0.tfx;
+    key.tcc  = cctx->tex0.tcc;
+
+    return key;
+}
+
+/* Looks up the pixel pipeline for a key */
+Pipeline selectPipeline(const PipelineKey &key) {
+    Pipeline pipeline;
+
+    /* Fog is applied after the texture function */
+    pipeline.shade   = shadeTable[(key.iip << 1) | (key.fge && !key.tme)];
+    pipeline.texture = key.tme ? textureTable[(getTexturePSMIndex(key.tpsm) << 4) | (key.tfx << 2) | (key.tcc << 1) | key.fge] : nullptr;
+    pipeline.dstTest = dstTestTable[getFramePSMIndex(key.fpsm)];
+    pipeline.test    = testTable[(key.date << 8) | (getDepthPSMIndex(key.zpsm) << 6) | (key.ztst << 4) | (key.zmsk << 3) | key.atst];
+    pipeline.output  = outputTable[(getFramePSMIndex(key.fpsm) << 1) | key.abe];
+
+    return pipeline;
+}
+
+/* Selects the HiZ summaries for the current drawing state */
+void setHiZTarget() {
+    setHiZTarget(drawState.zbp, drawState.fbw, drawState.zpsm, drawState.fbp, drawState.fpsm, (drawState.scissor.scay1 >> 4) + 1);
+}
+
+/* Latches the drawing state of the current context */
+void setDrawState() {
+    drawState.fbp   = cctx->frame.fbp;
+    drawState.fbw   = cctx->frame.fbw;
+    drawState.fbmsk = cctx->frame.fbmsk;
+    drawState.zbp   = cctx->zbuf.zbp;
+    drawState.zmax  = getMaxZ(cctx->zbuf.psm);
+    drawState.fpsm  = cctx->frame.psm;
+    drawState.zpsm  = cctx->zbuf.psm;
+
+    drawState.scissor = cctx->scissor;
+    drawState.ztst  = cctx->test.zte ? cctx->test.ztst : static_cast<u8>(ZTest::Always);
+
+    drawState.aref  = cctx->test.aref;
+    drawState.afail = cctx->test.afail;
+
+    drawState.fogcol = fogcol;
+
+    drawState.alpha    = cctx->alpha;
+    drawState.pabe     = pabe;
+    drawState.fba      = cctx->fba;
+    drawState.colclamp = colclamp;
+
+    drawState.date = cctx->test.date && (cctx->frame.psm != PSM::PSMCT24);
+    drawState.datm = cctx->test.datm;
+
+    /* Only 16-bit frame buffers are dithered */
+    drawState.dthe = dthe && (getBitsPerPixel(cctx->frame.psm) == 16);
+
+    setTexState(drawState.tex); // Also used for texture coordinates, even without TME
+
+    if (drawState.dthe) {
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                for (int i = 0; i < 16; i++) {
+                    drawState.dither[y][x][i] = ((i & 3) == 3) ? 0 : dimx[y][(x + (i >> 2)) & 3];
+                }
+            }
+        }
+    }
+
+    setHiZTarget();
+}
+
+/* Classifies the block segments of a span with HiZ, returns false if the whole span fails the Z test */
+bool classifySpan(const Span &span, SpanBuffer &buf) {
+    const auto ztst = drawState.ztst;
+
+    if ((ztst != static_cast<u8>(ZTest::GEqual)) && (ztst != static_cast<u8>(ZTest::Greater))) return true;
+
+    const auto count = span.x1 - span.x0;
+
+    bool isVisible = false;
+
+    for (i64 i = 0, seg = 0; i < count; seg++) {
+        const auto segEnd = std::min(count, i + HIZ_BLOCK_SIZE - ((span.x0 + i) % HIZ_BLOCK_SIZE));
+
+        if (!hizEnabled) {
+            buf.hiz[seg] = HiZResult::Test;
+        } else {
+            /* Z is linear along the span, the end points bound the segment */
+            const auto z0 = (u32)std::min(span.z + i * span.dz, (f64)drawState.zmax);
+            const auto z1 = (u32)std::min(span.z + (segEnd - 1) * span.dz, (f64)drawState.zmax);
+
+            buf.hiz[seg] = classifyHiZ(span.x0 + i, span.y, std::min(z0, z1), std::max(z0, z1), ztst);
+        }
+
+        isVisible |= buf.hiz[seg] != HiZResult::Reject;
+
+        i = segEnd;
+    }
+
+    return isVisible;
+}
+
+/* Runs a span through a pixel pipeline */
+void drawSpan(const Pipeline &pipeline, const Span &span) {
+    if (span.x0 >= span.x1) return;
+
+    assert((span.x1 - span.x0) <= MAX_SPAN);
+
+    pixelCount += span.x1 - span.x0;
+
+    if (!classifySpan(span, spanBuf)) return;
+
+    pipeline.shade(drawState, span, spanBuf);
+
+    if (pipeline.texture) pipeline.texture(drawState, span, spanBuf);
+
+    if (drawState.date) pipeline.dstTest(drawState, span, spanBuf);
+
+    pipeline.test(drawState, span, spanBuf);
+    pipeline.output(drawState, span, spanBuf);
+}
+
+u64 getPixelCount() {
+    flushBatch();
+    flushDeferred();
+
+    return pixelCount;
+}
+
+/* --- Rasterizers --- */
+
+/* Returns the pixel range [x0, x1) covered by the scissor area */
+inline i64 getScissorX0() { return drawState.scissor.scax0 >> 4; }
+inline i64 getScissorX1() { return (drawState.scissor.scax1 >> 4) + 1; }
+inline i64 getScissorY0() { return drawState.scissor.scay0 >> 4; }
+inline i64 getScissorY1() { return (drawState.scissor.scay1 >> 4) + 1; }
+
+/* Texture coordinates of a vertex, S and T are scaled to texels */
+struct TexCoords {
+    f32 s, t, q;
+};
+
+inline TexCoords getTexCoords(const Vertex &vtx) {
+    const auto &ts = drawState.tex;
+
+    if (ts.fst) return {vtx.u / 16.0f, vtx.v / 16.0f, 1.0f};
+
+    return {vtx.s * ts.width, vtx.t * ts.height, vtx.q};
+}
+
+void drawPoint(const Pipeline &pipeline, const Vertex &v0) {
+    const auto x = ((i64)v0.x + 8) >> 4;
+    const auto y = ((i64)v0.y + 8) >> 4;
+
+    if ((x < getScissorX0()) || (x >= getScissorX1()) || (y < getScissorY0()) || (y >= getScissorY1())) return;
+
+    Span span = {};
+
+    span.x0 = x;
+    span.x1 = x + 1;
+    span.y  = y;
+
+    span.z = v0.z;
+
+    span.r = v0.r;
+    span.g = v0.g;
+    span.b = v0.b;
+    span.a = v0.a;
+    span.f = v0.f;
+
+    const auto tc = getTexCoords(v0);
+
+    span.s = tc.s;
+    span.t = tc.t;
+    span.q = tc.q;
+
+    drawSpan(pipeline, span);
+}
+
+/* Draws a line as a series of single pixel spans, steps along the major axis */
+void drawLine(const Pipeline &pipeline, const Vertex &v0, const Vertex &v1, bool iip) {
+    const auto dx = (i64)v1.x - v0.x;
+    const auto dy = (i64)v1.y - v0.y;
+
+    const auto steps = std::max(std::abs(dx), std::abs(dy)) >> 4;
+
+    if (!steps) return;
+
+    Span span = {};
+
+    /* Flat shaded lines use the color of the second vertex */
+    const auto &c = iip ? v0 : v1;
+
+    const auto tc0 = getTexCoords(v0);
+    const auto tc1 = getTexCoords(v1);
+
+    for (i64 i = 0; i < steps; i++) {
+        const auto t = (f64)i / steps;
+
+        const auto x = ((i64)(v0.x + t * dx) + 8) >> 4;
+        const auto y = ((i64)(v0.y + t * dy) + 8) >> 4;
+
+        if ((x < getScissorX0()) || (x >= getScissorX1()) || (y < getScissorY0()) || (y >= getScissorY1())) continue;
+
+        span.x0 = x;
+        span.x1 = x + 1;
+        span.y  = y;
+
+        span.z = v0.z + t * ((f64)v1.z - v0.z);
+        span.f = v0.f + t * ((f32)v1.f - v0.f);
+
+        span.s = tc0.s + t * (tc1.s - tc0.s);
+        span.t = tc0.t + t * (tc1.t - tc0.t);
+        span.q = tc0.q + t * (tc1.q - tc0.q);
+
+        span.r = c.r;
+        span.g = c.g;
+        span.b = c.b;
+        span.a = c.a;
+
+        if (iip) {
+            span.r += t * ((f32)v1.r - v0.r);
+            span.g += t * ((f32)v1.g - v0.g);
+            span.b += t * ((f32)v1.b - v0.b);
+            span.a += t * ((f32)v1.a - v0.a);
+        }
+
+        drawSpan(pipeline, span);
+    }
+}
+
+/* Attribute gradients of a triangle */
+struct Gradients {
+    f64 dzdx, dzdy;
+
+    f32 drdx, dgdx, dbdx, dadx, dfdx;
+    f32 drdy, dgdy, dbdy, dady, dfdy;
+
+    f32 dsdx, dtdx, dqdx;
+    f32 dsdy, dtdy, dqdy;
+};
+
+/* Draws a triangle as horizontal spans, pixel centers are at integer coordinates */
+void drawTriangle(const Pipeline &pipeline, const Vertex &a, const Vertex &b, const Vertex &c, bool iip) {
+    const auto area = ((i64)b.x - a.x) * ((i64)c.y - a.y) - ((i64)c.x - a.x) * ((i64)b.y - a.y);
+
+    if (!area) return;
+
+    /* Calculate attribute gradients (per pixel) from the plane equations */
+
+    const auto e1x = (f64)((i64)b.x - a.x), e1y = (f64)((i64)b.y - a.y);
+    const auto e2x = (f64)((i64)c.x - a.x), e2y = (f64)((i64)c.y - a.y);
+
+    const auto invArea = 16.0 / area;
+
+    const auto ddx = [&](f64 a0, f64 a1, f64 a2) { return ((a1 - a0) * e2y - (a2 - a0) * e1y) * invArea; };
+    const auto ddy = [&](f64 a0, f64 a1, f64 a2) { return ((a2 - a0) * e1x - (a1 - a0) * e2x) * invArea; };
+
+    Gradients grad = {};
+
+    grad.dzdx = ddx(a.z, b.z, c.z);
+    grad.dzdy = ddy(a.z, b.z, c.z);
+    grad.dfdx = ddx(a.f, b.f, c.f);
+    grad.dfdy = ddy(a.f, b.f, c.f);
+
+    const auto tcA = getTexCoords(a);
+    const auto tcB = getTexCoords(b);
+    const auto tcC = getTexCoords(c);
+
+    grad.dsdx = ddx(tcA.s, tcB.s, tcC.s); grad.dsdy = ddy(tcA.s, tcB.s, tcC.s);
+    grad.dtdx = ddx(tcA.t, tcB.t, tcC.t); grad.dtdy = ddy(tcA.t, tcB.t, tcC.t);
+    grad.dqdx = ddx(tcA.q, tcB.q, tcC.q); grad.dqdy = ddy(tcA.q, tcB.q, tcC.q);
+
+    if (iip) {
+        grad.drdx = ddx(a.r, b.r, c.r); grad.drdy = ddy(a.r, b.r, c.r);
+        grad.dgdx = ddx(a.g, b.g, c.g); grad.dgdy = ddy(a.g, b.g, c.g);
+        grad.dbdx = ddx(a.b, b.b, c.b); grad.dbdy = ddy(a.b, b.b, c.b);
+        grad.dadx = ddx(a.a, b.a, c.a); grad.dady = ddy(a.a, b.a, c.a);
+    }
+
+    /* Sort vertices by Y */
+
+    const Vertex *v[3] = {&a, &b, &c};
+
+    if (v[0]->y > v[1]->y) std::swap(v[0], v[1]);
+    if (v[1]->y > v[2]->y) std::swap(v[1], v[2]);
+    if (v[0]->y > v[1]->y) std::swap(v[0], v[1]);
+
+    const auto yMin = std::max(((i64)v[0]->y + 15) >> 4, getScissorY0());
+    const auto yMax = std::min(((i64)v[2]->y + 15) >> 4, getScissorY1());
+
+    /* Flat shaded triangles use the color of the last vertex */
+    const auto &flat = c;
+
+    Span span = {};
+
+    span.dz = grad.dzdx;
+    span.df = grad.dfdx;
+    span.dr = grad.drdx;
+    span.dg = grad.dgdx;
+    span.db = grad.dbdx;
+    span.da = grad.dadx;
+    span.ds = grad.dsdx;
+    span.dt = grad.dtdx;
+    span.dq = grad.dqdx;
+
+    /* Returns the X coordinate of an edge at Y, 12.4 fixed point */
+    const auto edgeX = [](const Vertex *v0, const Vertex *v1, f64 y) {
+        return v0->x + (y - v0->y) * ((f64)v1->x - v0->x) / ((f64)v1->y - v0->y);
+    };
+
+    for (auto y = yMin; y < yMax; y++) {
+        const f64 py = 16 * y;
+
+        const auto xLong  = edgeX(v[0], v[2], py);
+        const auto xShort = (py < v[1]->y) ? edgeX(v[0], v[1], py) : edgeX(v[1], v[2], py);
+
+        const auto xMin = std::max((i64)std::ceil(std::min(xLong, xShort) / 16.0), getScissorX0());
+        const auto xMax = std::min((i64)std::ceil(std::max(xLong, xShort) / 16.0), getScissorX1());
+
+        if (xMin >= xMax) continue;
+
+        /* Evaluate attributes at the first pixel */
+
+        const auto ox = xMin - a.x / 16.0;
+        const auto oy = y - a.y / 16.0;
+
+        span.x0 = xMin;
+        span.x1 = std::min(xMax, xMin + MAX_SPAN);
+        span.y  = y;
+
+        span.z = std::max(a.z + grad.dzdx * ox + grad.dzdy * oy, 0.0);
+        span.f = a.f + grad.dfdx * ox + grad.dfdy * oy;
+
+        span.s = tcA.s + grad.dsdx * ox + grad.dsdy * oy;
+        span.t = tcA.t + grad.dtdx * ox + grad.dtdy * oy;
+        span.q = tcA.q + grad.dqdx * ox + grad.dqdy * oy;
+
+        if (iip) {
+            span.r = a.r + grad.drdx * ox + grad.drdy * oy;
+            span.g = a.g + grad.dgdx * ox + grad.dgdy * oy;
+            span.b = a.b + grad.dbdx * ox + grad.dbdy * oy;
+            span.a = a.a + grad.dadx * ox + grad.dady * oy;
+        } else {
+            span.r = flat.r;
+            span.g = flat.g;
+            span.b = flat.b;
+            span.a = flat.a;
+        }
+
+        drawSpan(pipeline, span);
+    }
+}
+
+void drawSprite(const Pipeline &pipeline, const Vertex &v0, const Vertex &v1) {
+    /* Calculate bounding box, pixel centers are at integer coordinates */
+
+    const auto &scissor = drawState.scissor;
+
+    const auto xMin = (std::max((i64)std::min(v0.x, v1.x), scissor.scax0) + 15) >> 4;
+    const auto xMax = (std::min((i64)std::max(v0.x, v1.x), (scissor.scax1 + 0x10)) + 15) >> 4;
+    const auto yMin = (std::max((i64)std::min(v0.y, v1.y), scissor.scay0) + 15) >> 4;
+    const auto yMax = (std::min((i64)std::max(v0.y, v1.y), (scissor.scay1 + 0x10)) + 15) >> 4;
+
+    if ((xMin >= xMax) || (yMin >= yMax)) return;
+
+    /* Sprites are flat shaded, all attributes come from the second vertex */
+
+    Span span = {};
+
+    span.x0 = xMin;
+    span.x1 = xMax;
+
+    span.z = v1.z;
+
+    span.r = v1.r;
+    span.g = v1.g;
+    span.b = v1.b;
+    span.a = v1.a;
+    span.f = v1.f;
+
+    /* Texture coordinates are interpolated across the sprite, Q comes from the second vertex */
+
+    const auto tc0 = getTexCoords(v0);
+    const auto tc1 = getTexCoords(v1);
+
+    span.ds = 16.0f * (tc1.s - tc0.s) / ((f32)v1.x - v0.x);
+    span.s  = tc0.s + (16.0f * xMin - v0.x) / 16.0f * span.ds;
+    span.q  = tc1.q;
+
+    const auto dtdy = 16.0f * (tc1.t - tc0.t) / ((f32)v1.y - v0.y);
+
+    /* Start drawing */
+
+    for (auto y = yMin; y < yMax; y++) {
+        span.y = y;
+        span.t = tc0.t + (16.0f * y - v0.y) / 16.0f * dtdy;
+
+        drawSpan(pipeline, span);
+    }
+}
+
+/* Draws count vertices as primitives of type primType, getVertex(i) returns the i-th vertex */
+template <typename GetVertex>
+void drawPrimitives(const Pipeline &pipeline, u8 primType, bool iip, u32 count, GetVertex getVertex) {
+    switch (primType) {
+        case Primitive::Point:
+            for (u32 i = 0; i < count; i++) {
+                drawPoint(pipeline, getVertex(i));
+            }
+            break;
+        case Primitive::Line:
+        case Primitive::LineStrip:
+            for (u32 i = 0; i < count; i += 2) {
+                drawLine(pipeline, getVertex(i), getVertex(i + 1), iip);
+            }
+            break;
+        case Primitive::Triangle:
+        case Primitive::TriangleStrip:
+        case Primitive::TriangleFan:
+            for (u32 i = 0; i < count; i += 3) {
+                drawTriangle(pipeline, getVertex(i), getVertex(i + 1), getVertex(i + 2), iip);
+            }
+            break;
+        case Primitive::Sprite:
+            for (u32 i = 0; i < count; i += 2) {
+                drawSprite(pipeline, getVertex(i), getVertex(i + 1));
+            }
+            break;
+        default:
+            std::printf("[GS        ] Unhandled primitive %u\n", primType);
+
+            exit(0);
+    }
+}
+
+/* --- Frame skipping --- */
+
+/*
+ * When the host can't keep up, whole frames are skipped to keep emulated time
+ * at full speed. GS registers and transmissions are still processed as usual,
+ * only rasterization is deferred: batches are kept together with their drawing
+ * state, and are drawn in order as soon as a transmission touches the VRAM they
+ * read or write. At VBLANK, batches that only draw to a displayed frame buffer
+ * are held back, everything else (render targets sampled later, off-screen
+ * buffers) is drawn. Held batches are drawn as soon as the next frame accesses
+ * their output (feedback effects, readbacks) or displays it, and are dropped
+ * otherwise. Skipped frames don't update the display.
+ *
+ * The frame limiter uses the same frame clock: at VBLANK, it waits until the
+ * next frame is due, frames that are late can be skipped.
+ */
+
+constexpr int MAX_SKIPPED_FRAMES = 4; // Consecutive frames
+
+constexpr auto FRAME_TIME    = std::chrono::nanoseconds(16683350); // NTSC, ~59.94 Hz
+constexpr auto MAX_FRAME_LAG = std::chrono::milliseconds(250);      // Don't try to catch up with longer stalls
+
+constexpr int DISPLAY_HISTORY = 4; // Number of recently displayed frame buffers
+
+/* VRAM words [start, end) */
+struct VRAMRange {
+    u64 start, end;
+};
+
+/* A batch drawn during a skipped frame */
+struct DeferredBatch {
+    Pipeline  pipeline;
+    DrawState state;
+
+    u8   primType;
+    bool iip;
+
+    std::vector<Vertex> vertices;
+
+    VRAMRange frame, depth, texture; // VRAM the batch accesses
+
+    bool isDepthWritten;
+};
+
+bool isFrameSkipEnabled = false, isSkippingFrame = false;
+bool isFrameLimitEnabled = true;
+
+int skippedFrames = 0;
+
+std::chrono::steady_clock::time_point frameDeadline; // Shared by the frame limiter and frame skipping
+
+std::vector<DeferredBatch> deferredBatches;
+
+u64 heldCount = 0; // Batches at the front of deferredBatches held from the previous skipped frame
+
+std::array<VRAMRange, DISPLAY_HISTORY> displayHistory;
+
+int displayHistoryPos = 0;
+
+inline bool isOverlapping(const VRAMRange &a, const VRAMRange &b) {
+    return (a.start < b.end) && (b.start < a.end);
+}
+
+/* Returns the VRAM words covered by lines [y0, y1) of a buffer */
+VRAMRange getBufferRange(u32 base, u32 width, u8 psm, u32 y0, u32 y1) {
+    u64 rowSize = width;
+
+    /* 8H, 4HL and 4HH pixels take up a whole word like 24-bit ones */
+    switch (psm) {
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S:
+        case PSM::PSMZ16  :
+        case PSM::PSMZ16S :
+            rowSize = width >> 1;
+            break;
+        case PSM::PSMCT8:
+            rowSize = width >> 2;
+            break;
+        case PSM::PSMCT4:
+            rowSize = width >> 3;
+            break;
+        default:
+            break;
+    }
+
+    return {base + rowSize * y0, base + rowSize * y1};
+}
+
+/* Returns the VRAM words read by the texture of the current context */
+VRAMRange getTextureRange() {
+    if (!cmode->tme) return {0, 0};
+
+    const auto &tex0 = cctx->tex0;
+
+    VRAMRange range = getBufferRange(tex0.tbp0, tex0.tbw, tex0.psm, 0, 1 << tex0.th);
+
+    for (int n = 1; n <= cctx->tex1.mxl; n++) {
+        const auto level = getBufferRange(cctx->miptbp.tbp[n - 1], cctx->miptbp.tbw[n - 1], tex0.psm, 0, std::max((1 << tex0.th) >> n, 1));
+
+        range.start = std::min(range.start, level.start);
+        range.end   = std::max(range.end, level.end);
+    }
+
+    return range;
+}
+
+/* Returns the VRAM words the current context draws to */
+VRAMRange getFrameRange() {
+    const auto &frame = cctx->frame;
+
+    if (frame.fbmsk == 0xFFFFFFFF) return {0, 0};
+
+    return getBufferRange(frame.fbp, frame.fbw, frame.psm, (u32)(cctx->scissor.scay0 >> 4), (u32)(cctx->scissor.scay1 >> 4) + 1);
+}
+
+/* Returns the VRAM words of the depth buffer if the current context tests or writes depth */
+VRAMRange getDepthRange() {
+    const auto &zbuf = cctx->zbuf;
+
+    const auto ztst = cctx->test.zte ? cctx->test.ztst : static_cast<u8>(ZTest::Always);
+
+    const auto hasZRead = (ztst == static_cast<u8>(ZTest::GEqual)) || (ztst == static_cast<u8>(ZTest::Greater));
+
+    if (zbuf.zmsk && !hasZRead) return {0, 0};
+
+    return getBufferRange(zbuf.zbp, cctx->frame.fbw, zbuf.psm, (u32)(cctx->scissor.scay0 >> 4), (u32)(cctx->scissor.scay1 >> 4) + 1);
+}
+
+/* Keeps a batch of the current drawing state until it has to be drawn */
+void deferBatch(const Pipeline &pipeline, bool iip, std::vector<Vertex> &&vertices) {
+    deferredBatches.push_back({pipeline, drawState, prim.prim, iip, std::move(vertices), getFrameRange(), getDepthRange(), getTextureRange(), !cctx->zbuf.zmsk});
+}
+
+/* Draws a deferred batch with its drawing state */
+void drawDeferred(const DeferredBatch &deferred) {
+    drawState = deferred.state;
+
+    setHiZTarget();
+
+    const auto &vertices = deferred.vertices;
+
+    drawPrimitives(deferred.pipeline, deferred.primType, deferred.iip, vertices.size(), [&vertices](u32 i) { return vertices[i]; });
+}
+
+/*
+ * Draws all deferred batches.
+ * Batches dropped by resolveSkippedFrame() or resolveHeldBatches() never get here, so Z values they would have written are lost.
+ * This is accepted: games clear the depth buffer every frame, the lost Z only shows up if a later frame depth tests
+ * against it without clearing first.
+ */
+void flushDeferred() {
+    if (deferredBatches.empty()) return;
+
+    printLog("[GS        ] Drawing %zu deferred batch(es)\n", deferredBatches.size());
+
+    for (const auto &deferred : deferredBatches) drawDeferred(deferred);
+
+    deferredBatches.clear();
+
+    heldCount = 0;
+}
+
+/* Draws all deferred batches if any of them reads or writes VRAM words in range */
+void flushDeferred(const VRAMRange &range) {
+    for (const auto &deferred : deferredBatches) {
+        if (isOverlapping(deferred.frame, range) || isOverlapping(deferred.depth, range) || isOverlapping(deferred.texture, range)) {
+            return flushDeferred();
+        }
+    }
+}
+
+/* Returns true if range overlaps a recently displayed frame buffer */
+bool isDisplayed(const VRAMRange &range) {
+    for (const auto &displayed : displayHistory) {
+        if (isOverlapping(displayed, range)) return true;
+    }
+
+    return false;
+}
+
+/* Returns the VRAM words shown by a read circuit, empty if it's disabled */
+VRAMRange getDisplayRange(int i) {
+    if (!(i ? pmode.en2 : pmode.en1)) return {0, 0};
+
+    const auto &fb = dispfb[i];
+
+    const auto height = (display[i].dh + 1) / (display[i].magv + 1);
+
+    return getBufferRange(fb.fbp, fb.fbw, fb.psm, fb.dby, fb.dby + height);
+}
+
+/* Records the frame buffers shown by the read circuits, double buffering alternates between them */
+void updateDisplayHistory() {
+    for (int i = 0; i < 2; i++) {
+        const auto range = getDisplayRange(i);
+
+        if (range.start >= range.end) continue;
+
+        bool isKnown = false;
+
+        for (const auto &displayed : displayHistory) {
+            isKnown |= (displayed.start == range.start) && (displayed.end == range.end);
+        }
+
+        if (isKnown) continue;
+
+        displayHistory[displayHistoryPos] = range;
+
+        displayHistoryPos = (displayHistoryPos + 1) % DISPLAY_HISTORY;
+    }
+}
+
+/* Adds a non-empty range to a set of ranges unless a range of the set already contains it */
+void addRange(std::vector<VRAMRange> &ranges, const VRAMRange &range) {
+    if (range.start >= range.end) return;
+
+    for (const auto &r : ranges) {
+        if ((r.start <= range.start) && (range.end <= r.end)) return;
+    }
+
+    ranges.push_back(range);
+}
+
+/* Ends a skipped frame, draws the batches whose output outlives it and holds back the others */
+void resolveSkippedFrame() {
+    flushBatch();
+
+    const auto count = deferredBatches.size();
+
+    printLog("[GS        ] Skipped frame, %zu batch(es)\n", count);
+
+    /* Walk backwards so that a batch knows whether later needed batches access its output */
+    std::vector<bool> isNeeded(count);
+    std::vector<VRAMRange> reads;
+
+    for (auto i = count; i-- > 0;) {
+        const auto &deferred = deferredBatches[i];
+
+        const auto depth = deferred.isDepthWritten ? deferred.depth : VRAMRange{0, 0};
+
+        /* Batches held from the previous frame are only needed if this frame accesses their output */
+        bool needed = (i >= heldCount) && !isDisplayed(deferred.frame);
+
+        for (const auto &read : reads) {
+            needed |= isOverlapping(deferred.frame, read) || isOverlapping(depth, read);
+        }
+
+        /* Needed batches depend on whatever was drawn before to their frame and depth buffers, too */
+        if (needed) {
+            addRange(reads, deferred.frame);
+            addRange(reads, deferred.depth);
+            addRange(reads, deferred.texture);
+        }
+
+        isNeeded[i] = needed;
+    }
+
+    /* Only hold back this frame's batches, previously held ones are dropped */
+    std::vector<DeferredBatch> held;
+
+    for (u64 i = 0; i < count; i++) {
+        if (isNeeded[i]) {
+            drawDeferred(deferredBatches[i]);
+        } else if (i >= heldCount) {
+            held.push_back(std::move(deferredBatches[i]));
+        }
+    }
+
+    deferredBatches = std::move(held);
+
+    heldCount = deferredBatches.size();
+}
+
+/* Ends a displayed frame, draws held batches if their output is shown and drops the others */
+void resolveHeldBatches() {
+    for (int i = 0; i < 2; i++) flushDeferred(getDisplayRange(i));
+
+    deferredBatches.clear();
+
+    heldCount = 0;
+}
+
+/*
+ * Advances the frame clock at VBLANK, returns true if emulation runs behind real time.
+ * The frame limiter waits until the next frame is due.
+ */
+bool updateFrameClock() {
+    auto now = std::chrono::steady_clock::now();
+
+    /* First frame */
+    if (frameDeadline == std::chrono::steady_clock::time_point{}) frameDeadline = now;
+
+    /* Running ahead of real time doesn't earn more than one frame of credit */
+    frameDeadline = std::clamp(frameDeadline + FRAME_TIME, now - MAX_FRAME_LAG, now + FRAME_TIME);
+
+    if (isFrameLimitEnabled && (frameDeadline > now)) {
+        std::this_thread::sleep_until(frameDeadline);
+
+        now = frameDeadline;
+    }
+
+    return now > frameDeadline;
+}
+
+/* Decides whether the next frame is skipped, called at VBLANK */
+void updateFrameSkip() {
+    updateDisplayHistory();
+
+    const auto isBehind = updateFrameClock();
+
+    if (!isFrameSkipEnabled) {
+        isSkippingFrame = false;
+
+        return;
+    }
+
+    isSkippingFrame = isBehind && (skippedFrames < MAX_SKIPPED_FRAMES);
+
+    skippedFrames = isSkippingFrame ? skippedFrames + 1 : 0;
+}
+
+/* Shows the frame at VBLANK, or ends a skipped frame */
+void endFrame() {
+    if (isSkippingFrame) {
+        resolveSkippedFrame();
+    } else {
+        resolveHeldBatches();
+        updateDisplay();
+    }
+
+    updateFrameSkip();
+}
+
+void setLogging(bool isEnabled) {
+    isLogEnabled = isEnabled;
+}
+
+void setFrameSkip(bool isEnabled) {
+    printLog("[GS        ] Frame skipping %s\n", isEnabled ? "enabled" : "disabled");
+
+    isFrameSkipEnabled = isEnabled;
+
+    frameDeadline = std::chrono::steady_clock::now();
+
+    skippedFrames = 0;
+}
+
+void setFrameLimit(bool isEnabled) {
+    printLog("[GS        ] Frame limiter %s\n", isEnabled ? "enabled" : "disabled");
+
+    isFrameLimitEnabled = isEnabled;
+
+    frameDeadline = std::chrono::steady_clock::now();
+}
+
+/* --- Primitive assembly --- */
+
+/*
+ * Vertex kicks append to a structure-of-arrays vertex buffer, and every
+ * completed primitive appends its vertex indices to the current batch.
+ * Batches are drawn when a register that affects drawing is written (or VRAM
+ * is about to be accessed otherwise), so consecutive primitives sharing the
+ * same drawing state only pay for pipeline selection and setup once.
+ */
+
+/* Assembled vertices */
+struct VertexBuffer {
+    alignas(32) i32 x[VTX_BUF_SIZE]; // XYOFFSET is already applied
+    alignas(32) i32 y[VTX_BUF_SIZE];
+    alignas(32) u32 z[VTX_BUF_SIZE];
+
+    alignas(32) u32 rgba[VTX_BUF_SIZE];
+    alignas(32) u8  f[VTX_BUF_SIZE];
+
+    alignas(32) u16 u[VTX_BUF_SIZE];
+    alignas(32) u16 v[VTX_BUF_SIZE];
+
+    alignas(32) f32 s[VTX_BUF_SIZE];
+    alignas(32) f32 t[VTX_BUF_SIZE];
+    alignas(32) f32 q[VTX_BUF_SIZE];
+
+    u32 count;
+};
+
+/* Primitives waiting to be drawn */
+struct Batch {
+    u16 indices[3 * VTX_BUF_SIZE];
+    u32 indexCount;
+
+    u32 primCount;
+};
+
+VertexBuffer vtxBuf;
+
+Batch batch;
+
+/* Reads a vertex from the vertex buffer */
+inline Vertex getVertex(u32 idx) {
+    Vertex vtx;
+
+    vtx.x = vtxBuf.x[idx];
+    vtx.y = vtxBuf.y[idx];
+    vtx.z = vtxBuf.z[idx];
+
+    const auto rgba = vtxBuf.rgba[idx];
+
+    vtx.r = rgba >>  0;
+    vtx.g = rgba >>  8;
+    vtx.b = rgba >> 16;
+    vtx.a = rgba >> 24;
+    vtx.f = vtxBuf.f[idx];
+
+    vtx.u = vtxBuf.u[idx];
+    vtx.v = vtxBuf.v[idx];
+
+    vtx.s = vtxBuf.s[idx];
+    vtx.t = vtxBuf.t[idx];
+    vtx.q = vtxBuf.q[idx];
+
+    return vtx;
+}
+
+/* Moves the vertices of the current primitive to the start of the vertex buffer */
+void compactVertices() {
+    for (int i = 0; i < vtxCount; i++) {
+        const auto src = vtxQueue[i];
+
+        vtxBuf.x[i] = vtxBuf.x[src];
+        vtxBuf.y[i] = vtxBuf.y[src];
+        vtxBuf.z[i] = vtxBuf.z[src];
+
+        vtxBuf.rgba[i] = vtxBuf.rgba[src];
+        vtxBuf.f[i] = vtxBuf.f[src];
+
+        vtxBuf.u[i] = vtxBuf.u[src];
+        vtxBuf.v[i] = vtxBuf.v[src];
+
+        vtxBuf.s[i] = vtxBuf.s[src];
+        vtxBuf.t[i] = vtxBuf.t[src];
+        vtxBuf.q[i] = vtxBuf.q[src];
+
+        vtxQueue[i] = i;
+    }
+
+    vtxBuf.count = vtxCount;
+}
+
+/* Draws all batched primitives, or keeps them for later if the current frame is skipped */
+void flushBatch() {
+    if (batch.primCount) {
+        const auto &idx = batch.indices;
+
+        /* Points and sprites are always flat shaded */
+        const auto iip = cmode->iip && (prim.prim != Primitive::Point) && (prim.prim != Primitive::Sprite);
+
+        const auto pipeline = selectPipeline(getPipelineKey(iip));
+
+        /* Batches held from the last skipped frame are drawn first if this one accesses their output */
+        if (!isSkippingFrame && !deferredBatches.empty()) {
+            flushDeferred(getFrameRange());
+            flushDeferred(getDepthRange());
+            flushDeferred(getTextureRange());
+        }
+
+        setDrawState();
+
+        if (isSkippingFrame) {
+            std::vector<Vertex> vertices(batch.indexCount);
+
+            for (u32 i = 0; i < batch.indexCount; i++) vertices[i] = getVertex(idx[i]);
+
+            deferBatch(pipeline, iip, std::move(vertices));
+        } else {
+            drawPrimitives(pipeline, prim.prim, iip, batch.indexCount, [&idx](u32 i) { return getVertex(idx[i]); });
+        }
+    }
+
+    batch.indexCount = 0;
+    batch.primCount  = 0;
+
+    compactVertices();
+}
+
+/* Appends a completed primitive to the batch */
+inline void emitPrimitive(i32 count) {
+    for (int i = 0; i < count; i++) {
+        batch.indices[batch.indexCount++] = vtxQueue[i];
+    }
+
+    batch.primCount++;
+}
+
+/* Adds a vertex to the vertex buffer, draws a primitive if this completes one */
+void kickVertex(u64 data, bool hasFog, bool isDrawingKick) {
+    /* Make room for this vertex and one more primitive */
+    if (((vtxBuf.count + 1) > VTX_BUF_SIZE) || ((batch.indexCount + 3) > (3 * VTX_BUF_SIZE))) flushBatch();
+
+    const auto idx = vtxBuf.count++;
+
+    vtxBuf.x[idx] = (i32)((data >>  0) & 0xFFFF) - (i32)cctx->xyoffset.ofx;
+    vtxBuf.y[idx] = (i32)((data >> 16) & 0xFFFF) - (i32)cctx->xyoffset.ofy;
+
+    if (hasFog) {
+        vtxBuf.z[idx] = (data >> 32) & 0xFFFFFF;
+        vtxBuf.f[idx] = data >> 56;
+    } else {
+        vtxBuf.z[idx] = data >> 32;
+        vtxBuf.f[idx] = fog;
+    }
+
+    vtxBuf.rgba[idx] = rgbaq.r | (rgbaq.g << 8) | (rgbaq.b << 16) | (rgbaq.a << 24);
+
+    vtxBuf.u[idx] = uv.u;
+    vtxBuf.v[idx] = uv.v;
+
+    vtxBuf.s[idx] = st.s;
+    vtxBuf.t[idx] = st.t;
+    vtxBuf.q[idx] = rgbaq.q;
+
+    vtxQueue[vtxCount++] = idx;
+
+    const auto needed = primVertexCount[prim.prim];
+
+    if (vtxCount < needed) return;
+
+    if (isDrawingKick) emitPrimitive(needed);
+
+    /* Keep the vertices strips and fans share with the next primitive */
+    switch (prim.prim) {
+        case Primitive::LineStrip:
+            vtxQueue[0] = vtxQueue[1];
+
+            vtxCount = 1;
+            break;
+        case Primitive::TriangleStrip:
+            vtxQueue[0] = vtxQueue[1];
+            vtxQueue[1] = vtxQueue[2];
+
+            vtxCount = 2;
+            break;
+        case Primitive::TriangleFan:
+            vtxQueue[1] = vtxQueue[2];
+
+            vtxCount = 2;
+            break;
+        default:
+            vtxCount = 0;
+    }
+}
+
+/* --- Display output --- */
+
+/*
+ * At every VBLANK, the two read circuits are converted to XBGR8888 line by line
+ * and merged into the output buffer. A line is only converted again if one of
+ * the VRAM pages it reads from has been written, or if the display setup has
+ * changed, and only the changed lines get uploaded.
+ */
+
+/* Read circuit setup, latched once per frame */
+struct ReadCircuit {
+    bool enabled;
+
+    u32 fbp, fbw;
+    u8  psm;
+    u32 dbx, dby;
+
+    i32 width, height; // In frame buffer pixels
+
+    bool operator==(const ReadCircuit &) const = default;
+};
+
+/* Output setup, latched once per frame */
+struct DisplaySetup {
+    ReadCircuit circuit[2];
+
+    bool mmod, slbg;
+    u8   alp;
+    u32  bgcolor;
+
+    bool intl, ffmd;
+
+    bool operator==(const DisplaySetup &) const = default;
+};
+
+DisplaySetup displaySetup;
+
+bool displayChanged = true;
+
+std::array<bool, OUTPUT_HEIGHT> lineDirty;
+
+alignas(32) u32 lineBuf[2][OUTPUT_WIDTH];
+
+/* Latches the current display setup */
+DisplaySetup getDisplaySetup() {
+    DisplaySetup setup{};
+
+    const bool en[2] = {pmode.en1, pmode.en2};
+
+    for (int i = 0; i < 2; i++) {
+        auto &circuit = setup.circuit[i];
+
+        const auto &fb   = dispfb[i];
+        const auto &disp = display[i];
+
+        circuit.enabled = en[i];
+
+        if (!circuit.enabled) continue;
+
+        circuit.fbp = fb.fbp;
+        circuit.fbw = fb.fbw;
+        circuit.psm = fb.psm;
+        circuit.dbx = fb.dbx;
+        circuit.dby = fb.dby;
+
+        circuit.width  = std::min((i32)((disp.dw + 1) / (disp.magh + 1)), OUTPUT_WIDTH);
+        circuit.height = std::min((i32)((disp.dh + 1) / (disp.magv + 1)), OUTPUT_HEIGHT);
+    }
+
+    setup.mmod = pmode.mmod;
+    setup.slbg = pmode.slbg;
+    setup.alp  = pmode.alp;
+
+    setup.bgcolor = bgcolor.r | (bgcolor.g << 8) | (bgcolor.b << 16);
+
+    setup.intl = smode2.intl;
+    setup.ffmd = smode2.ffmd;
+
+    return setup;
+}
+
+/* Returns the frame buffer line an output line reads from */
+i32 getSourceLine(const DisplaySetup &setup, i32 y) {
+    /* Interlaced frame mode reads every line of a half-height buffer in each field, so each line is shown twice */
+    if (setup.intl && setup.ffmd) return y >> 1;
+
+    return y;
+}
+
+/* Returns the first VRAM word and the number of words a circuit line covers */
+std::pair<u32, u32> getCircuitLine(const ReadCircuit &circuit, i32 line) {
+    const auto y = (circuit.dby + line) & 2047;
+
+    if (getBitsPerPixel(circuit.psm) == 16) {
+        const auto addr = 2 * circuit.fbp + circuit.dbx + circuit.fbw * y;
+
+        return {addr >> 1, ((addr & 1) + circuit.width + 1) >> 1};
+    }
+
+    return {circuit.fbp + circuit.dbx + circuit.fbw * y, circuit.width};
+}
+
+/* Converts a line of 32-bit pixels */
+void convertLine32(u32 addr, u32 *dst, i32 n) {
+    readRow32(addr, (u8 *)dst, n);
+}
+
+/* Converts a line of 24-bit pixels, alpha is 0x80 */
+void convertLine24(u32 addr, u32 *dst, i32 n) {
+    readRow32(addr, (u8 *)dst, n);
+
+    for (i32 i = 0; i < n; i++) {
+        dst[i] = (dst[i] & 0xFFFFFF) | (0x80u << 24);
+    }
+}
+
+/* Converts a line of 16-bit pixels, addr is a halfword address */
+void convertLine16(u32 addr, u32 *dst, i32 n) {
+    alignas(32) u16 line[OUTPUT_WIDTH];
+
+    readRow16(addr, (u8 *)line, n);
+
+    i32 i = 0;
+
+#if defined(__AVX2__)
+    const auto maskR = _mm256_set1_epi32(0x1F << 0);
+    const auto maskG = _mm256_set1_epi32(0x1F << 5);
+    const auto maskB = _mm256_set1_epi32(0x1F << 10);
+    const auto maskA = _mm256_set1_epi32(1 << 15);
+
+    for (; (i + 8) <= n; i += 8) {
+        const auto data = _mm256_cvtepu16_epi32(_mm_load_si128((const __m128i *)&line[i]));
+
+        const auto r = _mm256_slli_epi32(_mm256_and_si256(data, maskR),  3);
+        const auto g = _mm256_slli_epi32(_mm256_and_si256(data, maskG),  6);
+        const auto b = _mm256_slli_epi32(_mm256_and_si256(data, maskB),  9);
+        const auto a = _mm256_slli_epi32(_mm256_and_si256(data, maskA), 16);
+
+        _mm256_storeu_si256((__m256i *)&dst[i], _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, a)));
+    }
+#elif defined(__SSE2__)
+    const auto maskR = _mm_set1_epi32(0x1F << 0);
+    const auto maskG = _mm_set1_epi32(0x1F << 5);
+    const auto maskB = _mm_set1_epi32(0x1F << 10);
+    const auto maskA = _mm_set1_epi32(1 << 15);
+    const auto zero  = _mm_setzero_si128();
+
+    for (; (i + 8) <= n; i += 8) {
+        const auto data = _mm_load_si128((const __m128i *)&line[i]);
+
+        const __m128i half[2] = {_mm_unpacklo_epi16(data, zero), _mm_unpackhi_epi16(data, zero)};
+
+        for (int j = 0; j < 2; j++) {
+            const auto r = _mm_slli_epi32(_mm_and_si128(half[j], maskR),  3);
+            const auto g = _mm_slli_epi32(_mm_and_si128(half[j], maskG),  6);
+            const auto b = _mm_slli_epi32(_mm_and_si128(half[j], maskB),  9);
+            const auto a = _mm_slli_epi32(_mm_and_si128(half[j], maskA), 16);
+
+            _mm_storeu_si128((__m128i *)&dst[i + 4 * j], _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a)));
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        const u32 data = line[i];
+
+        dst[i] = ((data & 0x1F) << 3) | ((data & (0x1F << 5)) << 6) | ((data & (0x1F << 10)) << 9) | ((data & (1 << 15)) << 16);
+    }
+}
+
+/* Converts one line of a read circuit to XBGR8888 */
+void convertCircuitLine(const ReadCircuit &circuit, i32 line, u32 *dst) {
+    const auto y = (circuit.dby + line) & 2047;
+
+    switch (circuit.psm) {
+        case PSM::PSMCT32 : convertLine32(circuit.fbp + circuit.dbx + circuit.fbw * y, dst, circuit.width); break;
+        case PSM::PSMCT24 : convertLine24(circuit.fbp + circuit.dbx + circuit.fbw * y, dst, circuit.width); break;
+        case PSM::PSMCT16 :
+        case PSM::PSMCT16S: convertLine16(2 * circuit.fbp + circuit.dbx + circuit.fbw * y, dst, circuit.width); break;
+        default:
+            std::printf("[GS        ] Unhandled display pixel storage mode 0x%02X\n", circuit.psm);
+
+            exit(0);
+    }
+
+    /* Clear the rest of the line */
+    std::fill(dst + circuit.width, dst + OUTPUT_WIDTH, 0);
+}
+
+/* Blends circuit 1 (src) over the background (dst), alpha is 0..256 */
+void mergeLine(const u32 *src, const u32 *alpha, u32 *dst) {
+    i32 i = 0;
+
+#ifdef __SSE2__
+    const auto zero = _mm_setzero_si128();
+    const auto one  = _mm_set1_epi16(256);
+
+    for (; (i + 4) <= OUTPUT_WIDTH; i += 4) {
+        const auto a32 = _mm_load_si128((const __m128i *)&alpha[i]);
+        const auto a16 = _mm_or_si128(a32, _mm_slli_epi32(a32, 16));
+
+        const auto c1 = _mm_loadu_si128((const __m128i *)&src[i]);
+        const auto c2 = _mm_loadu_si128((const __m128i *)&dst[i]);
+
+        __m128i res[2];
+
+        for (int j = 0; j < 2; j++) {
+            const auto a  = j ? _mm_unpackhi_epi32(a16, a16) : _mm_unpacklo_epi32(a16, a16);
+            const auto s0 = j ? _mm_unpackhi_epi8(c1, zero) : _mm_unpacklo_epi8(c1, zero);
+            const auto s1 = j ? _mm_unpackhi_epi8(c2, zero) : _mm_unpacklo_epi8(c2, zero);
+
+            /* (C1 * A + C2 * (256 - A)) >> 8, fits into 16 bits */
+            const auto sum = _mm_add_epi16(_mm_mullo_epi16(s0, a), _mm_mullo_epi16(s1, _mm_sub_epi16(one, a)));
+
+            res[j] = _mm_srli_epi16(sum, 8);
+        }
+
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(res[0], res[1]));
+    }
+#endif
+
+    for (; i < OUTPUT_WIDTH; i++) {
+        u32 color = 0;
+
+        for (int j = 0; j < 32; j += 8) {
+            const auto c1 = (src[i] >> j) & 0xFF;
+            const auto c2 = (dst[i] >> j) & 0xFF;
+
+            color |= (((c1 * alpha[i] + c2 * (256 - alpha[i])) >> 8) & 0xFF) << j;
+        }
+
+        dst[i] = color;
+    }
+}
+
+/* Produces one output line from the read circuits */
+void drawOutputLine(const DisplaySetup &setup, i32 y, u32 *dst) {
+    const auto &c1 = setup.circuit[0];
+    const auto &c2 = setup.circuit[1];
+
+    const auto line = getSourceLine(setup, y);
+
+    const auto hasC1 = c1.enabled && (line < c1.height);
+    const auto hasC2 = c2.enabled && (line < c2.height);
+
+    /* Background */
+    if (setup.slbg) {
+        std::fill(dst, dst + OUTPUT_WIDTH, setup.bgcolor);
+    } else if (hasC2) {
+        convertCircuitLine(c2, line, dst);
+    } else {
+        std::fill(dst, dst + OUTPUT_WIDTH, 0);
+    }
+
+    if (!hasC1) return;
+
+    /* Circuit 1 fully replaces the background with a fixed alpha of 1.0 */
+    if (setup.mmod && (setup.alp == 0xFF)) return convertCircuitLine(c1, line, dst);
+
+    alignas(16) u32 alpha[OUTPUT_WIDTH];
+
+    convertCircuitLine(c1, line, lineBuf[0]);
+
+    if (setup.mmod) {
+        std::fill(alpha, alpha + OUTPUT_WIDTH, setup.alp + (setup.alp >> 7));
+    } else {
+        /* Frame buffer alpha is 1.0 at 0x80 */
+        for (i32 i = 0; i < OUTPUT_WIDTH; i++) {
+            alpha[i] = std::min(2 * (lineBuf[0][i] >> 24), 256u);
+        }
+    }
+
+    mergeLine(lineBuf[0], alpha, dst);
+}
+
+/* Converts changed lines and sends them to the host */
+void updateDisplay() {
+    flushBatch();
+
+    const auto setup = getDisplaySetup();
+
+    if (!(setup == displaySetup)) {
+        displaySetup = setup;
+
+        displayChanged = true;
+    }
+
+    /* Find lines that read from written pages */
+    for (i32 y = 0; y < OUTPUT_HEIGHT; y++) {
+        if (displayChanged) {
+            lineDirty[y] = true;
+
+            continue;
+        }
+
+        const auto line = getSourceLine(setup, y);
+
+        for (const auto &circuit : setup.circuit) {
+            if (!circuit.enabled || (line >= circuit.height)) continue;
+
+            const auto [addr, n] = getCircuitLine(circuit, line);
+
+            if (isDirty(addr, n)) lineDirty[y] = true;
+        }
+    }
+
+    displayChanged = false;
+
+    dirtyPages.fill(false);
+
+    /* Interlaced field mode reads every other line of a full-height buffer, only the lines of the current field change */
+    const auto field = (csr >> 13) & 1;
+
+    const auto isWeave = setup.intl && !setup.ffmd;
+
+    i32 yMin = OUTPUT_HEIGHT, yMax = 0;
+
+    for (i32 y = 0; y < OUTPUT_HEIGHT; y++) {
+        if (!lineDirty[y] || (isWeave && ((u32)(y & 1) != field))) continue;
+
+        lineDirty[y] = false;
+
+        drawOutputLine(setup, y, &outputBuf[OUTPUT_WIDTH * y]);
+
+        yMin = std::min(yMin, y);
+        yMax = std::max(yMax, y + 1);
+    }
+
+    if (yMin < yMax) {
+        update((u8 *)outputBuf.data(), yMin, yMax - yMin);
+    } else {
+        update((u8 *)outputBuf.data(), 0, 0);
+    }
+}
+
+/* --- CLUT --- */
+
+/*
+ * Loads the CLUT buffer from VRAM as requested by TEX0.CLD.
+ * CSM1 CLUTs are 16x16 (8-bit indices) or 8x2 (4-bit indices) pixels with a buffer width of 64,
+ * 8-bit CLUTs swap entries 8-15 and 16-23 of every 32. CSM2 CLUTs are a row of 16-bit entries at TEXCLUT.
+ */
+void loadCLUT(const TEX &tex0) {
+    switch (tex0.cld) {
+        case 1: break;
+        case 2: cbp0 = tex0.cbp; break;
+        case 3: cbp1 = tex0.cbp; break;
+        case 4:
+            if (tex0.cbp == cbp0) return;
+
+            cbp0 = tex0.cbp;
+            break;
+        case 5:
+            if (tex0.cbp == cbp1) return;
+
+            cbp1 = tex0.cbp;
+            break;
+        default: // No load
+            return;
+    }
+
+    if (!isIndexedPSM(tex0.psm)) return;
+
+    const auto count = (getBitsPerPixel(tex0.psm) == 8) ? 256u : 16u;
+
+    const auto is32 = (tex0.cpsm == PSM::PSMCT32) && !tex0.csm;
+
+    /* The CLUT might still be drawn by a deferred batch */
+    if (tex0.csm) {
+        flushDeferred(getBufferRange(tex0.cbp, texclut.cbw, PSM::PSMCT16, texclut.cov, texclut.cov + 1));
+    } else {
+        flushDeferred(getBufferRange(tex0.cbp, 64, tex0.cpsm, 0, (count == 256) ? 16 : 2));
+    }
+
+    printLog("[GS        ] CLUT load; CBP = 0x%05X, CPSM = 0x%X, CSM = %d, CSA = %u\n", tex0.cbp, tex0.cpsm, tex0.csm, tex0.csa);
+
+    for (u32 i = 0; i < count; i++) {
+        u32 color;
+
+        if (tex0.csm) {
+            color = readVRAM<PSM::PSMCT16>(tex0.cbp, texclut.cbw, (texclut.cou + i) & 2047, texclut.cov);
+        } else {
+            const auto x = (count == 256) ? ((i & 7) | ((i & 0x10) >> 1)) : (i & 7);
+            const auto y = (count == 256) ? (((i >> 4) & ~1) | ((i >> 3) & 1)) : (i >> 3);
+
+            color = is32 ? readVRAM<PSM::PSMCT32>(tex0.cbp, 64, x, y) : readVRAM<PSM::PSMCT16>(tex0.cbp, 64, x, y);
+        }
+
+        if (is32) {
+            const auto entry = (tex0.csa + i) & 0xFF;
+
+            clutBuffer[entry +   0] = color;
+            clutBuffer[entry + 256] = color >> 16;
+        } else {
+            clutBuffer[(tex0.csa + i) & 0x1FF] = color;
+        }
+    }
+}
+
+/* --- Transmission handlers --- */
+
+void doTransmission() {
+    /* Deferred batches must be drawn before a transmission reads what they draw or overwrites what they read */
+    const auto srcRange = getBufferRange(bitbltbuf.sbp, bitbltbuf.sbw, bitbltbuf.spsm, trxpos.ssay, trxpos.ssay + trxreg.rrh);
+    const auto dstRange = getBufferRange(bitbltbuf.dbp, bitbltbuf.dbw, bitbltbuf.dpsm, trxpos.dsay, trxpos.dsay + trxreg.rrh);
+
+    if (trxdir != TRXDIR::HostToLocal) flushDeferred(srcRange);
+    if (trxdir != TRXDIR::LocalToHost) flushDeferred(dstRange);
+
+    switch (trxdir) {
+        case TRXDIR::HostToLocal: // Handled via HWREG writes
+            printLog("[GS        ] Host->Local transmission\n");
+
+            dstTrx.x = 0;
+            dstTrx.y = 0;
+
+            trxBufSize = 0;
+            break;
+        case TRXDIR::LocalToHost:
+            printLog("[GS        ] Local->Host transmission\n");
+
+            doLocalToHost();
+            break;
+        case TRXDIR::LocalToLocal:
+            printLog("[GS        ] Local->Local transmission\n");
+
+            doLocalToLocal();
+
+            trxdir = TRXDIR::Deactivated;
+            break;
+        case TRXDIR::Deactivated:
+            printLog("[GS        ] Transmission deactivated\n");
+            break;
+    }
+}
+
 }
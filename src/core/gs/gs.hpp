@@ -8,6 +8,8 @@
 #include "../../common/types.hpp"
 
 namespace ps2::gs {
+    constexpr u32 VRAM_WORDS = 1 << 20; // VRAM size in words
+
     void init();
     void initQ();
 
@@ -15,8 +17,22 @@ namespace ps2::gs {
 
     void writePriv(u32 addr, u64 data);
 
+    using PACKEDFn = void (*)(const u128 &);
+
     void write(u8 addr, u64 data);
     void writePACKED(u8 addr, const u128 &data);
+
+    PACKEDFn getPACKEDFn(u8 addr);
     
-    void writeHWREG(u64 data);
+    void readHWREG(u64 *data, u64 count);
+    void writeHWREG(const u64 *data, u64 count);
+
+    void getVRAM(u32 *dst);
+    void setVRAM(const u32 *src);
+
+    u64 getPixelCount();
+
+    void setLogging(bool isEnabled);
+    void setFrameSkip(bool isEnabled);
+    void setFrameLimit(bool isEnabled);
 }
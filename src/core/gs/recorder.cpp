@@ -0,0 +1,201 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#include "recorder.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#include "gs.hpp"
+
+namespace ps2::gs::recorder {
+
+/* Registers that are not part of the snapshot because writing them has side effects */
+constexpr u8 XYZF2 = 0x04, XYZ2 = 0x05, XYZF3 = 0x0C, XYZ3 = 0x0D, TEXFLUSH = 0x3F, TRXDIR = 0x53, HWREG = 0x54;
+constexpr u8 SIGNAL = 0x60, FINISH = 0x61, LABEL = 0x62;
+
+constexpr u32 CSR = 0x12001000;
+
+const char *dumpPath = nullptr;
+
+std::FILE *file = nullptr;
+
+std::atomic<bool> toggleRequest = false;
+
+/* Last values written to the GS registers */
+u64  regs[0x80];
+bool isRegValid[0x80];
+
+/* Last values written to the privileged registers, indexed by [addr bit 12][addr bits 4-7] */
+u64  privRegs[2][16];
+bool isPrivRegValid[2][16];
+
+bool isSnapshotReg(u8 addr) {
+    switch (addr) {
+        case XYZF2: case XYZ2: case XYZF3: case XYZ3:
+        case TEXFLUSH: case TRXDIR: case HWREG:
+        case SIGNAL: case FINISH: case LABEL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+template <typename T>
+void put(const T &data) {
+    std::fwrite(&data, sizeof(T), 1, file);
+}
+
+void putPacket(Packet packet) {
+    put((u8)packet);
+}
+
+/* Writes the dump header and the current GS state */
+void writeSnapshot() {
+    put(DUMP_MAGIC);
+    put(DUMP_VERSION);
+
+    std::vector<u32> vram(VRAM_WORDS);
+
+    getVRAM(vram.data());
+
+    put(VRAM_WORDS);
+
+    std::fwrite(vram.data(), sizeof(u32), vram.size(), file);
+
+    u32 regCount = 0;
+
+    for (int i = 0; i < 0x80; i++) {
+        if (isRegValid[i] && isSnapshotReg(i)) regCount++;
+    }
+
+    put(regCount);
+
+    for (int i = 0; i < 0x80; i++) {
+        if (!isRegValid[i] || !isSnapshotReg(i)) continue;
+
+        put((u8)i);
+        put(regs[i]);
+    }
+
+    u32 privCount = 0;
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 16; j++) {
+            if (isPrivRegValid[i][j]) privCount++;
+        }
+    }
+
+    put(privCount);
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 16; j++) {
+            if (!isPrivRegValid[i][j]) continue;
+
+            put((u32)(0x12000000 | (i << 12) | (j << 4)));
+            put(privRegs[i][j]);
+        }
+    }
+}
+
+void start() {
+    if (!dumpPath) {
+        std::printf("[GS:REC    ] No dump path set\n");
+
+        return;
+    }
+
+    file = std::fopen(dumpPath, "wb");
+
+    if (!file) {
+        std::printf("[GS:REC    ] Unable to open file \"%s\"\n", dumpPath);
+
+        return;
+    }
+
+    std::printf("[GS:REC    ] Recording to \"%s\"\n", dumpPath);
+
+    writeSnapshot();
+}
+
+void stop() {
+    std::printf("[GS:REC    ] Recording stopped\n");
+
+    std::fclose(file);
+
+    file = nullptr;
+}
+
+void setPath(const char *path) {
+    dumpPath = path;
+}
+
+/* Starts or stops recording at the next VBLANK, can be called from any thread */
+void toggle() {
+    toggleRequest = true;
+}
+
+void onVBLANK() {
+    if (file) putPacket(Packet::VBLANK);
+
+    if (toggleRequest.exchange(false)) {
+        if (file) {
+            stop();
+        } else {
+            start();
+        }
+    }
+}
+
+void onWrite(u8 addr, u64 data) {
+    regs[addr & 0x7F] = data;
+
+    isRegValid[addr & 0x7F] = true;
+
+    if (!file) return;
+
+    putPacket(Packet::Write);
+    put(addr);
+    put(data);
+}
+
+void onWriteHWREG(const u64 *data, u64 count) {
+    if (!file) return;
+
+    putPacket(Packet::WriteHWREG);
+    put((u32)count);
+
+    std::fwrite(data, sizeof(u64), count, file);
+}
+
+void onReadHWREG(u64 count) {
+    if (!file) return;
+
+    putPacket(Packet::ReadHWREG);
+    put((u32)count);
+}
+
+void onWritePriv(u32 addr, u64 data) {
+    if (addr != CSR) {
+        privRegs[(addr >> 12) & 1][(addr >> 4) & 0xF] = data;
+
+        isPrivRegValid[(addr >> 12) & 1][(addr >> 4) & 0xF] = true;
+    }
+
+    if (!file) return;
+
+    putPacket(Packet::WritePriv);
+    put(addr);
+    put(data);
+}
+
+void onInitQ() {
+    if (!file) return;
+
+    putPacket(Packet::InitQ);
+}
+
+}
@@ -0,0 +1,47 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#pragma once
+
+#include "../../common/types.hpp"
+
+namespace ps2::gs::recorder {
+
+/*
+ * GS dump format (little endian):
+ *
+ * Header   : "MSGS", u32 version
+ * Snapshot : u32 VRAM size in words, VRAM
+ *            u32 register count, register count * (u8 address, u64 data)
+ *            u32 privileged register count, privileged register count * (u32 address, u64 data)
+ * Packets  : u8 packet type, followed by the packet data
+ */
+
+constexpr u32 DUMP_MAGIC   = 0x5347534D; // "MSGS"
+constexpr u32 DUMP_VERSION = 1;
+
+/* Dump packet types */
+enum class Packet : u8 {
+    Write,      // u8 address, u64 data
+    WriteHWREG, // u32 count, count * u64 data
+    ReadHWREG,  // u32 count
+    WritePriv,  // u32 address, u64 data
+    InitQ,
+    VBLANK,
+};
+
+void setPath(const char *path);
+
+void toggle();
+
+void onVBLANK();
+
+void onWrite(u8 addr, u64 data);
+void onWriteHWREG(const u64 *data, u64 count);
+void onReadHWREG(u64 count);
+void onWritePriv(u32 addr, u64 data);
+void onInitQ();
+
+}
@@ -5,8 +5,14 @@
 
 #include "moestation.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <ctype.h>
 
@@ -14,9 +20,14 @@
 #include "bus/bus.hpp"
 #include "ee/cpu/cpu.hpp"
 #include "ee/dmac/dmac.hpp"
+#include "ee/gif/gif.hpp"
+#include "ee/ipu/ipu.hpp"
 #include "ee/timer/timer.hpp"
 #include "ee/vif/vif.hpp"
+#include "ee/vu/vu_jit.hpp"
+#include "ee/vu/vu_thread.hpp"
 #include "gs/gs.hpp"
+#include "gs/recorder.hpp"
 #include "iop/iop.hpp"
 #include "iop/cdrom/cdrom.hpp"
 #include "iop/cdvd/cdvd.hpp"
@@ -33,6 +44,9 @@ using VectorInterface = ee::vif::VectorInterface;
 
 /* --- moestation constants --- */
 
+constexpr int FB_WIDTH  = 640;
+constexpr int FB_HEIGHT = 480;
+
 /* SDL2 */
 SDL_Renderer *renderer;
 SDL_Window   *window;
@@ -44,7 +58,50 @@ VectorInterface vif[2] = {VectorInterface(0, ee::cpu::getVU(0)), VectorInterface
 
 char execPath[256];
 
-bool isRunning = true, psxFastBoot = false;
+std::atomic<bool> isRunning = true;
+
+bool psxFastBoot = false;
+
+/* --- Frame handoff --- */
+
+/*
+ * Frames are handed from the emulator thread to the presentation thread via
+ * three buffers: the emulator renders into the back buffer, the most recent
+ * complete frame waits in the ready buffer, and the presenter owns the front
+ * buffer. Swapping only happens under a short lock, so the emulator never
+ * waits for the host display.
+ */
+
+/* Range of output lines [yMin, yMax) */
+struct LineRange {
+    int yMin = FB_HEIGHT, yMax = 0;
+
+    void add(int y, int h) {
+        if (!h) return;
+
+        yMin = std::min(yMin, y);
+        yMax = std::max(yMax, y + h);
+    }
+
+    void add(const LineRange &other) {
+        if (other.yMin < other.yMax) add(other.yMin, other.yMax - other.yMin);
+    }
+
+    bool isEmpty() const {
+        return yMin >= yMax;
+    }
+};
+
+std::array<std::vector<u8>, 3> frames;
+
+int backFrame = 0, readyFrame = 1, frontFrame = 2; // Frame buffer indices
+
+std::array<LineRange, 3> staleLines; // Lines a buffer is missing, only used by the emulator thread
+
+LineRange pendingLines; // Lines changed since the presenter took a frame
+bool hasNewFrame = false;
+
+std::mutex frameMtx;
 
 /* Initializes SDL */
 void initSDL() {
@@ -57,7 +114,9 @@ void initSDL() {
     SDL_SetWindowResizable(window, SDL_FALSE);
     SDL_SetWindowTitle(window, "moestation");
 
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XBGR8888, SDL_TEXTUREACCESS_STREAMING, 640, 480);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XBGR8888, SDL_TEXTUREACCESS_STREAMING, FB_WIDTH, FB_HEIGHT);
+
+    for (auto &frame : frames) frame.resize(4 * FB_WIDTH * FB_HEIGHT);
 }
 
 void init(const char *biosPath, const char *path, const char *psxmode) {
@@ -72,8 +131,11 @@ void init(const char *biosPath, const char *path, const char *psxmode) {
     bus::init(biosPath, &vif[0], &vif[1]);
 
     ee::cpu::init();
-    ee::dmac::init();
+    ee::dmac::init(&vif[0], &vif[1]);
+    ee::ipu::init();
     ee::timer::init();
+    ee::vu::jit::init();
+    ee::vu::thread::init(&vif[1]);
     
     gs::init();
 
@@ -89,7 +151,8 @@ void init(const char *biosPath, const char *path, const char *psxmode) {
     initSDL();
 }
 
-void run() {
+/* Runs the emulated hardware */
+void runEmulator() {
     while (isRunning) {
         const auto runCycles = scheduler::getRunCycles();
 
@@ -105,9 +168,71 @@ void run() {
         iop::step(runCycles >> 3);
         iop::timer::step(runCycles >> 3);
 
+        /* Send PATH1/PATH2 packets from the VU1 thread to the GS */
+        ee::gif::flushQueue();
+
+        /* Raise interrupts for IPU commands finished on the IPU thread */
+        ee::ipu::checkInterrupt();
+
         scheduler::flush();
     }
 
+    ee::vu::thread::shutdown();
+    ee::ipu::shutdown();
+}
+
+/* Takes the latest frame from the emulator thread, returns the lines to upload */
+bool takeFrame(LineRange &lines) {
+    std::lock_guard<std::mutex> lock(frameMtx);
+
+    if (!hasNewFrame) return false;
+
+    std::swap(frontFrame, readyFrame);
+
+    lines = pendingLines;
+
+    pendingLines = LineRange();
+    hasNewFrame  = false;
+
+    return true;
+}
+
+/* Handles SDL events and presents frames, runs on the main thread */
+void run() {
+    std::thread emuThread(runEmulator);
+
+    while (isRunning) {
+        while (SDL_PollEvent(&e)) {
+            switch (e.type) {
+                case SDL_QUIT: isRunning = false; break;
+                case SDL_KEYDOWN:
+                    if (e.key.keysym.sym == SDLK_F12) gs::recorder::toggle(); // Start/stop GS dump
+                    break;
+                default: break;
+            }
+        }
+
+        LineRange lines;
+
+        if (!takeFrame(lines)) {
+            /* Nothing new to show, wait for events instead of spinning */
+            SDL_WaitEventTimeout(nullptr, 1);
+
+            continue;
+        }
+
+        if (!lines.isEmpty()) {
+            const SDL_Rect rect = {0, lines.yMin, FB_WIDTH, lines.yMax - lines.yMin};
+
+            SDL_UpdateTexture(texture, &rect, frames[frontFrame].data() + 4 * FB_WIDTH * lines.yMin, 4 * FB_WIDTH);
+        }
+
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+
+    emuThread.join();
+
     SDL_Quit();
 }
 
@@ -166,17 +291,28 @@ void fastBoot() {
     }
 }
 
-void update(const u8 *fb) {
-    SDL_PollEvent(&e);
+/* Hands a frame to the presentation thread, lines y to y + h - 1 have changed */
+void update(const u8 *fb, int y, int h) {
+    /* Every buffer is now missing the changed lines */
+    for (auto &stale : staleLines) stale.add(y, h);
 
-    switch (e.type) {
-        case SDL_QUIT: isRunning = false; break;
-        default: break;
+    auto &stale = staleLines[backFrame];
+
+    if (!stale.isEmpty()) {
+        const auto offset = 4 * FB_WIDTH * stale.yMin;
+
+        std::memcpy(frames[backFrame].data() + offset, fb + offset, 4 * FB_WIDTH * (stale.yMax - stale.yMin));
+
+        stale = LineRange();
     }
 
-    SDL_UpdateTexture(texture, nullptr, fb, 4 * 640);
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-    SDL_RenderPresent(renderer);
+    std::lock_guard<std::mutex> lock(frameMtx);
+
+    std::swap(backFrame, readyFrame);
+
+    pendingLines.add(y, h);
+
+    hasNewFrame = true;
 }
 
 }
@@ -16,6 +16,6 @@ void enterPS1Mode();
 
 void fastBoot();
 
-void update(const u8 *fb);
+void update(const u8 *fb, int y, int h);
 
 }
@@ -0,0 +1,216 @@
+/*
+ * moestation is a WIP PlayStation 2 emulator.
+ * Copyright (C) 2022-2023  Lady Starbreeze (Michelle-Marie Schiller)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "common/file.hpp"
+#include "core/scheduler.hpp"
+#include "core/gs/gs.hpp"
+#include "core/gs/recorder.hpp"
+
+using Packet = ps2::gs::recorder::Packet;
+
+/* GS dump reader */
+struct Dump {
+    const std::vector<u8> &data;
+
+    u64 pos;
+
+    template <typename T>
+    T get() {
+        if ((pos + sizeof(T)) > data.size()) {
+            std::fprintf(stderr, "[gs-replay ] Unexpected end of dump\n");
+
+            exit(0);
+        }
+
+        T value;
+
+        std::memcpy(&value, &data[pos], sizeof(T));
+
+        pos += sizeof(T);
+
+        return value;
+    }
+
+    const u8 *getBytes(u64 size) {
+        if ((pos + size) > data.size()) {
+            std::fprintf(stderr, "[gs-replay ] Unexpected end of dump\n");
+
+            exit(0);
+        }
+
+        const auto bytes = &data[pos];
+
+        pos += size;
+
+        return bytes;
+    }
+
+    bool isEnd() const {
+        return pos >= data.size();
+    }
+};
+
+/* Restores the snapshot at the start of the dump, returns the position of the first packet */
+u64 loadSnapshot(const std::vector<u8> &data) {
+    Dump dump{data, 0};
+
+    if (dump.get<u32>() != ps2::gs::recorder::DUMP_MAGIC) {
+        std::fprintf(stderr, "[gs-replay ] Not a GS dump\n");
+
+        exit(0);
+    }
+
+    if (const auto version = dump.get<u32>(); version != ps2::gs::recorder::DUMP_VERSION) {
+        std::fprintf(stderr, "[gs-replay ] Unsupported dump version %u\n", version);
+
+        exit(0);
+    }
+
+    const auto vramSize = dump.get<u32>();
+
+    if (vramSize != ps2::gs::VRAM_WORDS) {
+        std::fprintf(stderr, "[gs-replay ] Invalid VRAM size %u\n", vramSize);
+
+        exit(0);
+    }
+
+    /* Copy VRAM out of the byte stream, it isn't necessarily aligned */
+    std::vector<u32> vram(vramSize);
+
+    std::memcpy(vram.data(), dump.getBytes(4 * vramSize), 4 * vramSize);
+
+    const auto regCount = dump.get<u32>();
+
+    std::vector<std::pair<u8, u64>> regs;
+
+    for (u32 i = 0; i < regCount; i++) {
+        const auto addr = dump.get<u8>();
+
+        regs.emplace_back(addr, dump.get<u64>());
+    }
+
+    const auto privCount = dump.get<u32>();
+
+    for (u32 i = 0; i < privCount; i++) {
+        const auto addr = dump.get<u32>();
+
+        ps2::gs::writePriv(addr, dump.get<u64>());
+    }
+
+    for (const auto &[addr, value] : regs) ps2::gs::write(addr, value);
+
+    ps2::gs::setVRAM(vram.data());
+
+    return dump.pos;
+}
+
+/* Feeds all packets into the GS, returns the number of frames */
+u64 replay(const std::vector<u8> &data, u64 start) {
+    Dump dump{data, start};
+
+    std::vector<u64> buf;
+
+    u64 frames = 0;
+
+    while (!dump.isEnd()) {
+        switch (static_cast<Packet>(dump.get<u8>())) {
+            case Packet::Write:
+                {
+                    const auto addr = dump.get<u8>();
+
+                    ps2::gs::write(addr, dump.get<u64>());
+                }
+                break;
+            case Packet::WriteHWREG:
+                {
+                    const auto count = dump.get<u32>();
+
+                    buf.resize(count);
+
+                    std::memcpy(buf.data(), dump.getBytes(8 * count), 8 * count);
+
+                    ps2::gs::writeHWREG(buf.data(), count);
+                }
+                break;
+            case Packet::ReadHWREG:
+                {
+                    const auto count = dump.get<u32>();
+
+                    buf.resize(count);
+
+                    ps2::gs::readHWREG(buf.data(), count);
+                }
+                break;
+            case Packet::WritePriv:
+                {
+                    const auto addr = dump.get<u32>();
+
+                    ps2::gs::writePriv(addr, dump.get<u64>());
+                }
+                break;
+            case Packet::InitQ:
+                ps2::gs::initQ();
+                break;
+            case Packet::VBLANK:
+                frames++;
+                break;
+            default:
+                std::fprintf(stderr, "[gs-replay ] Invalid packet type at offset %llu\n", (unsigned long long)(dump.pos - 1));
+
+                exit(0);
+        }
+    }
+
+    return frames;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: gs-replay /path/to/dump [loops] [-v]\n");
+
+        return -1;
+    }
+
+    const auto loops = (argc >= 3) ? std::max(std::atoi(argv[2]), 1) : 1;
+
+    /* The GS logs every register write, keep that out of the measurement */
+    ps2::gs::setLogging((argc >= 4) && (std::strcmp(argv[3], "-v") == 0));
+
+    const auto data = loadBinary(argv[1]);
+
+    ps2::scheduler::init();
+
+    ps2::gs::init();
+
+    u64 frames = 0, pixels = 0;
+
+    std::chrono::duration<f64> time{0};
+
+    for (int i = 0; i < loops; i++) {
+        const auto start = loadSnapshot(data);
+
+        /* Only measure the packet stream, not restoring the snapshot */
+        const auto pixelsStart = ps2::gs::getPixelCount();
+        const auto timeStart   = std::chrono::steady_clock::now();
+
+        frames += replay(data, start);
+
+        time   += std::chrono::steady_clock::now() - timeStart;
+        pixels += ps2::gs::getPixelCount() - pixelsStart;
+    }
+
+    std::fprintf(stderr, "[gs-replay ] %llu frames, %llu pixels in %.3f s\n", (unsigned long long)frames, (unsigned long long)pixels, time.count());
+    std::fprintf(stderr, "[gs-replay ] %.2f FPS, %.2f Mpixels/s\n", frames / time.count(), pixels / time.count() / 1E6);
+
+    return 0;
+}
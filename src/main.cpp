@@ -4,19 +4,64 @@
  */
 
 #include <cstdio>
+#include <cstring>
 
 #include "core/moestation.hpp"
+#include "core/gs/gs.hpp"
+#include "core/gs/recorder.hpp"
+#include "core/ee/ipu/ipu.hpp"
+#include "core/ee/vu/vu_jit.hpp"
+#include "core/ee/vu/vu_thread.hpp"
+
+/* Prints the command line usage */
+void printUsage() {
+    std::printf("Usage: moestation /path/to/bios /path/to/executable [-PSXMODE] [-GSDUMP=/path/to/dump] [-FRAMESKIP] [-NOLIMIT] [-VUINT] [-VU1THREAD] [-IPUTHREAD]\n");
+}
 
 int main(int argc, char **argv) {
     std::printf("[moestation] PlayStation 2 emulator\n");
 
     if (argc < 3) {
-        std::printf("Usage: moestation /path/to/bios /path/to/executable [-PSXMODE]\n");
+        printUsage();
 
         return -1;
     }
 
-    ps2::init(argv[1], argv[2], (argc == 4) ? argv[3] : NULL);
+    const char *psxmode = NULL;
+
+    bool frameSkip = false, noLimit = false, vu1Thread = false, ipuThread = false;
+
+    for (int i = 3; i < argc; i++) {
+        if (std::strncmp(argv[i], "-GSDUMP=", 8) == 0) {
+            ps2::gs::recorder::setPath(argv[i] + 8); // Press F12 to start/stop recording
+        } else if (std::strcmp(argv[i], "-FRAMESKIP") == 0) {
+            frameSkip = true;
+        } else if (std::strcmp(argv[i], "-NOLIMIT") == 0) {
+            noLimit = true; // Run as fast as possible
+        } else if (std::strcmp(argv[i], "-VUINT") == 0) {
+            ps2::ee::vu::jit::setEnabled(false); // Interpret VU micro programs
+        } else if (std::strcmp(argv[i], "-VU1THREAD") == 0) {
+            vu1Thread = true;
+        } else if (std::strcmp(argv[i], "-IPUTHREAD") == 0) {
+            ipuThread = true;
+        } else if (std::strncmp(argv[i], "-PSXMODE", 8) == 0) {
+            psxmode = argv[i];
+        } else {
+            std::printf("[moestation] Unknown option %s\n", argv[i]);
+
+            printUsage();
+
+            return -1;
+        }
+    }
+
+    ps2::init(argv[1], argv[2], psxmode);
+
+    if (frameSkip) ps2::gs::setFrameSkip(true);
+    if (noLimit) ps2::gs::setFrameLimit(false);
+    if (vu1Thread) ps2::ee::vu::thread::setEnabled(true);
+    if (ipuThread) ps2::ee::ipu::setThreadEnabled(true);
+
     ps2::run();
 
     return 0;